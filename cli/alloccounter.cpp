@@ -0,0 +1,66 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "alloccounter.h"
+#include <stddef.h>
+
+#if defined(__GLIBC__)
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t number, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+}
+
+//Plain counters, nothing that needs constructing, first allocations come before main()
+static volatile long sTotal = 0;
+static __thread qint64 sThisThread = 0;
+
+static inline void count()
+{
+    __sync_fetch_and_add(&sTotal, 1);
+    sThisThread++;
+}
+
+extern "C" void* malloc(size_t size)
+{
+    count();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t number, size_t size)
+{
+    count();
+    return __libc_calloc(number, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size)
+{
+    count();
+    return __libc_realloc(pointer, size);
+}
+
+bool AllocCounter::isSupported() { return true; }
+qint64 AllocCounter::total() { return __sync_fetch_and_add(&sTotal, 0); }
+qint64 AllocCounter::thisThread() { return sThisThread; }
+
+#else
+
+bool AllocCounter::isSupported() { return false; }
+qint64 AllocCounter::total() { return 0; }
+qint64 AllocCounter::thisThread() { return 0; }
+
+#endif
@@ -0,0 +1,35 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ALLOCCOUNTER_H_
+#define ALLOCCOUNTER_H_
+
+#include <QtGlobal>
+
+/*
+ * Counts malloc(), calloc() and realloc() calls of the whole process and of the calling thread.
+ * Works by wrapping glibc's allocator, elsewhere isSupported() is false and counts stay 0.
+ * operator new and Qt containers end up in malloc(), so they are counted too.
+ */
+class AllocCounter
+{
+public:
+    static bool isSupported();
+    static qint64 total();
+    static qint64 thisThread();
+};
+
+#endif /* ALLOCCOUNTER_H_ */
@@ -0,0 +1,67 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BENCHCLOCK_H_
+#define BENCHCLOCK_H_
+
+#include <QtGlobal>
+#include <time.h>
+#if defined(Q_OS_LINUX)
+#include <sys/resource.h>
+#endif
+
+/*
+ * Monotonic usec clock shared by the benchmark threads, and CPU time of the process or calling thread.
+ * CPU times are -1 where getrusage() can't tell.
+ */
+class BenchClock
+{
+public:
+    static qint64 nowUsec() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (qint64) now.tv_sec*1000000 + now.tv_nsec/1000;
+    }
+
+    static qint64 processCpuUsec() {
+#if defined(Q_OS_LINUX)
+        return cpuUsec(RUSAGE_SELF);
+#else
+        return -1;
+#endif
+    }
+
+    static qint64 threadCpuUsec() {
+#if defined(Q_OS_LINUX)
+        return cpuUsec(RUSAGE_THREAD);
+#else
+        return -1;
+#endif
+    }
+
+private:
+#if defined(Q_OS_LINUX)
+    static qint64 cpuUsec(int who) {
+        struct rusage usage;
+        if (getrusage(who, &usage) != 0)
+            return -1;
+        return (qint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1000000
+                + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+#endif
+};
+
+#endif /* BENCHCLOCK_H_ */
@@ -0,0 +1,291 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "benchrunner.h"
+#include "alloccounter.h"
+#include "benchclock.h"
+#include "h264.h"
+#include "socketwriter.h"
+#include "syntheticsource.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QtAlgorithms>
+#include <stdio.h>
+
+static const char PPS[] = {0x68, (char) 0xCE, 0x3C, (char) 0x80};
+static const char AAC_CONFIG[] = {0x11, (char) 0x90};     //AAC-LC, 48 kHz, stereo
+#define BENCH_FILLER 0x5A
+
+BenchFeeder::BenchFeeder(const BenchOptions& options, RTMPPublisher* publisher, qint64* enqueueTimes,
+        QObject* parent)
+    :QObject(parent),
+     mOptions(options),
+     mPublisher(publisher),
+     mEnqueueTimes(enqueueTimes),
+     mIsStopped(false) {}
+
+void BenchFeeder::start()
+{
+    /*
+     * Same frames SyntheticSource makes, IDR 4 times an average picture, but as MediaFrames with
+     * Controller's timestamps (SPS 0, PPS 1, pictures from 2). Audio is interleaved by timestamp.
+     */
+    MediaFrame frame;
+    frame.type = MediaFrame::VIDEO;
+    frame.dts = 0;
+    frame.pts = 0;
+    QByteArray sps = SyntheticSource::buildSPS(mOptions.width, mOptions.height, mOptions.fps);
+    frame.buffer = H264::toAVCC(sps.constData(), sps.size());
+    mPublisher->postFrame(frame);
+    frame.dts = frame.pts = 1;
+    frame.buffer = H264::toAVCC(PPS, sizeof(PPS));
+    mPublisher->postFrame(frame);
+
+    int average = qMax(16, mOptions.videoKbps*1000/8/mOptions.fps);
+    int keySize = 4*average;
+    int size = qMax(16, (average*mOptions.gopFrames - keySize)/qMax(1, mOptions.gopFrames - 1));
+    QByteArray payload(H264_AVCC_LENGTH_SIZE + qMax(keySize, size), BENCH_FILLER);
+    QByteArray audio(qMax(8, mOptions.audioKbps*1000/8*1024/BENCH_AUDIO_RATE), BENCH_FILLER);
+    int queueLimit = qMax(1, mOptions.queueFrames*1000/mOptions.fps);
+    qint64 audioIndex = 0;
+    for (int i = 0; i < mOptions.frameCount && !mIsStopped; i++) {
+        long dts = 2 + (qint64) i*1000/mOptions.fps;
+        while (mOptions.audioKbps > 0 && 2 + audioIndex*1024*1000/BENCH_AUDIO_RATE <= dts)
+            postAudio(audio, audioIndex++);
+        //Publisher sends as fast as it can, queue is kept short so latency isn't just queueing
+        while (mPublisher->queuedVideoDuration() >= queueLimit && !mIsStopped) {
+            mLock.lock();
+            if (!mIsStopped)
+                mCondition.wait(&mLock, 1);
+            mLock.unlock();
+        }
+        bool isKeyFrame = (i % mOptions.gopFrames == 0);
+        int nalSize = isKeyFrame ? keySize : size;
+        char* data = payload.data();
+        data[0] = (char) (nalSize >> 24);
+        data[1] = (char) (nalSize >> 16);
+        data[2] = (char) (nalSize >> 8);
+        data[3] = (char) nalSize;
+        data += H264_AVCC_LENGTH_SIZE;
+        data[0] = isKeyFrame ? 0x65 : 0x41;
+        data[1] = (char) (i >> 24);
+        data[2] = (char) (i >> 16);
+        data[3] = (char) (i >> 8);
+        data[4] = (char) i;
+        frame.buffer = MediaBuffer::fromData(payload.constData(), H264_AVCC_LENGTH_SIZE + nalSize);
+        frame.dts = frame.pts = dts;
+        mEnqueueTimes[i] = BenchClock::nowUsec();
+        mPublisher->postFrame(frame);
+    }
+    frame.buffer = MediaBuffer();
+    emit finished();
+}
+
+void BenchFeeder::postAudio(const QByteArray& payload, qint64 index)
+{
+    MediaFrame frame;
+    frame.type = MediaFrame::AUDIO;
+    frame.dts = frame.pts = 2 + index*1024*1000/BENCH_AUDIO_RATE;
+    frame.buffer = MediaBuffer::fromData(payload.constData(), payload.size());
+    mPublisher->postFrame(frame);
+}
+
+void BenchFeeder::safeStop()
+{
+    mLock.lock();
+    mIsStopped = true;
+    mCondition.wakeAll();
+    mLock.unlock();
+}
+
+BenchRunner::BenchRunner(const BenchOptions& options, QObject* parent)
+    :QObject(parent),
+     mOptions(options),
+     mSink(NULL),
+     mSinkThread(NULL),
+     mPublisher(NULL),
+     mPublisherThread(NULL),
+     mFeeder(NULL),
+     mFeederThread(NULL),
+     mIsSinkFinished(false),
+     mIsPublisherFinished(false),
+     mStartUsec(0),
+     mStartCpuUsec(0),
+     mStartAllocations(0),
+     mEndCpuUsec(0),
+     mEndAllocations(0),
+     mFramesSent(0),
+     mSyscalls(0),
+     mDroppedFrames(0)
+{
+    connect(&mDrainTimer,SIGNAL(timeout()),this,SLOT(checkDrained()));
+}
+
+BenchRunner::~BenchRunner()
+{
+    if(mFeederThread!=NULL) {
+        mFeeder->safeStop();
+        mFeederThread->quit();
+        mFeederThread->wait();
+        delete mFeeder;
+        delete mFeederThread;
+    }
+    if(mPublisherThread!=NULL) {
+        if(mPublisher!=NULL)
+            mPublisher->safeStop();
+        mPublisherThread->wait();
+        delete mPublisher;
+        delete mPublisherThread;
+    }
+    if(mSinkThread!=NULL) {
+        mSinkThread->quit();
+        mSinkThread->wait();
+        delete mSink;
+        delete mSinkThread;
+    }
+}
+
+bool BenchRunner::start()
+{
+    if(mOptions.width<=0 || mOptions.height<=0 || mOptions.fps<=0 || mOptions.frameCount<=0 ||
+            mOptions.gopFrames<=0 || mOptions.videoKbps<=0) {
+        qWarning()<<"Bad benchmark options";
+        return false;
+    }
+    mEnqueueTimes.fill(0, mOptions.frameCount);
+    mSink = new LoopbackSink(mEnqueueTimes.constData(), mOptions.frameCount);
+    mSinkThread = new QThread();
+    connect(mSinkThread,SIGNAL(started()),mSink,SLOT(start()));
+    connect(mSink,SIGNAL(listening(int)),this,SLOT(on_mSink_listening(int)));
+    connect(mSink,SIGNAL(finished()),this,SLOT(on_mSink_finished()));
+    mSink->moveToThread(mSinkThread);
+    mSinkThread->start();
+    return true;
+}
+
+void BenchRunner::on_mSink_listening(int port)
+{
+    mPublisher = new RTMPPublisher("127.0.0.1", port, "bench", "stream");
+    if(mOptions.audioKbps>0)
+        mPublisher->setAudioHeader(QByteArray(AAC_CONFIG, sizeof(AAC_CONFIG)), 2, 3, 2);
+    mPublisherThread = new QThread();
+    connect(mPublisherThread,SIGNAL(started()),mPublisher,SLOT(start()));
+    connect(mPublisher,SIGNAL(finished()),mPublisherThread,SLOT(quit()));
+    connect(mPublisherThread,SIGNAL(finished()),this,SLOT(on_mPublisherThread_finished()));
+    connect(mPublisher,SIGNAL(publishStatus(QString,QString,QString)),this,SLOT(on_mPublisher_publishStatus(QString,QString,QString)));
+    connect(mPublisher,SIGNAL(socketError(int)),this,SLOT(on_mPublisher_socketError(int)));
+    mPublisher->moveToThread(mPublisherThread);
+    mPublisherThread->start();
+}
+
+void BenchRunner::on_mPublisher_publishStatus(const QString level, const QString code, const QString description)
+{
+    Q_UNUSED(description);
+    if(level=="error") {
+        fail(code);
+        return;
+    }
+    if(code!="NetStream.Publish.Start" || mFeederThread!=NULL)
+        return;
+    mFeeder = new BenchFeeder(mOptions, mPublisher, mEnqueueTimes.data());
+    mFeederThread = new QThread();
+    connect(mFeederThread,SIGNAL(started()),mFeeder,SLOT(start()));
+    connect(mFeeder,SIGNAL(finished()),mFeederThread,SLOT(quit()));
+    connect(mFeeder,SIGNAL(finished()),this,SLOT(on_mFeeder_finished()));
+    mFeeder->moveToThread(mFeederThread);
+    mStartAllocations = AllocCounter::total();
+    mStartCpuUsec = BenchClock::processCpuUsec();
+    mStartUsec = BenchClock::nowUsec();
+    mFeederThread->start();
+}
+
+void BenchRunner::on_mPublisher_socketError(const int error)
+{
+    fail(QString("Socket error %1").arg(error));
+}
+
+void BenchRunner::on_mFeeder_finished()
+{
+    //safeStop() drops what is still queued, so wait for publisher to send it all
+    mDrainTimer.start(BENCH_DRAIN_POLL_MSEC);
+}
+
+void BenchRunner::checkDrained()
+{
+    if(mPublisher->queuedVideoDuration()>0 || mPublisher->bytesPending()>0)
+        return;
+    mDrainTimer.stop();
+    mPublisher->safeStop();
+}
+
+void BenchRunner::on_mPublisherThread_finished()
+{
+    mFramesSent = mPublisher->framesSentCount();
+    mSyscalls = mPublisher->writeSyscallCount();
+    mDroppedFrames = mPublisher->droppedFramesCount();
+    delete mPublisher;
+    mPublisher = NULL;
+    mIsPublisherFinished = true;
+    if(mIsSinkFinished)
+        report();
+}
+
+void BenchRunner::on_mSink_finished()
+{
+    mEndAllocations = AllocCounter::total();
+    mEndCpuUsec = BenchClock::processCpuUsec();
+    mIsSinkFinished = true;
+    if(mIsPublisherFinished)
+        report();
+}
+
+static qint64 percentile(const QVector<qint64>& sorted, int percent)
+{
+    if(sorted.isEmpty())
+        return -1;
+    return sorted.at(qMin(sorted.size()-1, sorted.size()*percent/100));
+}
+
+void BenchRunner::report()
+{
+    LoopbackSinkStats sink = mSink->stats();
+    QVector<qint64> latencies = mSink->latencies();
+    qSort(latencies.begin(), latencies.end());
+    double seconds = (sink.lastFrameUsec - mStartUsec)/1000000.0;
+    double frames = mFramesSent > 0 ? mFramesSent : 1;
+    double cpu = (mStartCpuUsec < 0 || sink.cpuUsec < 0) ? -1 : (mEndCpuUsec - mStartCpuUsec - sink.cpuUsec)/frames;
+    double allocations = AllocCounter::isSupported() ? (mEndAllocations - mStartAllocations - sink.allocations)/frames : -1;
+    double mbit = sink.bytesReceived*8/1000000.0;
+    double cpuPerMbit = (cpu < 0 || mbit <= 0) ? -1 : cpu*frames/mbit;
+    printf("{\"mode\":\"bench\",\"width\":%d,\"height\":%d,\"fps\":%d,\"videoKbps\":%d,\"audioKbps\":%d,"
+            "\"gop\":%d,\"queueFrames\":%d,\"videoFrames\":%lld,\"audioFrames\":%lld,\"droppedFrames\":%d,"
+            "\"seconds\":%.3f,\"videoFramesPerSec\":%.1f,\"mbitPerSec\":%.2f,\"cpuUsecPerFrame\":%.2f,"
+            "\"cpuUsecPerMbit\":%.2f,\"allocsPerFrame\":%.2f,\"syscallsPerFrame\":%.3f,\"gatheredWrites\":%s,"
+            "\"latencyP50Usec\":%lld,\"latencyP99Usec\":%lld}\n",
+            mOptions.width, mOptions.height, mOptions.fps, mOptions.videoKbps, mOptions.audioKbps,
+            mOptions.gopFrames, mOptions.queueFrames, sink.videoFrames, sink.audioFrames, mDroppedFrames,
+            seconds, seconds > 0 ? sink.videoFrames/seconds : 0, seconds > 0 ? sink.bytesReceived*8/seconds/1000000 : 0,
+            cpu, cpuPerMbit, allocations, mSyscalls/frames, SOCKETWRITER_GATHER_ENABLED ? "true" : "false",
+            percentile(latencies, 50), percentile(latencies, 99));
+    fflush(stdout);
+    QCoreApplication::exit(sink.videoFrames == mOptions.frameCount ? 0 : 1);
+}
+
+void BenchRunner::fail(const QString error)
+{
+    qWarning()<<"Benchmark failed:"<<error;
+    QCoreApplication::exit(1);
+}
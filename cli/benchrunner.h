@@ -0,0 +1,123 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef BENCHRUNNER_H_
+#define BENCHRUNNER_H_
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include "rtmppublisher.h"
+#include "loopbacksink.h"
+
+#define BENCH_AUDIO_RATE 48000
+#define BENCH_DRAIN_POLL_MSEC 5
+
+struct BenchOptions {
+    int width;
+    int height;
+    int fps;
+    int videoKbps;
+    int audioKbps;          //0 for video only
+    int gopFrames;
+    int frameCount;         //Video frames
+    int queueFrames;        //Feeder waits while publisher has this many video frames queued
+};
+
+/*
+ * Posts synthetic frames straight into an RTMPPublisher as fast as it takes them, on its own thread like
+ * the camera callbacks. Payload is allocated per frame from the MediaBuffer pool as Controller does.
+ * First 4 payload bytes after the NAL header carry the frame index for LoopbackSink's latency.
+ */
+class BenchFeeder : public QObject
+{
+    Q_OBJECT
+public:
+    BenchFeeder(const BenchOptions& options, RTMPPublisher* publisher, qint64* enqueueTimes,
+            QObject* parent = 0);
+
+signals:
+    void finished();
+
+public slots:
+    void start();
+    void safeStop();
+
+private:
+    void postAudio(const QByteArray& payload, qint64 index);
+
+    BenchOptions mOptions;
+    RTMPPublisher* mPublisher;
+    qint64* mEnqueueTimes;
+    QMutex mLock;
+    QWaitCondition mCondition;
+    volatile bool mIsStopped;
+};
+
+/*
+ * Publisher throughput benchmark: BenchFeeder -> RTMPPublisher -> loopback TCP -> LoopbackSink, each on its
+ * own thread. Measurement starts at NetStream.Publish.Start and ends when the sink has everything.
+ * Prints one JSON object on stdout. CPU time and allocations are for the whole process minus sink thread,
+ * so they include making the frames, like the camera path would. "Per frame" is per audio or video message.
+ */
+class BenchRunner : public QObject
+{
+    Q_OBJECT
+public:
+    BenchRunner(const BenchOptions& options, QObject* parent = 0);
+    ~BenchRunner();
+
+public slots:
+    bool start();
+
+private slots:
+    void on_mSink_listening(int port);
+    void on_mSink_finished();
+    void on_mPublisher_publishStatus(const QString level, const QString code, const QString description);
+    void on_mPublisher_socketError(const int error);
+    void on_mPublisherThread_finished();
+    void on_mFeeder_finished();
+    void checkDrained();
+
+private:
+    void report();
+    void fail(const QString error);
+
+    BenchOptions mOptions;
+    QVector<qint64> mEnqueueTimes;
+    LoopbackSink* mSink;
+    QThread* mSinkThread;
+    RTMPPublisher* mPublisher;
+    QThread* mPublisherThread;
+    BenchFeeder* mFeeder;
+    QThread* mFeederThread;
+    QTimer mDrainTimer;
+    bool mIsSinkFinished;
+    bool mIsPublisherFinished;
+    qint64 mStartUsec;
+    qint64 mStartCpuUsec;
+    qint64 mStartAllocations;
+    qint64 mEndCpuUsec;
+    qint64 mEndAllocations;
+    qint64 mFramesSent;
+    qint64 mSyscalls;
+    int mDroppedFrames;
+};
+
+#endif /* BENCHRUNNER_H_ */
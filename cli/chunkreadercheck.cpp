@@ -0,0 +1,144 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "chunkreadercheck.h"
+#include <stdio.h>
+
+QByteArray ChunkReaderCheck::header(int fmt, int csid, quint32 timestamp, int length, int type, quint32 streamId)
+{
+    //Timestamp is absolute for fmt 0, delta for fmt 1 and 2, and for fmt 3 only decides the extended field
+    QByteArray out;
+    if (csid < 64) {
+        out.append((char) ((fmt << 6) | csid));
+    } else {
+        out.append((char) (fmt << 6));
+        out.append((char) (csid - 64));
+    }
+    bool isExtended = timestamp >= 0xFFFFFF;
+    quint32 field = isExtended ? 0xFFFFFF : timestamp;
+    if (fmt <= 2) {
+        out.append((char) (field >> 16));
+        out.append((char) (field >> 8));
+        out.append((char) field);
+    }
+    if (fmt <= 1) {
+        out.append((char) (length >> 16));
+        out.append((char) (length >> 8));
+        out.append((char) length);
+        out.append((char) type);
+    }
+    if (fmt == 0) {
+        out.append((char) streamId);
+        out.append((char) (streamId >> 8));
+        out.append((char) (streamId >> 16));
+        out.append((char) (streamId >> 24));
+    }
+    if (isExtended) {
+        out.append((char) (timestamp >> 24));
+        out.append((char) (timestamp >> 16));
+        out.append((char) (timestamp >> 8));
+        out.append((char) timestamp);
+    }
+    return out;
+}
+
+QByteArray ChunkReaderCheck::payload(int length, int seed)
+{
+    QByteArray out(length, 0);
+    for (int i = 0; i < length; i++)
+        out[i] = (char) (seed + i*7);
+    return out;
+}
+
+bool ChunkReaderCheck::runCase(const char* name, const QByteArray& input, int chunkSize,
+        const QList<Expected>& expected, bool isBroken, bool isByteAtATime)
+{
+    RTMPChunkReader reader;
+    reader.setChunkSize(chunkSize);
+    QList<RTMPMessage> messages;
+    int step = isByteAtATime ? 1 : input.size();
+    for (int offset = 0; offset < input.size() && !reader.hasError(); offset += step) {
+        reader.append(input.constData() + offset, qMin(step, input.size() - offset));
+        RTMPMessage message;
+        while (reader.readMessage(message))
+            messages.append(message);
+    }
+    bool isPassed = reader.hasError() == isBroken && messages.size() == expected.size();
+    for (int i = 0; isPassed && i < messages.size(); i++) {
+        const RTMPMessage& message = messages.at(i);
+        const Expected& wanted = expected.at(i);
+        isPassed = message.csid == wanted.csid && message.timestamp == wanted.timestamp
+                && message.type == wanted.type && message.payload == wanted.payload;
+    }
+    printf("{\"mode\":\"chunkReaderCheck\",\"case\":\"%s\",\"bytes\":%d,\"messages\":%d,\"expected\":%d,"
+            "\"error\":%s,\"passed\":%s}\n",
+            name, input.size(), messages.size(), expected.size(),
+            reader.hasError() ? "true" : "false", isPassed ? "true" : "false");
+    return isPassed;
+}
+
+bool ChunkReaderCheck::run()
+{
+    const int chunkSize = RTMP_DEFAULT_CHUNK_SIZE;
+    bool isPassed = true;
+
+    //300 byte message in chunks of 128, 128 and 44
+    Expected split = {3, 1000, 20, payload(300, 1)};
+    QByteArray splitInput = header(0, 3, 1000, 300, 20, 1) + split.payload.left(128)
+            + header(3, 3, 0, 0, 0, 0) + split.payload.mid(128, 128)
+            + header(3, 3, 0, 0, 0, 0) + split.payload.mid(256);
+    isPassed = runCase("split", splitInput, chunkSize, QList<Expected>() << split, false, false) && isPassed;
+
+    //Chunks of two messages interleaved, second one on a two byte basic header csid
+    Expected first = {3, 500, 9, payload(200, 2)};
+    Expected second = {70, 480, 8, payload(150, 3)};
+    QByteArray interleavedInput = header(0, 3, 500, 200, 9, 1) + first.payload.left(128)
+            + header(0, 70, 480, 150, 8, 1) + second.payload.left(128)
+            + header(3, 3, 0, 0, 0, 0) + first.payload.mid(128)
+            + header(3, 70, 0, 0, 0, 0) + second.payload.mid(128);
+    QList<Expected> interleaved;
+    interleaved << first << second;
+    isPassed = runCase("interleaved", interleavedInput, chunkSize, interleaved, false, false) && isPassed;
+    isPassed = runCase("byteAtATime", interleavedInput, chunkSize, interleaved, false, true) && isPassed;
+
+    //fmt 2 sets a delta, a fmt 3 chunk starting a new message applies it again
+    Expected absolute = {4, 100, 9, payload(10, 4)};
+    Expected delta = {4, 140, 9, payload(10, 5)};
+    Expected repeated = {4, 180, 9, payload(10, 6)};
+    QByteArray deltaInput = header(0, 4, 100, 10, 9, 1) + absolute.payload
+            + header(2, 4, 40, 0, 0, 0) + delta.payload
+            + header(3, 4, 0, 0, 0, 0) + repeated.payload;
+    QList<Expected> deltas;
+    deltas << absolute << delta << repeated;
+    isPassed = runCase("fmt3NewMessage", deltaInput, chunkSize, deltas, false, false) && isPassed;
+
+    //Extended timestamp after the message header and again after the fmt 3 continuation
+    Expected extended = {5, 0x1000000, 9, payload(200, 7)};
+    QByteArray extendedInput = header(0, 5, 0x1000000, 200, 9, 1) + extended.payload.left(128)
+            + header(3, 5, 0x1000000, 0, 0, 0) + extended.payload.mid(128);
+    isPassed = runCase("extendedTimestamp", extendedInput, chunkSize, QList<Expected>() << extended, false, false)
+            && isPassed;
+
+    //New fmt 0 or fmt 1 header on csid 3 while its 300 byte message is only 128 bytes in, a shorter
+    //length must not shrink the payload under what was already received
+    QByteArray midMessage = header(0, 3, 1000, 300, 20, 1) + split.payload.left(128);
+    QByteArray fmt0Input = midMessage + header(0, 3, 2000, 10, 20, 1) + payload(10, 8);
+    isPassed = runCase("fmt0MidMessage", fmt0Input, chunkSize, QList<Expected>(), true, false) && isPassed;
+    QByteArray fmt1Input = midMessage + header(1, 3, 40, 10, 20, 0) + payload(10, 9);
+    isPassed = runCase("fmt1MidMessage", fmt1Input, chunkSize, QList<Expected>(), true, false) && isPassed;
+
+    fflush(stdout);
+    return isPassed;
+}
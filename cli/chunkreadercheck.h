@@ -0,0 +1,50 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CHUNKREADERCHECK_H_
+#define CHUNKREADERCHECK_H_
+
+#include <QByteArray>
+#include <QList>
+#include "rtmpchunkreader.h"
+
+/*
+ * Feeds hand built chunk streams into RTMPChunkReader, well formed ones (a message split over chunks,
+ * two chunk streams interleaved, fmt 3 starting a new message, extended timestamps, input arriving a byte
+ * at a time) and broken ones (a fmt 0 or fmt 1 header on a csid still in the middle of a message).
+ * Checks the messages that come out byte for byte, and that broken streams are flagged without any
+ * message. Prints a JSON line per case.
+ */
+class ChunkReaderCheck
+{
+public:
+    //False if any case failed
+    bool run();
+
+private:
+    struct Expected {
+        int csid;
+        quint32 timestamp;
+        int type;
+        QByteArray payload;
+    };
+
+    static QByteArray header(int fmt, int csid, quint32 timestamp, int length, int type, quint32 streamId);
+    static QByteArray payload(int length, int seed);
+    bool runCase(const char* name, const QByteArray& input, int chunkSize, const QList<Expected>& expected,
+            bool isBroken, bool isByteAtATime);
+};
+
+#endif /* CHUNKREADERCHECK_H_ */
@@ -0,0 +1,94 @@
+# Headless Linux build of the streaming pipeline, no Cascades or camera API.
+#   cd cli && qmake && make
+TEMPLATE = app
+TARGET = streamcam-cli
+
+QT += core network
+QT -= gui
+CONFIG += console warn_on
+QMAKE_CXXFLAGS_WARN_ON += -Wextra
+CONFIG -= app_bundle
+
+SRCDIR = $$quote($$PWD/../src)
+INCLUDEPATH += $$SRCDIR $$PWD
+
+SOURCES += \
+    $$quote($$PWD/alloccounter.cpp) \
+    $$quote($$PWD/benchrunner.cpp) \
+    $$quote($$PWD/chunkreadercheck.cpp) \
+    $$quote($$PWD/clirunner.cpp) \
+    $$quote($$PWD/eventloadmeter.cpp) \
+    $$quote($$PWD/filesource.cpp) \
+    $$quote($$PWD/impairedlink.cpp) \
+    $$quote($$PWD/interleavecheck.cpp) \
+    $$quote($$PWD/loopbacksink.cpp) \
+    $$quote($$PWD/main.cpp) \
+    $$quote($$PWD/nalbench.cpp) \
+    $$quote($$PWD/queuebench.cpp) \
+    $$quote($$PWD/scenariorunner.cpp) \
+    $$quote($$PWD/syntheticsource.cpp) \
+    $$quote($$SRCDIR/adts.cpp) \
+    $$quote($$SRCDIR/amf0.cpp) \
+    $$quote($$SRCDIR/bitratecontroller.cpp) \
+    $$quote($$SRCDIR/clipwriter.cpp) \
+    $$quote($$SRCDIR/controller.cpp) \
+    $$quote($$SRCDIR/flv.cpp) \
+    $$quote($$SRCDIR/frameswriter.cpp) \
+    $$quote($$SRCDIR/h264.cpp) \
+    $$quote($$SRCDIR/hlswriter.cpp) \
+    $$quote($$SRCDIR/interleaver.cpp) \
+    $$quote($$SRCDIR/latencytracer.cpp) \
+    $$quote($$SRCDIR/mediabuffer.cpp) \
+    $$quote($$SRCDIR/mediaclock.cpp) \
+    $$quote($$SRCDIR/mediafanout.cpp) \
+    $$quote($$SRCDIR/mediasource.cpp) \
+    $$quote($$SRCDIR/mp4muxer.cpp) \
+    $$quote($$SRCDIR/mp4writer.cpp) \
+    $$quote($$SRCDIR/prerollbuffer.cpp) \
+    $$quote($$SRCDIR/rtmpchunkreader.cpp) \
+    $$quote($$SRCDIR/rtmpchunkwriter.cpp) \
+    $$quote($$SRCDIR/rtmppublisher.cpp) \
+    $$quote($$SRCDIR/socketwriter.cpp)
+
+HEADERS += \
+    $$quote($$PWD/alloccounter.h) \
+    $$quote($$PWD/benchclock.h) \
+    $$quote($$PWD/benchrunner.h) \
+    $$quote($$PWD/chunkreadercheck.h) \
+    $$quote($$PWD/clirunner.h) \
+    $$quote($$PWD/eventloadmeter.h) \
+    $$quote($$PWD/filesource.h) \
+    $$quote($$PWD/impairedlink.h) \
+    $$quote($$PWD/interleavecheck.h) \
+    $$quote($$PWD/loopbacksink.h) \
+    $$quote($$PWD/nalbench.h) \
+    $$quote($$PWD/queuebench.h) \
+    $$quote($$PWD/scenariorunner.h) \
+    $$quote($$PWD/syntheticsource.h) \
+    $$quote($$SRCDIR/adts.h) \
+    $$quote($$SRCDIR/amf0.h) \
+    $$quote($$SRCDIR/bitratecontroller.h) \
+    $$quote($$SRCDIR/clipwriter.h) \
+    $$quote($$SRCDIR/controller.h) \
+    $$quote($$SRCDIR/encodercontrol.h) \
+    $$quote($$SRCDIR/flv.h) \
+    $$quote($$SRCDIR/framering.h) \
+    $$quote($$SRCDIR/frameswriter.h) \
+    $$quote($$SRCDIR/h264.h) \
+    $$quote($$SRCDIR/hlswriter.h) \
+    $$quote($$SRCDIR/interleaver.h) \
+    $$quote($$SRCDIR/latencytracer.h) \
+    $$quote($$SRCDIR/mediabuffer.h) \
+    $$quote($$SRCDIR/mediaclock.h) \
+    $$quote($$SRCDIR/mediafanout.h) \
+    $$quote($$SRCDIR/mediaframe.h) \
+    $$quote($$SRCDIR/mediasink.h) \
+    $$quote($$SRCDIR/mediasource.h) \
+    $$quote($$SRCDIR/mp4muxer.h) \
+    $$quote($$SRCDIR/mp4writer.h) \
+    $$quote($$SRCDIR/prerollbuffer.h) \
+    $$quote($$SRCDIR/rtmpchunkreader.h) \
+    $$quote($$SRCDIR/rtmpchunkwriter.h) \
+    $$quote($$SRCDIR/rtmpprotocol.h) \
+    $$quote($$SRCDIR/rtmppublisher.h) \
+    $$quote($$SRCDIR/socketwriter.h)
@@ -0,0 +1,158 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "clirunner.h"
+#include "filesource.h"
+#include "syntheticsource.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <signal.h>
+
+static volatile sig_atomic_t sIsInterrupted = 0;
+
+static void onInterrupt(int)
+{
+    sIsInterrupted = 1;
+}
+
+CliRunner::CliRunner(const CliOptions& options, QObject* parent)
+    :QObject(parent),
+     mOptions(options),
+     mController(NULL),
+     mSource(NULL),
+     mSourceThread(NULL),
+     mExitCode(0)
+{
+    connect(&mInterruptTimer,SIGNAL(timeout()),this,SLOT(checkInterrupt()));
+}
+
+CliRunner::~CliRunner()
+{
+    if(mSourceThread!=NULL) {
+        mSource->safeStop();
+        mSourceThread->wait();
+        delete mSourceThread;
+    }
+    delete mSource;
+}
+
+MediaSource* CliRunner::createSource()
+{
+    if(mOptions.videoPath.isEmpty() && mOptions.audioPath.isEmpty()) {
+        SyntheticSource* source = new SyntheticSource(mOptions.videoKbps, mOptions.fps, mOptions.gopFrames,
+                mOptions.audioKbps, mOptions.durationMsec);
+        //Lets BitrateController and key frame requests work like with the camera
+        mController->setEncoderControl(source);
+        return source;
+    }
+    FileSource* source = new FileSource(mOptions.videoPath, mOptions.audioPath, mOptions.fps, mOptions.loops);
+    if(!source->open()) {
+        delete source;
+        return NULL;
+    }
+    return source;
+}
+
+bool CliRunner::start()
+{
+    mController = new Controller(this);
+    if(!mController->setServer(mOptions.serverUrl, false)) {
+        qWarning()<<"Bad server url"<<mOptions.serverUrl;
+        return false;
+    }
+    mSource = createSource();
+    if(mSource==NULL)
+        return false;
+    mSource->setController(mController);
+    mSource->setRealtime(mOptions.isRealtime);
+    mController->setVideoFrameRate(mOptions.fps);
+    connect(mController,SIGNAL(publishError(QString)),this,SLOT(on_mController_publishError(QString)));
+    connect(mController,SIGNAL(publisherFinished()),this,SLOT(on_mController_publisherFinished()));
+    if(!mOptions.latencyTracePath.isEmpty())
+        mController->setLatencyTraceExport(true);
+
+    mSourceThread = new QThread();
+    connect(mSourceThread,SIGNAL(started()),mSource,SLOT(start()));
+    connect(mSource,SIGNAL(finished()),mSourceThread,SLOT(quit()));
+    connect(mSource,SIGNAL(finished()),this,SLOT(on_mSource_finished()));
+    mSource->moveToThread(mSourceThread);
+
+    signal(SIGINT, onInterrupt);
+    signal(SIGTERM, onInterrupt);
+    mInterruptTimer.start(200);
+    mClock.start();
+    if(mOptions.isEventStats)
+        mEventLoad.start();
+    mController->startStreaming();
+    mSourceThread->start();
+    return true;
+}
+
+void CliRunner::checkInterrupt()
+{
+    if(sIsInterrupted) {
+        sIsInterrupted = 0;
+        qDebug()<<"Interrupted, stopping";
+        mSource->safeStop();
+    }
+}
+
+void CliRunner::on_mSource_finished()
+{
+    qDebug()<<"Source done after"<<mClock.elapsed()<<"msec,"<<mController->totalBytesSent()/1024<<"kb sent";
+    mController->stopStreaming();
+}
+
+void CliRunner::on_mController_publishError(QString error)
+{
+    qWarning()<<"Publish error:"<<error;
+    mExitCode = 1;
+    mSource->safeStop();
+}
+
+void CliRunner::on_mController_publisherFinished()
+{
+    //Also comes when publisher fails on its own, source may still be running then.
+    //stopStreaming() waits for on_mSource_finished(), controller must not be reset under the source.
+    if(mController->isStreaming()) {
+        mExitCode = 1;
+        mSource->safeStop();
+    }
+    finish();
+}
+
+void CliRunner::finish()
+{
+    mInterruptTimer.stop();
+    mSource->safeStop();
+    mSourceThread->wait();
+    qDebug()<<mSource->framesCount()<<"frames"<<mSource->bytesCount()/1024<<"kb in"<<mClock.elapsed()<<"msec";
+    if(mOptions.isEventStats) {
+        mEventLoad.stop();
+        mEventLoad.report();
+    }
+    QVariantList latencies = mController->latencyStats();
+    for(int i=0;i<latencies.size();i++) {
+        QVariantMap track = latencies.at(i).toMap();
+        qDebug()<<"Latency"<<track.value("track").toString()<<track.value("frames").toInt()<<"frames, usec p50/p99"
+                <<"queue"<<track.value("queueP50").toLongLong()<<track.value("queueP99").toLongLong()
+                <<"socket"<<track.value("socketWaitP50").toLongLong()<<track.value("socketWaitP99").toLongLong()
+                <<"total"<<track.value("totalP50").toLongLong()<<track.value("totalP99").toLongLong();
+    }
+    if(!mOptions.latencyTracePath.isEmpty() && mController->exportLatencyTrace(mOptions.latencyTracePath))
+        qDebug()<<"Latency trace written to"<<mOptions.latencyTracePath;
+    QCoreApplication::exit(mExitCode);
+}
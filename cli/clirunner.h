@@ -0,0 +1,79 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef CLIRUNNER_H_
+#define CLIRUNNER_H_
+
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "controller.h"
+#include "mediasource.h"
+#include "eventloadmeter.h"
+
+struct CliOptions {
+    QString serverUrl;
+    QString videoPath;          //Both empty means synthetic source
+    QString audioPath;
+    int fps;
+    int loops;
+    int videoKbps;
+    int audioKbps;
+    int gopFrames;
+    int durationMsec;
+    bool isRealtime;
+    QString latencyTracePath;   //Chrome trace of frame latencies written here at the end, if set
+    bool isEventStats;          //Report main thread event load at the end
+};
+
+/*
+ * Runs one stream from a MediaSource through Controller and RTMPPublisher, same path the camera takes,
+ * and exits once the publisher has sent everything. Ctrl-C stops the source early.
+ */
+class CliRunner : public QObject
+{
+    Q_OBJECT
+public:
+    CliRunner(const CliOptions& options, QObject* parent = 0);
+    ~CliRunner();
+
+public slots:
+    //Returns false if options are unusable, nothing is started then
+    bool start();
+
+private slots:
+    void on_mSource_finished();
+    void on_mController_publishError(QString error);
+    void on_mController_publisherFinished();
+    void checkInterrupt();
+
+private:
+    MediaSource* createSource();
+    void finish();
+
+    CliOptions mOptions;
+    Controller* mController;
+    MediaSource* mSource;
+    QThread* mSourceThread;
+    QTimer mInterruptTimer;
+    QElapsedTimer mClock;
+    EventLoadMeter mEventLoad;
+    int mExitCode;
+};
+
+#endif /* CLIRUNNER_H_ */
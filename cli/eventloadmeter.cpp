@@ -0,0 +1,75 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "eventloadmeter.h"
+#include <QCoreApplication>
+#include <QDebug>
+
+EventLoadMeter::EventLoadMeter(QObject* parent)
+    :QObject(parent),
+     mElapsedMsec(0),
+     mEventsCount(0),
+     mMetaCallsCount(0),
+     mTimersCount(0),
+     mIsRunning(false) {}
+
+EventLoadMeter::~EventLoadMeter()
+{
+    stop();
+}
+
+void EventLoadMeter::start()
+{
+    if(mIsRunning)
+        return;
+    mIsRunning = true;
+    mClock.start();
+    QCoreApplication::instance()->installEventFilter(this);
+}
+
+void EventLoadMeter::stop()
+{
+    if(!mIsRunning)
+        return;
+    mIsRunning = false;
+    mElapsedMsec += mClock.elapsed();
+    QCoreApplication::instance()->removeEventFilter(this);
+}
+
+double EventLoadMeter::elapsedSeconds()
+{
+    return (mElapsedMsec + (mIsRunning ? mClock.elapsed() : 0))/1000.0;
+}
+
+bool EventLoadMeter::eventFilter(QObject* object, QEvent* event)
+{
+    mEventsCount++;
+    if(event->type()==QEvent::MetaCall)
+        mMetaCallsCount++;
+    else if(event->type()==QEvent::Timer)
+        mTimersCount++;
+    return QObject::eventFilter(object, event);
+}
+
+void EventLoadMeter::report()
+{
+    double seconds = elapsedSeconds();
+    if(seconds<=0)
+        return;
+    qDebug()<<"Main thread events per second"<<mEventsCount/seconds
+            <<"queued calls"<<mMetaCallsCount/seconds
+            <<"timers"<<mTimersCount/seconds;
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef EVENTLOADMETER_H_
+#define EVENTLOADMETER_H_
+
+#include <QObject>
+#include <QEvent>
+#include <QElapsedTimer>
+
+/*
+ * Counts events the main thread's event loop delivers, by application event filter, ie, queued signal
+ * calls from other threads, timers and the rest. Tells how much a streaming session costs the GUI thread.
+ */
+class EventLoadMeter : public QObject
+{
+    Q_OBJECT
+public:
+    EventLoadMeter(QObject* parent = 0);
+    ~EventLoadMeter();
+
+    void start();
+    void stop();
+    qint64 eventsCount() { return mEventsCount; }
+    qint64 metaCallsCount() { return mMetaCallsCount; }
+    qint64 timersCount() { return mTimersCount; }
+    double elapsedSeconds();
+    void report();
+
+protected:
+    bool eventFilter(QObject* object, QEvent* event);
+
+private:
+    QElapsedTimer mClock;
+    qint64 mElapsedMsec;
+    qint64 mEventsCount;
+    qint64 mMetaCallsCount;
+    qint64 mTimersCount;
+    bool mIsRunning;
+};
+
+#endif /* EVENTLOADMETER_H_ */
@@ -0,0 +1,148 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "filesource.h"
+#include "h264.h"
+#include "adts.h"
+#include <QFile>
+#include <QVector>
+#include <QDebug>
+
+static const char START_CODE[4] = {0, 0, 0, 1};
+
+FileSource::FileSource(QString videoPath, QString audioPath, int fps, int loops, QObject* parent)
+    :MediaSource(parent),
+     mVideoPath(videoPath),
+     mAudioPath(audioPath),
+     mFps(fps > 0 ? fps : FILESOURCE_DEFAULT_FPS),
+     mLoops(loops),
+     mAudioSampleRate(48000),
+     mVideoIndex(0),
+     mAudioIndex(0) {}
+
+bool FileSource::open()
+{
+    if (!mVideoPath.isEmpty()) {
+        QFile file(mVideoPath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qDebug()<<"Can't open"<<mVideoPath<<file.errorString();
+            return false;
+        }
+        if (!splitVideo(file.readAll())) {
+            qDebug()<<"No H.264 access units in"<<mVideoPath;
+            return false;
+        }
+    }
+    if (!mAudioPath.isEmpty()) {
+        QFile file(mAudioPath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qDebug()<<"Can't open"<<mAudioPath<<file.errorString();
+            return false;
+        }
+        mAudio = file.readAll();
+        if (!splitAudio(mAudio)) {
+            qDebug()<<"No ADTS frames in"<<mAudioPath;
+            return false;
+        }
+    }
+    qDebug()<<"FileSource"<<mVideoUnits.size()<<"video and"<<mAudioUnits.size()<<"audio frames";
+    return !mVideoUnits.isEmpty() || !mAudioUnits.isEmpty();
+}
+
+bool FileSource::splitVideo(const QByteArray& data)
+{
+    /*
+     * Frames are laid out like the camera's: an IDR as start code, SPS, start code, PPS, start code, IDR and
+     * any other picture as start code, slice. Controller needs SPS/PPS before the first picture it sends,
+     * so pictures before the first IDR are skipped.
+     */
+    const char* bytes = data.constData();
+    QVector<H264NALUnit> nals(data.size()/4 + 1);
+    int count = H264::splitAnnexB(bytes, data.size(), nals.data(), nals.size());
+    QByteArray sps;
+    QByteArray pps;
+    for (int i = 0; i < count; i++) {
+        const H264NALUnit& nal = nals.at(i);
+        if (nal.type == H264_NAL_SPS) {
+            sps = QByteArray(bytes + nal.offset, nal.size);
+        } else if (nal.type == H264_NAL_PPS) {
+            pps = QByteArray(bytes + nal.offset, nal.size);
+        } else if ((nal.type == H264_NAL_IDR || (nal.type == H264_NAL_SLICE && !mVideoUnits.isEmpty())) && !sps.isEmpty() && !pps.isEmpty()) {
+            Unit unit;
+            unit.offset = mVideo.size();
+            unit.isKeyFrame = (nal.type == H264_NAL_IDR);
+            if (unit.isKeyFrame) {
+                mVideo.append(START_CODE, 4);
+                mVideo.append(sps);
+                mVideo.append(START_CODE, 4);
+                mVideo.append(pps);
+            }
+            mVideo.append(START_CODE, 4);
+            mVideo.append(bytes + nal.offset, nal.size);
+            unit.size = mVideo.size() - unit.offset;
+            mVideoUnits.append(unit);
+        }
+    }
+    return !mVideoUnits.isEmpty();
+}
+
+bool FileSource::splitAudio(const QByteArray& data)
+{
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    int offset = 0;
+    while (offset + ADTS_HEADER_SIZE <= data.size()) {
+        ADTSFrame frame;
+        if (!ADTS::parseFrame(bytes + offset, data.size() - offset, frame)) {
+            offset++;   //Resync on next syncword
+            continue;
+        }
+        if (mAudioUnits.isEmpty())
+            mAudioSampleRate = ADTS::samplingRate(frame.config.samplingRateIndex);
+        Unit unit;
+        unit.offset = offset;
+        unit.size = frame.size;
+        unit.isKeyFrame = true;
+        mAudioUnits.append(unit);
+        offset += frame.size;
+    }
+    return !mAudioUnits.isEmpty();
+}
+
+bool FileSource::nextVideoFrame(Frame& frame)
+{
+    if (mVideoUnits.isEmpty() || (mLoops > 0 && mVideoIndex >= (qint64) mLoops*mVideoUnits.size()))
+        return false;
+    const Unit& unit = mVideoUnits.at(mVideoIndex % mVideoUnits.size());
+    frame.data = reinterpret_cast<const uint8_t*>(mVideo.constData() + unit.offset);
+    frame.size = unit.size;
+    frame.timestamp = mVideoIndex*1000000/mFps;
+    frame.isKeyFrame = unit.isKeyFrame;
+    mVideoIndex++;
+    return true;
+}
+
+bool FileSource::nextAudioFrame(Frame& frame)
+{
+    if (mAudioUnits.isEmpty() || (mLoops > 0 && mAudioIndex >= (qint64) mLoops*mAudioUnits.size()))
+        return false;
+    const Unit& unit = mAudioUnits.at(mAudioIndex % mAudioUnits.size());
+    frame.data = reinterpret_cast<const uint8_t*>(mAudio.constData() + unit.offset);
+    frame.size = unit.size;
+    frame.timestamp = mAudioIndex*AAC_SAMPLES_PER_BLOCK*1000000/mAudioSampleRate;
+    frame.isKeyFrame = true;
+    mAudioIndex++;
+    return true;
+}
@@ -0,0 +1,72 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef FILESOURCE_H_
+#define FILESOURCE_H_
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include "mediasource.h"
+
+#define FILESOURCE_DEFAULT_FPS 30
+
+/*
+ * Plays a raw Annex-B H.264 file and/or an ADTS AAC file, as recorded off the camera or with
+ * ffmpeg -c copy -bsf h264_mp4toannexb. Files are read whole and split up front, so reading doesn't show
+ * up in measurements. Video timestamps come from fps, audio from ADTS sample rate.
+ * Access units are rebuilt into the camera's layout, AUD and SEI are dropped. One slice per picture is
+ * assumed, like the camera encoder.
+ */
+class FileSource : public MediaSource
+{
+    Q_OBJECT
+public:
+    //Either path may be empty. loops < 1 plays forever.
+    FileSource(QString videoPath, QString audioPath, int fps = FILESOURCE_DEFAULT_FPS, int loops = 1,
+            QObject* parent = 0);
+
+    //Returns false if a file can't be read or has no frames
+    bool open();
+
+protected:
+    bool nextVideoFrame(Frame& frame);
+    bool nextAudioFrame(Frame& frame);
+
+private:
+    struct Unit {
+        int offset;
+        int size;
+        bool isKeyFrame;
+    };
+
+    bool splitVideo(const QByteArray& data);
+    bool splitAudio(const QByteArray& data);
+
+    QString mVideoPath;
+    QString mAudioPath;
+    int mFps;
+    int mLoops;
+    QByteArray mVideo;          //Access units in camera layout, back to back
+    QList<Unit> mVideoUnits;
+    QByteArray mAudio;          //ADTS file as is
+    QList<Unit> mAudioUnits;
+    int mAudioSampleRate;
+    qint64 mVideoIndex;         //Counts on across loops, gives timestamps
+    qint64 mAudioIndex;
+};
+
+#endif /* FILESOURCE_H_ */
@@ -0,0 +1,324 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "impairedlink.h"
+#include "benchclock.h"
+#include <QFile>
+#include <QStringList>
+#include <QtNetwork/QHostAddress>
+#include <QDebug>
+#if defined(Q_OS_UNIX)
+#include <sys/socket.h>
+#endif
+
+ImpairedLink::ImpairedLink(int targetPort, const QList<ImpairmentStep>& steps, quint32 seed, QObject* parent)
+    :QObject(parent),
+     mTargetPort(targetPort),
+     mSteps(steps),
+     mStepIndex(-1),
+     mRandom(seed ? seed : 1),
+     mServer(NULL),
+     mClient(NULL),
+     mTarget(NULL),
+     mLastTickUsec(0),
+     mTokens(0),
+     mLastUpRelease(0),
+     mLastDownRelease(0),
+     mIsClientClosed(false),
+     mIsFinished(false)
+{
+    if(mSteps.isEmpty()) {
+        ImpairmentStep step = {0, IMPAIREDLINK_UNLIMITED, 0, 0, false};
+        mSteps.append(step);
+    }
+    connect(&mTicker,SIGNAL(timeout()),this,SLOT(tick()));
+}
+
+bool ImpairedLink::loadTrace(const QString& path, QList<ImpairmentStep>& steps)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)) {
+        qWarning()<<"Can't open trace"<<path;
+        return false;
+    }
+    ImpairmentStep step = {0, 0, 0, 0, false};
+    int lineNumber = 0;
+    while(!file.atEnd()) {
+        QString line = QString::fromLatin1(file.readLine().constData()).trimmed();
+        lineNumber++;
+        int comment = line.indexOf("#");
+        if(comment>=0)
+            line = line.left(comment).trimmed();
+        if(line.isEmpty())
+            continue;
+        QStringList fields = line.simplified().split(" ");
+        bool isNumber = fields.size()>=2;
+        double seconds = fields.at(0).toDouble(&isNumber);
+        if(isNumber && fields.size()==2 && fields.at(1)=="reset") {
+            if(steps.isEmpty()) {
+                qWarning()<<"Reset before any link conditions, line"<<lineNumber<<"in"<<path;
+                return false;
+            }
+            ImpairmentStep reset = step;
+            reset.atMsec = (int) (seconds*1000);
+            reset.isReset = true;
+            steps.append(reset);
+            continue;
+        }
+        for(int i=1;i<fields.size() && i<4 && isNumber;i++) {
+            int value = fields.at(i).toInt(&isNumber);
+            if(i==1)
+                step.kbps = value;
+            else if(i==2)
+                step.rttMsec = value;
+            else
+                step.jitterMsec = value;
+        }
+        if(!isNumber || fields.size()<2 || step.kbps<IMPAIREDLINK_UNLIMITED || step.rttMsec<0 || step.jitterMsec<0) {
+            qWarning()<<"Bad trace line"<<lineNumber<<"in"<<path;
+            return false;
+        }
+        step.atMsec = (int) (seconds*1000);
+        steps.append(step);
+    }
+    return !steps.isEmpty();
+}
+
+void ImpairedLink::addResets(QList<ImpairmentStep>& steps, int minMsec, int maxMsec, int untilMsec, quint32 seed)
+{
+    if(minMsec<=0 || maxMsec<minMsec || steps.isEmpty())
+        return;
+    //Own generator, so the reset times don't shift the link jitter sequence
+    quint32 random = seed ? seed : 1;
+    int index = 0;
+    int at = 0;
+    for(;;) {
+        at += minMsec;
+        if(maxMsec>minMsec)
+            at += nextRandom(random) % (quint32) (maxMsec-minMsec+1);
+        if(at>=untilMsec)
+            break;
+        while(index+1<steps.size() && steps.at(index+1).atMsec<=at)
+            index++;
+        ImpairmentStep reset = steps.at(index);
+        reset.atMsec = at;
+        reset.isReset = true;
+        steps.insert(++index, reset);
+    }
+}
+
+void ImpairedLink::start()
+{
+    mServer = new QTcpServer(this);
+    connect(mServer,SIGNAL(newConnection()),this,SLOT(on_mServer_newConnection()));
+    if(!mServer->listen(QHostAddress::LocalHost, 0)) {
+        qWarning()<<"ImpairedLink can't listen"<<mServer->errorString();
+        finish();
+        return;
+    }
+    emit listening(mServer->serverPort());
+}
+
+void ImpairedLink::stop()
+{
+    if(mClient!=NULL)
+        mClient->abort();
+    if(mTarget!=NULL)
+        mTarget->abort();
+    finish();
+}
+
+void ImpairedLink::on_mServer_newConnection()
+{
+    //One publisher at a time, a new one only after a reset dropped the last
+    QTcpSocket* socket = mServer->nextPendingConnection();
+    if(mClient!=NULL) {
+        socket->close();
+        socket->deleteLater();
+        return;
+    }
+    mClient = socket;
+    //Qt stops reading from the kernel once this much is waiting, rest stays with the sender
+    mClient->setReadBufferSize(IMPAIREDLINK_READ_BUFFER);
+#if defined(Q_OS_UNIX)
+    int size = IMPAIREDLINK_READ_BUFFER;
+    ::setsockopt(mClient->socketDescriptor(), SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+#endif
+    connect(mClient,SIGNAL(disconnected()),this,SLOT(on_mClient_disconnected()));
+    mTarget = new QTcpSocket(this);
+    connect(mTarget,SIGNAL(disconnected()),this,SLOT(on_mTarget_disconnected()));
+    mTarget->connectToHost("127.0.0.1", mTargetPort);
+    if(mTicker.isActive())
+        return;     //Reconnect, steps keep their time line
+    mClock.start();
+    mLastTickUsec = BenchClock::nowUsec();
+    applyStep(0);
+    mTicker.start(IMPAIREDLINK_TICK_MSEC);
+}
+
+void ImpairedLink::applyStep(qint64 elapsedMsec)
+{
+    int index = mStepIndex < 0 ? 0 : mStepIndex;
+    bool isReset = false;
+    //A tick late enough to pass several steps still resets for any of them
+    while(index+1<mSteps.size() && mSteps.at(index+1).atMsec<=elapsedMsec) {
+        index++;
+        isReset = isReset || mSteps.at(index).isReset;
+    }
+    if(index==mStepIndex)
+        return;
+    mStepIndex = index;
+    const ImpairmentStep& step = mSteps.at(index);
+    mCurrentKbps.fetchAndStoreRelaxed(step.kbps);
+    mCurrentRtt.fetchAndStoreRelaxed(step.rttMsec);
+    if(step.kbps==0)
+        mTokens = 0;
+    if(isReset)
+        resetConnection();
+}
+
+void ImpairedLink::resetConnection()
+{
+    /*
+     * What a NAT timeout or a dropped uplink looks like to both ends, the publisher gets ECONNRESET (or EPIPE)
+     * on its next read or write and has to reconnect. Bytes still in the link are lost.
+     */
+    if(mClient==NULL)
+        return;
+    qDebug()<<"ImpairedLink reset at"<<mClock.elapsed()<<"msec";
+    mResetCount.ref();
+    abortSocket(mClient);
+    abortSocket(mTarget);
+    mClient = NULL;
+    mTarget = NULL;
+    int lost = 0;
+    for(int i=0;i<mUpstream.size();i++)
+        lost += mUpstream.at(i).data.size();
+    mQueuedBytes.fetchAndAddRelaxed(-lost);
+    mUpstream.clear();
+    mDownstream.clear();
+    mLastUpRelease = 0;
+    mLastDownRelease = 0;
+    mIsClientClosed = false;
+}
+
+void ImpairedLink::abortSocket(QTcpSocket* socket)
+{
+    //Its disconnected() is ours, not the end of the run
+    socket->disconnect(this);
+#if defined(Q_OS_UNIX)
+    //Zero linger turns close into RST
+    struct linger noLinger;
+    noLinger.l_onoff = 1;
+    noLinger.l_linger = 0;
+    if(socket->socketDescriptor()>=0)
+        ::setsockopt(socket->socketDescriptor(), SOL_SOCKET, SO_LINGER, &noLinger, sizeof(noLinger));
+#endif
+    socket->abort();
+    socket->deleteLater();
+}
+
+quint32 ImpairedLink::nextRandom(quint32& state)
+{
+    //xorshift32, same sequence on every platform for a given seed
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+qint64 ImpairedLink::releaseTime(qint64 nowUsec, qint64& lastRelease)
+{
+    const ImpairmentStep& step = mSteps.at(mStepIndex);
+    qint64 delay = (qint64) step.rttMsec*1000/2;
+    if(step.jitterMsec>0)
+        delay += nextRandom(mRandom) % ((quint32) step.jitterMsec*1000);
+    //Never overtakes what is already in flight
+    lastRelease = qMax(lastRelease, nowUsec + delay);
+    return lastRelease;
+}
+
+int ImpairedLink::flush(QList<Packet>& queue, QTcpSocket* socket, qint64 nowUsec)
+{
+    int bytes = 0;
+    while(!queue.isEmpty() && queue.first().releaseUsec<=nowUsec) {
+        Packet packet = queue.takeFirst();
+        socket->write(packet.data);
+        bytes += packet.data.size();
+    }
+    return bytes;
+}
+
+void ImpairedLink::tick()
+{
+    qint64 now = BenchClock::nowUsec();
+    applyStep(mClock.elapsed());
+    const ImpairmentStep& step = mSteps.at(mStepIndex);
+    if(step.kbps>0) {
+        double burst = qMax((double) IMPAIREDLINK_MIN_BURST, step.kbps*125.0*IMPAIREDLINK_BURST_MSEC/1000);
+        mTokens = qMin(burst, mTokens + step.kbps*125.0*(now-mLastTickUsec)/1000000);
+    }
+    mLastTickUsec = now;
+    if(mClient==NULL)
+        return;     //Reset, waiting for the publisher to come back
+
+    qint64 available = mClient->bytesAvailable();
+    if(step.kbps>=0)
+        available = qMin(available, (qint64) mTokens);
+    if(available>0) {
+        Packet packet;
+        packet.data = mClient->read(available);
+        mTokens -= packet.data.size();
+        packet.releaseUsec = releaseTime(now, mLastUpRelease);
+        mQueuedBytes.fetchAndAddRelaxed(packet.data.size());
+        mUpstream.append(packet);
+    }
+    if(mTarget->state()==QAbstractSocket::ConnectedState) {
+        if(mTarget->bytesAvailable()>0) {
+            Packet packet;
+            packet.data = mTarget->readAll();
+            packet.releaseUsec = releaseTime(now, mLastDownRelease);
+            mDownstream.append(packet);
+        }
+        mQueuedBytes.fetchAndAddRelaxed(-flush(mUpstream, mTarget, now));
+    }
+    if(mClient->state()==QAbstractSocket::ConnectedState)
+        flush(mDownstream, mClient, now);
+    if(mIsClientClosed && mUpstream.isEmpty() && mClient->bytesAvailable()==0)
+        mTarget->disconnectFromHost();
+}
+
+void ImpairedLink::on_mClient_disconnected()
+{
+    //Whatever is still in the link gets delivered first
+    mIsClientClosed = true;
+}
+
+void ImpairedLink::on_mTarget_disconnected()
+{
+    if(mClient!=NULL && mClient->state()!=QAbstractSocket::UnconnectedState)
+        mClient->disconnectFromHost();
+    finish();
+}
+
+void ImpairedLink::finish()
+{
+    if(mIsFinished)
+        return;
+    mIsFinished = true;
+    mTicker.stop();
+    emit finished();
+}
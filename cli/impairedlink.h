@@ -0,0 +1,124 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef IMPAIREDLINK_H_
+#define IMPAIREDLINK_H_
+
+#include <QObject>
+#include <QList>
+#include <QTimer>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+#define IMPAIREDLINK_TICK_MSEC 1
+#define IMPAIREDLINK_READ_BUFFER (64*1024)     //Socket buffers, so a capped link pushes back on the sender
+#define IMPAIREDLINK_BURST_MSEC 20             //Token bucket depth
+#define IMPAIREDLINK_MIN_BURST 3000
+#define IMPAIREDLINK_UNLIMITED -1
+
+//Link conditions from atMsec on, till the next step. kbps 0 is a stall, IMPAIREDLINK_UNLIMITED no cap.
+//A reset step drops the connection at atMsec and keeps conditions as they were.
+struct ImpairmentStep {
+    int atMsec;
+    int kbps;
+    int rttMsec;
+    int jitterMsec;
+    bool isReset;
+};
+
+/*
+ * TCP relay on 127.0.0.1 between one publisher and the real (or loopback) server, playing a bad network.
+ * Publisher to server bytes are let through a token bucket at the current bandwidth and then held for half
+ * the RTT plus a random jitter, server to publisher bytes only get the delay. Order is kept, like TCP would.
+ * The publisher side socket buffers are kept small so a slow link shows up as backpressure in the
+ * publisher and not as megabytes sitting in loopback kernel buffers.
+ * Conditions follow a list of steps in time, read from a trace file or made from fixed values.
+ * Jitter comes from a seeded generator so the same seed and trace give the same run.
+ * A reset step aborts both sides with RST and drops what is in flight, the publisher's reconnect is then
+ * taken as a fresh client and relayed over a fresh connection to the server.
+ */
+class ImpairedLink : public QObject
+{
+    Q_OBJECT
+public:
+    ImpairedLink(int targetPort, const QList<ImpairmentStep>& steps, quint32 seed, QObject* parent = 0);
+
+    //Lines of "<seconds> <kbps> [rttMsec [jitterMsec]]" or "<seconds> reset", # comments.
+    //Missing values carry over, kbps -1 is no cap.
+    static bool loadTrace(const QString& path, QList<ImpairmentStep>& steps);
+    //Reset steps up to untilMsec, merged into steps in time order. Gaps are drawn between minMsec and
+    //maxMsec from seed, equal bounds give a fixed interval.
+    static void addResets(QList<ImpairmentStep>& steps, int minMsec, int maxMsec, int untilMsec, quint32 seed);
+
+    //Any thread, for sampling while running
+    int currentKbps() { return mCurrentKbps.fetchAndAddRelaxed(0); }
+    int currentRttMsec() { return mCurrentRtt.fetchAndAddRelaxed(0); }
+    int queuedBytes() { return mQueuedBytes.fetchAndAddRelaxed(0); }
+    int resetCount() { return mResetCount.fetchAndAddRelaxed(0); }
+
+signals:
+    void listening(int port);
+    void finished();
+
+public slots:
+    void start();
+    void stop();
+
+private slots:
+    void on_mServer_newConnection();
+    void on_mClient_disconnected();
+    void on_mTarget_disconnected();
+    void tick();
+
+private:
+    struct Packet {
+        qint64 releaseUsec;
+        QByteArray data;
+    };
+    void applyStep(qint64 elapsedMsec);
+    void resetConnection();
+    void abortSocket(QTcpSocket* socket);
+    qint64 releaseTime(qint64 nowUsec, qint64& lastRelease);
+    int flush(QList<Packet>& queue, QTcpSocket* socket, qint64 nowUsec);
+    static quint32 nextRandom(quint32& state);
+    void finish();
+
+    int mTargetPort;
+    QList<ImpairmentStep> mSteps;
+    int mStepIndex;
+    quint32 mRandom;
+    QTcpServer* mServer;
+    QTcpSocket* mClient;
+    QTcpSocket* mTarget;
+    QTimer mTicker;
+    QElapsedTimer mClock;
+    qint64 mLastTickUsec;
+    double mTokens;
+    QList<Packet> mUpstream;
+    QList<Packet> mDownstream;
+    qint64 mLastUpRelease;
+    qint64 mLastDownRelease;
+    bool mIsClientClosed;
+    bool mIsFinished;
+    QAtomicInt mCurrentKbps;
+    QAtomicInt mCurrentRtt;
+    QAtomicInt mQueuedBytes;
+    QAtomicInt mResetCount;
+};
+
+#endif /* IMPAIREDLINK_H_ */
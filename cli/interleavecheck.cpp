@@ -0,0 +1,147 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "interleavecheck.h"
+#include <stdio.h>
+
+InterleaveCheck::InterleaveCheck()
+    :mSeed(1) {}
+
+const char* InterleaveCheck::patternName(int pattern)
+{
+    static const char* names[PatternCount] = {"steady", "jitter", "micStall", "micDies", "audioBursts",
+            "lateVideo", "lateStart"};
+    return names[pattern];
+}
+
+int InterleaveCheck::jitter(int maxMsec)
+{
+    mSeed ^= mSeed << 13;
+    mSeed ^= mSeed >> 17;
+    mSeed ^= mSeed << 5;
+    return (int) (mSeed % (maxMsec + 1));
+}
+
+QList<InterleaveCheck::Arrival> InterleaveCheck::arrivals(int pattern)
+{
+    /*
+     * Frames of each track are captured at their period and arrive in capture order, late by however much
+     * the pattern says. Both lists are merged by arrival time.
+     */
+    QList<Arrival> tracks[2];
+    for (int track = 0; track < 2; track++) {
+        bool isAudio = track == INTERLEAVER_TRACK_AUDIO;
+        qint64 period = isAudio ? INTERLEAVECHECK_AUDIO_PERIOD_USEC : INTERLEAVECHECK_VIDEO_PERIOD_USEC;
+        qint64 lastAt = 0;
+        for (qint64 captured = 0; captured < INTERLEAVECHECK_SECONDS*1000000LL; captured += period) {
+            qint64 dts = captured/1000;
+            qint64 at = dts;
+            if (pattern == PatternJitter)
+                at += jitter(40);
+            else if (pattern == PatternMicStall && isAudio && dts >= 3000 && dts < 5000)
+                at = 5000;
+            else if (pattern == PatternMicDies && isAudio && dts >= 2000)
+                break;
+            else if (pattern == PatternAudioBursts && isAudio)
+                at = (dts/400 + 1)*400;
+            else if (pattern == PatternLateVideo && !isAudio)
+                at += 300;
+            else if (pattern == PatternLateStart && isAudio && dts < 1000)
+                continue;
+            at = qMax(at, lastAt);
+            lastAt = at;
+            Arrival arrival;
+            arrival.atMsec = at;
+            arrival.track = track;
+            arrival.dts = (long) dts;
+            tracks[track].append(arrival);
+        }
+    }
+    QList<Arrival> merged;
+    int indexes[2] = {0, 0};
+    while (indexes[0] < tracks[0].size() || indexes[1] < tracks[1].size()) {
+        int track = indexes[1] >= tracks[1].size() ? 0 : indexes[0] >= tracks[0].size() ? 1
+                : tracks[0].at(indexes[0]).atMsec <= tracks[1].at(indexes[1]).atMsec ? 0 : 1;
+        merged.append(tracks[track].at(indexes[track]++));
+    }
+    return merged;
+}
+
+bool InterleaveCheck::runPattern(int pattern)
+{
+    /*
+     * One msec per step: frames arriving then are queued, then frames are taken while the interleaver
+     * picks one, like a sink's pump. A frame taken while an earlier one of the other track was already
+     * queued is a violation, one taken after it's passed by frames that came later is an inversion.
+     */
+    QList<Arrival> pending = arrivals(pattern);
+    int total = pending.size();
+    QList<Arrival> queues[2];
+    Interleaver interleaver(2);
+    long lastDts[2] = {-1, -1};
+    long maxEmittedDts = -1;
+    int emitted = 0;
+    int inversions = 0;
+    int violations = 0;
+    qint64 maxHoldMsec = 0;
+    qint64 endMsec = INTERLEAVECHECK_SECONDS*1000 + 2000;
+    for (qint64 now = 0; now <= endMsec; now++) {
+        while (!pending.isEmpty() && pending.first().atMsec <= now)
+            queues[pending.first().track].append(pending.takeFirst());
+        //Everything has arrived, what's left goes like a sink drains at EOS
+        bool isEnd = pending.isEmpty();
+        while (true) {
+            long heads[2];
+            for (int i = 0; i < 2; i++)
+                heads[i] = queues[i].isEmpty() ? INTERLEAVER_EMPTY : queues[i].first().dts;
+            int track = interleaver.next(heads, now);
+            if (isEnd && track < 0 && (heads[0] != INTERLEAVER_EMPTY || heads[1] != INTERLEAVER_EMPTY))
+                track = heads[1] == INTERLEAVER_EMPTY || (heads[0] != INTERLEAVER_EMPTY && heads[0] <= heads[1]) ? 0 : 1;
+            if (track < 0)
+                break;
+            Arrival frame = queues[track].takeFirst();
+            interleaver.taken(track, frame.dts);
+            int other = 1 - track;
+            if (frame.dts <= lastDts[track] || (!queues[other].isEmpty() && queues[other].first().dts < frame.dts))
+                violations++;
+            if (frame.dts < maxEmittedDts)
+                inversions++;
+            maxEmittedDts = qMax(maxEmittedDts, frame.dts);
+            lastDts[track] = frame.dts;
+            if (!isEnd)
+                maxHoldMsec = qMax(maxHoldMsec, now - frame.atMsec);
+            emitted++;
+        }
+    }
+    bool isWellBehaved = pattern == PatternSteady || pattern == PatternJitter || pattern == PatternLateStart;
+    //Held while the other track is silent, at most the wait timeout, or late but delivering, at most the skew
+    bool isPassed = emitted == total && violations == 0 && maxHoldMsec <= INTERLEAVER_WAIT_MSEC + INTERLEAVER_MAX_SKEW_MSEC
+            && (!isWellBehaved || (inversions == 0 && interleaver.stallCount() == 0));
+    printf("{\"mode\":\"interleaveCheck\",\"pattern\":\"%s\",\"frames\":%d,\"emitted\":%d,\"violations\":%d,"
+            "\"inversions\":%d,\"stalls\":%d,\"maxHoldMsec\":%lld,\"passed\":%s}\n",
+            patternName(pattern), total, emitted, violations, inversions, interleaver.stallCount(),
+            maxHoldMsec, isPassed ? "true" : "false");
+    return isPassed;
+}
+
+bool InterleaveCheck::run()
+{
+    bool isPassed = true;
+    for (int pattern = 0; pattern < PatternCount; pattern++)
+        isPassed = runPattern(pattern) && isPassed;
+    fflush(stdout);
+    return isPassed;
+}
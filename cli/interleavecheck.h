@@ -0,0 +1,69 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef INTERLEAVECHECK_H_
+#define INTERLEAVECHECK_H_
+
+#include <QList>
+#include <QVector>
+#include "interleaver.h"
+
+#define INTERLEAVECHECK_SECONDS 20
+#define INTERLEAVECHECK_AUDIO_PERIOD_USEC 21333     //1024 samples at 48 kHz
+#define INTERLEAVECHECK_VIDEO_PERIOD_USEC 33333
+
+/*
+ * Runs Interleaver against simulated arrival patterns on a virtual msec clock, steady and jittered
+ * tracks, a microphone that stalls and then bursts its backlog, one that dies, audio that only ever comes
+ * in bursts, late video and a track starting late. Checks every frame comes out once, in order within its
+ * track, never held past the wait timeout plus max skew, and for the well behaved patterns in dts order
+ * overall without any track given up on.
+ * Prints a JSON line per pattern.
+ */
+class InterleaveCheck
+{
+public:
+    InterleaveCheck();
+
+    //False if any pattern failed
+    bool run();
+
+private:
+    struct Arrival {
+        qint64 atMsec;
+        int track;
+        long dts;
+    };
+    enum Pattern {
+        PatternSteady = 0,
+        PatternJitter,
+        PatternMicStall,
+        PatternMicDies,
+        PatternAudioBursts,
+        PatternLateVideo,
+        PatternLateStart,
+        PatternCount
+    };
+
+    static const char* patternName(int pattern);
+    QList<Arrival> arrivals(int pattern);
+    bool runPattern(int pattern);
+    int jitter(int maxMsec);
+
+    quint32 mSeed;
+};
+
+#endif /* INTERLEAVECHECK_H_ */
@@ -0,0 +1,274 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "loopbacksink.h"
+#include "alloccounter.h"
+#include "benchclock.h"
+#include "amf0.h"
+#include "flv.h"
+#include <QtNetwork/QHostAddress>
+#include <QDebug>
+#include <string.h>
+
+LoopbackSink::LoopbackSink(const qint64* enqueueTimes, int frameCount, QObject* parent)
+    :QObject(parent),
+     mServer(NULL),
+     mSocket(NULL),
+     mHandshakeBytesLeft(1536),
+     mIsHandshakeDone(false),
+     mIsReconnectable(false),
+     mHasConnectionVideo(false),
+     mLastAudioTimestamp(-1),
+     mLastVideoTimestamp(-1),
+     mEnqueueTimes(enqueueTimes),
+     mFrameCount(frameCount),
+     mStartAllocations(0),
+     mStartCpuUsec(0),
+     mIsFinished(false)
+{
+    memset(&mStats, 0, sizeof(mStats));
+    mStats.firstFrameUsec = -1;
+    //Allocated here, not while frames arrive
+    if (enqueueTimes != NULL)
+        mLatencies.reserve(frameCount);
+    else
+        mArrivals.reserve(frameCount);
+    mReadBuffer.resize(LOOPBACKSINK_READ_SIZE);
+}
+
+void LoopbackSink::start()
+{
+    mStartAllocations = AllocCounter::thisThread();
+    mStartCpuUsec = BenchClock::threadCpuUsec();
+    mServer = new QTcpServer(this);
+    connect(mServer,SIGNAL(newConnection()),this,SLOT(on_mServer_newConnection()));
+    if (!mServer->listen(QHostAddress::LocalHost, 0)) {
+        qWarning()<<"LoopbackSink can't listen"<<mServer->errorString();
+        finish();
+        return;
+    }
+    emit listening(mServer->serverPort());
+}
+
+void LoopbackSink::on_mServer_newConnection()
+{
+    QTcpSocket* socket = mServer->nextPendingConnection();
+    if (mSocket != NULL || (mStats.connections > 0 && !mIsReconnectable)) {
+        //One publisher per benchmark, one at a time when reconnectable
+        socket->close();
+        socket->deleteLater();
+        return;
+    }
+    mSocket = socket;
+    mStats.connections++;
+    mWriter.setSocket(mSocket);
+    connect(mSocket,SIGNAL(readyRead()),this,SLOT(on_mSocket_readyRead()));
+    connect(mSocket,SIGNAL(disconnected()),this,SLOT(on_mSocket_disconnected()));
+}
+
+void LoopbackSink::on_mSocket_readyRead()
+{
+    if (!mIsHandshakeDone) {
+        //C0+C1 in, S0+S1+S2 out, S1 all zeros and S2 echoing C1
+        if (mSocket->bytesAvailable() < 1537)
+            return;
+        QByteArray c0c1 = mSocket->read(1537);
+        QByteArray reply(1 + 2*1536, 0);
+        reply[0] = 3;
+        memcpy(reply.data() + 1 + 1536, c0c1.constData() + 1, 1536);
+        mSocket->write(reply);
+        mIsHandshakeDone = true;
+    }
+    while (mSocket->bytesAvailable() > 0) {
+        qint64 length = mSocket->read(mReadBuffer.data(), mReadBuffer.size());
+        if (length <= 0)
+            break;
+        int offset = 0;
+        if (mHandshakeBytesLeft > 0) {
+            offset = qMin((qint64) mHandshakeBytesLeft, length);
+            mHandshakeBytesLeft -= offset;
+        }
+        mStats.bytesReceived += length - offset;
+        mChunkReader.append(mReadBuffer.constData() + offset, length - offset);
+        RTMPMessage message;
+        while (mChunkReader.readMessage(message))
+            handleMessage(message);
+        if (mChunkReader.hasError()) {
+            qWarning()<<"LoopbackSink broken chunk stream";
+            mSocket->close();
+            return;
+        }
+    }
+}
+
+void LoopbackSink::handleMessage(const RTMPMessage& message)
+{
+    switch (message.type) {
+        case RTMP_MSG_SET_CHUNK_SIZE:
+            if (message.payload.size() >= 4)
+                mChunkReader.setChunkSize((int) (((quint32) (uchar) message.payload.at(0) << 24) |
+                        ((uchar) message.payload.at(1) << 16) | ((uchar) message.payload.at(2) << 8) |
+                        (uchar) message.payload.at(3)));
+            break;
+        case RTMP_MSG_COMMAND_AMF0:
+            handleCommand(message);
+            break;
+        case RTMP_MSG_AUDIO:
+            if (message.payload.size() > 1 && message.payload.at(1) == FLV_AAC_RAW) {
+                checkTimestamp(mLastAudioTimestamp, message.timestamp);
+                mStats.audioFrames++;
+                mStats.lastFrameUsec = BenchClock::nowUsec();
+            }
+            break;
+        case RTMP_MSG_VIDEO:
+            handleVideo(message);
+            break;
+        default:
+            break;
+    }
+}
+
+void LoopbackSink::handleVideo(const RTMPMessage& message)
+{
+    //FLV video header (5), NAL length (4), NAL header (1), frame index (4)
+    const QByteArray& body = message.payload;
+    if (body.size() < FLV_VIDEO_HEADER_SIZE + 4 + 5 || body.at(1) != FLV_AVC_NALU)
+        return;
+    if (!mHasConnectionVideo) {
+        //Frame type 1 in upper nibble, first picture after (re)connecting must be decodable on its own
+        if (((uchar) body.at(0) >> 4) != 1)
+            mStats.nonKeyFrameStarts++;
+        mHasConnectionVideo = true;
+    }
+    checkTimestamp(mLastVideoTimestamp, message.timestamp);
+    qint64 now = BenchClock::nowUsec();
+    if (mStats.firstFrameUsec < 0)
+        mStats.firstFrameUsec = now;
+    mStats.lastFrameUsec = now;
+    mStats.videoFrames++;
+    if (mEnqueueTimes == NULL) {
+        if (mArrivals.size() < mArrivals.capacity()) {
+            LoopbackArrival arrival;
+            arrival.usec = now;
+            arrival.timestamp = message.timestamp;
+            arrival.bytesReceived = mStats.bytesReceived;
+            mArrivals.append(arrival);
+        }
+        return;
+    }
+    const uchar* index = reinterpret_cast<const uchar*>(body.constData()) + FLV_VIDEO_HEADER_SIZE + 4 + 1;
+    int frame = (index[0] << 24) | (index[1] << 16) | (index[2] << 8) | index[3];
+    if (frame >= 0 && frame < mFrameCount && mLatencies.size() < mLatencies.capacity())
+        mLatencies.append(now - mEnqueueTimes[frame]);
+}
+
+void LoopbackSink::handleCommand(const RTMPMessage& message)
+{
+    QVariantList values;
+    if (!AMF0::decode(message.payload, values) || values.isEmpty())
+        return;
+    QString name = values.at(0).toString();
+    double transactionId = values.value(1).toDouble();
+    QByteArray body;
+    if (name == "connect") {
+        AMF0::encodeString(body, "_result");
+        AMF0::encodeNumber(body, transactionId);
+        AMF0::encodeNull(body);
+        AMF0::encodeObjectStart(body);
+        AMF0::encodePropertyName(body, "level");
+        AMF0::encodeString(body, "status");
+        AMF0::encodePropertyName(body, "code");
+        AMF0::encodeString(body, "NetConnection.Connect.Success");
+        AMF0::encodeObjectEnd(body);
+        sendCommand(0, body);
+    } else if (name == "createStream") {
+        AMF0::encodeString(body, "_result");
+        AMF0::encodeNumber(body, transactionId);
+        AMF0::encodeNull(body);
+        AMF0::encodeNumber(body, LOOPBACKSINK_STREAM_ID);
+        sendCommand(0, body);
+    } else if (name == "publish") {
+        AMF0::encodeString(body, "onStatus");
+        AMF0::encodeNumber(body, 0);
+        AMF0::encodeNull(body);
+        AMF0::encodeObjectStart(body);
+        AMF0::encodePropertyName(body, "level");
+        AMF0::encodeString(body, "status");
+        AMF0::encodePropertyName(body, "code");
+        AMF0::encodeString(body, "NetStream.Publish.Start");
+        AMF0::encodePropertyName(body, "description");
+        AMF0::encodeString(body, "Loopback sink");
+        AMF0::encodeObjectEnd(body);
+        sendCommand(LOOPBACKSINK_STREAM_ID, body);
+    }
+}
+
+void LoopbackSink::sendCommand(quint32 streamId, const QByteArray& body)
+{
+    mWriter.clear();
+    mChunkWriter.writeMessage(mWriter, RTMP_CSID_COMMAND, RTMP_MSG_COMMAND_AMF0, streamId, 0, NULL, 0,
+            body.constData(), body.size());
+    mWriter.submit();
+}
+
+void LoopbackSink::checkTimestamp(qint64& lastTimestamp, quint32 timestamp)
+{
+    if ((qint64) timestamp < lastTimestamp)
+        mStats.timestampRegressions++;
+    lastTimestamp = timestamp;
+}
+
+void LoopbackSink::on_mSocket_disconnected()
+{
+    if (!mIsReconnectable) {
+        finish();
+        return;
+    }
+    resetConnection();
+}
+
+void LoopbackSink::resetConnection()
+{
+    //Next publisher connection starts from the handshake, chunk streams and all
+    mSocket->disconnect(this);
+    mSocket->deleteLater();
+    mSocket = NULL;
+    mWriter.setSocket(NULL);
+    mChunkReader.reset();
+    mChunkWriter.reset();
+    mHandshakeBytesLeft = 1536;
+    mIsHandshakeDone = false;
+    mHasConnectionVideo = false;
+}
+
+void LoopbackSink::stop()
+{
+    //Whatever the link delivered before it went away still counts
+    if (mSocket != NULL && mSocket->state() == QAbstractSocket::ConnectedState)
+        on_mSocket_readyRead();
+    finish();
+}
+
+void LoopbackSink::finish()
+{
+    if (mIsFinished)
+        return;
+    mIsFinished = true;
+    mStats.allocations = AllocCounter::thisThread() - mStartAllocations;
+    qint64 cpu = BenchClock::threadCpuUsec();
+    mStats.cpuUsec = (cpu < 0 || mStartCpuUsec < 0) ? -1 : cpu - mStartCpuUsec;
+    emit finished();
+}
@@ -0,0 +1,119 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LOOPBACKSINK_H_
+#define LOOPBACKSINK_H_
+
+#include <QObject>
+#include <QVector>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include "rtmpchunkreader.h"
+#include "rtmpchunkwriter.h"
+#include "socketwriter.h"
+
+#define LOOPBACKSINK_STREAM_ID 1
+#define LOOPBACKSINK_READ_SIZE (256*1024)
+
+struct LoopbackSinkStats {
+    qint64 bytesReceived;
+    qint64 audioFrames;
+    qint64 videoFrames;         //Without sequence headers
+    qint64 firstFrameUsec;      //BenchClock times of first and last media message
+    qint64 lastFrameUsec;
+    qint64 cpuUsec;             //Sink thread only, -1 if unknown
+    qint64 allocations;         //Sink thread only
+    int connections;
+    int nonKeyFrameStarts;      //Connections whose first video frame wasn't an IDR
+    int timestampRegressions;   //Audio or video messages older than the one before on their track
+};
+
+struct LoopbackArrival {
+    qint64 usec;                //BenchClock time the video message was complete
+    quint32 timestamp;          //RTMP timestamp, msec
+    qint64 bytesReceived;       //Running total at that point
+};
+
+/*
+ * Just enough of an RTMP server on 127.0.0.1 to take one publisher: handshake, _result for connect and
+ * createStream, NetStream.Publish.Start for publish. Media messages are only counted.
+ * Video payload of benchmark frames starts with the frame index, see BenchFeeder, the sink looks up
+ * when that frame was queued and keeps enqueue-to-arrival latency per frame.
+ * Without enqueue times (any other source) it logs arrival time and timestamp of each video message instead.
+ * Lives on its own thread so the publisher's measurements don't include it.
+ * A reconnectable sink takes a new publisher connection after the last one dropped, and checks each starts
+ * its video on an IDR and timestamps keep growing across them. It then finishes on stop() only.
+ */
+class LoopbackSink : public QObject
+{
+    Q_OBJECT
+public:
+    //enqueueTimes is written by the feeder, one slot per video frame, and must outlive the sink.
+    //NULL logs arrivals, frameCount is then how many are kept.
+    LoopbackSink(const qint64* enqueueTimes, int frameCount, QObject* parent = 0);
+
+    //Valid after finished()
+    LoopbackSinkStats stats() { return mStats; }
+    const QVector<qint64>& latencies() { return mLatencies; }
+    const QVector<LoopbackArrival>& arrivals() { return mArrivals; }
+    //Set before start()
+    void setReconnectable(bool isReconnectable) { mIsReconnectable = isReconnectable; }
+
+signals:
+    void listening(int port);
+    void finished();
+
+public slots:
+    void start();
+    void stop();
+
+private slots:
+    void on_mServer_newConnection();
+    void on_mSocket_readyRead();
+    void on_mSocket_disconnected();
+
+private:
+    void resetConnection();
+    void checkTimestamp(qint64& lastTimestamp, quint32 timestamp);
+    void handleMessage(const RTMPMessage& message);
+    void handleCommand(const RTMPMessage& message);
+    void handleVideo(const RTMPMessage& message);
+    void sendCommand(quint32 streamId, const QByteArray& body);
+    void finish();
+
+    QTcpServer* mServer;
+    QTcpSocket* mSocket;
+    SocketWriter mWriter;
+    RTMPChunkReader mChunkReader;
+    RTMPChunkWriter mChunkWriter;
+    QByteArray mReadBuffer;
+    int mHandshakeBytesLeft;        //C2 still to skip
+    bool mIsHandshakeDone;
+    bool mIsReconnectable;
+    bool mHasConnectionVideo;       //A video frame came on this connection
+    qint64 mLastAudioTimestamp;     //-1 till first message
+    qint64 mLastVideoTimestamp;
+    const qint64* mEnqueueTimes;
+    int mFrameCount;
+    QVector<qint64> mLatencies;
+    QVector<LoopbackArrival> mArrivals;
+    LoopbackSinkStats mStats;
+    qint64 mStartAllocations;
+    qint64 mStartCpuUsec;
+    bool mIsFinished;
+};
+
+#endif /* LOOPBACKSINK_H_ */
@@ -0,0 +1,444 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <stdio.h>
+#include "clirunner.h"
+#include "benchrunner.h"
+#include "scenariorunner.h"
+#include "nalbench.h"
+#include "queuebench.h"
+#include "interleavecheck.h"
+#include "chunkreadercheck.h"
+
+static void printUsage()
+{
+    fprintf(stderr,
+            "Usage: streamcam-cli [options] rtmp://host[:port]/app/stream\n"
+            "       streamcam-cli --bench [options]\n"
+            "       streamcam-cli --scenario [options]\n"
+            "       streamcam-cli --nal-bench [options]\n"
+            "       streamcam-cli --interleave-check\n"
+            "       streamcam-cli --queue-bench [--seconds N]\n"
+            "       streamcam-cli --chunk-reader-check\n"
+            "Streams recorded or generated frames through Controller and RTMPPublisher.\n"
+            "\n"
+            "  --video FILE        Annex-B H.264 elementary stream\n"
+            "  --audio FILE        ADTS AAC stream\n"
+            "  --fps N             Video frame rate, files and synthetic (30)\n"
+            "  --loop N            Play files N times, 0 forever (1)\n"
+            "  --video-kbps N      Synthetic video bitrate (2000)\n"
+            "  --audio-kbps N      Synthetic audio bitrate, 0 for none (128)\n"
+            "  --gop N             Synthetic frames per GOP (60)\n"
+            "  --duration SECS     Synthetic stream length, 0 till Ctrl-C (0)\n"
+            "  --fast              Don't pace frames in real time\n"
+            "  --latency-trace FILE  Write per frame latencies as Chrome trace events\n"
+            "  --event-stats       Report main thread event loop load\n"
+            "\n"
+            "Without --video and --audio a synthetic stream is sent.\n"
+            "\n"
+            "  --bench             Publish synthetic frames to a loopback RTMP sink as fast as\n"
+            "                      possible and print a JSON report line\n"
+            "  --preset NAME       720p30, 1080p30, 1080p60, 2160p30 or 2160p60 (720p30)\n"
+            "  --size WxH          Bench frame size, after --preset\n"
+            "  --frames N          Bench video frames (1800)\n"
+            "  --queue N           Bench publisher queue limit in video frames (4)\n"
+            "\n"
+            "  --scenario          Stream a synthetic real time stream through a simulated link to\n"
+            "                      a loopback RTMP sink, print one JSON line per interval\n"
+            "  --link-kbps N       Link bandwidth, 0 for a stall (no limit)\n"
+            "  --rtt MSEC          Link round trip time (0)\n"
+            "  --jitter MSEC       Extra random one way delay, up to (0)\n"
+            "  --trace FILE        Link steps, lines of \"<secs> <kbps> [rtt [jitter]]\"\n"
+            "                      or \"<secs> reset\" to drop the connection\n"
+            "  --reset-every SECS  Drop the connection this often, publisher has to reconnect\n"
+            "  --reset-random MIN MAX\n"
+            "                      Drop the connection after MIN to MAX msec each time, drawn from\n"
+            "                      --seed, so resets land anywhere in a GOP\n"
+            "  --seed N            Jitter and reset seed (1)\n"
+            "  --sample MSEC       Reporting interval (500)\n"
+            "  --duration SECS     Scenario length (60)\n"
+            "  --abr-check         Congest the link to half the video bitrate from 15 to 35 secs,\n"
+            "                      fail unless the encoder stepped under it and recovered (100 secs)\n"
+            "\n"
+            "  --nal-bench         Split a synthetic 4K IDR access unit with the vectorized and the\n"
+            "                      scalar start code scan, print a JSON report line\n"
+            "  --bytes N           Access unit size (3145728)\n"
+            "  --slices N          Slices per picture (8)\n"
+            "  --iterations N      Times the access unit is split (200)\n"
+            "\n"
+            "  --interleave-check  Run the A/V interleaver against simulated arrival patterns,\n"
+            "                      print a JSON line per pattern, exit 1 if any fails\n"
+            "\n"
+            "  --queue-bench       Post paced 30 and 60 fps video and AAC audio into the old locked\n"
+            "                      queue and into the frame rings, print enqueue latency percentiles\n"
+            "  --seconds N         Run length of each queue and frame rate (10)\n"
+            "\n"
+            "  --chunk-reader-check  Feed well formed and broken chunk streams into the RTMP chunk reader,\n"
+            "                      print a JSON line per case, exit 1 if any fails\n");
+}
+
+struct BenchPreset {
+    const char* name;
+    int width;
+    int height;
+    int fps;
+    int videoKbps;
+};
+
+static const BenchPreset BENCH_PRESETS[] = {
+    {"720p30", 1280, 720, 30, 4000},
+    {"1080p30", 1920, 1080, 30, 6000},
+    {"1080p60", 1920, 1080, 60, 9000},
+    {"2160p30", 3840, 2160, 30, 25000},
+    {"2160p60", 3840, 2160, 60, 40000}
+};
+
+static bool applyPreset(const QString& name, BenchOptions& options)
+{
+    for(unsigned int i=0;i<sizeof(BENCH_PRESETS)/sizeof(BENCH_PRESETS[0]);i++) {
+        if(name==BENCH_PRESETS[i].name) {
+            options.width = BENCH_PRESETS[i].width;
+            options.height = BENCH_PRESETS[i].height;
+            options.fps = BENCH_PRESETS[i].fps;
+            options.videoKbps = BENCH_PRESETS[i].videoKbps;
+            options.gopFrames = 2*options.fps;
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown preset %s\n", qPrintable(name));
+    return false;
+}
+
+static bool parseBenchOptions(const QStringList& args, BenchOptions& options)
+{
+    applyPreset("720p30", options);
+    options.audioKbps = 128;
+    options.frameCount = 1800;
+    options.queueFrames = 4;
+    for(int i=1;i<args.size();i++) {
+        QString arg = args.at(i);
+        bool isNumber = true;
+        if(arg=="--bench")
+            continue;
+        if(i+1>=args.size()) {
+            fprintf(stderr, "%s needs a value\n", qPrintable(arg));
+            return false;
+        }
+        QString value = args.at(++i);
+        if(arg=="--preset") {
+            if(!applyPreset(value, options))
+                return false;
+        } else if(arg=="--size") {
+            QStringList size = value.split("x");
+            bool isHeight = size.size()==2;
+            options.width = size.at(0).toInt(&isNumber);
+            if(isHeight)
+                options.height = size.at(1).toInt(&isHeight);
+            isNumber = isNumber && isHeight;
+        } else if(arg=="--fps") {
+            options.fps = value.toInt(&isNumber);
+        } else if(arg=="--video-kbps") {
+            options.videoKbps = value.toInt(&isNumber);
+        } else if(arg=="--audio-kbps") {
+            options.audioKbps = value.toInt(&isNumber);
+        } else if(arg=="--gop") {
+            options.gopFrames = value.toInt(&isNumber);
+        } else if(arg=="--frames") {
+            options.frameCount = value.toInt(&isNumber);
+        } else if(arg=="--queue") {
+            options.queueFrames = value.toInt(&isNumber);
+        } else {
+            fprintf(stderr, "Unknown bench option %s\n", qPrintable(arg));
+            return false;
+        }
+        if(!isNumber) {
+            fprintf(stderr, "%s needs a number\n", qPrintable(arg));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parseOptions(const QStringList& args, CliOptions& options)
+{
+    options.fps = 30;
+    options.loops = 1;
+    options.videoKbps = 2000;
+    options.audioKbps = 128;
+    options.gopFrames = 60;
+    options.durationMsec = 0;
+    options.isRealtime = true;
+    options.isEventStats = false;
+    for(int i=1;i<args.size();i++) {
+        QString arg = args.at(i);
+        bool hasValue = i+1<args.size();
+        bool isNumber = true;
+        if(arg=="--fast") {
+            options.isRealtime = false;
+        } else if(arg=="--event-stats") {
+            options.isEventStats = true;
+        } else if(arg=="--help" || arg=="-h") {
+            return false;
+        } else if(!arg.startsWith("--")) {
+            options.serverUrl = arg;
+        } else if(!hasValue) {
+            fprintf(stderr, "%s needs a value\n", qPrintable(arg));
+            return false;
+        } else if(arg=="--video") {
+            options.videoPath = args.at(++i);
+        } else if(arg=="--audio") {
+            options.audioPath = args.at(++i);
+        } else if(arg=="--latency-trace") {
+            options.latencyTracePath = args.at(++i);
+        } else if(arg=="--fps") {
+            options.fps = args.at(++i).toInt(&isNumber);
+        } else if(arg=="--loop") {
+            options.loops = args.at(++i).toInt(&isNumber);
+        } else if(arg=="--video-kbps") {
+            options.videoKbps = args.at(++i).toInt(&isNumber);
+        } else if(arg=="--audio-kbps") {
+            options.audioKbps = args.at(++i).toInt(&isNumber);
+        } else if(arg=="--gop") {
+            options.gopFrames = args.at(++i).toInt(&isNumber);
+        } else if(arg=="--duration") {
+            options.durationMsec = args.at(++i).toInt(&isNumber)*1000;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", qPrintable(arg));
+            return false;
+        }
+        if(!isNumber) {
+            fprintf(stderr, "%s needs a number\n", qPrintable(arg));
+            return false;
+        }
+    }
+    return !options.serverUrl.isEmpty();
+}
+
+static bool parseScenarioOptions(const QStringList& args, ScenarioOptions& options)
+{
+    options.fps = 30;
+    options.videoKbps = 2000;
+    options.audioKbps = 128;
+    options.gopFrames = 60;
+    options.durationMsec = 60000;
+    options.sampleMsec = 500;
+    options.seed = 1;
+    options.isAbrCheck = false;
+    bool hasDuration = false;
+    ImpairmentStep fixed = {0, IMPAIREDLINK_UNLIMITED, 0, 0, false};
+    QString tracePath;
+    int resetMinMsec = 0;
+    int resetMaxMsec = 0;
+    for(int i=1;i<args.size();i++) {
+        QString arg = args.at(i);
+        bool isNumber = true;
+        if(arg=="--scenario")
+            continue;
+        if(arg=="--abr-check") {
+            options.isAbrCheck = true;
+            continue;
+        }
+        if(i+1>=args.size()) {
+            fprintf(stderr, "%s needs a value\n", qPrintable(arg));
+            return false;
+        }
+        QString value = args.at(++i);
+        if(arg=="--trace") {
+            tracePath = value;
+        } else if(arg=="--link-kbps") {
+            fixed.kbps = value.toInt(&isNumber);
+        } else if(arg=="--rtt") {
+            fixed.rttMsec = value.toInt(&isNumber);
+        } else if(arg=="--jitter") {
+            fixed.jitterMsec = value.toInt(&isNumber);
+        } else if(arg=="--reset-every") {
+            resetMinMsec = resetMaxMsec = value.toInt(&isNumber)*1000;
+        } else if(arg=="--reset-random") {
+            if(i+1>=args.size()) {
+                fprintf(stderr, "%s needs two values\n", qPrintable(arg));
+                return false;
+            }
+            resetMinMsec = value.toInt(&isNumber);
+            if(isNumber)
+                resetMaxMsec = args.at(++i).toInt(&isNumber);
+        } else if(arg=="--seed") {
+            options.seed = value.toUInt(&isNumber);
+        } else if(arg=="--sample") {
+            options.sampleMsec = value.toInt(&isNumber);
+        } else if(arg=="--duration") {
+            options.durationMsec = value.toInt(&isNumber)*1000;
+            hasDuration = true;
+        } else if(arg=="--fps") {
+            options.fps = value.toInt(&isNumber);
+        } else if(arg=="--video-kbps") {
+            options.videoKbps = value.toInt(&isNumber);
+        } else if(arg=="--audio-kbps") {
+            options.audioKbps = value.toInt(&isNumber);
+        } else if(arg=="--gop") {
+            options.gopFrames = value.toInt(&isNumber);
+        } else {
+            fprintf(stderr, "Unknown scenario option %s\n", qPrintable(arg));
+            return false;
+        }
+        if(!isNumber) {
+            fprintf(stderr, "%s needs a number\n", qPrintable(arg));
+            return false;
+        }
+    }
+    if(options.isAbrCheck) {
+        if(!tracePath.isEmpty()) {
+            fprintf(stderr, "--abr-check makes its own link, no --trace\n");
+            return false;
+        }
+        options.steps = ScenarioRunner::abrCheckSteps(fixed, options.videoKbps);
+        if(!hasDuration)
+            options.durationMsec = SCENARIO_ABR_DURATION_MSEC;
+    } else if(!tracePath.isEmpty()) {
+        if(!ImpairedLink::loadTrace(tracePath, options.steps))
+            return false;
+    } else
+        options.steps.append(fixed);
+    if(resetMaxMsec<resetMinMsec) {
+        fprintf(stderr, "--reset-random MAX is below MIN\n");
+        return false;
+    }
+    ImpairedLink::addResets(options.steps, resetMinMsec, resetMaxMsec, options.durationMsec, options.seed);
+    return true;
+}
+
+static bool parseNalBenchOptions(const QStringList& args, NalBenchOptions& options)
+{
+    options.frameBytes = 3*1024*1024;
+    options.slices = 8;
+    options.iterations = 200;
+    for(int i=1;i<args.size();i++) {
+        QString arg = args.at(i);
+        bool isNumber = true;
+        if(arg=="--nal-bench")
+            continue;
+        if(i+1>=args.size()) {
+            fprintf(stderr, "%s needs a value\n", qPrintable(arg));
+            return false;
+        }
+        QString value = args.at(++i);
+        if(arg=="--bytes") {
+            options.frameBytes = value.toInt(&isNumber);
+        } else if(arg=="--slices") {
+            options.slices = value.toInt(&isNumber);
+        } else if(arg=="--iterations") {
+            options.iterations = value.toInt(&isNumber);
+        } else {
+            fprintf(stderr, "Unknown NAL bench option %s\n", qPrintable(arg));
+            return false;
+        }
+        if(!isNumber || value.toInt()<1) {
+            fprintf(stderr, "%s needs a positive number\n", qPrintable(arg));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parseQueueBenchOptions(const QStringList& args, QueueBenchOptions& options)
+{
+    options.seconds = 10;
+    for(int i=1;i<args.size();i++) {
+        QString arg = args.at(i);
+        bool isNumber = true;
+        if(arg=="--queue-bench")
+            continue;
+        if(i+1>=args.size()) {
+            fprintf(stderr, "%s needs a value\n", qPrintable(arg));
+            return false;
+        }
+        QString value = args.at(++i);
+        if(arg=="--seconds") {
+            options.seconds = value.toInt(&isNumber);
+        } else {
+            fprintf(stderr, "Unknown queue bench option %s\n", qPrintable(arg));
+            return false;
+        }
+        if(!isNumber || value.toInt()<1) {
+            fprintf(stderr, "%s needs a positive number\n", qPrintable(arg));
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    if(app.arguments().contains("--bench")) {
+        BenchOptions benchOptions;
+        if(!parseBenchOptions(app.arguments(), benchOptions)) {
+            printUsage();
+            return 2;
+        }
+        BenchRunner bench(benchOptions);
+        if(!bench.start())
+            return 1;
+        return app.exec();
+    }
+    if(app.arguments().contains("--nal-bench")) {
+        NalBenchOptions nalBenchOptions;
+        if(!parseNalBenchOptions(app.arguments(), nalBenchOptions)) {
+            printUsage();
+            return 2;
+        }
+        NalBench nalBench(nalBenchOptions);
+        return nalBench.run() ? 0 : 1;
+    }
+    if(app.arguments().contains("--queue-bench")) {
+        QueueBenchOptions queueBenchOptions;
+        if(!parseQueueBenchOptions(app.arguments(), queueBenchOptions)) {
+            printUsage();
+            return 2;
+        }
+        QueueBench queueBench(queueBenchOptions);
+        return queueBench.run() ? 0 : 1;
+    }
+    if(app.arguments().contains("--chunk-reader-check")) {
+        ChunkReaderCheck chunkReaderCheck;
+        return chunkReaderCheck.run() ? 0 : 1;
+    }
+    if(app.arguments().contains("--interleave-check")) {
+        InterleaveCheck interleaveCheck;
+        return interleaveCheck.run() ? 0 : 1;
+    }
+    if(app.arguments().contains("--scenario")) {
+        ScenarioOptions scenarioOptions;
+        if(!parseScenarioOptions(app.arguments(), scenarioOptions)) {
+            printUsage();
+            return 2;
+        }
+        ScenarioRunner scenario(scenarioOptions);
+        if(!scenario.start())
+            return 1;
+        return app.exec();
+    }
+    CliOptions options;
+    if(!parseOptions(app.arguments(), options)) {
+        printUsage();
+        return 2;
+    }
+    CliRunner runner(options);
+    if(!runner.start())
+        return 1;
+    return app.exec();
+}
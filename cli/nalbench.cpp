@@ -0,0 +1,129 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "nalbench.h"
+#include "benchclock.h"
+#include "syntheticsource.h"
+#include <stdio.h>
+
+static const char START_CODE[] = {0, 0, 0, 1};
+static const char AUD[] = {0x09, (char) 0xF0};
+static const char PPS[] = {0x68, (char) 0xCE, 0x3C, (char) 0x80};
+static const char SEI[] = {0x06, 0x05, 0x01, 0x00, (char) 0x80};     //Empty user data unregistered
+
+NalBench::NalBench(const NalBenchOptions& options)
+    :mOptions(options), mNALCount(0) {}
+
+void NalBench::appendPayload(int size, quint32& seed)
+{
+    /*
+     * Noise has a zero byte every 256 on average like entropy coded data, 00 00 0x with x <= 3 gets the
+     * emulation prevention byte an encoder would put there so start codes only show up between NALs.
+     */
+    int zeros = 0;
+    for (int i = 0; i < size; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uchar byte = seed >> 24;
+        if (zeros >= 2 && byte <= 3) {
+            mAccessUnit.append((char) 3);
+            zeros = 0;
+        }
+        mAccessUnit.append((char) byte);
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+    mAccessUnit.append((char) 0x80);   //rbsp_stop_one_bit, slice data never ends on a zero byte
+}
+
+void NalBench::buildAccessUnit()
+{
+    QByteArray sps = SyntheticSource::buildSPS(NALBENCH_WIDTH, NALBENCH_HEIGHT, 30);
+    mAccessUnit.reserve(mOptions.frameBytes + mOptions.frameBytes/64 + 1024);
+    mAccessUnit.append(START_CODE, 4);
+    mAccessUnit.append(AUD, sizeof(AUD));
+    mAccessUnit.append(START_CODE, 4);
+    mAccessUnit.append(sps);
+    mAccessUnit.append(START_CODE, 4);
+    mAccessUnit.append(PPS, sizeof(PPS));
+    mAccessUnit.append(START_CODE, 4);
+    mAccessUnit.append(SEI, sizeof(SEI));
+    quint32 seed = 1;
+    int sliceBytes = mOptions.frameBytes / mOptions.slices;
+    for (int i = 0; i < mOptions.slices; i++) {
+        //Slices after the first get the 3 byte start code, like most encoders do
+        mAccessUnit.append(START_CODE + (i == 0 ? 0 : 1), i == 0 ? 4 : 3);
+        mAccessUnit.append((char) 0x65);
+        appendPayload(sliceBytes, seed);
+    }
+    mNALCount = 4 + mOptions.slices;
+}
+
+int NalBench::walk(bool vectorized, QVector<int>* positions)
+{
+    const char* data = mAccessUnit.constData();
+    int size = mAccessUnit.size();
+    int codeLength = 0;
+    int count = 0;
+    int position = 0;
+    while (true) {
+        position = vectorized ? H264::findStartCode(data, size, position, codeLength)
+                : H264::findStartCodeScalar(data, size, position, codeLength);
+        if (position < 0)
+            break;
+        if (positions != NULL)
+            positions->append(position);
+        count++;
+        position += codeLength;
+    }
+    return count;
+}
+
+bool NalBench::run()
+{
+    buildAccessUnit();
+    QVector<int> vectorPositions;
+    QVector<int> scalarPositions;
+    walk(true, &vectorPositions);
+    walk(false, &scalarPositions);
+    QVector<H264NALUnit> units(mNALCount + 1);
+    int unitCount = H264::splitAnnexB(mAccessUnit.constData(), mAccessUnit.size(), units.data(), units.size());
+    bool isMatching = vectorPositions == scalarPositions && vectorPositions.size() == mNALCount && unitCount == mNALCount;
+
+    qint64 found = 0;
+    qint64 start = BenchClock::nowUsec();
+    for (int i = 0; i < mOptions.iterations; i++)
+        found += walk(true, NULL);
+    qint64 vectorUsec = BenchClock::nowUsec() - start;
+    start = BenchClock::nowUsec();
+    for (int i = 0; i < mOptions.iterations; i++)
+        found += walk(false, NULL);
+    qint64 scalarUsec = BenchClock::nowUsec() - start;
+    start = BenchClock::nowUsec();
+    for (int i = 0; i < mOptions.iterations; i++)
+        found += H264::splitAnnexB(mAccessUnit.constData(), mAccessUnit.size(), units.data(), units.size());
+    qint64 splitUsec = BenchClock::nowUsec() - start;
+
+    //found keeps the loops from being optimized out
+    double megabytes = (double) mAccessUnit.size() * mOptions.iterations / (1024*1024);
+    printf("{\"mode\":\"nalBench\",\"frameBytes\":%d,\"nals\":%d,\"iterations\":%d,\"matching\":%s,"
+            "\"vectorMBPerSec\":%.1f,\"scalarMBPerSec\":%.1f,\"splitMBPerSec\":%.1f,\"found\":%lld}\n",
+            mAccessUnit.size(), mNALCount, mOptions.iterations, isMatching ? "true" : "false",
+            vectorUsec > 0 ? megabytes*1000000/vectorUsec : 0, scalarUsec > 0 ? megabytes*1000000/scalarUsec : 0,
+            splitUsec > 0 ? megabytes*1000000/splitUsec : 0, found);
+    fflush(stdout);
+    return isMatching;
+}
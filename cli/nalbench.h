@@ -0,0 +1,56 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NALBENCH_H_
+#define NALBENCH_H_
+
+#include <QByteArray>
+#include <QVector>
+#include "h264.h"
+
+#define NALBENCH_WIDTH 3840
+#define NALBENCH_HEIGHT 2160
+
+struct NalBenchOptions {
+    int frameBytes;         //Synthetic IDR access unit size
+    int slices;             //Slices the picture is cut into
+    int iterations;
+};
+
+/*
+ * Splits one synthetic 4K IDR access unit (AUD, SPS, PPS, SEI and the slices, payload is emulation
+ * prevented noise) over and over, once walking the start codes with the vectorized scan, once with the
+ * scalar one and once through H264::splitAnnexB, and prints a JSON report line with MB/s of each.
+ */
+class NalBench
+{
+public:
+    explicit NalBench(const NalBenchOptions& options);
+
+    //False if the scans don't find the same NAL layout
+    bool run();
+
+private:
+    void buildAccessUnit();
+    void appendPayload(int size, quint32& seed);
+    int walk(bool vectorized, QVector<int>* positions);
+
+    NalBenchOptions mOptions;
+    QByteArray mAccessUnit;
+    int mNALCount;
+};
+
+#endif /* NALBENCH_H_ */
@@ -0,0 +1,219 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "queuebench.h"
+#include "benchclock.h"
+#include <QThread>
+#include <QtAlgorithms>
+#include <string.h>
+#include <stdio.h>
+
+BenchQueue::BenchQueue()
+    :mFramesSent(0)
+{
+    //Largest frame, so copying never allocates
+    mScratch.resize(QUEUEBENCH_VIDEO_KBPS*1000/8);
+}
+
+void BenchQueue::send(const MediaFrame& frame)
+{
+    memcpy(mScratch.data(), frame.buffer.constData(), qMin(frame.buffer.size(), mScratch.size()));
+    mFramesSent++;
+}
+
+LockedBenchQueue::LockedBenchQueue()
+    :mIsStopped(false) {}
+
+void LockedBenchQueue::post(const MediaFrame& frame)
+{
+    //Old RTMPPublisher::postFrame(), node allocated and consumer woken under the lock
+    QMutexLocker locker(&mLock);
+    QLinkedList<MediaFrame>& queue = frame.type == MediaFrame::AUDIO ? mAudioQueue : mVideoQueue;
+    int limit = frame.type == MediaFrame::AUDIO ? 2*QUEUEBENCH_QUEUE_SIZE : QUEUEBENCH_QUEUE_SIZE;
+    if (queue.size() >= limit) {
+        mFramesDropped.ref();
+        return;
+    }
+    queue.append(frame);
+    mCondition.wakeAll();
+}
+
+void LockedBenchQueue::start()
+{
+    //Old publisher loop, earliest of the two heads goes next, lock is let go while sending
+    mLock.lock();
+    while (true) {
+        while (!mIsStopped && mAudioQueue.isEmpty() && mVideoQueue.isEmpty())
+            mCondition.wait(&mLock);
+        if (mAudioQueue.isEmpty() && mVideoQueue.isEmpty())
+            break;
+        bool isAudio = mVideoQueue.isEmpty() ||
+                (!mAudioQueue.isEmpty() && mAudioQueue.first().dts <= mVideoQueue.first().dts);
+        MediaFrame frame = isAudio ? mAudioQueue.takeFirst() : mVideoQueue.takeFirst();
+        mLock.unlock();
+        send(frame);
+        mLock.lock();
+    }
+    mLock.unlock();
+    emit finished();
+}
+
+void LockedBenchQueue::stop()
+{
+    QMutexLocker locker(&mLock);
+    mIsStopped = true;
+    mCondition.wakeAll();
+}
+
+RingBenchQueue::RingBenchQueue()
+    :mAudioQueue(2*QUEUEBENCH_QUEUE_SIZE),
+     mVideoQueue(2*QUEUEBENCH_QUEUE_SIZE) {}
+
+void RingBenchQueue::post(const MediaFrame& frame)
+{
+    //RTMPPublisher::postFrame() and schedulePump()
+    FrameRing<MediaFrame>& queue = frame.type == MediaFrame::AUDIO ? mAudioQueue : mVideoQueue;
+    if (!queue.push(frame)) {
+        mFramesDropped.ref();
+        return;
+    }
+    if (mIsPumpScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "pump", Qt::QueuedConnection);
+}
+
+void RingBenchQueue::start() {}
+
+void RingBenchQueue::pump()
+{
+    mIsPumpScheduled.fetchAndStoreOrdered(0);
+    while (true) {
+        MediaFrame* audio = mAudioQueue.peek();
+        MediaFrame* video = mVideoQueue.peek();
+        if (audio == NULL && video == NULL)
+            return;
+        MediaFrame frame;
+        if (video == NULL || (audio != NULL && audio->dts <= video->dts))
+            mAudioQueue.pop(frame);
+        else
+            mVideoQueue.pop(frame);
+        send(frame);
+    }
+}
+
+void RingBenchQueue::stop()
+{
+    QMetaObject::invokeMethod(this, "finish", Qt::QueuedConnection);
+}
+
+void RingBenchQueue::finish()
+{
+    pump();
+    emit finished();
+}
+
+BenchProducer::BenchProducer(BenchQueue* queue, MediaFrame::MediaFrameType type, double fps, int frameBytes,
+        int count)
+    :mQueue(queue),
+     mType(type),
+     mFps(fps),
+     mPayload(frameBytes, (char) 0x5A),
+     mCount(count)
+{
+    mLatencies.reserve(count);
+}
+
+void BenchProducer::start()
+{
+    /*
+     * Frames are due every 1/fps sec from start, a late one goes right away. Payload copy, as the camera
+     * callback does it, is outside the timed part, only post() is measured.
+     */
+    qint64 startUsec = BenchClock::nowUsec();
+    for (int i = 0; i < mCount; i++) {
+        qint64 due = startUsec + (qint64) (i*1000000/mFps);
+        qint64 now;
+        while ((now = BenchClock::nowUsec()) < due) {
+            mLock.lock();
+            mCondition.wait(&mLock, (unsigned long) qMax((qint64) 1, (due - now)/1000));
+            mLock.unlock();
+        }
+        MediaFrame frame;
+        frame.type = mType;
+        frame.dts = frame.pts = (long) ((due - startUsec)/1000);
+        frame.buffer = MediaBuffer::fromData(mPayload.constData(), mPayload.size());
+        qint64 before = BenchClock::nowUsec();
+        mQueue->post(frame);
+        mLatencies.append(BenchClock::nowUsec() - before);
+    }
+    emit finished();
+}
+
+QueueBench::QueueBench(const QueueBenchOptions& options)
+    :mOptions(options) {}
+
+bool QueueBench::run()
+{
+    int rates[] = {30, 60};
+    for (int i = 0; i < 2; i++) {
+        runOne(true, rates[i]);
+        runOne(false, rates[i]);
+    }
+    return true;
+}
+
+void QueueBench::runOne(bool isLocked, int fps)
+{
+    BenchQueue* queue = isLocked ? static_cast<BenchQueue*>(new LockedBenchQueue())
+            : static_cast<BenchQueue*>(new RingBenchQueue());
+    double audioFps = (double) QUEUEBENCH_AUDIO_RATE/1024;
+    BenchProducer video(queue, MediaFrame::VIDEO, fps, QUEUEBENCH_VIDEO_KBPS*1000/8/fps, mOptions.seconds*fps);
+    BenchProducer audio(queue, MediaFrame::AUDIO, audioFps, QUEUEBENCH_AUDIO_KBPS*1000/8*1024/QUEUEBENCH_AUDIO_RATE,
+            (int) (mOptions.seconds*audioFps));
+    QThread queueThread;
+    QThread videoThread;
+    QThread audioThread;
+    QObject::connect(&queueThread,SIGNAL(started()),queue,SLOT(start()));
+    QObject::connect(queue,SIGNAL(finished()),&queueThread,SLOT(quit()));
+    QObject::connect(&videoThread,SIGNAL(started()),&video,SLOT(start()));
+    QObject::connect(&video,SIGNAL(finished()),&videoThread,SLOT(quit()));
+    QObject::connect(&audioThread,SIGNAL(started()),&audio,SLOT(start()));
+    QObject::connect(&audio,SIGNAL(finished()),&audioThread,SLOT(quit()));
+    queue->moveToThread(&queueThread);
+    video.moveToThread(&videoThread);
+    audio.moveToThread(&audioThread);
+    queueThread.start();
+    videoThread.start();
+    audioThread.start();
+    videoThread.wait();
+    audioThread.wait();
+    queue->stop();
+    queueThread.wait();
+
+    QVector<qint64> latencies = video.latencies();
+    latencies += audio.latencies();
+    qSort(latencies.begin(), latencies.end());
+    int count = latencies.size();
+    printf("{\"mode\":\"queueBench\",\"queue\":\"%s\",\"fps\":%d,\"frames\":%d,\"sent\":%lld,\"dropped\":%d,"
+            "\"p50Usec\":%lld,\"p99Usec\":%lld,\"p999Usec\":%lld,\"maxUsec\":%lld}\n",
+            isLocked ? "lockedList" : "ring", fps, count, queue->framesSent(), queue->framesDropped(),
+            count > 0 ? latencies.at(count/2) : -1,
+            count > 0 ? latencies.at(qMin(count-1, count*99/100)) : -1,
+            count > 0 ? latencies.at(qMin(count-1, count*999/1000)) : -1,
+            count > 0 ? latencies.last() : -1);
+    fflush(stdout);
+    delete queue;
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef QUEUEBENCH_H_
+#define QUEUEBENCH_H_
+
+#include <QObject>
+#include <QByteArray>
+#include <QLinkedList>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+#include "framering.h"
+#include "mediaframe.h"
+
+#define QUEUEBENCH_VIDEO_KBPS 4000
+#define QUEUEBENCH_AUDIO_KBPS 128
+#define QUEUEBENCH_AUDIO_RATE 48000
+#define QUEUEBENCH_QUEUE_SIZE 128      //Publisher's MAX_QUEUE_SIZE, audio gets twice that
+
+struct QueueBenchOptions {
+    int seconds;            //Per queue and frame rate
+};
+
+/*
+ * Publisher queue as seen from the encoder callbacks. post() is all a callback pays for, the consumer
+ * thread copies each frame out as a stand-in for the socket write.
+ */
+class BenchQueue : public QObject
+{
+    Q_OBJECT
+public:
+    BenchQueue();
+    virtual ~BenchQueue() {}
+
+    //Producer threads, one per track
+    virtual void post(const MediaFrame& frame) = 0;
+    //Any thread, finished() follows once what is queued is sent
+    virtual void stop() = 0;
+    qint64 framesSent() const { return mFramesSent; }
+    int framesDropped() const { return mFramesDropped.fetchAndAddRelaxed(0); }
+
+public slots:
+    virtual void start() = 0;
+
+signals:
+    void finished();
+
+protected:
+    void send(const MediaFrame& frame);
+
+    QByteArray mScratch;
+    qint64 mFramesSent;
+    mutable QAtomicInt mFramesDropped;
+};
+
+//What RTMPPublisher had before FrameRing, both tracks in QLinkedLists under one mutex, consumer waits on a condition
+class LockedBenchQueue : public BenchQueue
+{
+    Q_OBJECT
+public:
+    LockedBenchQueue();
+    void post(const MediaFrame& frame);
+    void stop();
+
+public slots:
+    void start();
+
+private:
+    QMutex mLock;
+    QWaitCondition mCondition;
+    QLinkedList<MediaFrame> mAudioQueue;
+    QLinkedList<MediaFrame> mVideoQueue;
+    bool mIsStopped;
+};
+
+//What RTMPPublisher does now, a FrameRing per track and pumpFrames() posted to consumer's event loop
+class RingBenchQueue : public BenchQueue
+{
+    Q_OBJECT
+public:
+    RingBenchQueue();
+    void post(const MediaFrame& frame);
+    void stop();
+
+public slots:
+    void start();
+
+private slots:
+    void pump();
+    void finish();
+
+private:
+    FrameRing<MediaFrame> mAudioQueue;
+    FrameRing<MediaFrame> mVideoQueue;
+    QAtomicInt mIsPumpScheduled;
+};
+
+//An encoder callback, one frame every 1/fps sec posted to the queue, post() timed
+class BenchProducer : public QObject
+{
+    Q_OBJECT
+public:
+    BenchProducer(BenchQueue* queue, MediaFrame::MediaFrameType type, double fps, int frameBytes, int count);
+
+    const QVector<qint64>& latencies() const { return mLatencies; }
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private:
+    BenchQueue* mQueue;
+    MediaFrame::MediaFrameType mType;
+    double mFps;
+    QByteArray mPayload;
+    int mCount;
+    QVector<qint64> mLatencies;
+    QMutex mLock;
+    QWaitCondition mCondition;
+};
+
+/*
+ * Enqueue latency of the encoder callbacks, old locked list against the SPSC rings, at 30 and 60 fps.
+ * Video and audio producers run in real time on their own threads against a consumer on a third,
+ * like the camera and the publisher do, and one JSON line per queue and frame rate gives percentiles.
+ */
+class QueueBench
+{
+public:
+    explicit QueueBench(const QueueBenchOptions& options);
+
+    bool run();
+
+private:
+    void runOne(bool isLocked, int fps);
+
+    QueueBenchOptions mOptions;
+};
+
+#endif /* QUEUEBENCH_H_ */
@@ -0,0 +1,300 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scenariorunner.h"
+#include "benchclock.h"
+#include <QCoreApplication>
+#include <QVariant>
+#include <QDebug>
+#include <QtAlgorithms>
+#include <stdio.h>
+
+ScenarioRunner::ScenarioRunner(const ScenarioOptions& options, QObject* parent)
+    :QObject(parent),
+     mOptions(options),
+     mSink(NULL),
+     mSinkThread(NULL),
+     mLink(NULL),
+     mLinkThread(NULL),
+     mController(NULL),
+     mSource(NULL),
+     mSourceThread(NULL),
+     mStartUsec(0),
+     mIsPublisherFinished(false),
+     mIsSinkFinished(false),
+     mExitCode(0)
+{
+    connect(&mSampleTimer,SIGNAL(timeout()),this,SLOT(sample()));
+}
+
+ScenarioRunner::~ScenarioRunner()
+{
+    if(mSourceThread!=NULL) {
+        mSource->safeStop();
+        mSourceThread->wait();
+        delete mSourceThread;
+    }
+    delete mSource;
+    if(mLinkThread!=NULL) {
+        QMetaObject::invokeMethod(mLink, "stop");
+        mLinkThread->quit();
+        mLinkThread->wait();
+        delete mLink;
+        delete mLinkThread;
+    }
+    if(mSinkThread!=NULL) {
+        mSinkThread->quit();
+        mSinkThread->wait();
+        delete mSink;
+        delete mSinkThread;
+    }
+}
+
+QList<ImpairmentStep> ScenarioRunner::abrCheckSteps(const ImpairmentStep& base, int videoKbps)
+{
+    QList<ImpairmentStep> steps;
+    ImpairmentStep step = base;
+    step.atMsec = 0;
+    step.kbps = IMPAIREDLINK_UNLIMITED;
+    steps.append(step);
+    step.atMsec = SCENARIO_ABR_CONGESTED_FROM_MSEC;
+    step.kbps = videoKbps*SCENARIO_ABR_LINK_PERCENT/100;
+    steps.append(step);
+    step.atMsec = SCENARIO_ABR_CONGESTED_UNTIL_MSEC;
+    step.kbps = IMPAIREDLINK_UNLIMITED;
+    steps.append(step);
+    return steps;
+}
+
+bool ScenarioRunner::start()
+{
+    if(mOptions.fps<=0 || mOptions.fps>SCENARIO_MAX_FPS || mOptions.durationMsec<=0 || mOptions.sampleMsec<=0) {
+        qWarning()<<"Bad scenario options";
+        return false;
+    }
+    //Room for every video frame with some slack, the sink must not allocate while frames arrive
+    int frames = (int) ((qint64) mOptions.durationMsec*mOptions.fps/1000) + mOptions.fps;
+    mSink = new LoopbackSink(NULL, frames);
+    mSink->setReconnectable(true);
+    mSinkThread = new QThread();
+    connect(mSinkThread,SIGNAL(started()),mSink,SLOT(start()));
+    connect(mSink,SIGNAL(listening(int)),this,SLOT(on_mSink_listening(int)));
+    connect(mSink,SIGNAL(finished()),this,SLOT(on_mSink_finished()));
+    mSink->moveToThread(mSinkThread);
+    mSinkThread->start();
+    return true;
+}
+
+void ScenarioRunner::on_mSink_listening(int port)
+{
+    mLink = new ImpairedLink(port, mOptions.steps, mOptions.seed);
+    mLinkThread = new QThread();
+    connect(mLinkThread,SIGNAL(started()),mLink,SLOT(start()));
+    connect(mLink,SIGNAL(listening(int)),this,SLOT(on_mLink_listening(int)));
+    connect(mLink,SIGNAL(finished()),mLinkThread,SLOT(quit()));
+    //Sink outlives any number of link resets, it is done once the link is
+    connect(mLink,SIGNAL(finished()),mSink,SLOT(stop()));
+    mLink->moveToThread(mLinkThread);
+    mLinkThread->start();
+}
+
+void ScenarioRunner::on_mLink_listening(int port)
+{
+    mController = new Controller(this);
+    mController->setServer(QString("rtmp://127.0.0.1:%1/scenario/stream").arg(port), false);
+    mSource = new SyntheticSource(mOptions.videoKbps, mOptions.fps, mOptions.gopFrames, mOptions.audioKbps,
+            mOptions.durationMsec);
+    mController->setEncoderControl(mSource);
+    mSource->setController(mController);
+    mSource->setRealtime(true);
+    connect(mController,SIGNAL(publishError(QString)),this,SLOT(on_mController_publishError(QString)));
+    connect(mController,SIGNAL(publisherFinished()),this,SLOT(on_mController_publisherFinished()));
+
+    mSourceThread = new QThread();
+    connect(mSourceThread,SIGNAL(started()),mSource,SLOT(start()));
+    connect(mSource,SIGNAL(finished()),mSourceThread,SLOT(quit()));
+    connect(mSource,SIGNAL(finished()),this,SLOT(on_mSource_finished()));
+    mSource->moveToThread(mSourceThread);
+
+    mStartUsec = BenchClock::nowUsec();
+    mController->startStreaming();
+    mSourceThread->start();
+    mSampleTimer.start(mOptions.sampleMsec);
+}
+
+void ScenarioRunner::sample()
+{
+    Sample sample;
+    sample.usec = BenchClock::nowUsec();
+    sample.linkKbps = mLink->currentKbps();
+    sample.rttMsec = mLink->currentRttMsec();
+    sample.linkQueuedBytes = mLink->queuedBytes();
+    sample.encoderKbps = mSource->encoderBitrate();
+    sample.queuedVideoMsec = 0;
+    sample.bytesPending = 0;
+    sample.droppedFrames = 0;
+    sample.lostReplays = 0;
+    sample.bytesSent = 0;
+    QVariantList destinations = mController->destinationStats();
+    if(!destinations.isEmpty()) {
+        QVariantMap primary = destinations.at(0).toMap();
+        sample.queuedVideoMsec = primary.value("queuedVideoMsec").toInt();
+        sample.bytesPending = primary.value("bytesPending").toInt();
+        sample.droppedFrames = primary.value("droppedFrames").toInt();
+        sample.lostReplays = primary.value("lostReplays").toInt();
+        sample.bytesSent = primary.value("bytesSent").toLongLong();
+    }
+    mSamples.append(sample);
+}
+
+void ScenarioRunner::on_mSource_finished()
+{
+    mController->stopStreaming();
+}
+
+void ScenarioRunner::on_mController_publishError(QString error)
+{
+    qWarning()<<"Publish error:"<<error;
+    mExitCode = 1;
+    mSource->safeStop();
+}
+
+void ScenarioRunner::on_mController_publisherFinished()
+{
+    //stopStreaming() waits for on_mSource_finished(), controller must not be reset under the source
+    if(mController->isStreaming()) {
+        mExitCode = 1;
+        mSource->safeStop();
+    }
+    mSampleTimer.stop();
+    mIsPublisherFinished = true;
+    checkFinished();
+}
+
+void ScenarioRunner::on_mSink_finished()
+{
+    mIsSinkFinished = true;
+    checkFinished();
+}
+
+void ScenarioRunner::checkFinished()
+{
+    if(!mIsPublisherFinished || !mIsSinkFinished)
+        return;
+    mSourceThread->wait();
+    report();
+    QCoreApplication::exit(mExitCode);
+}
+
+void ScenarioRunner::report()
+{
+    const QVector<LoopbackArrival>& arrivals = mSink->arrivals();
+    qint64 baseline = 0;
+    for(int i=0;i<arrivals.size();i++) {
+        qint64 offset = arrivals.at(i).usec - (qint64) arrivals.at(i).timestamp*1000;
+        if(i==0 || offset<baseline)
+            baseline = offset;
+    }
+    QList<qint64> allDelays;
+    int arrival = 0;
+    qint64 lastUsec = mStartUsec;
+    qint64 lastBytesSent = 0;
+    qint64 lastBytesReceived = 0;
+    for(int i=0;i<mSamples.size();i++) {
+        const Sample& sample = mSamples.at(i);
+        QList<qint64> delays;
+        qint64 bytesReceived = lastBytesReceived;
+        while(arrival<arrivals.size() && arrivals.at(arrival).usec<=sample.usec) {
+            const LoopbackArrival& frame = arrivals.at(arrival++);
+            delays.append(frame.usec - (qint64) frame.timestamp*1000 - baseline);
+            bytesReceived = frame.bytesReceived;
+        }
+        allDelays += delays;
+        qSort(delays.begin(), delays.end());
+        double seconds = qMax((qint64) 1, sample.usec - lastUsec)/1000000.0;
+        printf("{\"mode\":\"scenario\",\"t\":%.3f,\"linkKbps\":%d,\"rttMsec\":%d,\"linkQueuedBytes\":%d,"
+                "\"encoderKbps\":%d,\"sentKbps\":%.0f,\"receivedKbps\":%.0f,\"queuedVideoMsec\":%d,"
+                "\"bytesPending\":%d,\"droppedFrames\":%d,\"framesReceived\":%d,\"delayP50Msec\":%lld,"
+                "\"delayMaxMsec\":%lld}\n",
+                (sample.usec - mStartUsec)/1000000.0, sample.linkKbps, sample.rttMsec, sample.linkQueuedBytes,
+                sample.encoderKbps, (sample.bytesSent - lastBytesSent)*8/seconds/1000,
+                (bytesReceived - lastBytesReceived)*8/seconds/1000, sample.queuedVideoMsec, sample.bytesPending,
+                sample.droppedFrames, delays.size(), delays.isEmpty() ? -1 : delays.at(delays.size()/2)/1000,
+                delays.isEmpty() ? -1 : delays.last()/1000);
+        lastUsec = sample.usec;
+        lastBytesSent = sample.bytesSent;
+        lastBytesReceived = bytesReceived;
+    }
+    qSort(allDelays.begin(), allDelays.end());
+    LoopbackSinkStats sink = mSink->stats();
+    int dropped = mSamples.isEmpty() ? 0 : mSamples.last().droppedFrames;
+    int lostReplays = mSamples.isEmpty() ? 0 : mSamples.last().lostReplays;
+    //Every connection, first and reconnects, has to start on an IDR with timestamps carrying on,
+    //and a reconnect anywhere in a GOP has to find it cached instead of waiting for the next IDR
+    bool isStartOnIDR = sink.nonKeyFrameStarts == 0;
+    bool isMonotonic = sink.timestampRegressions == 0;
+    if(!isStartOnIDR || !isMonotonic || lostReplays>0)
+        mExitCode = 1;
+    if(mOptions.isAbrCheck && !reportAbrCheck())
+        mExitCode = 1;
+    printf("{\"mode\":\"scenarioSummary\",\"seed\":%u,\"seconds\":%.3f,\"sourceFrames\":%lld,"
+            "\"videoFramesReceived\":%lld,\"audioFramesReceived\":%lld,\"droppedFrames\":%d,"
+            "\"linkResets\":%d,\"connections\":%d,\"startsOnIDR\":%s,\"timestampsMonotonic\":%s,"
+            "\"lostReplays\":%d,\"delayP50Msec\":%lld,\"delayP99Msec\":%lld,\"delayMaxMsec\":%lld}\n",
+            mOptions.seed, (BenchClock::nowUsec() - mStartUsec)/1000000.0, mSource->framesCount(),
+            sink.videoFrames, sink.audioFrames, dropped, mLink->resetCount(), sink.connections,
+            isStartOnIDR ? "true" : "false", isMonotonic ? "true" : "false", lostReplays,
+            allDelays.isEmpty() ? -1 : allDelays.at(allDelays.size()/2)/1000,
+            allDelays.isEmpty() ? -1 : allDelays.at(qMin(allDelays.size()-1, allDelays.size()*99/100))/1000,
+            allDelays.isEmpty() ? -1 : allDelays.last()/1000);
+    fflush(stdout);
+}
+
+bool ScenarioRunner::reportAbrCheck()
+{
+    /*
+     * Step down: encoder has to go below what the congested link carries while it is congested.
+     * Recovery: after the link clears, encoder has to get back to SCENARIO_ABR_RECOVERED_PERCENT of
+     * the bitrate it started with before the run ends. Times are from the link change to first sample
+     * that shows it, -1 if none did.
+     */
+    int linkKbps = mOptions.videoKbps*SCENARIO_ABR_LINK_PERCENT/100;
+    int recoveredKbps = mOptions.videoKbps*SCENARIO_ABR_RECOVERED_PERCENT/100;
+    int lowestKbps = mOptions.videoKbps;
+    qint64 stepDownMsec = -1;
+    qint64 recoveryMsec = -1;
+    for(int i=0;i<mSamples.size();i++) {
+        const Sample& sample = mSamples.at(i);
+        qint64 msec = (sample.usec - mStartUsec)/1000;
+        if(msec>=SCENARIO_ABR_CONGESTED_FROM_MSEC && msec<SCENARIO_ABR_CONGESTED_UNTIL_MSEC) {
+            lowestKbps = qMin(lowestKbps, sample.encoderKbps);
+            if(stepDownMsec<0 && sample.encoderKbps<linkKbps)
+                stepDownMsec = msec - SCENARIO_ABR_CONGESTED_FROM_MSEC;
+        } else if(msec>=SCENARIO_ABR_CONGESTED_UNTIL_MSEC && recoveryMsec<0 &&
+                sample.encoderKbps>=recoveredKbps) {
+            recoveryMsec = msec - SCENARIO_ABR_CONGESTED_UNTIL_MSEC;
+        }
+    }
+    int finalKbps = mSamples.isEmpty() ? 0 : mSamples.last().encoderKbps;
+    bool isSteppedDown = stepDownMsec>=0;
+    bool isRecovered = recoveryMsec>=0;
+    printf("{\"mode\":\"abrCheck\",\"startKbps\":%d,\"congestedLinkKbps\":%d,\"lowestKbps\":%d,"
+            "\"stepDownMsec\":%lld,\"finalKbps\":%d,\"recoveryMsec\":%lld,\"steppedDown\":%s,"
+            "\"recovered\":%s}\n",
+            mOptions.videoKbps, linkKbps, lowestKbps, stepDownMsec, finalKbps, recoveryMsec,
+            isSteppedDown ? "true" : "false", isRecovered ? "true" : "false");
+    return isSteppedDown && isRecovered;
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SCENARIORUNNER_H_
+#define SCENARIORUNNER_H_
+
+#include <QObject>
+#include <QList>
+#include <QThread>
+#include <QTimer>
+#include "controller.h"
+#include "impairedlink.h"
+#include "loopbacksink.h"
+#include "syntheticsource.h"
+
+#define SCENARIO_MAX_FPS 120
+//--abr-check link: unlimited, then SCENARIO_ABR_LINK_PERCENT of the video bitrate for a while, unlimited again
+#define SCENARIO_ABR_CONGESTED_FROM_MSEC 15000
+#define SCENARIO_ABR_CONGESTED_UNTIL_MSEC 35000
+#define SCENARIO_ABR_LINK_PERCENT 50
+#define SCENARIO_ABR_RECOVERED_PERCENT 90     //Encoder bitrate back to this share of the start counts as recovered
+#define SCENARIO_ABR_DURATION_MSEC 100000     //Step ups of ABR_INCREASE_FACTOR need about a minute to get there
+
+struct ScenarioOptions {
+    int fps;
+    int videoKbps;
+    int audioKbps;
+    int gopFrames;
+    int durationMsec;
+    int sampleMsec;
+    quint32 seed;
+    bool isAbrCheck;
+    QList<ImpairmentStep> steps;
+};
+
+/*
+ * Congestion scenario: real time SyntheticSource -> Controller -> RTMPPublisher -> ImpairedLink -> LoopbackSink.
+ * Every sampleMsec the link conditions, encoder bitrate, publisher queue, backlog and drops are taken down,
+ * arrivals at the sink are matched up into the same intervals after the run. One JSON line per interval
+ * and a summary line go to stdout.
+ * Delay of a frame is arrival time minus its timestamp, less the smallest such value of the run, so it is
+ * what queueing and the link added over the best frame, not absolute glass to glass latency.
+ * With isAbrCheck the link is made by abrCheckSteps() and the run also checks that BitrateController
+ * brought the encoder under the congested link and back up once it cleared, exit code is 1 if not.
+ */
+class ScenarioRunner : public QObject
+{
+    Q_OBJECT
+public:
+    ScenarioRunner(const ScenarioOptions& options, QObject* parent = 0);
+    ~ScenarioRunner();
+
+    //Link for --abr-check, conditions other than bandwidth are taken from base
+    static QList<ImpairmentStep> abrCheckSteps(const ImpairmentStep& base, int videoKbps);
+
+public slots:
+    bool start();
+
+private slots:
+    void on_mSink_listening(int port);
+    void on_mSink_finished();
+    void on_mLink_listening(int port);
+    void on_mSource_finished();
+    void on_mController_publishError(QString error);
+    void on_mController_publisherFinished();
+    void sample();
+
+private:
+    struct Sample {
+        qint64 usec;
+        int linkKbps;
+        int rttMsec;
+        int linkQueuedBytes;
+        int encoderKbps;
+        int queuedVideoMsec;
+        int bytesPending;
+        int droppedFrames;
+        int lostReplays;
+        qint64 bytesSent;
+    };
+    void checkFinished();
+    void report();
+    bool reportAbrCheck();
+
+    ScenarioOptions mOptions;
+    LoopbackSink* mSink;
+    QThread* mSinkThread;
+    ImpairedLink* mLink;
+    QThread* mLinkThread;
+    Controller* mController;
+    SyntheticSource* mSource;
+    QThread* mSourceThread;
+    QTimer mSampleTimer;
+    QList<Sample> mSamples;
+    qint64 mStartUsec;
+    bool mIsPublisherFinished;
+    bool mIsSinkFinished;
+    int mExitCode;
+};
+
+#endif /* SCENARIORUNNER_H_ */
@@ -0,0 +1,209 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "syntheticsource.h"
+#include <string.h>
+
+static const char START_CODE[] = {0, 0, 0, 1};
+static const char PPS[] = {0, 0, 0, 1, 0x68, (char) 0xCE, 0x3C, (char) 0x80};
+//Filler without zero bytes, so it can't contain a start code
+#define SYNTHETICSOURCE_FILLER 0x5A
+
+SyntheticSource::SyntheticSource(int videoKbps, int fps, int gopFrames, int audioKbps, int durationMsec,
+        QObject* parent)
+    :MediaSource(parent),
+     mVideoKbps(videoKbps),
+     mFps(fps > 0 ? fps : 30),
+     mGopFrames(gopFrames > 1 ? gopFrames : 2),
+     mAudioKbps(audioKbps),
+     mDurationMsec(durationMsec),
+     mIsKeyFrameRequested(0),
+     mVideoIndex(0),
+     mAudioIndex(0),
+     mGopIndex(0)
+{
+    setSize(1280, 720);
+}
+
+void SyntheticSource::setSize(int width, int height)
+{
+    mSPS = QByteArray(START_CODE, sizeof(START_CODE)) + buildSPS(width, height, mFps);
+}
+
+namespace {
+
+class BitWriter
+{
+public:
+    BitWriter() : mBitCount(0) {}
+    void bits(quint32 value, int count) {
+        for (int i = count - 1; i >= 0; i--) {
+            if (mBitCount % 8 == 0)
+                mBytes.append((char) 0);
+            if ((value >> i) & 1)
+                mBytes.data()[mBytes.size() - 1] |= (char) (0x80 >> (mBitCount % 8));
+            mBitCount++;
+        }
+    }
+    void ue(quint32 value) {
+        value++;
+        int length = 0;
+        while ((value >> length) > 1)
+            length++;
+        bits(0, length);
+        bits(value, length + 1);
+    }
+    //Stop bit, byte alignment and emulation prevention
+    QByteArray toNAL() {
+        bits(1, 1);
+        QByteArray nal;
+        int zeros = 0;
+        for (int i = 0; i < mBytes.size(); i++) {
+            uchar byte = (uchar) mBytes.at(i);
+            if (zeros >= 2 && byte <= 3) {
+                nal.append((char) 3);
+                zeros = 0;
+            }
+            zeros = (byte == 0) ? zeros + 1 : 0;
+            nal.append((char) byte);
+        }
+        return nal;
+    }
+private:
+    QByteArray mBytes;
+    int mBitCount;
+};
+
+}
+
+QByteArray SyntheticSource::buildSPS(int width, int height, int fps)
+{
+    /*
+     * Baseline, constraint set 0 and 1, POC type 2, one reference frame, progressive, no VUI.
+     * Size is in macroblocks, cropping takes off what 16 pixel rounding added.
+     */
+    int mbWidth = (width + 15) / 16;
+    int mbHeight = (height + 15) / 16;
+    int mbRate = mbWidth * mbHeight * fps;
+    int level = mbRate <= 108000 ? 31 : mbRate <= 245760 ? 40 : mbRate <= 522240 ? 42 : mbRate <= 983040 ? 51 : 52;
+    BitWriter writer;
+    writer.bits(0x67, 8);
+    writer.bits(66, 8);
+    writer.bits(0xC0, 8);
+    writer.bits(level, 8);
+    writer.ue(0);                   //seq_parameter_set_id
+    writer.ue(0);                   //log2_max_frame_num_minus4
+    writer.ue(2);                   //pic_order_cnt_type
+    writer.ue(1);                   //max_num_ref_frames
+    writer.bits(0, 1);              //gaps_in_frame_num_value_allowed_flag
+    writer.ue(mbWidth - 1);
+    writer.ue(mbHeight - 1);
+    writer.bits(1, 1);              //frame_mbs_only_flag
+    writer.bits(1, 1);              //direct_8x8_inference_flag
+    int cropRight = (mbWidth*16 - width) / 2;
+    int cropBottom = (mbHeight*16 - height) / 2;
+    if (cropRight > 0 || cropBottom > 0) {
+        writer.bits(1, 1);
+        writer.ue(0);
+        writer.ue(cropRight);
+        writer.ue(0);
+        writer.ue(cropBottom);
+    } else {
+        writer.bits(0, 1);
+    }
+    writer.bits(0, 1);              //vui_parameters_present_flag
+    return writer.toNAL();
+}
+
+int SyntheticSource::encoderBitrate()
+{
+    return mVideoKbps.fetchAndAddRelaxed(0);
+}
+
+bool SyntheticSource::setEncoderBitrate(const int kbps)
+{
+    mVideoKbps.fetchAndStoreRelaxed(kbps);
+    return true;
+}
+
+bool SyntheticSource::requestKeyFrame()
+{
+    mIsKeyFrameRequested.fetchAndStoreRelaxed(1);
+    return true;
+}
+
+bool SyntheticSource::nextVideoFrame(Frame& frame)
+{
+    /*
+     * IDR gets 4 times an average picture, the rest share what is left of the GOP's budget,
+     * so bitrate over a GOP is what was asked.
+     */
+    qint64 timestamp = mVideoIndex*1000000/mFps;
+    if (mDurationMsec > 0 && timestamp/1000 >= mDurationMsec)
+        return false;
+    bool isKeyFrame = (mGopIndex == 0) || mIsKeyFrameRequested.testAndSetRelaxed(1, 0);
+    if (isKeyFrame)
+        mGopIndex = 0;
+    int average = encoderBitrate()*1000/8/mFps;
+    int size = isKeyFrame ? 4*average : qMax(16, (average*mGopFrames - 4*average)/(mGopFrames - 1));
+    int headerSize = isKeyFrame ? mSPS.size() + sizeof(PPS) + 5 : 5;
+    if (mVideo.size() < headerSize + size)
+        mVideo.fill(SYNTHETICSOURCE_FILLER, headerSize + size);
+    char* data = mVideo.data();
+    int offset = 0;
+    if (isKeyFrame) {
+        memcpy(data, mSPS.constData(), mSPS.size());
+        memcpy(data + mSPS.size(), PPS, sizeof(PPS));
+        offset = mSPS.size() + sizeof(PPS);
+    }
+    memcpy(data + offset, START_CODE, sizeof(START_CODE));
+    data[offset + 4] = isKeyFrame ? 0x65 : 0x41;
+    memset(data + offset + 5, SYNTHETICSOURCE_FILLER, size);
+    frame.data = reinterpret_cast<const uint8_t*>(data);
+    frame.size = headerSize + size;
+    frame.timestamp = timestamp;
+    frame.isKeyFrame = isKeyFrame;
+    mVideoIndex++;
+    mGopIndex = (mGopIndex + 1) % mGopFrames;
+    return true;
+}
+
+bool SyntheticSource::nextAudioFrame(Frame& frame)
+{
+    if (mAudioKbps <= 0)
+        return false;
+    qint64 timestamp = mAudioIndex*1024*1000000/SYNTHETICSOURCE_AUDIO_RATE;
+    if (mDurationMsec > 0 && timestamp/1000 >= mDurationMsec)
+        return false;
+    int length = 7 + qMax(8, mAudioKbps*1000/8*1024/SYNTHETICSOURCE_AUDIO_RATE);
+    if (mAudio.size() != length)
+        mAudio.fill(SYNTHETICSOURCE_FILLER, length);
+    //ADTS, AAC-LC, 48 kHz (index 3), 2 channels, no CRC
+    uchar* header = reinterpret_cast<uchar*>(mAudio.data());
+    header[0] = 0xFF;
+    header[1] = 0xF1;
+    header[2] = (1 << 6) | (3 << 2);
+    header[3] = (2 << 6) | ((length >> 11) & 3);
+    header[4] = (length >> 3) & 0xFF;
+    header[5] = ((length & 7) << 5) | 0x1F;
+    header[6] = 0xFC;
+    frame.data = reinterpret_cast<const uint8_t*>(mAudio.constData());
+    frame.size = length;
+    frame.timestamp = timestamp;
+    frame.isKeyFrame = true;
+    mAudioIndex++;
+    return true;
+}
@@ -0,0 +1,69 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SYNTHETICSOURCE_H_
+#define SYNTHETICSOURCE_H_
+
+#include <QByteArray>
+#include <QAtomicInt>
+#include "mediasource.h"
+#include "encodercontrol.h"
+
+#define SYNTHETICSOURCE_AUDIO_RATE 48000    //Like the device
+
+/*
+ * Generates frames of the requested bitrates without an encoder: a baseline SPS for the requested size,
+ * fixed PPS, IDR every gopFrames pictures and AAC-LC stereo ADTS frames. Payload is filler, nothing decodes it,
+ * but sizes and timing are those of a real stream, which is all the transport sees.
+ * Also stands in for the encoder, so BitrateController and key frame requests can be exercised.
+ */
+class SyntheticSource : public MediaSource, public EncoderControl
+{
+    Q_OBJECT
+public:
+    //durationMsec 0 runs till stopped
+    SyntheticSource(int videoKbps = 2000, int fps = 30, int gopFrames = 60, int audioKbps = 128,
+            int durationMsec = 0, QObject* parent = 0);
+
+    //1280x720 unless set, before start()
+    void setSize(int width, int height);
+    //Baseline profile SPS NAL, level picked from macroblock rate
+    static QByteArray buildSPS(int width, int height, int fps);
+
+    int encoderBitrate();
+    bool setEncoderBitrate(const int kbps);
+    bool requestKeyFrame();
+
+protected:
+    bool nextVideoFrame(Frame& frame);
+    bool nextAudioFrame(Frame& frame);
+
+private:
+    QAtomicInt mVideoKbps;
+    QByteArray mSPS;            //With start code
+    int mFps;
+    int mGopFrames;
+    int mAudioKbps;
+    int mDurationMsec;
+    QAtomicInt mIsKeyFrameRequested;
+    QByteArray mVideo;          //Grown once to largest frame, rewritten in place
+    QByteArray mAudio;
+    qint64 mVideoIndex;
+    qint64 mAudioIndex;
+    int mGopIndex;
+};
+
+#endif /* SYNTHETICSOURCE_H_ */
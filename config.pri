@@ -56,17 +56,59 @@ config_pri_assets {
 config_pri_source_group1 {
     SOURCES += \
         $$quote($$BASEDIR/src/StreamCam.cpp) \
+        $$quote($$BASEDIR/src/adts.cpp) \
+        $$quote($$BASEDIR/src/amf0.cpp) \
+        $$quote($$BASEDIR/src/bitratecontroller.cpp) \
+        $$quote($$BASEDIR/src/clipwriter.cpp) \
         $$quote($$BASEDIR/src/controller.cpp) \
+        $$quote($$BASEDIR/src/flv.cpp) \
         $$quote($$BASEDIR/src/frameswriter.cpp) \
+        $$quote($$BASEDIR/src/h264.cpp) \
+        $$quote($$BASEDIR/src/hlswriter.cpp) \
+        $$quote($$BASEDIR/src/interleaver.cpp) \
+        $$quote($$BASEDIR/src/latencytracer.cpp) \
         $$quote($$BASEDIR/src/main.cpp) \
-        $$quote($$BASEDIR/src/rtmppublisher.cpp)
+        $$quote($$BASEDIR/src/mediabuffer.cpp) \
+        $$quote($$BASEDIR/src/mediaclock.cpp) \
+        $$quote($$BASEDIR/src/mediafanout.cpp) \
+        $$quote($$BASEDIR/src/mediasource.cpp) \
+        $$quote($$BASEDIR/src/mp4muxer.cpp) \
+        $$quote($$BASEDIR/src/mp4writer.cpp) \
+        $$quote($$BASEDIR/src/prerollbuffer.cpp) \
+        $$quote($$BASEDIR/src/rtmpchunkreader.cpp) \
+        $$quote($$BASEDIR/src/rtmpchunkwriter.cpp) \
+        $$quote($$BASEDIR/src/rtmppublisher.cpp) \
+        $$quote($$BASEDIR/src/socketwriter.cpp)
 
     HEADERS += \
         $$quote($$BASEDIR/src/StreamCam.hpp) \
+        $$quote($$BASEDIR/src/adts.h) \
+        $$quote($$BASEDIR/src/amf0.h) \
+        $$quote($$BASEDIR/src/bitratecontroller.h) \
+        $$quote($$BASEDIR/src/clipwriter.h) \
         $$quote($$BASEDIR/src/controller.h) \
+        $$quote($$BASEDIR/src/encodercontrol.h) \
+        $$quote($$BASEDIR/src/flv.h) \
+        $$quote($$BASEDIR/src/framering.h) \
         $$quote($$BASEDIR/src/frameswriter.h) \
+        $$quote($$BASEDIR/src/h264.h) \
+        $$quote($$BASEDIR/src/hlswriter.h) \
+        $$quote($$BASEDIR/src/interleaver.h) \
+        $$quote($$BASEDIR/src/latencytracer.h) \
+        $$quote($$BASEDIR/src/mediabuffer.h) \
+        $$quote($$BASEDIR/src/mediaclock.h) \
+        $$quote($$BASEDIR/src/mediafanout.h) \
         $$quote($$BASEDIR/src/mediaframe.h) \
-        $$quote($$BASEDIR/src/rtmppublisher.h)
+        $$quote($$BASEDIR/src/mediasink.h) \
+        $$quote($$BASEDIR/src/mediasource.h) \
+        $$quote($$BASEDIR/src/mp4muxer.h) \
+        $$quote($$BASEDIR/src/mp4writer.h) \
+        $$quote($$BASEDIR/src/prerollbuffer.h) \
+        $$quote($$BASEDIR/src/rtmpchunkreader.h) \
+        $$quote($$BASEDIR/src/rtmpchunkwriter.h) \
+        $$quote($$BASEDIR/src/rtmpprotocol.h) \
+        $$quote($$BASEDIR/src/rtmppublisher.h) \
+        $$quote($$BASEDIR/src/socketwriter.h)
 }
 
 INCLUDEPATH += $$quote($$BASEDIR/src)
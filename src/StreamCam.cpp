@@ -66,6 +66,7 @@ StreamCam::StreamCam(bb::cascades::Application *app) :
         mSwitchCameraTimer(NULL),
         mCameraResolutionsModel(NULL),
         mVideoBitrate(360),
+        mEncoderBitrate(360),
         mVideoFramerate(30.0),
         mCameraHasVideoLight(false)
 {
@@ -91,8 +92,12 @@ StreamCam::StreamCam(bb::cascades::Application *app) :
         setPreferredCameraSize(settings.value(KEY_VIDEO_RESOLUTION).toString());
 
     mController = new Controller(this);
+    mController->setEncoderControl(this);
     if(!settings.value(KEY_SERVER_URL).toString().isEmpty())
         mController->setServer(settings.value(KEY_SERVER_URL).toString(), false);
+    QStringList extraServerUrls = settings.value(KEY_EXTRA_SERVER_URLS).toStringList();
+    for(int i=0;i<extraServerUrls.size();i++)
+        mController->addDestination(extraServerUrls.at(i), false);
     if (!QObject::connect(this,SIGNAL(streamingStart()),mController,SLOT(startStreaming()))) {
         qWarning() << "failed to connect streamingStart signal";
     }
@@ -593,6 +598,7 @@ int StreamCam::startVideoVf()
             qDebug() << " Could not set video property";
             return err;
         }
+        mController->setVideoFrameRate(mVideoFramerate);
         err = camera_set_videoencoder_parameter(mHandle,
                        CAMERA_H264AVC_BITRATE, mVideoBitrate*1000,
                        CAMERA_H264AVC_KEYFRAMEINTERVAL, 30,
@@ -603,6 +609,7 @@ int StreamCam::startVideoVf()
             qDebug() << " Could not set video encoder property";
             return err;
         }
+        mEncoderBitrate = mVideoBitrate;
         err = camera_init_video_encoder();
         if(err != CAMERA_EOK) {
             qDebug() << "Could not init video encoder!";
@@ -634,6 +641,7 @@ int StreamCam::startVideoVf()
 int StreamCam::stopVideoVf()
 {
     qDebug() << "stopping video viewfinder";
+    mController->coolDown();
     int err = camera_stop_video_viewfinder(mHandle);
     if (err) {
         qDebug() << "error trying to shut down video viewfinder:" << err;
@@ -814,6 +822,7 @@ int StreamCam::enterState(CamState state, CamState &nextState)
             nextState = StateIdle;
         } else {
             mStopViewfinder = true;
+            mController->prewarm();
         }
         break;
     case StateVideoVf:
@@ -1632,11 +1641,13 @@ void StreamCam::video_callback(camera_handle_t cameraHandle,
 void StreamCam::enc_video_callback(camera_handle_t cameraHandle,
         camera_buffer_t* cameraBuffer,
         void* etc) {
+    qint64 captureTime = LatencyTracer::nowUsec();
     camera_frame_compressedvideo_t ct = cameraBuffer->framedesc.compvid;
     ((StreamCam*)etc)->controller()->handleVideoFrame(cameraBuffer->framebuf,
                             ct.bufsize,
                             cameraBuffer->frametimestamp,
-                            ct.keyframe);
+                            ct.keyframe,
+                            captureTime);
 //    uint8_t type = (cameraBuffer->framebuf[4] & 31);
 //    qDebug()<<"----Encoded video frame"<<cameraBuffer->frametimestamp
 //            <<type<<ct.bufsize<<ct.codec<<ct.keyframe;
@@ -1644,11 +1655,13 @@ void StreamCam::enc_video_callback(camera_handle_t cameraHandle,
 void StreamCam::enc_audio_callback(camera_handle_t cameraHandle,
         camera_buffer_t* cameraBuffer,
         void* etc) {
+    qint64 captureTime = LatencyTracer::nowUsec();
     camera_frame_compressedaudio_t ct = cameraBuffer->framedesc.compaud;
     ((StreamCam*)etc)->controller()->handleAudioFrame(cameraBuffer->framebuf,
                                 ct.bufsize,
                                 cameraBuffer->frametimestamp,
-                                ct.keyframe);
+                                ct.keyframe,
+                                captureTime);
 //    qDebug()<<"Encoded audio frame"<<cameraBuffer->frametimestamp<<ct.bufsize;
 }
 void StreamCam::status_callback(camera_handle_t cameraHandle,
@@ -1738,6 +1751,26 @@ void StreamCam::restartCamera()
     }
 }
 
+bool StreamCam::setEncoderBitrate(const int kbps)
+{
+    if (mHandle == CAMERA_HANDLE_INVALID)
+        return false;
+    int err = camera_set_videoencoder_parameter(mHandle,
+                   CAMERA_H264AVC_BITRATE, kbps*1000);
+    if (err != CAMERA_EOK) {
+        qDebug() << "Could not change video encoder bitrate" << kbps << err;
+        return false;
+    }
+    mEncoderBitrate = kbps;
+    return true;
+}
+
+bool StreamCam::requestKeyFrame()
+{
+    //Camera API has no way to force an IDR, publisher waits for the next one in KEYFRAMEINTERVAL
+    return false;
+}
+
 void StreamCam::on_mController_publishError(const QString error)
 {
     qDebug()<<"StreamCam-PublishError"<<error;
@@ -25,6 +25,7 @@
 #include <QSize>
 #include <bb/cascades/ArrayDataModel>
 #include "controller.h"
+#include "encodercontrol.h"
 
 #define KEY_VIDEO_BITRATE "Video_Bitrate"
 #define KEY_VIDEO_FRAMERATE "Video_Framerate"
@@ -76,13 +77,18 @@ private:
 };
 
 
-class StreamCam : public QObject
+class StreamCam : public QObject, public EncoderControl
 {
     Q_OBJECT
 public:
     StreamCam(bb::cascades::Application *app);
     virtual ~StreamCam() {}
 
+    //EncoderControl
+    int encoderBitrate() { return mEncoderBitrate; }
+    bool setEncoderBitrate(const int kbps);
+    bool requestKeyFrame();
+
     static void video_callback(camera_handle_t cameraHandle,
             camera_buffer_t* cameraBuffer,
             void* etc);
@@ -341,6 +347,7 @@ private:
     QList<QSize>mRearCamVideoResolutions;
     bb::cascades::ArrayDataModel* mCameraResolutionsModel;
     int mVideoBitrate;
+    int mEncoderBitrate;    //What encoder runs at now, mVideoBitrate unless adaptive bitrate stepped it down
     double mVideoFramerate;
 
     Controller* mController;
@@ -0,0 +1,77 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "adts.h"
+
+static const int SAMPLING_RATES[16] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000,
+        11025, 8000, 7350, 0, 0, 0};
+
+bool ADTS::parseFrame(const uchar* data, int size, ADTSFrame& frame) {
+    /*
+     * Fields are pulled out unconditionally and checked in one go, frames come in steadily and are
+     * almost never bad. CRC follows the fixed header unless protection_absent is set, with several raw
+     * blocks it is preceded by their positions, 2 bytes each.
+     */
+    if (size < ADTS_HEADER_SIZE)
+        return false;
+    int protectionAbsent = data[1] & 1;
+    int rawBlocks = (data[6] & 3) + 1;
+    int headerSize = ADTS_HEADER_SIZE + (1 - protectionAbsent) * ADTS_CRC_SIZE * rawBlocks;
+    int frameLength = ((data[3] & 3) << 11) | (data[4] << 3) | (data[5] >> 5);
+    int samplingRateIndex = (data[2] >> 2) & 15;
+    bool isValid = (data[0] == 0xFF) & ((data[1] & 0xF0) == 0xF0) & (frameLength > headerSize)
+            & (frameLength <= size) & (SAMPLING_RATES[samplingRateIndex] != 0);
+    if (!isValid)
+        return false;
+    frame.offset = 0;
+    frame.size = frameLength;
+    frame.payloadOffset = headerSize;
+    frame.payloadSize = frameLength - headerSize;
+    frame.rawBlocks = rawBlocks;
+    frame.config.objectType = (data[2] >> 6) + 1;
+    frame.config.samplingRateIndex = samplingRateIndex;
+    frame.config.channelConfig = ((data[2] & 1) << 2) | (data[3] >> 6);
+    return true;
+}
+
+int ADTS::split(const uchar* data, int size, ADTSFrame* frames, int maxFrames) {
+    int count = 0;
+    int offset = 0;
+    while (count < maxFrames && parseFrame(data + offset, size - offset, frames[count])) {
+        ADTSFrame& frame = frames[count++];
+        frame.offset = offset;
+        frame.payloadOffset += offset;
+        offset += frame.size;
+    }
+    return count;
+}
+
+int ADTS::samplingRate(int index) {
+    return SAMPLING_RATES[index & 15];
+}
+
+QByteArray ADTS::audioSpecificConfig(const ADTSConfig& config) {
+    //5 bits object type, 4 bits sampling rate index, 4 bits channel configuration, 3 bits GASpecificConfig 0
+    char header[2] = {(char) ((config.objectType << 3) | (config.samplingRateIndex >> 1)),
+            (char) (((config.samplingRateIndex & 1) << 7) | (config.channelConfig << 3))};
+    return QByteArray(header, 2);
+}
+
+int ADTS::channelConfig(const QByteArray& audioSpecificConfig) {
+    if (audioSpecificConfig.size() < 2)
+        return 0;
+    return (audioSpecificConfig.at(1) >> 3) & 15;
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ADTS_H_
+#define ADTS_H_
+
+#include <QByteArray>
+
+#define ADTS_HEADER_SIZE 7
+#define ADTS_CRC_SIZE 2
+#define AAC_SAMPLES_PER_BLOCK 1024
+
+//Stream parameters an ADTS header carries, a change of any needs a new AudioSpecificConfig
+struct ADTSConfig {
+    int objectType;         //profile+1, AAC-LC is 2
+    int samplingRateIndex;
+    int channelConfig;
+};
+
+//One ADTS frame of a buffer, offsets from buffer start. Payload is raw AAC without header and CRC.
+struct ADTSFrame {
+    int offset;
+    int size;
+    int payloadOffset;
+    int payloadSize;
+    int rawBlocks;          //Of 1024 samples each, payload is one block unless this is 1
+    ADTSConfig config;
+};
+
+/*
+ * ADTS (AAC audio data transport stream) helpers. Camera and files deliver AAC this way, FLV and MP4 want
+ * raw blocks and the AudioSpecificConfig sent once up front.
+ */
+class ADTS
+{
+public:
+    //Returns false unless data starts with a valid header of a frame that fits in size
+    static bool parseFrame(const uchar* data, int size, ADTSFrame& frame);
+    //Back to back frames, stops at the first bad or truncated one. Returns count found, at most maxFrames.
+    static int split(const uchar* data, int size, ADTSFrame* frames, int maxFrames);
+    //Hz, 0 for a reserved index
+    static int samplingRate(int index);
+    //2 byte AudioSpecificConfig
+    static QByteArray audioSpecificConfig(const ADTSConfig& config);
+    //Channel configuration back out of an AudioSpecificConfig, 0 if too short
+    static int channelConfig(const QByteArray& audioSpecificConfig);
+    static bool isSameConfig(const ADTSConfig& a, const ADTSConfig& b) {
+        return a.objectType == b.objectType && a.samplingRateIndex == b.samplingRateIndex
+                && a.channelConfig == b.channelConfig;
+    }
+};
+
+#endif /* ADTS_H_ */
@@ -0,0 +1,222 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "amf0.h"
+#include <string.h>
+
+bool AMF0::decode(const QByteArray& data, QVariantList& values)
+{
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    int offset = 0;
+    while (offset < data.size()) {
+        QVariant value;
+        if (!decodeValue(bytes, data.size(), offset, value))
+            return false;
+        values.append(value);
+    }
+    return true;
+}
+
+bool AMF0::decodeValue(const uchar* data, int size, int& offset, QVariant& value, int depth)
+{
+    if (offset >= size || depth > AMF0_MAX_DEPTH)
+        return false;
+    int marker = data[offset++];
+    switch (marker) {
+        case Number:
+            if (offset + 8 > size)
+                return false;
+            value = readDouble(data + offset);
+            offset += 8;
+            return true;
+        case Boolean:
+            if (offset + 1 > size)
+                return false;
+            value = (data[offset++] != 0);
+            return true;
+        case String: {
+            QString string;
+            if (!decodeString(data, size, offset, 2, string))
+                return false;
+            value = string;
+            return true;
+        }
+        case LongString: {
+            QString string;
+            if (!decodeString(data, size, offset, 4, string))
+                return false;
+            value = string;
+            return true;
+        }
+        case Object: {
+            QVariantMap map;
+            if (!decodeProperties(data, size, offset, map, depth))
+                return false;
+            value = map;
+            return true;
+        }
+        case EcmaArray: {
+            //Count is only a hint, properties end with an object end marker like objects
+            if (offset + 4 > size)
+                return false;
+            offset += 4;
+            QVariantMap map;
+            if (!decodeProperties(data, size, offset, map, depth))
+                return false;
+            value = map;
+            return true;
+        }
+        case StrictArray: {
+            if (offset + 4 > size)
+                return false;
+            quint32 count = (data[offset] << 24) | (data[offset + 1] << 16) | (data[offset + 2] << 8) | data[offset + 3];
+            offset += 4;
+            QVariantList list;
+            for (quint32 i = 0; i < count; i++) {
+                QVariant item;
+                if (!decodeValue(data, size, offset, item, depth + 1))
+                    return false;
+                list.append(item);
+            }
+            value = list;
+            return true;
+        }
+        case Date:
+            //Milliseconds as double followed by a 2 byte time zone which is always 0
+            if (offset + 10 > size)
+                return false;
+            value = readDouble(data + offset);
+            offset += 10;
+            return true;
+        case Null:
+        case Undefined:
+            value = QVariant();
+            return true;
+        default:
+            //MovieClip, Reference, XML and typed objects are never sent by servers we talk to
+            return false;
+    }
+}
+
+double AMF0::readDouble(const uchar* data)
+{
+    //Big endian IEEE 754
+    quint64 bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits = (bits << 8) | data[i];
+    double number;
+    memcpy(&number, &bits, 8);
+    return number;
+}
+
+bool AMF0::decodeString(const uchar* data, int size, int& offset, int lengthSize, QString& value)
+{
+    if (offset + lengthSize > size)
+        return false;
+    quint32 length = 0;
+    for (int i = 0; i < lengthSize; i++)
+        length = (length << 8) | data[offset + i];
+    offset += lengthSize;
+    if (length > (quint32) (size - offset))
+        return false;
+    value = QString::fromUtf8(reinterpret_cast<const char*>(data + offset), length);
+    offset += length;
+    return true;
+}
+
+bool AMF0::decodeProperties(const uchar* data, int size, int& offset, QVariantMap& map, int depth)
+{
+    //Each property is a 2 byte length key and a value, list ends with empty key and object end marker
+    while (true) {
+        QString key;
+        if (!decodeString(data, size, offset, 2, key))
+            return false;
+        if (key.isEmpty()) {
+            if (offset >= size || data[offset] != ObjectEnd)
+                return false;
+            offset++;
+            return true;
+        }
+        QVariant value;
+        if (!decodeValue(data, size, offset, value, depth + 1))
+            return false;
+        map.insert(key, value);
+    }
+}
+
+void AMF0::encodeNumber(QByteArray& out, double value)
+{
+    quint64 bits;
+    memcpy(&bits, &value, 8);
+    out.append((char) Number);
+    for (int i = 7; i >= 0; i--)
+        out.append((char) ((bits >> (8*i)) & 255));
+}
+
+void AMF0::encodeBoolean(QByteArray& out, bool value)
+{
+    out.append((char) Boolean);
+    out.append((char) (value ? 1 : 0));
+}
+
+void AMF0::encodeString(QByteArray& out, const QString& value)
+{
+    QByteArray utf8 = value.toUtf8();
+    if (utf8.size() > 0xFFFF) {
+        quint32 length = utf8.size();
+        out.append((char) LongString);
+        out.append((char) ((length >> 24) & 255));
+        out.append((char) ((length >> 16) & 255));
+    } else {
+        out.append((char) String);
+    }
+    out.append((char) ((utf8.size() >> 8) & 255));
+    out.append((char) (utf8.size() & 255));
+    out.append(utf8);
+}
+
+void AMF0::encodeNull(QByteArray& out)
+{
+    out.append((char) Null);
+}
+
+void AMF0::encodeObjectStart(QByteArray& out)
+{
+    out.append((char) Object);
+}
+
+void AMF0::encodeEcmaArrayStart(QByteArray& out, quint32 count)
+{
+    //Count is only a hint for readers, pairs and end marker follow just like in an object
+    out.append((char) EcmaArray);
+    for (int i = 3; i >= 0; i--)
+        out.append((char) ((count >> (8*i)) & 255));
+}
+
+void AMF0::encodePropertyName(QByteArray& out, const QString& name)
+{
+    //Same as a string without the marker
+    QByteArray utf8 = name.toUtf8();
+    out.append((char) ((utf8.size() >> 8) & 255));
+    out.append((char) (utf8.size() & 255));
+    out.append(utf8);
+}
+
+void AMF0::encodeObjectEnd(QByteArray& out)
+{
+    out.append((char) 0);
+    out.append((char) 0);
+    out.append((char) ObjectEnd);
+}
@@ -0,0 +1,70 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AMF0_H_
+#define AMF0_H_
+
+#include <QByteArray>
+#include <QVariant>
+
+#define AMF0_MAX_DEPTH 16
+
+/*
+ * AMF0 values as carried in RTMP command messages (type 20).
+ * Decoded into QVariant: number is double, boolean is bool, strings are QString,
+ * object and ECMA array are QVariantMap, strict array is QVariantList, null and undefined are invalid QVariant.
+ * Encoding appends one value at a time, objects are written as start, name/value pairs and end.
+ */
+class AMF0
+{
+public:
+    enum Marker {
+        Number = 0,
+        Boolean = 1,
+        String = 2,
+        Object = 3,
+        MovieClip = 4,
+        Null = 5,
+        Undefined = 6,
+        Reference = 7,
+        EcmaArray = 8,
+        ObjectEnd = 9,
+        StrictArray = 10,
+        Date = 11,
+        LongString = 12
+    };
+
+    //Decodes all values in data, returns false on a malformed or unsupported value
+    static bool decode(const QByteArray& data, QVariantList& values);
+    static bool decodeValue(const uchar* data, int size, int& offset, QVariant& value, int depth = 0);
+
+    static void encodeNumber(QByteArray& out, double value);
+    static void encodeBoolean(QByteArray& out, bool value);
+    static void encodeString(QByteArray& out, const QString& value);
+    static void encodeNull(QByteArray& out);
+    static void encodeObjectStart(QByteArray& out);
+    //Ended with encodeObjectEnd() like an object, used by onMetaData
+    static void encodeEcmaArrayStart(QByteArray& out, quint32 count);
+    //Property name inside an object, value is encoded right after it
+    static void encodePropertyName(QByteArray& out, const QString& name);
+    static void encodeObjectEnd(QByteArray& out);
+
+private:
+    static double readDouble(const uchar* data);
+    static bool decodeString(const uchar* data, int size, int& offset, int lengthSize, QString& value);
+    static bool decodeProperties(const uchar* data, int size, int& offset, QVariantMap& map, int depth);
+};
+
+#endif /* AMF0_H_ */
@@ -0,0 +1,121 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bitratecontroller.h"
+#include <QDebug>
+
+BitrateController::BitrateController(RTMPPublisher* publisher,
+            EncoderControl* encoder,
+            const int maxBitrate,
+            QObject* parent)
+    :QObject(parent),
+     mPublisher(publisher),
+     mEncoder(encoder),
+     mIsClear(false),
+     mMaxBitrate(maxBitrate),
+     mBitrate(maxBitrate),
+     mDrainRate(0),
+     mLastBytesWritten(0),
+     mLastDroppedCount(0) {
+    mTimer = new QTimer(this);
+    mTimer->setInterval(ABR_INTERVAL_MSEC);
+    connect(mTimer,SIGNAL(timeout()),this,SLOT(on_mTimer_timeout()));
+}
+
+void BitrateController::start()
+{
+    mBitrate = mEncoder->encoderBitrate();
+    if(mBitrate<=0 || mBitrate>mMaxBitrate)
+        mBitrate = mMaxBitrate;
+    mLastBytesWritten = mPublisher->bytesWrittenCounter();
+    mLastDroppedCount = mPublisher->droppedFramesCount();
+    mIsClear = false;
+    mLastChange.start();
+    mTimer->start();
+}
+
+void BitrateController::stop()
+{
+    mTimer->stop();
+    //Next stream starts from the bitrate user asked for
+    if(mBitrate!=mMaxBitrate)
+        mEncoder->setEncoderBitrate(mMaxBitrate);
+    mBitrate = mMaxBitrate;
+}
+
+void BitrateController::on_mTimer_timeout()
+{
+    quint32 bytesWritten = mPublisher->bytesWrittenCounter();
+    quint32 delta = bytesWritten - mLastBytesWritten;   //Counter may wrap, unsigned difference is still right
+    mLastBytesWritten = bytesWritten;
+    mDrainRate = (int) ((qint64) delta*8/ABR_INTERVAL_MSEC);   //bits per msec is kbps
+    int queued = mPublisher->queuedVideoDuration();
+    int pending = mPublisher->bytesPending();
+    int dropped = mPublisher->droppedFramesCount();
+    bool isDropping = dropped>mLastDroppedCount;
+    mLastDroppedCount = dropped;
+
+    if(queued>ABR_HIGH_QUEUE_MSEC ||
+            pending>ABR_HIGH_PENDING_BYTES ||
+            isDropping) {
+        mIsClear = false;
+        if(mLastChange.elapsed()>=ABR_DECREASE_HOLD_MSEC) {
+            int target = (int) (mBitrate*ABR_DECREASE_FACTOR);
+            //Drain rate includes audio and RTMP framing, so it is an upper bound of what video can get
+            if(mDrainRate>0 && mDrainRate*ABR_DRAIN_HEADROOM<target)
+                target = (int) (mDrainRate*ABR_DRAIN_HEADROOM);
+            if(target<ABR_MIN_BITRATE)
+                target = ABR_MIN_BITRATE;
+            if(VERBOSE)
+                qDebug()<<"ABR congested, queued"<<queued<<"pending"<<pending<<"drain"<<mDrainRate<<"kbps";
+            applyBitrate(target);
+        }
+    } else if(queued<ABR_LOW_QUEUE_MSEC &&
+            pending<ABR_HIGH_PENDING_BYTES/4) {
+        if(!mIsClear) {
+            mIsClear = true;
+            mClearSince.start();
+        } else if(mBitrate<mMaxBitrate &&
+                mClearSince.elapsed()>=ABR_INCREASE_HOLD_MSEC &&
+                mLastChange.elapsed()>=ABR_INCREASE_HOLD_MSEC) {
+            int target = (int) (mBitrate*ABR_INCREASE_FACTOR);
+            if(target<mBitrate+32)
+                target = mBitrate+32;
+            if(target>mMaxBitrate)
+                target = mMaxBitrate;
+            applyBitrate(target);
+            mClearSince.restart();
+        }
+    } else {
+        //Neither congested nor clear, hold current bitrate
+        mIsClear = false;
+    }
+}
+
+void BitrateController::applyBitrate(int kbps)
+{
+    if(kbps==mBitrate)
+        return;
+    if(mEncoder->setEncoderBitrate(kbps)) {
+        qDebug()<<"ABR bitrate"<<mBitrate<<"->"<<kbps<<"kbps, drain"<<mDrainRate<<"kbps";
+        mBitrate = kbps;
+        mLastChange.restart();
+        emit bitrateChanged(kbps);
+    } else {
+        qDebug()<<"ABR couldn't set encoder bitrate"<<kbps;
+        //Don't retry on every sample
+        mLastChange.restart();
+    }
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BITRATECONTROLLER_H_
+#define BITRATECONTROLLER_H_
+
+#include <QObject>
+#include <QTimer>
+#include <QTime>
+#include "encodercontrol.h"
+#include "rtmppublisher.h"
+
+#define ABR_INTERVAL_MSEC 500
+#define ABR_MIN_BITRATE 128                 //kbps
+#define ABR_HIGH_QUEUE_MSEC 1000            //Backlog above this is congestion
+#define ABR_LOW_QUEUE_MSEC 250              //Backlog below this counts as clear
+#define ABR_HIGH_PENDING_BYTES (128*1024)   //Unsent socket bytes above this is congestion
+#define ABR_DECREASE_FACTOR 0.75
+#define ABR_DRAIN_HEADROOM 0.85             //Target this share of measured drain rate when stepping down
+#define ABR_INCREASE_FACTOR 1.10
+#define ABR_INCREASE_HOLD_MSEC 5000         //Clear time needed before each step up
+#define ABR_DECREASE_HOLD_MSEC 2000         //Encoder needs this long before a step down shows in backlog
+
+/*
+ * Adaptive bitrate engine. Samples publisher backlog (queued video in msec and unsent socket bytes)
+ * and measured drain rate every ABR_INTERVAL_MSEC, steps encoder bitrate down multiplicatively on
+ * congestion and back up by ABR_INCREASE_FACTOR (at least 32 kbps) each time the link has stayed clear
+ * for ABR_INCREASE_HOLD_MSEC, never above the bitrate the stream was started with.
+ * Lives on the thread of whoever creates it, publisher getters it uses are thread safe.
+ */
+class BitrateController : public QObject
+{
+    Q_OBJECT
+public:
+    BitrateController(RTMPPublisher* publisher,
+            EncoderControl* encoder,
+            const int maxBitrate,
+            QObject* parent = 0);
+
+    int bitrate() { return mBitrate; }
+    int drainRate() { return mDrainRate; }
+
+signals:
+    void bitrateChanged(int kbps);
+
+public slots:
+    void start();
+    void stop();
+
+private slots:
+    void on_mTimer_timeout();
+
+private:
+    void applyBitrate(int kbps);
+
+    RTMPPublisher* mPublisher;
+    EncoderControl* mEncoder;
+    QTimer* mTimer;
+    QTime mLastChange;
+    QTime mClearSince;
+    bool mIsClear;
+    int mMaxBitrate;
+    int mBitrate;
+    int mDrainRate;
+    quint32 mLastBytesWritten;
+    int mLastDroppedCount;
+};
+
+#endif /* BITRATECONTROLLER_H_ */
@@ -0,0 +1,136 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "clipwriter.h"
+#include "frameswriter.h"
+#include "h264.h"
+#include "mp4muxer.h"
+#include "mp4writer.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtAlgorithms>
+#include <QDebug>
+
+static bool frameLessThan(const MediaFrame& a, const MediaFrame& b)
+{
+    return a.dts < b.dts;
+}
+
+ClipWriter::ClipWriter(const PrerollClip& clip, QString path, Format format, QObject* parent)
+    :QObject(parent),
+     mClip(clip),
+     mFormat(format)
+{
+    mWriteLocation = path + (format == FormatMP4 ? MP4WRITER_EXTENSION : FRAMESWRITER_EXTENSION);
+}
+
+void ClipWriter::start()
+{
+    /*
+     * Snapshot is in arrival order, audio may trail video by a frame or two. Stable sort keeps
+     * each track's own order, audio from before the first IDR is dropped.
+     */
+    qStableSort(mClip.frames.begin(), mClip.frames.end(), frameLessThan);
+    long startTS = -1;
+    for (int i = 0; i < mClip.frames.size(); i++) {
+        if (mClip.frames.at(i).type == MediaFrame::VIDEO) {
+            startTS = mClip.frames.at(i).dts;
+            break;
+        }
+    }
+    while (!mClip.frames.isEmpty() && mClip.frames.first().dts < startTS)
+        mClip.frames.removeFirst();
+    for (int i = 0; i < mClip.frames.size(); i++) {
+        mClip.frames[i].dts -= startTS;
+        mClip.frames[i].pts -= startTS;
+    }
+    QDir dir;
+    dir.mkpath(QFileInfo(mWriteLocation).absolutePath());
+    bool isWritten = startTS >= 0 && (mFormat == FormatMP4 ? writeMP4() : writeFLV());
+    if (isWritten) {
+        qDebug()<<"ClipWriter"<<mWriteLocation<<mClip.frames.size()<<"frames";
+        emit clipSaved(mWriteLocation);
+    } else {
+        QFile::remove(mWriteLocation);
+        emit writeLocationError();
+    }
+    mClip.frames.clear();
+    emit finished();
+}
+
+bool ClipWriter::writeMP4()
+{
+    QFile file(mWriteLocation);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug()<<"Can't open"<<mWriteLocation<<file.errorString();
+        return false;
+    }
+    MP4Muxer muxer;
+    muxer.setVideoConfig(mClip.sps, mClip.pps);
+    if (!mClip.aacHeader.isEmpty())
+        muxer.setAudioConfig(mClip.aacHeader);
+    QByteArray out = muxer.initSegment();
+    //Same fragmenting as MP4Writer, one write per fragment
+    for (int i = 0; i < mClip.frames.size(); i++) {
+        const MediaFrame& frame = mClip.frames.at(i);
+        if (frame.type == MediaFrame::AUDIO) {
+            if (!muxer.hasAudio())
+                continue;
+            muxer.addAudioSample(frame.buffer, frame.dts);
+        } else {
+            bool isKeyFrame = frame.isKeyFrame();
+            muxer.addVideoSample(frame.buffer, frame.pts, frame.dts, isKeyFrame);
+            if (!(isKeyFrame && muxer.fragmentDuration() >= MP4WRITER_MIN_FRAGMENT_MSEC) &&
+                    muxer.fragmentBytes() < MP4WRITER_MAX_FRAGMENT_BYTES)
+                continue;
+            muxer.writeFragment(out, false);
+        }
+        if (out.size() > 0) {
+            if (file.write(out) != out.size())
+                return false;
+            out.clear();
+        }
+    }
+    muxer.writeFragment(out, true);
+    bool isWritten = file.write(out) == out.size();
+    file.close();
+    return isWritten;
+}
+
+bool ClipWriter::writeFLV()
+{
+    //Path already carries the extension, FramesWriter would add it again
+    FramesWriter writer(mWriteLocation.left(mWriteLocation.size() - qstrlen(FRAMESWRITER_EXTENSION)));
+    writer.setAudioHeader(mClip.aacHeader, mClip.numChannels, 0, mClip.sampleSize);
+    if (!writer.openFile())
+        return false;
+    MediaFrame frame;
+    frame.type = MediaFrame::VIDEO;
+    frame.dts = 0;
+    frame.pts = 0;
+    frame.buffer = H264::toAVCC(mClip.sps.constData(), mClip.sps.size());
+    writer.writeFrame(frame);
+    frame.buffer = H264::toAVCC(mClip.pps.constData(), mClip.pps.size());
+    writer.writeFrame(frame);
+    for (int i = 0; i < mClip.frames.size(); i++) {
+        if (mClip.frames.at(i).type == MediaFrame::AUDIO && mClip.aacHeader.isEmpty())
+            continue;
+        writer.writeFrame(mClip.frames.at(i));
+    }
+    writer.finalize();
+    return !writer.hasWriteFailed();
+}
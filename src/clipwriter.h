@@ -0,0 +1,59 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef CLIPWRITER_H_
+#define CLIPWRITER_H_
+
+#include <QObject>
+#include <QString>
+#include "prerollbuffer.h"
+
+/*
+ * Writes a PrerollBuffer snapshot to a file on its own thread, live publishers never see it.
+ * MP4 goes straight through MP4Muxer, FLV through a FramesWriter that is driven synchronously.
+ * Frames are put in timestamp order across tracks and rebased so clip starts at 0.
+ */
+class ClipWriter : public QObject
+{
+    Q_OBJECT
+public:
+    enum Format {
+        FormatMP4 = 0,
+        FormatFLV
+    };
+
+    //Path without extension, MP4WRITER_EXTENSION or FRAMESWRITER_EXTENSION is appended
+    ClipWriter(const PrerollClip& clip, QString path, Format format, QObject* parent = 0);
+    QString fileName() { return mWriteLocation; }
+
+signals:
+    void clipSaved(QString fileName);
+    void writeLocationError();
+    void finished();
+
+public slots:
+    void start();
+
+private:
+    bool writeMP4();
+    bool writeFLV();
+
+    PrerollClip mClip;
+    QString mWriteLocation;
+    Format mFormat;
+};
+
+#endif /* CLIPWRITER_H_ */
@@ -14,16 +14,34 @@
  */
 
 #include "controller.h"
+#include "h264.h"
 #include <QUrl>
 #include <QSettings>
 
 Controller::Controller(QObject* parent)
     :QObject(parent) {
     mRTMPPublisher = NULL;
+    mIsPublisherWarm = false;
+    mIsWarmWanted = false;
+    mHasWarmFailed = false;
+    mEncoder = NULL;
+    mBitrateController = NULL;
+    memset(&mStats, 0, sizeof(mStats));
+    mStatsTimer.setInterval(STATS_INTERVAL_MSEC);
+    connect(&mStatsTimer,SIGNAL(timeout()),this,SLOT(publishStats()));
 #if(FRAMESWRITER_ENABLED)
     mFramesWriter = NULL;
+#endif
+#if(MP4WRITER_ENABLED)
+    mMP4Writer = NULL;
+#endif
+#if(HLSWRITER_ENABLED)
+    mHLSWriter = NULL;
 #endif
     setIsStreaming(false);
+#if(PREROLL_ENABLED)
+    mFanOut.addSink(&mPreroll);
+#endif
     connect(this,SIGNAL(hostChanged()),this,SIGNAL(serverDisplayChanged()));
     connect(this,SIGNAL(portChanged()),this,SIGNAL(serverDisplayChanged()));
     connect(this,SIGNAL(appChanged()),this,SIGNAL(serverDisplayChanged()));
@@ -32,24 +50,121 @@ Controller::Controller(QObject* parent)
 
 Controller::~Controller()
 {
+#if(PREROLL_ENABLED)
+    mFanOut.removeSink(&mPreroll);
+#endif
+    stopBitrateController();
     if(mRTMPPublisher!=NULL) {
         mRTMPPublisher->safeStop();
     }
+    stopExtraPublishers();
 #if(FRAMESWRITER_ENABLED)
     if(mFramesWriter!=NULL) {
         mFramesWriter->safeStop();
     }
 #endif
+#if(MP4WRITER_ENABLED)
+    if(mMP4Writer!=NULL) {
+        mMP4Writer->safeStop();
+    }
+#endif
+#if(HLSWRITER_ENABLED)
+    if(mHLSWriter!=NULL) {
+        mHLSWriter->safeStop();
+    }
+#endif
 }
 
 void Controller::on_mRTMPPublisher_finished()
 {
     qDebug()<<"Delete mRTMPPublisher!";
+    stopBitrateController();
+    //Deleted here rather than on its own thread, only once camera threads can't reach it anymore
+    mFanOut.removeSink(mRTMPPublisher);
+    delete mRTMPPublisher;
     mRTMPPublisher = NULL;
+    mIsPublisherWarm = false;
+    mStatsTimer.stop();
+    publishStats();
+    //Have a warm session ready for next start, back off if last one failed
+    if(mIsWarmWanted && !mIsStreaming)
+        QTimer::singleShot(mHasWarmFailed ? WARM_RETRY_MSEC : 0, this, SLOT(prewarm()));
+    mHasWarmFailed = false;
+    emit publisherFinished();
+}
+
+int Controller::findExtraPublisher(QObject* thread)
+{
+    for(int i=0;i<mExtraPublishers.size();i++) {
+        if(mExtraPublishers.at(i).thread==thread)
+            return i;
+    }
+    return -1;
+}
+
+void Controller::on_mExtraPublisher_finished()
+{
+    int index = findExtraPublisher(sender());
+    if(index<0)
+        return;
+    Destination destination = mExtraPublishers.takeAt(index);
+    qDebug()<<"Delete extra publisher"<<destination.url;
+    mFanOut.removeSink(destination.publisher);
+    delete destination.publisher;
+}
+
+void Controller::on_mExtraPublisher_socketError(const int error)
+{
+    //Publisher has used up its reconnects, drop it and keep streaming to the rest
+    for(int i=0;i<mExtraPublishers.size();i++) {
+        if(mExtraPublishers.at(i).publisher==sender()) {
+            qDebug()<<"Controller-Extra destination error"<<mExtraPublishers.at(i).url<<error;
+            mFanOut.removeSink(mExtraPublishers.at(i).publisher);
+            emit destinationError(tr("Socket error! Stopped streaming to %1.").arg(mExtraPublishers.at(i).url));
+            return;
+        }
+    }
+}
+
+void Controller::on_mExtraPublisher_publishStatus(const QString level, const QString code, const QString description)
+{
+    qDebug()<<"Controller-Extra publishStatus"<<level<<code<<description;
+    if(level != "error")
+        return;
+    for(int i=0;i<mExtraPublishers.size();i++) {
+        if(mExtraPublishers.at(i).publisher==sender()) {
+            mFanOut.removeSink(mExtraPublishers.at(i).publisher);
+            mExtraPublishers.at(i).publisher->safeStop();
+            emit destinationError(tr("%1 rejected stream! %2").arg(mExtraPublishers.at(i).url)
+                    .arg(description.isEmpty() ? code : description));
+            return;
+        }
+    }
+}
+
+void Controller::on_mRTMPPublisher_keyFrameRequested()
+{
+    if(mEncoder!=NULL && !mEncoder->requestKeyFrame() && VERBOSE)
+        qDebug()<<"Encoder can't force a key frame";
+    emit keyFrameRequested();
+}
+
+void Controller::stopBitrateController()
+{
+    if(mBitrateController!=NULL) {
+        mBitrateController->stop();
+        delete mBitrateController;
+        mBitrateController = NULL;
+    }
 }
 
 void Controller::on_mRTMPPublisher_socketError(const int error) {
     qDebug()<<"Controller-SocketError"<<error;
+    if(!mIsStreaming) {
+        //Warm session, nobody is waiting on it, it's retried once its thread is done
+        mHasWarmFailed = true;
+        return;
+    }
     QAbstractSocket::SocketError err = (QAbstractSocket::SocketError)error;
     QString errorString = tr("Socket error!");
     if(err == QAbstractSocket::HostNotFoundError)
@@ -62,26 +177,67 @@ void Controller::on_mRTMPPublisher_socketError(const int error) {
         errorString += tr(" %1 refused connection.").arg(mHost);
     else if(err == QAbstractSocket::SocketTimeoutError)
         errorString += tr(" Connection to %1 timed out.").arg(mHost);
+    stopBitrateController();
+    stopExtraPublishers();
     setIsStreaming(false);
     emit publishError(errorString);
 }
 
+void Controller::on_mRTMPPublisher_publishStatus(const QString level, const QString code, const QString description) {
+    qDebug()<<"Controller-publishStatus"<<level<<code<<description;
+    if(level != "error")
+        return;
+    if(!mIsStreaming) {
+        qDebug()<<"Warm session rejected";
+        mHasWarmFailed = true;
+        if(mRTMPPublisher!=NULL)
+            mRTMPPublisher->safeStop();
+        return;
+    }
+    //Server refused connect or publish, eg, NetStream.Publish.BadName for a stream key in use
+    QString errorString = tr("Server rejected stream!");
+    if(!description.isEmpty())
+        errorString += " "+description;
+    else
+        errorString += " "+code;
+    stopStreaming();
+    emit publishError(errorString);
+}
+
 void Controller::on_mFramesWriter_finished() {
     qDebug()<<"Delete mFramesWriter!";
 #if(FRAMESWRITER_ENABLED)
+    mFanOut.removeSink(mFramesWriter);
+    delete mFramesWriter;
     mFramesWriter = NULL;
 #endif
 }
 
+void Controller::on_mMP4Writer_finished() {
+    qDebug()<<"Delete mMP4Writer!";
+#if(MP4WRITER_ENABLED)
+    mFanOut.removeSink(mMP4Writer);
+    delete mMP4Writer;
+    mMP4Writer = NULL;
+#endif
+}
+
+void Controller::on_mHLSWriter_finished() {
+    qDebug()<<"Delete mHLSWriter!";
+#if(HLSWRITER_ENABLED)
+    mFanOut.removeSink(mHLSWriter);
+    delete mHLSWriter;
+    mHLSWriter = NULL;
+#endif
+}
+
 void Controller::clearVars()
 {
     mAudioStartTS = 0;
     mLastAudioTS = 0;
-    mRemainingAudioTS = 0;
     mIsAACHeaderSent = false;
     mVideoStartTS = 0;
     mLastVideoTS = 0;
-    mRemainingVideoTS = 0;
     mIsSPSSent = false;
     mIsPPSSent = false;
     mVideoSPS.clear();
@@ -94,12 +250,42 @@ void Controller::clearVars()
     setAudioChannel("");
 }
 
-void Controller::startStreaming()
+void Controller::prewarm()
 {
-    if(mRTMPPublisher==NULL && !mIsStreaming) {
-        setIsStreaming(true);
-        clearVars();
-        QThread* thread = new QThread();
+#if(WARM_CONNECTION_ENABLED)
+    mIsWarmWanted = true;
+    if(mRTMPPublisher!=NULL || mIsStreaming ||
+            mHost.isEmpty() || mApp.isEmpty() || mPlayPath.isEmpty())
+        return;
+    qDebug()<<"Pre-warming connection to"<<mHost;
+    createPublisher(true);
+#endif
+}
+
+void Controller::coolDown()
+{
+    mIsWarmWanted = false;
+    if(mRTMPPublisher!=NULL && mIsPublisherWarm && !mIsStreaming) {
+        mIsPublisherWarm = false;
+        mRTMPPublisher->safeStop();
+    }
+}
+
+RTMPPublisher* Controller::newPublisher(const QString host, const int port, const QString app, const QString playPath, QThread** thread)
+{
+    //Own thread and own queues per destination, one stalling can't hold up camera or other destinations
+    *thread = new QThread();
+    RTMPPublisher* publisher = new RTMPPublisher(host, port, app, playPath);
+    connect(*thread,SIGNAL(started()),publisher,SLOT(start()));
+    connect(publisher,SIGNAL(socketError(int)),*thread,SLOT(quit()));
+    connect(publisher,SIGNAL(finished()),*thread,SLOT(quit()));
+    publisher->moveToThread(*thread);
+    return publisher;
+}
+
+void Controller::createPublisher(const bool isWarm)
+{
+    QThread* thread;
 //        if(mHost.isEmpty())
 //            setHost("a.rtmp.youtube.com");
 //        setPort(1935);
@@ -107,21 +293,82 @@ void Controller::startStreaming()
 //            setApp("live2");
 //        if(mPlayPath.isEmpty())
 //            setPlayPath("abhishek");
-        mRTMPPublisher = new RTMPPublisher(mHost, mPort, mApp, mPlayPath);
-        connect(thread,SIGNAL(started()),mRTMPPublisher,SLOT(start()));
-        connect(mRTMPPublisher,SIGNAL(socketError(int)),this,SLOT(on_mRTMPPublisher_socketError(int)));
-        connect(mRTMPPublisher,SIGNAL(socketError(int)),thread,SLOT(quit()));
-        connect(mRTMPPublisher,SIGNAL(finished()),thread,SLOT(quit()));
-        connect(mRTMPPublisher,SIGNAL(audioFramesCountChanged()),this,SIGNAL(audioFramesCountChanged()));
-        connect(mRTMPPublisher,SIGNAL(videoFramesCountChanged()),this,SIGNAL(videoFramesCountChanged()));
-        connect(mRTMPPublisher,SIGNAL(audioFramesCountChanged()),this,SIGNAL(totalFramesCountChanged()));
-        connect(mRTMPPublisher,SIGNAL(videoFramesCountChanged()),this,SIGNAL(totalFramesCountChanged()));
-        connect(mRTMPPublisher,SIGNAL(droppedFramesCountChanged()),this,SIGNAL(droppedFramesCountChanged()));
-        connect(thread,SIGNAL(finished()),mRTMPPublisher,SLOT(deleteLater()));
-        connect(thread,SIGNAL(finished()),this,SLOT(on_mRTMPPublisher_finished()));
-        connect(thread,SIGNAL(finished()),thread,SLOT(deleteLater()));
-        mRTMPPublisher->moveToThread(thread);
-        thread->start();
+    mRTMPPublisher = newPublisher(mHost, mPort, mApp, mPlayPath, &thread);
+    mRTMPPublisher->setWarm(isWarm);
+    mIsPublisherWarm = isWarm;
+    if(LATENCY_TRACE_ENABLED)
+        mRTMPPublisher->setLatencyTracer(&mLatencyTracer);
+    connect(mRTMPPublisher,SIGNAL(socketError(int)),this,SLOT(on_mRTMPPublisher_socketError(int)));
+    connect(mRTMPPublisher,SIGNAL(keyFrameRequested()),this,SLOT(on_mRTMPPublisher_keyFrameRequested()));
+    connect(mRTMPPublisher,SIGNAL(publishStatus(QString,QString,QString)),this,SLOT(on_mRTMPPublisher_publishStatus(QString,QString,QString)));
+    connect(thread,SIGNAL(finished()),this,SLOT(on_mRTMPPublisher_finished()));
+    connect(thread,SIGNAL(finished()),thread,SLOT(deleteLater()));
+    mFanOut.addSink(mRTMPPublisher);
+    thread->start();
+    mStatsTimer.start();
+}
+
+void Controller::startExtraPublishers()
+{
+    for(int i=0;i<mExtraServerUrls.size();i++) {
+        Destination destination;
+        QString host, app, playPath;
+        int port;
+        if(!parseServerUrl(mExtraServerUrls.at(i), host, port, app, playPath))
+            continue;
+        destination.url = mExtraServerUrls.at(i);
+        destination.publisher = newPublisher(host, port, app, playPath, &destination.thread);
+        //Key frame requests and bitrate stay with primary, a slow extra destination only drops on its own
+        connect(destination.publisher,SIGNAL(socketError(int)),this,SLOT(on_mExtraPublisher_socketError(int)));
+        connect(destination.publisher,SIGNAL(publishStatus(QString,QString,QString)),this,SLOT(on_mExtraPublisher_publishStatus(QString,QString,QString)));
+        connect(destination.thread,SIGNAL(finished()),this,SLOT(on_mExtraPublisher_finished()));
+        connect(destination.thread,SIGNAL(finished()),destination.thread,SLOT(deleteLater()));
+        mExtraPublishers.append(destination);
+        mFanOut.addSink(destination.publisher);
+        destination.thread->start();
+    }
+}
+
+void Controller::stopExtraPublishers()
+{
+    //Entries go away in on_mExtraPublisher_finished() once each thread is done
+    for(int i=0;i<mExtraPublishers.size();i++) {
+        mFanOut.removeSink(mExtraPublishers.at(i).publisher);
+        mExtraPublishers.at(i).publisher->safeStop();
+    }
+}
+
+void Controller::startBitrateController()
+{
+#if(ADAPTIVE_BITRATE_ENABLED)
+    //Runs on this thread, encoder calls have to come from where the camera was set up
+    if(mEncoder!=NULL && mBitrateController==NULL && mRTMPPublisher!=NULL) {
+        mBitrateController = new BitrateController(mRTMPPublisher, mEncoder, mEncoder->encoderBitrate());
+        mBitrateController->start();
+    }
+#endif
+}
+
+void Controller::startStreaming()
+{
+    //A publisher that is not warm is still shutting down from last stream
+    if(!mIsStreaming && (mRTMPPublisher==NULL || mIsPublisherWarm)) {
+        setIsStreaming(true);
+        clearVars();
+#if(PREROLL_ENABLED)
+        //Timestamps start over, last stream's frames can't go in the same clip
+        mPreroll.clear();
+#endif
+        mLatencyTracer.clear();
+        if(mRTMPPublisher!=NULL) {
+            qDebug()<<"Going live on warm connection";
+            mIsPublisherWarm = false;
+            mRTMPPublisher->goLive();
+        } else {
+            createPublisher(false);
+        }
+        startExtraPublishers();
+        startBitrateController();
 
 #if(FRAMESWRITER_ENABLED)
         if(mFramesWriter==NULL) {
@@ -129,16 +376,74 @@ void Controller::startStreaming()
             mFramesWriter = new FramesWriter("shared/documents/"+QDateTime::currentDateTime().toString("dd-MMM-yy hh:mm:ssAP"));
             connect(thread,SIGNAL(started()),mFramesWriter,SLOT(start()));
             connect(mFramesWriter,SIGNAL(finished()),thread,SLOT(quit()));
-            connect(thread,SIGNAL(finished()),mFramesWriter,SLOT(deleteLater()));
             connect(thread,SIGNAL(finished()),this,SLOT(on_mFramesWriter_finished()));
             connect(thread,SIGNAL(finished()),thread,SLOT(deleteLater()));
             mFramesWriter->moveToThread(thread);
+            mFanOut.addSink(mFramesWriter);
+            thread->start();
+        }
+#endif
+#if(MP4WRITER_ENABLED)
+        if(mMP4Writer==NULL) {
+            QThread* thread = new QThread();
+            mMP4Writer = new MP4Writer("shared/documents/"+QDateTime::currentDateTime().toString("dd-MMM-yy hh:mm:ssAP"));
+            connect(thread,SIGNAL(started()),mMP4Writer,SLOT(start()));
+            connect(mMP4Writer,SIGNAL(finished()),thread,SLOT(quit()));
+            connect(thread,SIGNAL(finished()),this,SLOT(on_mMP4Writer_finished()));
+            connect(thread,SIGNAL(finished()),thread,SLOT(deleteLater()));
+            mMP4Writer->moveToThread(thread);
+            mFanOut.addSink(mMP4Writer);
+            thread->start();
+        }
+#endif
+#if(HLSWRITER_ENABLED)
+        if(mHLSWriter==NULL) {
+            QThread* thread = new QThread();
+            mHLSWriter = new HLSWriter("shared/documents/hls");
+            connect(thread,SIGNAL(started()),mHLSWriter,SLOT(start()));
+            connect(mHLSWriter,SIGNAL(finished()),thread,SLOT(quit()));
+            connect(thread,SIGNAL(finished()),this,SLOT(on_mHLSWriter_finished()));
+            connect(thread,SIGNAL(finished()),thread,SLOT(deleteLater()));
+            mHLSWriter->moveToThread(thread);
+            mFanOut.addSink(mHLSWriter);
             thread->start();
         }
 #endif
     }
 }
 
+bool Controller::saveReplay(bool isMP4)
+{
+#if(PREROLL_ENABLED)
+    PrerollClip clip;
+    if(!mPreroll.snapshot(clip)) {
+        qDebug()<<"Nothing to replay yet";
+        return false;
+    }
+    QThread* thread = new QThread();
+    ClipWriter* writer = new ClipWriter(clip,
+            "shared/documents/Replay "+QDateTime::currentDateTime().toString("dd-MMM-yy hh:mm:ssAP"),
+            isMP4 ? ClipWriter::FormatMP4 : ClipWriter::FormatFLV);
+    connect(thread,SIGNAL(started()),writer,SLOT(start()));
+    connect(writer,SIGNAL(clipSaved(QString)),this,SIGNAL(replaySaved(QString)));
+    connect(writer,SIGNAL(writeLocationError()),this,SLOT(on_mClipWriter_writeLocationError()));
+    connect(writer,SIGNAL(finished()),thread,SLOT(quit()));
+    connect(thread,SIGNAL(finished()),writer,SLOT(deleteLater()));
+    connect(thread,SIGNAL(finished()),thread,SLOT(deleteLater()));
+    writer->moveToThread(thread);
+    thread->start(QThread::LowPriority);
+    return true;
+#else
+    Q_UNUSED(isMP4);
+    return false;
+#endif
+}
+
+void Controller::on_mClipWriter_writeLocationError()
+{
+    emit replayError("Can't write replay");
+}
+
 void Controller::stopStreaming()
 {
     if(mRTMPPublisher!=NULL &&  mIsStreaming) {
@@ -152,186 +457,185 @@ void Controller::stopStreaming()
                     <<"of"
                     <<mTotalBytesDecoded/1024<<"kb";
         }
+        stopBitrateController();
         mRTMPPublisher->safeStop();
+        stopExtraPublishers();
+#if(FRAMESWRITER_ENABLED)
+        //Writes what is buffered and patches onMetaData before it finishes
+        if(mFramesWriter!=NULL) {
+            mFanOut.removeSink(mFramesWriter);
+            mFramesWriter->safeStop();
+        }
+#endif
+#if(MP4WRITER_ENABLED)
+        //Last fragment is written before it finishes, file needs nothing else
+        if(mMP4Writer!=NULL) {
+            mFanOut.removeSink(mMP4Writer);
+            mMP4Writer->safeStop();
+        }
+#endif
+#if(HLSWRITER_ENABLED)
+        //Last part is written and playlist gets EXT-X-ENDLIST before it finishes
+        if(mHLSWriter!=NULL) {
+            mFanOut.removeSink(mHLSWriter);
+            mHLSWriter->safeStop();
+        }
+#endif
         setIsStreaming(false);
     }
+    /*
+     * Camera threads call the clock without a lock, so it is reset here where they are known to be done:
+     * StreamCam stops encoding before it emits streamingStop, also after a publish error, and the cli
+     * runners call this once their source has finished. Next stream starts on a fresh clock.
+     */
+    mClock.reset();
+}
+
+void Controller::sendAudioConfig(const ADTSConfig& config)
+{
+    int samplingRate = ADTS::samplingRate(config.samplingRateIndex);
+    setAudioSamplingRate(QString("%1 kHz").arg((float)samplingRate/1000.0));
+    if(config.channelConfig==1)
+        setAudioChannel("mono");
+    else
+        setAudioChannel("stereo");
+    setAudioBitrate("194 kbps"); //TODO: Actually calculate this
+    qDebug()<<QString("AAC aot=%1; freq=%2(%3); chan=%4").arg(config.objectType).arg(config.samplingRateIndex).arg(samplingRate).arg(config.channelConfig);
+    mFanOut.setAudioHeader(ADTS::audioSpecificConfig(config), config.channelConfig, config.samplingRateIndex, 2);
+    mAudioConfig = config;
+    mIsAACHeaderSent = true;
 }
 
 void Controller::handleAudioFrame(const uint8_t* frameBuffer,
             const uint64_t frameSize,
             const uint64_t timestamp,
-            const bool isKeyFrame)
+            const bool isKeyFrame,
+            const qint64 captureTime)
 {
+    /*
+     * Buffer holds one or more ADTS frames, every header is parsed and its size, CRC and config honoured.
+     * Raw AAC payloads go downstream as slices of one copy of the buffer, each frame timestamped
+     * 1024 samples per block after the one before it. A config change sends a new AudioSpecificConfig.
+     */
+    qint64 captured = captureTime!=0 ? captureTime : LatencyTracer::nowUsec();
+    ADTSFrame frames[CONTROLLER_MAX_ADTS_FRAMES];
+    int count = ADTS::split(frameBuffer, (int)frameSize, frames, CONTROLLER_MAX_ADTS_FRAMES);
+    if(count==0) {
+        qDebug()<<"Bad ADTS frame"<<frameSize<<(frameSize>0 ? (int)frameBuffer[0] : -1);
+        return;
+    }
     if(this->mAudioStartTS==0) {
         this->mAudioStartTS = timestamp;
         this->mLastAudioTS = 0;
-
-        uchar iHeader[7];
-        memcpy(iHeader, frameBuffer, 7);
-        QByteArray k = QByteArray::fromRawData((char*)iHeader, 7);
-        for(int m=0;m<k.size();m++)
-            qDebug()<<(uint8_t)k.at(m);
-        qDebug()<<"First loop done!"<<iHeader<<k;
-        unsigned char firstByte = iHeader[0];
-        if (!((firstByte & 255) == 255 && (firstByte & 240) == 240)) {
-            qDebug()<<"Bad ADTS signature"<<(firstByte & 240)<<(int)firstByte<<iHeader[0];
-            qDebug()<<"Audio signature error";
-            return;
-        }
-        int size = (((iHeader[3] & 3) << 11) | ((iHeader[4] & 255) << 3)) | ((iHeader[5] & 224) >> 5);
-        if (size < 7) {
-            qDebug()<<"Bad ADTS packet size:"<<size;
-            qDebug()<<"Audio packet size error";
-            return;
-        }
-
-        int aot = ((iHeader[2] & 192) >> 6) + 1;
-        int nof = (iHeader[6] & 3) + 1;
-        int samplingRateIndex = (iHeader[2] & 60) >> 2;
-        int channelCount = ((iHeader[2] & 1) << 2) | ((iHeader[3] & 192) >> 6);
-        int iArrLength = 13;
-        int iArr[13] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
-        if (samplingRateIndex < 0 || samplingRateIndex >= iArrLength) {
-//            break;
+    }
+    //Only copy of the payload, headers are skipped by slicing instead of removed afterwards
+    MediaBuffer buffer = MediaBuffer::fromData(frameBuffer, frames[count-1].offset+frames[count-1].size);
+    uint64_t frameTimestamp = timestamp;
+    for(int i=0;i<count;i++) {
+        const ADTSFrame& adts = frames[i];
+        if(mRTMPPublisher!=NULL && (!mIsAACHeaderSent || !ADTS::isSameConfig(adts.config, mAudioConfig)))
+            sendAudioConfig(adts.config);
+        int sampleRate = ADTS::samplingRate(adts.config.samplingRateIndex);
+        int sampleCount = adts.rawBlocks*AAC_SAMPLES_PER_BLOCK;
+        long ts = (long) (mClock.audioTimestamp(frameTimestamp, sampleCount, sampleRate)/1000);
+        frameTimestamp += (uint64_t)sampleCount*1000000/sampleRate;
+        if(adts.rawBlocks!=1) {
+            //FLV and MP4 take one block per frame, blocks without CRC can't even be found
+            qDebug()<<"Skipping ADTS frame of"<<adts.rawBlocks<<"blocks";
+            continue;
         }
-        int samplingRate = iArr[samplingRateIndex];
-        setAudioSamplingRate(QString("%1 kHz").arg((float)samplingRate/1000.0));
-        if(channelCount==1)
-            setAudioChannel("mono");
-        else
-            setAudioChannel("stereo");
-        setAudioBitrate("194 kbps"); //TODO: Actually calculate this
-        qDebug()<<QString("AAC aot=%1; freq=%2(%3); chan=%4; nof=%5").arg(aot).arg(samplingRateIndex).arg(samplingRate).arg(channelCount).arg(nof);
-        uchar header[2] = {(uchar) ((samplingRateIndex >> 1) | 16), (uchar) ((samplingRateIndex << 7) | (channelCount << 3))};
-        QByteArray h = QByteArray::fromRawData((char*)header, 2);
-        qDebug()<<"Header"<<header<<h;
-        if(!mIsAACHeaderSent && mRTMPPublisher!=NULL)
-            mRTMPPublisher->setAudioHeader(h, channelCount, samplingRateIndex, 2);
-        else
+        mAudioFrameCount++;
+        if(VERBOSE)
+            qDebug()<<"AudioFrames"<<mAudioFrameCount<<isKeyFrame<<ts<<adts.payloadSize<<i;
+        if(mRTMPPublisher!=NULL) {
+            MediaFrame frame;
+            frame.buffer = buffer.mid(adts.payloadOffset, adts.payloadSize);
+            frame.dts = ts;
+            frame.pts = ts;
+            frame.type = MediaFrame::AUDIO;
+            frame.times.capture = captured;
+            mTotalBytesDecoded += frame.buffer.size();
+            mFanOut.postFrame(frame);
+        } else
             qDebug()<<"RTMPPublisher is NULL! Audio!";
+        this->mLastAudioTS = ts;
     }
-    QByteArray buffer(reinterpret_cast<const char*>(frameBuffer), frameSize);
-    buffer.remove(0,7);  //Remove AAC header
-    long ts = (timestamp-this->mAudioStartTS);
-    mRemainingAudioTS += ts%1000;
-    ts /= 1000;
-    if(mRemainingAudioTS>=1000) {
-        ts += 1;
-        mRemainingAudioTS -= 1000;
-    }
-    mAudioFrameCount++;
-    if(VERBOSE)
-        qDebug()<<"AudioFrames"<<mAudioFrameCount<<isKeyFrame<<ts<<buffer.size();
-    if(mRTMPPublisher!=NULL) {
-        MediaFrame frame;
-        frame.buffer = buffer;
-        frame.dts = ts;
-        frame.pts = ts;
-        frame.type = MediaFrame::AUDIO;
-        mTotalBytesDecoded += frame.buffer.size();
-        mRTMPPublisher->postFrame(frame);
-#if(FRAMESWRITER_ENABLED)
-        if(mFramesWriter!=NULL)
-            mFramesWriter->postFrame(frame);
-#endif
-    } else
-        qDebug()<<"RTMPPublisher is NULL! Audio!";
-    this->mLastAudioTS = ts;
 }
 
 void Controller::handleVideoFrame(const uint8_t* frameBuffer,
             const uint64_t frameSize,
             const uint64_t timestamp,
-            const bool isKeyFrame)
+            const bool isKeyFrame,
+            const qint64 captureTime)
 {
-    QByteArray buffer(reinterpret_cast<const char*>(frameBuffer), frameSize);
-    int prefixSize = 4;
+    /*
+     * Frame is one Annex-B access unit in whatever layout the encoder picked: AUD, SEI, parameter sets and
+     * any number of slices. It's split by start codes and every NAL is classified, parameter sets are kept
+     * from the first frame that has them, AUD/SEI/filler are dropped (FLV and MP4 carry none of them) and
+     * picture NALs are copied once into a single AVCC sample, ie, one MediaFrame per picture however many
+     * slices it has. Sinks see one keyframe per IDR picture and write the sample as it is.
+     */
+    const char* data = reinterpret_cast<const char*>(frameBuffer);
+    H264NALUnit units[CONTROLLER_MAX_NALS];
+    int count = H264::splitAnnexB(data, (int)frameSize, units, CONTROLLER_MAX_NALS);
     MediaFrame frame;
     frame.type = MediaFrame::VIDEO;
-    int type;
+    frame.times.capture = captureTime!=0 ? captureTime : LatencyTracer::nowUsec();
+    int pictureCount = 0;
+    for(int i=0;i<count;i++) {
+        if(units[i].type==H264_NAL_SPS && mVideoSPS.isEmpty())
+            mVideoSPS = QByteArray(data+units[i].offset, units[i].size);
+        else if(units[i].type==H264_NAL_PPS && mVideoPPS.isEmpty())
+            mVideoPPS = QByteArray(data+units[i].offset, units[i].size);
+        else if(H264::isPictureNAL(units[i].type))
+            units[pictureCount++] = units[i];   //Compacted in place, never ahead of i
+    }
+    if(pictureCount==0) {
+        qDebug()<<"----Video frame without picture"<<frameSize<<count;
+        return;
+    }
     if(this->mVideoStartTS==0) {
+        //Decoder config has to go first, nothing is sent till the encoder has given both
+        if(mVideoSPS.isEmpty() || mVideoPPS.isEmpty()) {
+            qDebug()<<"----Waiting for SPS/PPS"<<isKeyFrame;
+            return;
+        }
         this->mVideoStartTS = timestamp;
         this->mLastVideoTS = 0;
-        for(int i=4;i<frameSize && i<40;i++) {
-            if(i+3<frameSize) {
-                if(((uint8_t)buffer.at(i))==0 &&
-                        ((uint8_t)buffer.at(i+1))==0 &&
-                        ((uint8_t)buffer.at(i+2))==0 &&
-                        ((uint8_t)buffer.at(i+3))==1) {
-                    //0001 is H264, In AVC this will be size of NAL
-                    //Moving to AVC might clean this code?
-                    if(mVideoSPS.isEmpty()) {
-                        mVideoSPS = buffer.left(i);
-                    }
-                    if(mVideoPPS.isEmpty()) {
-                        mVideoPPS = buffer.mid(mVideoSPS.size(), i-mVideoSPS.size());
-                    }
-                    if(!mVideoSPS.isEmpty() && !mVideoPPS.isEmpty())
-                        break;
-                }
-            }
-        }
-        mVideoSPS.remove(0, prefixSize);
         mVideoFrameCount++;
-        type = ((uchar)mVideoSPS.at(0) & 31);
         if(VERBOSE)
-            qDebug()<<"----VideoFrames"<<mVideoFrameCount<<0<<mVideoSPS.size()<<type;
+            qDebug()<<"----VideoFrames"<<mVideoFrameCount<<0<<mVideoSPS.size()<<H264_NAL_SPS;
         if(mRTMPPublisher!=NULL) {
-            frame.buffer = mVideoSPS;
+            frame.buffer = H264::toAVCC(mVideoSPS.constData(), mVideoSPS.size());
             frame.dts = 0;
             frame.pts = frame.dts;
             mTotalBytesDecoded += frame.buffer.size();
-            mRTMPPublisher->postFrame(frame);
-#if(FRAMESWRITER_ENABLED)
-            if(mFramesWriter!=NULL)
-                mFramesWriter->postFrame(frame);
-#endif
+            mFanOut.postFrame(frame);
         } else
             qDebug()<<"----RTMPPublisher is NULL! Video!";
-        mVideoPPS.remove(0, prefixSize);
         mVideoFrameCount++;
-        type = ((uchar)mVideoSPS.at(0) & 31);
         if(VERBOSE)
-            qDebug()<<"----VideoFrames"<<mVideoFrameCount<<1<<mVideoPPS.size()<<type;
+            qDebug()<<"----VideoFrames"<<mVideoFrameCount<<1<<mVideoPPS.size()<<H264_NAL_PPS;
         if(mRTMPPublisher!=NULL) {
-            frame.buffer = mVideoPPS;
+            frame.buffer = H264::toAVCC(mVideoPPS.constData(), mVideoPPS.size());
             frame.dts = 1;
             frame.pts = frame.dts;
             mTotalBytesDecoded += frame.buffer.size();
-            mRTMPPublisher->postFrame(frame);
-#if(FRAMESWRITER_ENABLED)
-            if(mFramesWriter!=NULL)
-                mFramesWriter->postFrame(frame);
-#endif
+            mFanOut.postFrame(frame);
         } else
             qDebug()<<"----RTMPPublisher is NULL! Video!";
     }
-    if(isKeyFrame) {
-        prefixSize *= 3;
-        prefixSize += mVideoSPS.size()+mVideoPPS.size();
-    }
-    buffer.remove(0, prefixSize);  //Remove NAL prefix
-    long ts = (timestamp-this->mVideoStartTS);
-    mRemainingVideoTS += ts%1000;
-    ts /= 1000;
-    if(mRemainingVideoTS>=1000) {
-        ts += 1;
-        mRemainingVideoTS -= 1000;
-    }
+    //Only copy of the payload, AUD/SEI/SPS/PPS between slices are left out
+    long ts = (long) (mClock.videoTimestamp(timestamp)/1000);
     mVideoFrameCount++;
-    type = ((uchar)buffer.at(0) & 31);
     if(VERBOSE)
-        qDebug()<<"----VideoFrames"<<mVideoFrameCount<<isKeyFrame<<ts<<buffer.size()<<type;
+        qDebug()<<"----VideoFrames"<<mVideoFrameCount<<isKeyFrame<<ts<<frameSize<<pictureCount;
     if(mRTMPPublisher!=NULL) {
-        frame.buffer = buffer;
+        frame.buffer = H264::toAVCC(data, units, pictureCount);
         frame.dts = ts+2;   //Adding 2 for SPS & PPS
         frame.pts = frame.dts;
         mTotalBytesDecoded += frame.buffer.size();
-        mRTMPPublisher->postFrame(frame);
-#if(FRAMESWRITER_ENABLED)
-        if(mFramesWriter!=NULL)
-            mFramesWriter->postFrame(frame);
-#endif
+        mFanOut.postFrame(frame);
     } else
         qDebug()<<"----RTMPPublisher is NULL! Video!";
     this->mLastVideoTS = ts;
@@ -346,55 +650,76 @@ QString Controller::serverDisplay()
 }
 
 
-bool Controller::setServer(QString serverUrl, bool doSave) {
+bool Controller::parseServerUrl(QString serverUrl, QString& host, int& port, QString& app, QString& playPath) {
     if(!serverUrl.startsWith("rtmp://") &&
             !serverUrl.startsWith("https://") &&
             !serverUrl.startsWith("http://"))
         serverUrl = "rtmp://"+serverUrl;
     QUrl url(serverUrl);
     if(!url.isValid()) return false;
-    setHost(url.host());
-    setPort(url.port(1935));
     QString path = url.path();
     if(path.startsWith("/"))
         path = path.right(path.size()-1);
     if(!path.contains("/") ||
             path.count("/")!=1)
         return false;
-    setApp(path.split("/").first());
-    setPlayPath(path.split("/").last());
+    host = url.host();
+    port = url.port(1935);
+    app = path.split("/").first();
+    playPath = path.split("/").last();
+    return true;
+}
+
+bool Controller::setServer(QString serverUrl, bool doSave) {
+    QString host, app, playPath;
+    int port;
+    if(!parseServerUrl(serverUrl, host, port, app, playPath))
+        return false;
+    setHost(host);
+    setPort(port);
+    setApp(app);
+    setPlayPath(playPath);
     if(doSave) {
         QSettings settings("ShowStopper", "StreamCam");
         settings.setValue(KEY_SERVER_URL, serverUrl);
     }
+    //Warm session points at old server, replace it
+    if(mRTMPPublisher!=NULL && mIsPublisherWarm && !mIsStreaming) {
+        mIsPublisherWarm = false;
+        mRTMPPublisher->safeStop();
+    } else if(mIsWarmWanted)
+        prewarm();
     return true;
 }
 
-int Controller::droppedFramesCount() {
-    if(mRTMPPublisher!=NULL)
-        return mRTMPPublisher->droppedFramesCount();
-    else
-        return 0;
-}
-
-int Controller::totalFramesCount() {
-    if(mRTMPPublisher!=NULL)
-        return mRTMPPublisher->totalFramesCount();
-    else
-        return 0;
-}
-
-int Controller::audioFramesCount() {
-    if(mRTMPPublisher!=NULL)
-        return mRTMPPublisher->audioFramesCount();
-    else
-        return 0;
-}
-int Controller::videoFramesCount() {
-    if(mRTMPPublisher!=NULL)
-        return mRTMPPublisher->videoFramesCount();
-    else
-        return 0;
+void Controller::publishStats()
+{
+    /*
+     * Publisher counters are atomics bumped on camera threads and nothing is signalled per frame.
+     * They are copied here once per tick, and only properties that moved are notified, so GUI thread
+     * gets a few events a second no matter the frame rate.
+     */
+    StreamStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if(mRTMPPublisher!=NULL) {
+        stats.audioFrames = mRTMPPublisher->audioFramesCount();
+        stats.videoFrames = mRTMPPublisher->videoFramesCount();
+        stats.droppedFrames = mRTMPPublisher->droppedFramesCount();
+        stats.bytesSent = mRTMPPublisher->totalBytesWritten();
+    }
+    StreamStats last = mStats;
+    mStats = stats;
+    if(stats.audioFrames!=last.audioFrames)
+        emit audioFramesCountChanged();
+    if(stats.videoFrames!=last.videoFrames)
+        emit videoFramesCountChanged();
+    if(stats.audioFrames+stats.videoFrames!=last.audioFrames+last.videoFrames)
+        emit totalFramesCountChanged();
+    if(stats.droppedFrames!=last.droppedFrames)
+        emit droppedFramesCountChanged();
+    if(stats.audioFrames!=last.audioFrames || stats.videoFrames!=last.videoFrames ||
+            stats.droppedFrames!=last.droppedFrames || stats.bytesSent!=last.bytesSent)
+        emit statsChanged();
 }
 
 qint64 Controller::totalBytesSent() {
@@ -404,5 +729,50 @@ qint64 Controller::totalBytesSent() {
         return 0;
 }
 
+QVariantList Controller::destinationStats() {
+    QVariantList stats;
+    QList<Destination> destinations;
+    if(mRTMPPublisher!=NULL) {
+        Destination primary;
+        primary.url = serverDisplay();
+        primary.publisher = mRTMPPublisher;
+        primary.thread = NULL;
+        destinations.append(primary);
+    }
+    destinations += mExtraPublishers;
+    for(int i=0;i<destinations.size();i++) {
+        QVariantMap map;
+        map["url"] = destinations.at(i).url;
+        map["bytesSent"] = destinations.at(i).publisher->totalBytesWritten();
+        map["droppedFrames"] = destinations.at(i).publisher->droppedFramesCount();
+        map["totalFrames"] = destinations.at(i).publisher->totalFramesCount();
+        map["queuedVideoMsec"] = destinations.at(i).publisher->queuedVideoDuration();
+        map["bytesPending"] = destinations.at(i).publisher->bytesPending();
+        map["lostReplays"] = destinations.at(i).publisher->lostReplaysCount();
+        stats.append(map);
+    }
+    return stats;
+}
 
+bool Controller::addDestination(QString serverUrl, bool doSave) {
+    QString host, app, playPath;
+    int port;
+    if(mExtraServerUrls.size()>=MAX_EXTRA_DESTINATIONS ||
+            !parseServerUrl(serverUrl, host, port, app, playPath))
+        return false;
+    if(!mExtraServerUrls.contains(serverUrl))
+        mExtraServerUrls.append(serverUrl);
+    if(doSave) {
+        QSettings settings("ShowStopper", "StreamCam");
+        settings.setValue(KEY_EXTRA_SERVER_URLS, mExtraServerUrls);
+    }
+    return true;
+}
 
+void Controller::clearDestinations(bool doSave) {
+    mExtraServerUrls.clear();
+    if(doSave) {
+        QSettings settings("ShowStopper", "StreamCam");
+        settings.remove(KEY_EXTRA_SERVER_URLS);
+    }
+}
@@ -20,10 +20,42 @@
 #include <QTimer>
 #include "rtmppublisher.h"
 #include "frameswriter.h"
+#include "mp4writer.h"
+#include "hlswriter.h"
+#include "bitratecontroller.h"
+#include "encodercontrol.h"
+#include "mediafanout.h"
+#include "prerollbuffer.h"
+#include "clipwriter.h"
+#include "latencytracer.h"
+#include "adts.h"
+#include "mediaclock.h"
+#include <QStringList>
+#include <QVariant>
 #include <stdint.h>
 
-#define FRAMESWRITER_ENABLED false
+#define FRAMESWRITER_ENABLED true
+#define MP4WRITER_ENABLED false
+#define HLSWRITER_ENABLED false
+#define PREROLL_ENABLED true
+#define LATENCY_TRACE_ENABLED true
+#define ADAPTIVE_BITRATE_ENABLED true
+#define WARM_CONNECTION_ENABLED true
+#define WARM_RETRY_MSEC 5000
+#define MAX_EXTRA_DESTINATIONS 4
+#define STATS_INTERVAL_MSEC 250         //Frame counters reach QML at most this often
+#define CONTROLLER_MAX_ADTS_FRAMES 16   //Per audio buffer
+#define CONTROLLER_MAX_NALS 256         //Per access unit, 4K encoders may cut a picture into many slices
 #define KEY_SERVER_URL "Server_Url"
+#define KEY_EXTRA_SERVER_URLS "Extra_Server_Urls"
+
+//Primary publisher's counters as of last stats tick, all zero without a publisher
+struct StreamStats {
+    int audioFrames;
+    int videoFrames;
+    int droppedFrames;
+    qint64 bytesSent;
+};
 
 class Controller : public QObject
 {
@@ -51,6 +83,7 @@ public:
     void setAudioBitrate(const QString audioBitrate) { mAudioBitrate = audioBitrate; emit audioBitrateChanged(); }
     void setAudioSamplingRate(const QString audioSamplingRate) { mAudioSamplingRate = audioSamplingRate; emit audioSamplingRateChanged(); }
     void setAudioChannel(const QString audioChannel) { mAudioChannel = audioChannel; emit audioChannelChanged(); }
+    void setEncoderControl(EncoderControl* encoder) { mEncoder = encoder; }
 
     QString host() { return mHost; }
     int port() { return mPort; }
@@ -63,30 +96,64 @@ public:
     QString audioSamplingRate() { return mAudioSamplingRate; }
     QString audioChannel() { return mAudioChannel; }
 
-    int droppedFramesCount();
-    int totalFramesCount();
-    int audioFramesCount();
-    int videoFramesCount();
+    //From the stats snapshot, not the live counters
+    int droppedFramesCount() { return mStats.droppedFrames; }
+    int totalFramesCount() { return mStats.audioFrames+mStats.videoFrames; }
+    int audioFramesCount() { return mStats.audioFrames; }
+    int videoFramesCount() { return mStats.videoFrames; }
+    StreamStats stats() { return mStats; }
+    void setStatsInterval(const int msec) { mStatsTimer.setInterval(msec); }
     qint64 totalBytesSent();
+    QStringList extraDestinations() { return mExtraServerUrls; }
+    //One map per destination, primary first: url, bytesSent, droppedFrames, totalFrames
+    Q_INVOKABLE QVariantList destinationStats();
+    //Primary destination, one map per track, see LatencyTracer::stats()
+    Q_INVOKABLE QVariantList latencyStats() { return mLatencyTracer.stats(); }
+    //Keeps recent frames' trace points for exportLatencyTrace()
+    void setLatencyTraceExport(const bool isEnabled) { mLatencyTracer.setExportEnabled(isEnabled); }
+    bool exportLatencyTrace(QString fileName) { return mLatencyTracer.exportChromeTrace(fileName); }
+    //Encoder's configured rate, first guess for video timestamp smoothing
+    void setVideoFrameRate(const double fps) { mClock.setVideoFrameRate(fps); }
 
 public slots:
     void startStreaming();
     void stopStreaming();
+    //captureTime is LatencyTracer::nowUsec() at encoder callback, 0 takes it here
     void handleAudioFrame(const uint8_t* frameBuffer,
             const uint64_t frameSize,
             const uint64_t timestamp,
-            const bool isKeyFrame);
+            const bool isKeyFrame,
+            const qint64 captureTime = 0);
+    //captureTime is LatencyTracer::nowUsec() at encoder callback, 0 takes it here
     void handleVideoFrame(const uint8_t* frameBuffer,
             const uint64_t frameSize,
             const uint64_t timestamp,
-            const bool isKeyFrame);
+            const bool isKeyFrame,
+            const qint64 captureTime = 0);
     bool setServer(QString serverUrl, bool doSave = true);
+    //Extra ingest URLs the same encode goes to, taken up on next startStreaming()
+    bool addDestination(QString serverUrl, bool doSave = true);
+    void clearDestinations(bool doSave = true);
+    //Viewfinder is up, open RTMP session now so start has no connection setup left to do
+    void prewarm();
+    void coolDown();
+    //Last PREROLL_DURATION_MSEC of the stream to a file, written in background. False if nothing to save yet.
+    bool saveReplay(bool isMP4 = true);
 
 
 private slots:
+    void publishStats();
     void on_mRTMPPublisher_socketError(const int error);
     void on_mRTMPPublisher_finished();
     void on_mFramesWriter_finished();
+    void on_mMP4Writer_finished();
+    void on_mHLSWriter_finished();
+    void on_mRTMPPublisher_keyFrameRequested();
+    void on_mRTMPPublisher_publishStatus(const QString level, const QString code, const QString description);
+    void on_mExtraPublisher_socketError(const int error);
+    void on_mExtraPublisher_publishStatus(const QString level, const QString code, const QString description);
+    void on_mExtraPublisher_finished();
+    void on_mClipWriter_writeLocationError();
 
 signals:
     void hostChanged();
@@ -102,11 +169,36 @@ signals:
     void videoFramesCountChanged();
     void droppedFramesCountChanged();
     void totalFramesCountChanged();
+    //Once per stats tick that changed anything, after the property signals
+    void statsChanged();
+    //Publisher started dropping video, encoder should send an IDR as soon as it can
+    void keyFrameRequested();
 
     void publishError(QString error);
+    //Primary publisher is gone, eg, stream stopped and everything sent
+    void publisherFinished();
+    //An extra destination gave up, stream goes on to the others
+    void destinationError(QString error);
+    void replaySaved(QString fileName);
+    void replayError(QString error);
 
 private:
+    struct Destination {
+        QString url;
+        RTMPPublisher* publisher;
+        QThread* thread;
+    };
+
     void clearVars();
+    static bool parseServerUrl(QString serverUrl, QString& host, int& port, QString& app, QString& playPath);
+    RTMPPublisher* newPublisher(const QString host, const int port, const QString app, const QString playPath, QThread** thread);
+    void createPublisher(const bool isWarm);
+    void startExtraPublishers();
+    void stopExtraPublishers();
+    int findExtraPublisher(QObject* thread);
+    void startBitrateController();
+    void stopBitrateController();
+    void sendAudioConfig(const ADTSConfig& config);
     QString mHost;
     int mPort;
     QString mApp;
@@ -115,11 +207,11 @@ private:
     int mVideoFileDescriptor;
     uint64_t mAudioStartTS;
     long mLastAudioTS;
-    int mRemainingAudioTS;
     bool mIsAACHeaderSent;
+    ADTSConfig mAudioConfig;        //Last one sent, valid while mIsAACHeaderSent
+    MediaClock mClock;
     uint64_t mVideoStartTS;
     long mLastVideoTS;
-    int mRemainingVideoTS;
     bool mIsSPSSent;
     bool mIsPPSSent;
     int mAudioFrameCount;
@@ -128,9 +220,32 @@ private:
     QByteArray mVideoPPS;
     long mTotalBytesDecoded;
     RTMPPublisher* mRTMPPublisher;
+    bool mIsPublisherWarm;          //mRTMPPublisher is a warm session not yet live
+    bool mIsWarmWanted;
+    bool mHasWarmFailed;
+    EncoderControl* mEncoder;
+    BitrateController* mBitrateController;
+    //Every destination's postFrame() goes through here, camera threads never touch publishers directly
+    MediaFanOut mFanOut;
+    QStringList mExtraServerUrls;
+    QList<Destination> mExtraPublishers;
 #if(FRAMESWRITER_ENABLED)
     FramesWriter* mFramesWriter;
 #endif
+#if(MP4WRITER_ENABLED)
+    MP4Writer* mMP4Writer;
+#endif
+#if(HLSWRITER_ENABLED)
+    HLSWriter* mHLSWriter;
+#endif
+#if(PREROLL_ENABLED)
+    //Always a sink of mFanOut, arena is allocated once here
+    PrerollBuffer mPreroll;
+#endif
+
+    LatencyTracer mLatencyTracer;
+    QTimer mStatsTimer;
+    StreamStats mStats;
 
     //For QML
     QString mAudioBitrate;
@@ -0,0 +1,35 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ENCODERCONTROL_H_
+#define ENCODERCONTROL_H_
+
+/*
+ * Runtime knobs of whatever produces the encoded frames.
+ * StreamCam implements this on top of the camera encoder, other sources can plug in their own.
+ */
+class EncoderControl
+{
+public:
+    virtual ~EncoderControl() {}
+
+    //Video bitrate currently asked from the encoder, in kbps
+    virtual int encoderBitrate() = 0;
+    virtual bool setEncoderBitrate(const int kbps) = 0;
+    //Ask for an IDR as soon as possible, returns false if encoder can't do that
+    virtual bool requestKeyFrame() = 0;
+};
+
+#endif /* ENCODERCONTROL_H_ */
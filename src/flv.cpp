@@ -0,0 +1,92 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "flv.h"
+
+unsigned char FLV::aacSoundFormat(int nchan, int ssize) {
+    //1010 11xy, format 10 and rate 3 are fixed for AAC, decoder takes real values from AudioSpecificConfig
+    return (unsigned char) ((((nchan - 1) & 1) | 172) | (((ssize - 1) & 1) << 1));
+}
+
+void FLV::audioTagHeader(unsigned char* out, unsigned char soundFormat, int aacPacketType) {
+    out[0] = soundFormat;
+    out[1] = (unsigned char) aacPacketType;
+}
+
+void FLV::videoTagHeader(unsigned char* out, bool isKeyFrame, int avcPacketType, long compositionTime) {
+    //Frame type 1 (key) or 2 (inter) in upper nibble, codec id 7 in lower
+    out[0] = (unsigned char) (((isKeyFrame ? 1 : 2) << 4) | FLV_CODEC_AVC);
+    out[1] = (unsigned char) avcPacketType;
+    putUInt24(out + 2, (quint32) compositionTime);
+}
+
+QByteArray FLV::avcDecoderConfigurationRecord(const QByteArray& sps, const QByteArray& pps) {
+    /*
+     * Version 1, profile, compatibility and level copied from SPS bytes 1-3, 0xFF for 4 byte NAL lengths,
+     * 0xE1 for one SPS, then 16 bit SPS length and SPS, one PPS, 16 bit PPS length and PPS.
+     */
+    QByteArray record;
+    record.reserve(11 + sps.size() + pps.size());
+    unsigned char header[8] = {1, 0, 0, 0, 0xFF, 0xE1, 0, 0};
+    if (sps.size() >= 4) {
+        header[1] = (unsigned char) sps.at(1);
+        header[2] = (unsigned char) sps.at(2);
+        header[3] = (unsigned char) sps.at(3);
+    }
+    putUInt16(header + 6, sps.size());
+    record.append(reinterpret_cast<const char*>(header), 8);
+    record.append(sps);
+    unsigned char ppsHeader[3] = {1, 0, 0};
+    putUInt16(ppsHeader + 1, pps.size());
+    record.append(reinterpret_cast<const char*>(ppsHeader), 3);
+    record.append(pps);
+    return record;
+}
+
+void FLV::fileHeader(unsigned char* out, bool hasAudio, bool hasVideo) {
+    out[0] = 'F';
+    out[1] = 'L';
+    out[2] = 'V';
+    out[3] = 1;
+    out[4] = (unsigned char) ((hasAudio ? 4 : 0) | (hasVideo ? 1 : 0));
+    putUInt32(out + 5, FLV_HEADER_SIZE);
+}
+
+void FLV::tagHeader(unsigned char* out, int type, int dataSize, long timestamp) {
+    out[0] = (unsigned char) type;
+    putUInt24(out + 1, dataSize);
+    putUInt24(out + 4, (quint32) timestamp & 0xFFFFFF);
+    out[7] = (unsigned char) (((quint32) timestamp >> 24) & 255);
+    putUInt24(out + 8, 0);  //Stream id, always 0
+}
+
+void FLV::putUInt16(unsigned char* out, quint32 value) {
+    out[0] = (unsigned char) ((value >> 8) & 255);
+    out[1] = (unsigned char) (value & 255);
+}
+
+void FLV::putUInt24(unsigned char* out, quint32 value) {
+    out[0] = (unsigned char) ((value >> 16) & 255);
+    out[1] = (unsigned char) ((value >> 8) & 255);
+    out[2] = (unsigned char) (value & 255);
+}
+
+void FLV::putUInt32(unsigned char* out, quint32 value) {
+    out[0] = (unsigned char) ((value >> 24) & 255);
+    out[1] = (unsigned char) ((value >> 16) & 255);
+    out[2] = (unsigned char) ((value >> 8) & 255);
+    out[3] = (unsigned char) (value & 255);
+}
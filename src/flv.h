@@ -0,0 +1,69 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef FLV_H_
+#define FLV_H_
+
+#include <QByteArray>
+
+#define FLV_HEADER_SIZE 9
+#define FLV_TAG_HEADER_SIZE 11
+#define FLV_PREVIOUS_TAG_SIZE 4
+#define FLV_AUDIO_HEADER_SIZE 2
+#define FLV_VIDEO_HEADER_SIZE 5
+
+//Tag types, same numbers as RTMP message types
+#define FLV_TAG_AUDIO 8
+#define FLV_TAG_VIDEO 9
+#define FLV_TAG_SCRIPT 18
+
+#define FLV_CODEC_AVC 7
+#define FLV_CODEC_AAC 10
+
+//AACPacketType and AVCPacketType
+#define FLV_AAC_SEQUENCE_HEADER 0
+#define FLV_AAC_RAW 1
+#define FLV_AVC_SEQUENCE_HEADER 0
+#define FLV_AVC_NALU 1
+
+/*
+ * FLV tag layouts, shared by RTMP messages and recorded FLV files.
+ * An RTMP audio or video message body is exactly an FLV tag body, ie, the codec header written here followed
+ * by the payload. Files add the 11 byte tag header in front and the 4 byte previous tag size after each tag.
+ */
+class FLV
+{
+public:
+    //Sound format byte of an AAC tag, AAC/44 kHz, sample size and channel bits from stream parameters
+    static unsigned char aacSoundFormat(int nchan, int ssize);
+    //FLV_AUDIO_HEADER_SIZE bytes
+    static void audioTagHeader(unsigned char* out, unsigned char soundFormat, int aacPacketType);
+    //FLV_VIDEO_HEADER_SIZE bytes, frame type/codec, AVCPacketType and 24 bit composition time (pts-dts)
+    static void videoTagHeader(unsigned char* out, bool isKeyFrame, int avcPacketType, long compositionTime);
+    //Body of an AVC sequence header, one SPS and one PPS, both without start code
+    static QByteArray avcDecoderConfigurationRecord(const QByteArray& sps, const QByteArray& pps);
+
+    //FLV_HEADER_SIZE bytes, signature, version, track flags and header size
+    static void fileHeader(unsigned char* out, bool hasAudio, bool hasVideo);
+    //FLV_TAG_HEADER_SIZE bytes, timestamp in msec with its upper 8 bits in the extension byte
+    static void tagHeader(unsigned char* out, int type, int dataSize, long timestamp);
+
+    static void putUInt16(unsigned char* out, quint32 value);
+    static void putUInt24(unsigned char* out, quint32 value);
+    static void putUInt32(unsigned char* out, quint32 value);
+};
+
+#endif /* FLV_H_ */
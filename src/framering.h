@@ -0,0 +1,153 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAMERING_H_
+#define FRAMERING_H_
+
+#include <QAtomicInt>
+
+#define FRAMERING_CACHE_LINE 64
+
+/*
+ * Ordering for index loads and stores without a read-modify-write. Qt 5 has loadAcquire()/storeRelease(),
+ * Qt 4 only plain reads and writes of the volatile value, so those get a barrier next to them.
+ * x86 doesn't reorder loads with loads or stores with stores, only the compiler has to be held back there.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+#define FRAMERING_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define FRAMERING_BARRIER() __sync_synchronize()
+#endif
+
+/*
+ * Bounded single-producer/single-consumer ring.
+ * Slots are allocated once in the constructor, push() and pop() never lock or allocate.
+ * Only one thread may call push() and only one (other) thread may call peek()/peekAt()/pop()/clear().
+ * Capacity is rounded up to a power of two so indices can be masked instead of divided.
+ * Each index is written by one side only, so it reads its own index plainly and the other one with acquire.
+ * Head and tail sit on cache lines of their own, producer and consumer don't keep stealing each other's.
+ */
+template <typename T>
+class FrameRing
+{
+public:
+    explicit FrameRing(int capacity)
+        :mHead(0), mTail(0) {
+        int size = 1;
+        while (size < capacity)
+            size <<= 1;
+        mCapacity = size;
+        mMask = size - 1;
+        mSlots = new T[size];
+    }
+
+    ~FrameRing() {
+        delete[] mSlots;
+    }
+
+    int capacity() const { return mCapacity; }
+
+    //Approximate when called from neither end, exact for the producer or the consumer
+    int size() const {
+        return loadAcquire(mTail) - loadAcquire(mHead);
+    }
+
+    bool isEmpty() const { return size() <= 0; }
+
+    //Producer side. Returns false if ring is full, item is not queued then.
+    bool push(const T& item) {
+        int tail = loadRelaxed(mTail);
+        if (tail - loadAcquire(mHead) >= mCapacity)
+            return false;
+        mSlots[tail & mMask] = item;
+        storeRelease(mTail, tail + 1);
+        return true;
+    }
+
+    //Consumer side. Returns NULL if ring is empty. Pointer is valid till next pop().
+    T* peek() {
+        int head = loadRelaxed(mHead);
+        if (head == loadAcquire(mTail))
+            return NULL;
+        return &mSlots[head & mMask];
+    }
+
+    //Consumer side. Returns NULL if fewer than index+1 items are queued.
+    T* peekAt(int index) {
+        int head = loadRelaxed(mHead);
+        if (index < 0 || index >= loadAcquire(mTail) - head)
+            return NULL;
+        return &mSlots[(head + index) & mMask];
+    }
+
+    //Consumer side. Slot is reset so ring doesn't keep frame data alive.
+    bool pop(T& item) {
+        int head = loadRelaxed(mHead);
+        if (head == loadAcquire(mTail))
+            return false;
+        item = mSlots[head & mMask];
+        mSlots[head & mMask] = T();
+        storeRelease(mHead, head + 1);
+        return true;
+    }
+
+    //Consumer side.
+    void clear() {
+        T item;
+        while (pop(item)) {}
+    }
+
+private:
+    Q_DISABLE_COPY(FrameRing)
+
+    static inline int loadRelaxed(const QAtomicInt& value) {
+#if QT_VERSION >= 0x050000
+        return value.load();
+#else
+        return value;
+#endif
+    }
+
+    static inline int loadAcquire(const QAtomicInt& value) {
+#if QT_VERSION >= 0x050000
+        return value.loadAcquire();
+#else
+        int result = value;
+        FRAMERING_BARRIER();
+        return result;
+#endif
+    }
+
+    static inline void storeRelease(QAtomicInt& value, int newValue) {
+#if QT_VERSION >= 0x050000
+        value.storeRelease(newValue);
+#else
+        FRAMERING_BARRIER();
+        value = newValue;
+#endif
+    }
+
+    T* mSlots;
+    int mCapacity;
+    int mMask;
+    //Full lines either side, the ring itself isn't necessarily line aligned
+    char mPadBeforeHead[FRAMERING_CACHE_LINE];
+    QAtomicInt mHead;               //Written by consumer only
+    char mPadBeforeTail[FRAMERING_CACHE_LINE];
+    QAtomicInt mTail;               //Written by producer only
+    char mPadAfterTail[FRAMERING_CACHE_LINE];
+};
+
+#endif /* FRAMERING_H_ */
@@ -13,156 +13,335 @@
  * limitations under the License.
  */
 
+
 #include "frameswriter.h"
+#include "flv.h"
+#include "amf0.h"
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
 #include <QDebug>
 
 FramesWriter::FramesWriter(QString path, QObject* parent)
     :QObject(parent),
      mWriteLocation(path),
+     mAudioQueue(FRAMESWRITER_MAX_QUEUE_SIZE),
+     mVideoQueue(FRAMESWRITER_MAX_QUEUE_SIZE),
+     mIsPumpScheduled(0),
+     mDroppedFramesCount(0),
      mIsStopped(false),
-     mAudioFramesReceivedCount(0),
-     mVideoFramesReceivedCount(0),
-     mDroppedFramesCount(0)
+     mIsDroppingToKeyFrame(false),
+     mNumChannels(0),
+     mSampleSize(0),
+     mFileOffset(0),
+     mDurationOffset(-1),
+     mFileSizeOffset(-1),
+     mLastTimestamp(0),
+     mHasWriteFailed(false),
+     mHasAudio(false),
+     mHasVideo(false),
+     mSoundFormat(0),
+     mWriteCount(0),
+     mInterleaver(2)
 {
+    mInterleaveTimer = new QTimer(this);
+    mInterleaveTimer->setSingleShot(true);
+    QObject::connect(mInterleaveTimer,SIGNAL(timeout()),this,SLOT(pumpFrames()));
+    mInterleaveClock.start();
     if(path.isEmpty())
         path = "shared/documents/"+QDateTime::currentDateTime().toString("dd-MMM-yy hh:mm:ssAP");
-    mWriteLocation = path;
+    mWriteLocation = path+FRAMESWRITER_EXTENSION;
     QDir dir;
-    dir.mkpath(mWriteLocation);
-    mLock = new QMutex();
+    dir.mkpath(QFileInfo(mWriteLocation).absolutePath());
 }
 
 FramesWriter::~FramesWriter() {}
 
 void FramesWriter::start()
 {
-    mAudioQueue.clear();
-    mVideoQueue.clear();
-    mIsStopped = false;
-    run();
+    if (!openFile()) {
+        mIsStopped = true;
+        emit writeLocationError();
+        emit finished();
+        return;
+    }
+    schedulePump();
+}
+
+void FramesWriter::setAudioHeader(QByteArray header, int nchan, int srate, int ssize)
+{
+    Q_UNUSED(srate);
+    mConfigLock.lock();
+    mAACHeader = header;
+    mNumChannels = nchan;
+    mSampleSize = ssize;
+    mConfigLock.unlock();
 }
 
 void FramesWriter::postFrame(MediaFrame frame)
 {
-    if(this->mIsStopped) return;
-    mLock->lock();
+    //Camera threads, one producer per ring, never blocks
+    if (mIsStopped)
+        return;
     if (frame.type == MediaFrame::EOS) {
-        this->mVideoQueue.append(frame);
-        this->mAudioQueue.append(frame);
-        mCondition.wakeAll();
+        safeStop();
+        return;
+    }
+    bool isQueued;
+    if (frame.type == MediaFrame::AUDIO) {
+        isQueued = mAudioQueue.push(frame);
+    } else if (frame.isSequenceHeader()) {
+        isQueued = mVideoQueue.push(frame);
     } else {
-        QLinkedList<MediaFrame> *queue;
-        if(frame.type == MediaFrame::AUDIO) {
-            queue = &mAudioQueue;
-            mAudioFramesReceivedCount++;
-        } else {
-            queue = &mVideoQueue;
-            mVideoFramesReceivedCount++;
-        }
-        if (queue->size() >= MAX_QUEUE_SIZE) {
-//            qDebug()<<"Drop frame";
-            mDroppedFramesCount++;
-        } else {
-            queue->append(frame);
-            mCondition.wakeAll();
-        }
+        //Pictures after a dropped one reference it, the file skips ahead to the next IDR instead
+        if (frame.isKeyFrame())
+            mIsDroppingToKeyFrame = false;
+        isQueued = !mIsDroppingToKeyFrame && mVideoQueue.push(frame);
+        if (!isQueued)
+            mIsDroppingToKeyFrame = true;
     }
-    mLock->unlock();
+    if (!isQueued) {
+        mDroppedFramesCount.fetchAndAddRelaxed(1);
+        return;
+    }
+    schedulePump();
 }
 
-void FramesWriter::run()
+void FramesWriter::schedulePump()
 {
-    qDebug()<<"Thread";
-    mIsStopped = false;
-    bool video = false;
-    bool audio = false;
-    while (!mIsStopped) {
-        mLock->lock();
-        MediaFrame audioFrame;
-        MediaFrame videoFrame;
-        MediaFrame frame;
-        while (!mIsStopped) {
-            if (!mIsStopped && this->mAudioQueue.isEmpty() && audio) {
-                mCondition.wait(mLock);
-            } else {
-                if (!this->mAudioQueue.isEmpty()) {
-                    audioFrame = this->mAudioQueue.first();
-                    audio = true;
-                    if (audioFrame.type == MediaFrame::EOS) {
-                        return;
-                    }
-                }
-                while (!mIsStopped && this->mVideoQueue.isEmpty() && video) {
-                    mCondition.wait(mLock);
-                }
-                if (!this->mVideoQueue.isEmpty()) {
-                    videoFrame = this->mVideoQueue.first();
-                    video = true;
-                    if (videoFrame.type == MediaFrame::EOS) {
-                        return;
-                    }
-                }
-                if (!audioFrame.isEmpty() && (videoFrame.isEmpty() || audioFrame.dts < videoFrame.dts)) {
-                    if(VERBOSE)
-                        qDebug()<<"--Sending AUDIO DTS"<<audioFrame.dts<<"size"<<audioFrame.buffer.size()<<"Video Queue Size"<<mVideoQueue.size();
-                    frame = audioFrame;
-                    mAudioQueue.removeFirst();
-                } else if (!videoFrame.isEmpty()) {
-                    if(VERBOSE)
-                        qDebug()<<"----Sending VIDEO DTS"<<videoFrame.dts<<"size"<<videoFrame.buffer.size()<<"Audio Queue Size"<<mAudioQueue.size();
-                    frame = videoFrame;
-                    mVideoQueue.removeFirst();
-                } else {
-                    if(!mIsStopped)
-                        mCondition.wait(mLock);
-                }
-                if (!frame.isEmpty()) {
-                    mLock->unlock();
-                    switch (frame.type) {
-                        case MediaFrame::AUDIO:
-                            writeAudioFrame(1000000+frame.pts, frame.buffer);
-                            break;
-                        case MediaFrame::VIDEO:
-                            writeVideoFrame(1000000+frame.pts, frame.buffer);
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-                }
-            }
+    if (mIsPumpScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "pumpFrames", Qt::QueuedConnection);
+}
+
+void FramesWriter::pumpFrames()
+{
+    /*
+     * Writes frames of both rings in dts order. Once a track has started, its next frame is waited for
+     * before anything else is written, so audio and video tags stay interleaved in the file, but no longer
+     * than the interleaver allows.
+     */
+    mIsPumpScheduled.fetchAndStoreOrdered(0);
+    while (!mIsStopped && !mHasWriteFailed) {
+        MediaFrame* audioFrame = mAudioQueue.peek();
+        MediaFrame* videoFrame = mVideoQueue.peek();
+        long heads[2];
+        heads[INTERLEAVER_TRACK_VIDEO] = videoFrame != NULL ? videoFrame->dts : INTERLEAVER_EMPTY;
+        heads[INTERLEAVER_TRACK_AUDIO] = audioFrame != NULL ? audioFrame->dts : INTERLEAVER_EMPTY;
+        int track = mInterleaver.next(heads, mInterleaveClock.elapsed());
+        if (track < 0) {
+            int wait = mInterleaver.waitMsec(mInterleaveClock.elapsed());
+            if (wait >= 0 && !mInterleaveTimer->isActive())
+                mInterleaveTimer->start(wait);
+            return;
         }
+        MediaFrame frame;
+        if (track == INTERLEAVER_TRACK_AUDIO)
+            mAudioQueue.pop(frame);
+        else
+            mVideoQueue.pop(frame);
+        mInterleaver.taken(track, frame.dts);
+        writeFrame(frame);
     }
-    qDebug()<<"Thread finished"<<mIsStopped;
-    if(mIsStopped)
-        emit finished();
 }
 
-bool FramesWriter::writeAudioFrame(const long timestamp, const QByteArray data)
+bool FramesWriter::openFile()
+{
+    mFile.setFileName(mWriteLocation);
+    //Unbuffered, mBuffer already hands over whole blocks
+    if (!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        qDebug()<<"Can't open"<<mWriteLocation<<mFile.errorString();
+        return false;
+    }
+    mBuffer.reserve(2*FRAMESWRITER_BLOCK_SIZE);
+    unsigned char header[FLV_HEADER_SIZE+FLV_PREVIOUS_TAG_SIZE];
+    FLV::fileHeader(header, true, true);
+    FLV::putUInt32(header+FLV_HEADER_SIZE, 0);
+    mBuffer.append(reinterpret_cast<const char*>(header), sizeof(header));
+    writeMetaData();
+    return true;
+}
+
+void FramesWriter::writeMetaData()
+{
+    /*
+     * Script tag with onMetaData ECMA array. Duration and filesize are unknown till stop,
+     * their offsets in the file are kept so finalize() can overwrite the 8 byte doubles.
+     */
+    QByteArray body;
+    AMF0::encodeString(body, "onMetaData");
+    AMF0::encodeEcmaArrayStart(body, 4);
+    AMF0::encodePropertyName(body, "duration");
+    int durationOffset = body.size() + 1;   //Past number marker
+    AMF0::encodeNumber(body, 0);
+    AMF0::encodePropertyName(body, "filesize");
+    int fileSizeOffset = body.size() + 1;
+    AMF0::encodeNumber(body, 0);
+    AMF0::encodePropertyName(body, "videocodecid");
+    AMF0::encodeNumber(body, FLV_CODEC_AVC);
+    AMF0::encodePropertyName(body, "audiocodecid");
+    AMF0::encodeNumber(body, FLV_CODEC_AAC);
+    AMF0::encodeObjectEnd(body);
+    qint64 bodyStart = mFileOffset + mBuffer.size() + FLV_TAG_HEADER_SIZE;
+    mDurationOffset = bodyStart + durationOffset;
+    mFileSizeOffset = bodyStart + fileSizeOffset;
+    writeTag(FLV_TAG_SCRIPT, 0, NULL, 0, body.constData(), body.size());
+}
+
+void FramesWriter::writeFrame(const MediaFrame& frame)
+{
+    if (mHasWriteFailed || frame.buffer.isEmpty())
+        return;
+    switch (frame.type) {
+        case MediaFrame::AUDIO:
+            writeAudioFrame(frame.dts, frame.buffer);
+            break;
+        case MediaFrame::VIDEO:
+            writeVideoFrame(frame);
+            break;
+        default:
+            break;
+    }
+}
+
+void FramesWriter::writeAudioFrame(const long timestamp, const MediaBuffer& data)
+{
+    unsigned char tag[FLV_AUDIO_HEADER_SIZE];
+    if (!mHasAudio) {
+        //AAC sequence header first, raw frames can't be decoded without AudioSpecificConfig
+        mConfigLock.lock();
+        QByteArray header = mAACHeader;
+        int nchan = mNumChannels;
+        int ssize = mSampleSize;
+        mConfigLock.unlock();
+        if (header.isEmpty())
+            return;
+        mSoundFormat = FLV::aacSoundFormat(nchan, ssize);
+        FLV::audioTagHeader(tag, mSoundFormat, FLV_AAC_SEQUENCE_HEADER);
+        writeTag(FLV_TAG_AUDIO, timestamp, tag, FLV_AUDIO_HEADER_SIZE, header.constData(), header.size());
+        mHasAudio = true;
+    }
+    FLV::audioTagHeader(tag, mSoundFormat, FLV_AAC_RAW);
+    writeTag(FLV_TAG_AUDIO, timestamp, tag, FLV_AUDIO_HEADER_SIZE, data.constData(), data.size());
+}
+
+void FramesWriter::writeVideoFrame(const MediaFrame& frame)
+{
+    //Same as RTMPPublisher::sendVideoFrame(), SPS/PPS go into the AVC sequence header before first frame
+    int nalType = frame.nalType();
+    if (nalType == 7) {
+        mSPS = frame.firstNAL().toByteArray();
+        return;
+    } else if (nalType == 8) {
+        mPPS = frame.firstNAL().toByteArray();
+        return;
+    }
+    unsigned char tag[FLV_VIDEO_HEADER_SIZE];
+    if (!mHasVideo) {
+        if (mSPS.isEmpty() || mPPS.isEmpty())
+            return;
+        QByteArray record = FLV::avcDecoderConfigurationRecord(mSPS, mPPS);
+        FLV::videoTagHeader(tag, true, FLV_AVC_SEQUENCE_HEADER, 0);
+        writeTag(FLV_TAG_VIDEO, frame.dts, tag, FLV_VIDEO_HEADER_SIZE, record.constData(), record.size());
+        mHasVideo = true;
+    }
+    FLV::videoTagHeader(tag, nalType == 5, FLV_AVC_NALU, frame.pts - frame.dts);
+    writeTag(FLV_TAG_VIDEO, frame.dts, tag, FLV_VIDEO_HEADER_SIZE, frame.buffer.constData(), frame.buffer.size());
+}
+
+void FramesWriter::writeTag(int type, long timestamp, const unsigned char* bodyHeader, int bodyHeaderLength,
+        const char* payload, int payloadLength)
+{
+    //Tag header, codec header, payload and previous tag size land next to each other in mBuffer
+    int dataSize = bodyHeaderLength + payloadLength;
+    unsigned char header[FLV_TAG_HEADER_SIZE];
+    unsigned char tagSize[FLV_PREVIOUS_TAG_SIZE];
+    FLV::tagHeader(header, type, dataSize, timestamp);
+    FLV::putUInt32(tagSize, FLV_TAG_HEADER_SIZE + dataSize);
+    mBuffer.append(reinterpret_cast<const char*>(header), FLV_TAG_HEADER_SIZE);
+    if (bodyHeaderLength > 0)
+        mBuffer.append(reinterpret_cast<const char*>(bodyHeader), bodyHeaderLength);
+    if (payloadLength > 0)
+        mBuffer.append(payload, payloadLength);
+    mBuffer.append(reinterpret_cast<const char*>(tagSize), FLV_PREVIOUS_TAG_SIZE);
+    if (timestamp > mLastTimestamp)
+        mLastTimestamp = timestamp;
+    if (mBuffer.size() >= FRAMESWRITER_BLOCK_SIZE)
+        flushBuffer(false);
+}
+
+void FramesWriter::flushBuffer(bool isFinal)
 {
-    QFile file(mWriteLocation+"/"+QString::number(timestamp)+"-AUDIO.frame");
-    if(file.open(QIODevice::WriteOnly)) {
-        file.write(data);
-        file.close();
-        return true;
+    //Whole blocks only while recording, remainder stays in mBuffer for next time
+    int length = mBuffer.size();
+    if (!isFinal)
+        length -= length % FRAMESWRITER_BLOCK_SIZE;
+    if (length <= 0 || mHasWriteFailed)
+        return;
+    qint64 written = mFile.write(mBuffer.constData(), length);
+    mWriteCount++;
+    if (written != length) {
+        qDebug()<<"FramesWriter write failed"<<mFile.errorString();
+        mHasWriteFailed = true;
+        mBuffer.clear();
+        emit writeLocationError();
+        return;
     }
-    return false;
+    mFileOffset += length;
+    mBuffer.remove(0, length);
 }
 
-bool FramesWriter::writeVideoFrame(const long timestamp, const QByteArray data)
+void FramesWriter::finalize()
 {
-    QFile file(mWriteLocation+"/"+QString::number(timestamp)+"-VIDEO.frame");
-    if(file.open(QIODevice::WriteOnly)) {
-        file.write(data);
-        file.close();
-        return true;
+    flushBuffer(true);
+    if (!mFile.isOpen())
+        return;
+    if (!mHasWriteFailed && mDurationOffset >= 0) {
+        QByteArray number;
+        AMF0::encodeNumber(number, mLastTimestamp/1000.0);
+        if (mFile.seek(mDurationOffset))
+            mFile.write(number.constData()+1, 8);
+        number.clear();
+        AMF0::encodeNumber(number, (double) mFileOffset);
+        if (mFile.seek(mFileSizeOffset))
+            mFile.write(number.constData()+1, 8);
     }
-    return false;
+    mFile.close();
 }
 
 void FramesWriter::safeStop()
 {
+    if (mIsStopped)
+        return;
     mIsStopped = true;
-    mCondition.wakeAll();
+    //May be called from any thread, queued frames and the tail are written on writer's own thread
+    QMetaObject::invokeMethod(this, "stop", Qt::QueuedConnection);
+}
+
+void FramesWriter::stop()
+{
+    /*
+     * Camera threads are detached from the fan-out before safeStop(), what the rings hold is all there is.
+     * It goes out in dts order without waiting on either track, then the tail and onMetaData.
+     */
+    mInterleaveTimer->stop();
+    if (mFile.isOpen()) {
+        MediaFrame* audioFrame;
+        MediaFrame* videoFrame;
+        while (!mHasWriteFailed) {
+            audioFrame = mAudioQueue.peek();
+            videoFrame = mVideoQueue.peek();
+            if (audioFrame == NULL && videoFrame == NULL)
+                break;
+            MediaFrame frame;
+            if (videoFrame == NULL || (audioFrame != NULL && audioFrame->dts < videoFrame->dts))
+                mAudioQueue.pop(frame);
+            else
+                mVideoQueue.pop(frame);
+            writeFrame(frame);
+        }
+        finalize();
+    }
+    qDebug()<<"FramesWriter"<<mWriteLocation<<mFileOffset/1024<<"kb in"<<mWriteCount<<"writes,"
+            <<droppedFramesCount()<<"frames dropped";
+    emit finished();
 }
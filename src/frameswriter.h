@@ -13,6 +13,7 @@
  * limitations under the License.
  */
 
+
 #ifndef FRAMESWRITER_H_
 #define FRAMESWRITER_H_
 
@@ -20,23 +21,47 @@
 #include <QThread>
 #include <QDir>
 #include <QFile>
-#include <QLinkedList>
 #include <QMutex>
-#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QTimer>
+#include <QElapsedTimer>
 #include "mediaframe.h"
+#include "mediasink.h"
+#include "framering.h"
+#include "interleaver.h"
 
 #define VERBOSE false
-#define MAX_QUEUE_SIZE 32
+#define FRAMESWRITER_MAX_QUEUE_SIZE 256     //Per track, a slow card drops frames instead of growing memory
+#define FRAMESWRITER_BLOCK_SIZE (256*1024)  //File is written in multiples of this, so writes stay block aligned
+#define FRAMESWRITER_EXTENSION ".flv"
 
-class FramesWriter : public QObject
+/*
+ * Records the stream locally as one append-only FLV file.
+ * Tags are assembled in memory, tag header, codec header and payload back to back, and the file only sees
+ * whole FRAMESWRITER_BLOCK_SIZE blocks while recording. On stop whatever is still queued is written, then
+ * the tail, and duration and filesize in onMetaData are patched in place, so the file needs no remux to be
+ * seekable.
+ * Frames arrive on camera threads into two single-producer rings like MP4Writer's, tags are written on
+ * writer's own thread. A full video ring drops up to the next IDR, never a single picture of a GOP.
+ */
+class FramesWriter : public QObject, public MediaSink
 {
     Q_OBJECT
 public:
+    //Path without extension, FRAMESWRITER_EXTENSION is appended
     FramesWriter(QString path = QString(),
             QObject* parent = 0);
     ~FramesWriter();
-    void run();
+    void setAudioHeader(QByteArray header, int nchan, int srate, int ssize);
     void postFrame(MediaFrame frame);
+    QString fileName() { return mWriteLocation; }
+    int droppedFramesCount() { return mDroppedFramesCount.fetchAndAddRelaxed(0); }
+
+    //Writing on caller's thread without start(), eg, a clip already in memory. setAudioHeader() comes first.
+    bool openFile();
+    void writeFrame(const MediaFrame& frame);
+    void finalize();
+    bool hasWriteFailed() { return mHasWriteFailed; }
 
 signals:
     void writeLocationError();
@@ -47,20 +72,49 @@ public slots:
     void safeStop();
 
 private slots:
+    void pumpFrames();
+    void stop();
 
 private:
-    bool writeAudioFrame(const long timestamp, const QByteArray data);
-    bool writeVideoFrame(const long timestamp, const QByteArray data);
+    void schedulePump();
+    void writeMetaData();
+    void writeAudioFrame(const long timestamp, const MediaBuffer& data);
+    void writeVideoFrame(const MediaFrame& frame);
+    void writeTag(int type, long timestamp, const unsigned char* bodyHeader, int bodyHeaderLength,
+            const char* payload, int payloadLength);
+    void flushBuffer(bool isFinal);
 
     QString mWriteLocation;
-    QMutex* mLock;
-    QWaitCondition mCondition;
-    bool mIsStopped;
-    QLinkedList<MediaFrame> mAudioQueue;
-    QLinkedList<MediaFrame> mVideoQueue;
-    int mAudioFramesReceivedCount;
-    int mVideoFramesReceivedCount;
-    int mDroppedFramesCount;
+    FrameRing<MediaFrame> mAudioQueue;
+    FrameRing<MediaFrame> mVideoQueue;
+    QAtomicInt mIsPumpScheduled;
+    QAtomicInt mDroppedFramesCount;
+    volatile bool mIsStopped;
+    bool mIsDroppingToKeyFrame;     //Camera video thread only
+
+    //Set by camera audio thread under mConfigLock
+    QMutex mConfigLock;
+    QByteArray mAACHeader;
+    int mNumChannels;
+    int mSampleSize;
+
+    //Writer thread only
+    QFile mFile;
+    QByteArray mBuffer;             //Tags not written yet, starts at file offset mFileOffset
+    qint64 mFileOffset;
+    qint64 mDurationOffset;         //File offsets of onMetaData numbers patched on stop
+    qint64 mFileSizeOffset;
+    long mLastTimestamp;
+    bool mHasWriteFailed;
+    bool mHasAudio;
+    bool mHasVideo;
+    unsigned char mSoundFormat;
+    QByteArray mSPS;
+    QByteArray mPPS;
+    qint64 mWriteCount;
+    Interleaver mInterleaver;
+    QElapsedTimer mInterleaveClock;
+    QTimer* mInterleaveTimer;       //Gives up on a late track
 };
 
 #endif /* FRAMESWRITER_H_ */
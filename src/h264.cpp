@@ -0,0 +1,288 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "h264.h"
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+//Exp-Golomb reader over RBSP, reads past the end return zeros and set mIsOverrun
+class BitReader
+{
+public:
+    BitReader(const QByteArray& data)
+        :mData(reinterpret_cast<const uchar*>(data.constData())),
+         mSizeBits(data.size()*8),
+         mPos(0),
+         mIsOverrun(false) {}
+
+    quint32 bits(int count) {
+        quint32 value = 0;
+        for (int i = 0; i < count; i++) {
+            value <<= 1;
+            if (mPos >= mSizeBits) {
+                mIsOverrun = true;
+            } else {
+                value |= (mData[mPos >> 3] >> (7 - (mPos & 7))) & 1;
+            }
+            mPos++;
+        }
+        return value;
+    }
+
+    bool bit() { return bits(1) != 0; }
+
+    quint32 ue() {
+        int leadingZeros = 0;
+        while (!bit()) {
+            if (mIsOverrun || ++leadingZeros > 31)
+                return 0;
+        }
+        if (leadingZeros == 0)
+            return 0;
+        return ((1u << leadingZeros) - 1) + bits(leadingZeros);
+    }
+
+    qint32 se() {
+        quint32 value = ue();
+        if (value & 1)
+            return (qint32) ((value + 1) / 2);
+        return -(qint32) (value / 2);
+    }
+
+    bool isOverrun() { return mIsOverrun; }
+
+private:
+    const uchar* mData;
+    int mSizeBits;
+    int mPos;
+    bool mIsOverrun;
+};
+
+void skipScalingList(BitReader& reader, int size) {
+    int lastScale = 8;
+    int nextScale = 8;
+    for (int i = 0; i < size; i++) {
+        if (nextScale != 0)
+            nextScale = (lastScale + reader.se() + 256) % 256;
+        lastScale = (nextScale == 0) ? lastScale : nextScale;
+    }
+}
+
+}
+
+QByteArray H264::toRBSP(const char* data, int size) {
+    QByteArray rbsp;
+    rbsp.reserve(size);
+    int zeros = 0;
+    for (int i = 0; i < size; i++) {
+        char c = data[i];
+        if (zeros >= 2 && c == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = (c == 0) ? zeros + 1 : 0;
+        rbsp.append(c);
+    }
+    return rbsp;
+}
+
+int H264::findStartCodeScalar(const char* data, int size, int from, int& codeLength) {
+    for (int i = from; i + 2 < size; i++) {
+        if (data[i] != 0 || data[i+1] != 0)
+            continue;
+        if (data[i+2] == 1) {
+            if (i > from && data[i-1] == 0) {
+                codeLength = 4;
+                return i - 1;
+            }
+            codeLength = 3;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int H264::findStartCode(const char* data, int size, int from, int& codeLength) {
+    /*
+     * Candidate 00 00 01 at i is tested for 16 values of i at once: bytes i, i+1 and i+2 are loaded as three
+     * overlapping vectors and compared to 0, 0 and 1. Emulation prevention keeps 00 00 01 out of NAL payload,
+     * so a block with any match is rare and the exact position is found there. Tail goes byte by byte.
+     */
+    int i = from;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 18 <= size; i += 16) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(data + i);
+        __m128i first = _mm_cmpeq_epi8(_mm_loadu_si128(p), zero);
+        __m128i second = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1)), zero);
+        __m128i third = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2)), one);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(first, second), third));
+        if (mask != 0) {
+            i += __builtin_ctz(mask);
+            break;
+        }
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    for (; i + 18 <= size; i += 16) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data + i);
+        uint8x16_t match = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero)),
+                vceqq_u8(vld1q_u8(p + 2), one));
+        uint64x2_t lanes = vreinterpretq_u64_u8(match);
+        //No movemask on NEON, block with a match is rescanned below
+        if ((vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) != 0)
+            break;
+    }
+#endif
+    int position = findStartCodeScalar(data, size, i, codeLength);
+    //A 4 byte code whose leading zero is just before the block the vector loop stopped at
+    if (position == i && codeLength == 3 && i > from && data[i-1] == 0) {
+        codeLength = 4;
+        return i - 1;
+    }
+    return position;
+}
+
+int H264::splitAnnexB(const char* data, int size, H264NALUnit* units, int maxUnits) {
+    int count = 0;
+    int codeLength = 0;
+    int start = findStartCode(data, size, 0, codeLength);
+    while (start >= 0 && count < maxUnits) {
+        int nalStart = start + codeLength;
+        int next = findStartCode(data, size, nalStart, codeLength);
+        int nalEnd = next >= 0 ? next : size;
+        //trailing_zero_8bits before next start code belong to neither NAL
+        while (nalEnd > nalStart && data[nalEnd-1] == 0)
+            nalEnd--;
+        if (nalEnd > nalStart) {
+            H264NALUnit& unit = units[count++];
+            unit.offset = nalStart;
+            unit.size = nalEnd - nalStart;
+            unit.type = data[nalStart] & 31;
+        }
+        start = next;
+    }
+    return count;
+}
+
+MediaBuffer H264::toAVCC(const char* data, const H264NALUnit* units, int count) {
+    int size = 0;
+    for (int i = 0; i < count; i++)
+        size += H264_AVCC_LENGTH_SIZE + units[i].size;
+    MediaBuffer sample = MediaBuffer::allocate(size);
+    char* out = sample.data();
+    if (out == NULL)
+        return sample;
+    for (int i = 0; i < count; i++) {
+        quint32 length = (quint32) units[i].size;
+        out[0] = (char) (length >> 24);
+        out[1] = (char) (length >> 16);
+        out[2] = (char) (length >> 8);
+        out[3] = (char) length;
+        memcpy(out + H264_AVCC_LENGTH_SIZE, data + units[i].offset, units[i].size);
+        out += H264_AVCC_LENGTH_SIZE + units[i].size;
+    }
+    return sample;
+}
+
+MediaBuffer H264::toAVCC(const char* nal, int size) {
+    H264NALUnit unit;
+    unit.offset = 0;
+    unit.size = size;
+    unit.type = size > 0 ? nal[0] & 31 : 0;
+    return toAVCC(nal, &unit, 1);
+}
+
+bool H264::parseSPS(const QByteArray& sps, H264SPSInfo& info) {
+    /*
+     * seq_parameter_set_data() of H.264 section 7.3.2.1.1, only far enough for frame size.
+     * High profiles carry chroma format and scaling matrices before the common part.
+     */
+    if (sps.size() < 4 || (sps.at(0) & 31) != 7)
+        return false;
+    BitReader reader(toRBSP(sps.constData() + 1, sps.size() - 1));
+    info.profile = reader.bits(8);
+    info.constraints = reader.bits(8);
+    info.level = reader.bits(8);
+    reader.ue();    //seq_parameter_set_id
+    int chromaFormat = 1;
+    bool isSeparateColourPlane = false;
+    int profile = info.profile;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+            profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+            profile == 139 || profile == 134 || profile == 135) {
+        chromaFormat = reader.ue();
+        if (chromaFormat == 3)
+            isSeparateColourPlane = reader.bit();
+        reader.ue();    //bit_depth_luma_minus8
+        reader.ue();    //bit_depth_chroma_minus8
+        reader.bit();   //qpprime_y_zero_transform_bypass_flag
+        if (reader.bit()) {
+            int count = (chromaFormat != 3) ? 8 : 12;
+            for (int i = 0; i < count; i++) {
+                if (reader.bit())
+                    skipScalingList(reader, i < 6 ? 16 : 64);
+            }
+        }
+    }
+    reader.ue();    //log2_max_frame_num_minus4
+    int pocType = reader.ue();
+    if (pocType == 0) {
+        reader.ue();    //log2_max_pic_order_cnt_lsb_minus4
+    } else if (pocType == 1) {
+        reader.bit();
+        reader.se();
+        reader.se();
+        int cycle = reader.ue();
+        for (int i = 0; i < cycle && !reader.isOverrun(); i++)
+            reader.se();
+    }
+    reader.ue();    //max_num_ref_frames
+    reader.bit();   //gaps_in_frame_num_value_allowed_flag
+    int widthInMbs = reader.ue() + 1;
+    int heightInMapUnits = reader.ue() + 1;
+    int frameMbsOnly = reader.bit() ? 1 : 0;
+    if (!frameMbsOnly)
+        reader.bit();   //mb_adaptive_frame_field_flag
+    reader.bit();   //direct_8x8_inference_flag
+    int cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+    if (reader.bit()) {
+        cropLeft = reader.ue();
+        cropRight = reader.ue();
+        cropTop = reader.ue();
+        cropBottom = reader.ue();
+    }
+    if (reader.isOverrun())
+        return false;
+    //Crop units, table 6-1, monochrome and 4:4:4 (or separate planes) crop in luma samples
+    int cropUnitX = 1;
+    int cropUnitY = 2 - frameMbsOnly;
+    if (chromaFormat != 0 && !isSeparateColourPlane) {
+        cropUnitX = (chromaFormat == 3) ? 1 : 2;
+        cropUnitY *= (chromaFormat == 1) ? 2 : 1;
+    }
+    info.width = widthInMbs*16 - cropUnitX*(cropLeft + cropRight);
+    info.height = (2 - frameMbsOnly)*heightInMapUnits*16 - cropUnitY*(cropTop + cropBottom);
+    return info.width > 0 && info.height > 0;
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef H264_H_
+#define H264_H_
+
+#include <QByteArray>
+#include "mediabuffer.h"
+
+//What containers need to know from an SPS
+struct H264SPSInfo {
+    int profile;
+    int constraints;
+    int level;
+    int width;      //After cropping
+    int height;
+};
+
+#define H264_NAL_SLICE 1
+#define H264_NAL_IDR 5
+#define H264_NAL_SEI 6
+#define H264_NAL_SPS 7
+#define H264_NAL_PPS 8
+#define H264_NAL_AUD 9
+#define H264_NAL_FILLER 12
+
+#define H264_AVCC_LENGTH_SIZE 4     //NAL length prefix in FLV and MP4 samples
+
+//One NAL unit of an Annex-B buffer, offset of its header byte and size without start code or trailing zeros
+struct H264NALUnit {
+    int offset;
+    int size;
+    int type;
+};
+
+/*
+ * H.264 bitstream helpers. NAL units are handled without start code or length prefix,
+ * ie, first byte is the NAL header, except toAVCC() which builds the length prefixed samples
+ * MediaFrame carries.
+ */
+class H264
+{
+public:
+    //Returns false if sps is truncated or not an SPS
+    static bool parseSPS(const QByteArray& sps, H264SPSInfo& info);
+    //Drops emulation prevention bytes (00 00 03 -> 00 00)
+    static QByteArray toRBSP(const char* data, int size);
+    //Annex-B, position of next 00 00 01 or 00 00 00 01 at or after from, -1 if none. codeLength gets 3 or 4.
+    //Compares 16 bytes at a time with SSE2 or NEON where compiler has them.
+    static int findStartCode(const char* data, int size, int from, int& codeLength);
+    //Same result byte by byte, for comparison
+    static int findStartCodeScalar(const char* data, int size, int from, int& codeLength);
+    //Annex-B access unit into its NAL units, nothing copied. Returns count found, at most maxUnits.
+    static int splitAnnexB(const char* data, int size, H264NALUnit* units, int maxUnits);
+    //Units of data copied once into a single AVCC sample, each behind a 4 byte big-endian length
+    static MediaBuffer toAVCC(const char* data, const H264NALUnit* units, int count);
+    static MediaBuffer toAVCC(const char* nal, int size);
+    //Slices of a picture, IDR or not
+    static bool isPictureNAL(int type) { return type >= H264_NAL_SLICE && type <= H264_NAL_IDR; }
+};
+
+#endif /* H264_H_ */
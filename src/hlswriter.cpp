@@ -0,0 +1,357 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "hlswriter.h"
+#include <QDir>
+#include <QStringList>
+#include <QDebug>
+#include <stdio.h>
+
+HLSWriter::HLSWriter(QString directory, QObject* parent)
+    :QObject(parent),
+     mDirectory(directory),
+     mAudioQueue(HLSWRITER_MAX_QUEUE_SIZE),
+     mVideoQueue(HLSWRITER_MAX_QUEUE_SIZE),
+     mIsPumpScheduled(0),
+     mDroppedFramesCount(0),
+     mIsStopped(false),
+     mIsInitWritten(false),
+     mHasWriteFailed(false),
+     mInterleaver(2),
+     mIsPartIndependent(true),
+     mIsNextPartIndependent(false),
+     mStartTS(0),
+     mMaxSegmentDuration(0)
+{
+    mInterleaveTimer = new QTimer(this);
+    mInterleaveTimer->setSingleShot(true);
+    QObject::connect(mInterleaveTimer,SIGNAL(timeout()),this,SLOT(pumpFrames()));
+    mInterleaveClock.start();
+    if(mDirectory.isEmpty())
+        mDirectory = "shared/documents/hls";
+    QDir dir;
+    dir.mkpath(mDirectory);
+    mSegment.sequence = 0;
+    mSegment.duration = 0;
+}
+
+HLSWriter::~HLSWriter() {}
+
+void HLSWriter::start()
+{
+    removeOldFiles();
+    mFragment.reserve(1024*1024);
+    schedulePump();
+}
+
+void HLSWriter::removeOldFiles()
+{
+    //Players must not pick up last stream's playlist or mix its segments with new ones
+    QDir dir(mDirectory);
+    QStringList filters;
+    filters<<"seg*.m4s"<<HLSWRITER_PLAYLIST<<HLSWRITER_INIT_SEGMENT;
+    QStringList names = dir.entryList(filters, QDir::Files);
+    for (int i = 0; i < names.size(); i++)
+        dir.remove(names.at(i));
+}
+
+void HLSWriter::setAudioHeader(QByteArray header, int nchan, int srate, int ssize)
+{
+    Q_UNUSED(nchan);
+    Q_UNUSED(srate);
+    Q_UNUSED(ssize);
+    mConfigLock.lock();
+    mAACHeader = header;
+    mConfigLock.unlock();
+}
+
+void HLSWriter::postFrame(MediaFrame frame)
+{
+    //Camera threads, one producer per ring, never blocks
+    if (mIsStopped)
+        return;
+    if (frame.type == MediaFrame::EOS) {
+        safeStop();
+        return;
+    }
+    FrameRing<MediaFrame>& queue = (frame.type == MediaFrame::AUDIO) ? mAudioQueue : mVideoQueue;
+    if (!queue.push(frame)) {
+        mDroppedFramesCount.fetchAndAddRelaxed(1);
+        return;
+    }
+    schedulePump();
+}
+
+void HLSWriter::schedulePump()
+{
+    if (mIsPumpScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "pumpFrames", Qt::QueuedConnection);
+}
+
+void HLSWriter::pumpFrames()
+{
+    //Same dts ordering as MP4Writer::pumpFrames()
+    mIsPumpScheduled.fetchAndStoreOrdered(0);
+    while (!mIsStopped && !mHasWriteFailed) {
+        if (!mIsInitWritten && !writeInitSegment())
+            return;
+        if (!mMuxer.hasAudio()) {
+            MediaFrame dropped;
+            while (mAudioQueue.pop(dropped)) {}
+        }
+        MediaFrame* audioFrame = mAudioQueue.peek();
+        MediaFrame* videoFrame = mVideoQueue.peek();
+        long heads[2];
+        heads[INTERLEAVER_TRACK_VIDEO] = videoFrame != NULL ? videoFrame->dts : INTERLEAVER_EMPTY;
+        heads[INTERLEAVER_TRACK_AUDIO] = audioFrame != NULL ? audioFrame->dts : INTERLEAVER_EMPTY;
+        int track = mInterleaver.next(heads, mInterleaveClock.elapsed());
+        if (track < 0) {
+            int wait = mInterleaver.waitMsec(mInterleaveClock.elapsed());
+            if (wait >= 0 && !mInterleaveTimer->isActive())
+                mInterleaveTimer->start(wait);
+            return;
+        }
+        MediaFrame frame;
+        if (track == INTERLEAVER_TRACK_AUDIO)
+            mAudioQueue.pop(frame);
+        else
+            mVideoQueue.pop(frame);
+        mInterleaver.taken(track, frame.dts);
+        writeFrame(frame);
+    }
+}
+
+bool HLSWriter::writeInitSegment()
+{
+    //Starts at first IDR, see MP4Writer::writeInitSegment()
+    MediaFrame frame;
+    MediaFrame* head;
+    while ((head = mVideoQueue.peek()) != NULL && !head->isKeyFrame()) {
+        mVideoQueue.pop(frame);
+        if (frame.isSequenceHeader()) {
+            if (frame.nalType() == 7)
+                mSPS = frame.firstNAL().toByteArray();
+            else
+                mPPS = frame.firstNAL().toByteArray();
+        }
+    }
+    if (head == NULL || mSPS.isEmpty() || mPPS.isEmpty())
+        return false;
+    mConfigLock.lock();
+    QByteArray audioConfig = mAACHeader;
+    mConfigLock.unlock();
+    if (audioConfig.isEmpty()) {
+        MediaFrame* last = mVideoQueue.peekAt(mVideoQueue.size() - 1);
+        if (last == NULL || last->dts - head->dts < HLSWRITER_AUDIO_WAIT_MSEC)
+            return false;
+        qDebug()<<"HLSWriter no audio config, video only";
+    }
+    mStartTS = head->dts;
+    mMuxer.reset();
+    mMuxer.setVideoConfig(mSPS, mPPS);
+    if (!audioConfig.isEmpty())
+        mMuxer.setAudioConfig(audioConfig);
+    while ((head = mAudioQueue.peek()) != NULL && head->dts < mStartTS)
+        mAudioQueue.pop(frame);
+    mIsInitWritten = true;
+    return writeFile(mDirectory + "/" + HLSWRITER_INIT_SEGMENT, mMuxer.initSegment());
+}
+
+void HLSWriter::writeFrame(const MediaFrame& frame)
+{
+    if (frame.buffer.isEmpty())
+        return;
+    if (frame.type == MediaFrame::AUDIO) {
+        mMuxer.addAudioSample(frame.buffer, frame.dts - mStartTS);
+    } else {
+        if (frame.isSequenceHeader())
+            return;
+        bool isKeyFrame = frame.isKeyFrame();
+        mMuxer.addVideoSample(frame.buffer, frame.pts - mStartTS, frame.dts - mStartTS, isKeyFrame);
+        mIsNextPartIndependent = isKeyFrame;
+        //IDR is held back by the muxer, so segment closed here ends right before it
+        if (isKeyFrame && mSegment.duration + mMuxer.fragmentDuration() >= HLSWRITER_SEGMENT_MSEC) {
+            writePart(false);
+            closeSegment();
+            writePlaylist(false);
+            return;
+        }
+    }
+    /*
+     * Part durations must stay within PART-TARGET. Duration grows by at most one frame per sample,
+     * cutting at 90% keeps parts under target down to 15 fps.
+     */
+    if (mMuxer.fragmentDuration() >= HLSWRITER_PART_MSEC*9/10) {
+        writePart(false);
+        writePlaylist(false);
+    }
+}
+
+QString HLSWriter::segmentFileName(int sequence)
+{
+    return QString("seg%1.m4s").arg(sequence);
+}
+
+void HLSWriter::writePart(bool isFinal)
+{
+    //Final part also takes held back samples, its duration misses the last frame's
+    int duration = mMuxer.fragmentDuration();
+    mFragment.clear();
+    if (mHasWriteFailed || !mMuxer.writeFragment(mFragment, isFinal))
+        return;
+    QString fileName = mDirectory + "/" + segmentFileName(mSegment.sequence);
+    if (!mSegmentFile.isOpen()) {
+        mSegmentFile.setFileName(fileName);
+        if (!mSegmentFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+            failWrite(fileName, mSegmentFile.errorString());
+            return;
+        }
+    }
+    Part part;
+    part.offset = mSegment.parts.isEmpty() ? 0 : mSegment.parts.last().offset + mSegment.parts.last().size;
+    part.size = mFragment.size();
+    part.duration = duration;
+    part.isIndependent = mIsPartIndependent;
+    if (mSegmentFile.write(mFragment.constData(), mFragment.size()) != mFragment.size()) {
+        failWrite(fileName, mSegmentFile.errorString());
+        return;
+    }
+    mSegment.parts.append(part);
+    mSegment.duration += duration;
+    mIsPartIndependent = mIsNextPartIndependent;
+}
+
+void HLSWriter::closeSegment()
+{
+    if (!mSegmentFile.isOpen())
+        return;
+    mSegmentFile.close();
+    if (mSegment.duration > mMaxSegmentDuration)
+        mMaxSegmentDuration = mSegment.duration;
+    mSegments.append(mSegment);
+    mSegment.sequence++;
+    mSegment.duration = 0;
+    mSegment.parts.clear();
+    //Disk use stays bounded, players get a little time to finish segments that just left the playlist
+    while (mSegments.size() > HLSWRITER_PLAYLIST_SEGMENTS + HLSWRITER_DELETE_DELAY_SEGMENTS) {
+        QFile::remove(mDirectory + "/" + segmentFileName(mSegments.first().sequence));
+        mSegments.removeFirst();
+    }
+}
+
+void HLSWriter::writePlaylist(bool isEnd)
+{
+    if (mHasWriteFailed)
+        return;
+    int first = qMax(0, mSegments.size() - HLSWRITER_PLAYLIST_SEGMENTS);
+    int firstWithParts = qMax(0, mSegments.size() - HLSWRITER_PART_SEGMENTS);
+    int targetDuration = qMax(HLSWRITER_TARGET_DURATION, (mMaxSegmentDuration + 999)/1000);
+    mPlaylist.clear();
+    mPlaylist.append("#EXTM3U\n#EXT-X-VERSION:6\n");
+    mPlaylist.append("#EXT-X-TARGETDURATION:" + QByteArray::number(targetDuration) + "\n");
+    mPlaylist.append("#EXT-X-PART-INF:PART-TARGET=" + QByteArray::number(HLSWRITER_PART_MSEC/1000.0, 'f', 3) + "\n");
+    mPlaylist.append("#EXT-X-SERVER-CONTROL:PART-HOLD-BACK="
+            + QByteArray::number(3*HLSWRITER_PART_MSEC/1000.0, 'f', 3) + "\n");
+    int sequence = first < mSegments.size() ? mSegments.at(first).sequence : mSegment.sequence;
+    mPlaylist.append("#EXT-X-MEDIA-SEQUENCE:" + QByteArray::number(sequence) + "\n");
+    mPlaylist.append("#EXT-X-INDEPENDENT-SEGMENTS\n");
+    mPlaylist.append("#EXT-X-MAP:URI=\"" HLSWRITER_INIT_SEGMENT "\"\n");
+    for (int i = first; i <= mSegments.size(); i++) {
+        const Segment& segment = (i < mSegments.size()) ? mSegments.at(i) : mSegment;
+        QByteArray uri = segmentFileName(segment.sequence).toLatin1();
+        if (i >= firstWithParts) {
+            for (int p = 0; p < segment.parts.size(); p++) {
+                const Part& part = segment.parts.at(p);
+                mPlaylist.append("#EXT-X-PART:DURATION=" + QByteArray::number(part.duration/1000.0, 'f', 3)
+                        + ",URI=\"" + uri + "\",BYTERANGE=\"" + QByteArray::number(part.size)
+                        + "@" + QByteArray::number(part.offset) + "\"");
+                if (part.isIndependent)
+                    mPlaylist.append(",INDEPENDENT=YES");
+                mPlaylist.append("\n");
+            }
+        }
+        //Open segment is only listed through its parts
+        if (i < mSegments.size())
+            mPlaylist.append("#EXTINF:" + QByteArray::number(segment.duration/1000.0, 'f', 3) + ",\n" + uri + "\n");
+    }
+    if (isEnd)
+        mPlaylist.append("#EXT-X-ENDLIST\n");
+    //Players polling the playlist see either the old or the new one, never half of it
+    QString fileName = mDirectory + "/" + HLSWRITER_PLAYLIST;
+    QString tempName = fileName + ".tmp";
+    if (!writeFile(tempName, mPlaylist))
+        return;
+    if (::rename(QFile::encodeName(tempName).constData(), QFile::encodeName(fileName).constData()) != 0)
+        failWrite(fileName, "rename failed");
+}
+
+bool HLSWriter::writeFile(const QString& fileName, const QByteArray& data)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size()) {
+        failWrite(fileName, file.errorString());
+        return false;
+    }
+    file.close();
+    return true;
+}
+
+void HLSWriter::failWrite(const QString& fileName, const QString& error)
+{
+    qDebug()<<"HLSWriter can't write"<<fileName<<error;
+    mHasWriteFailed = true;
+    emit writeLocationError();
+}
+
+void HLSWriter::safeStop()
+{
+    if (mIsStopped)
+        return;
+    mIsStopped = true;
+    //May be called from any thread, last part is written on writer's own thread
+    QMetaObject::invokeMethod(this, "stop", Qt::QueuedConnection);
+}
+
+void HLSWriter::stop()
+{
+    //Drains what the rings still hold first, same as MP4Writer::stop()
+    mInterleaveTimer->stop();
+    if (!mIsInitWritten && !mHasWriteFailed)
+        writeInitSegment();
+    if (mIsInitWritten && !mMuxer.hasAudio()) {
+        MediaFrame dropped;
+        while (mAudioQueue.pop(dropped)) {}
+    }
+    while (mIsInitWritten && !mHasWriteFailed) {
+        MediaFrame* audioFrame = mAudioQueue.peek();
+        MediaFrame* videoFrame = mVideoQueue.peek();
+        if (audioFrame == NULL && videoFrame == NULL)
+            break;
+        MediaFrame frame;
+        if (videoFrame == NULL || (audioFrame != NULL && audioFrame->dts < videoFrame->dts))
+            mAudioQueue.pop(frame);
+        else
+            mVideoQueue.pop(frame);
+        writeFrame(frame);
+    }
+    if (mIsInitWritten) {
+        writePart(true);
+        closeSegment();
+        writePlaylist(true);
+    }
+    qDebug()<<"HLSWriter"<<mDirectory<<mSegment.sequence<<"segments,"<<droppedFramesCount()<<"frames dropped";
+    emit finished();
+}
@@ -0,0 +1,134 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HLSWRITER_H_
+#define HLSWRITER_H_
+
+#include <QObject>
+#include <QThread>
+#include <QFile>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+#include "mediaframe.h"
+#include "mediasink.h"
+#include "framering.h"
+#include "interleaver.h"
+#include "mp4muxer.h"
+
+#define HLSWRITER_MAX_QUEUE_SIZE 256        //Per track, same as MP4Writer
+#define HLSWRITER_SEGMENT_MSEC 2000         //Segment is cut at first IDR past this
+#define HLSWRITER_TARGET_DURATION 6         //Secs, EXT-X-TARGETDURATION, longer GOPs make longer segments
+#define HLSWRITER_PART_MSEC 500             //LL-HLS partial segment
+#define HLSWRITER_AUDIO_WAIT_MSEC 2000      //Video waits this long for AAC config, then stream is video only
+#define HLSWRITER_PLAYLIST_SEGMENTS 6       //Whole segments listed
+#define HLSWRITER_PART_SEGMENTS 3           //Newest segments whose parts are listed too
+#define HLSWRITER_DELETE_DELAY_SEGMENTS 2   //Unlisted segments kept for players still fetching them
+#define HLSWRITER_PLAYLIST "stream.m3u8"
+#define HLSWRITER_INIT_SEGMENT "init.mp4"
+
+/*
+ * Writes the stream as a rolling LL-HLS playlist of fMP4 segments into one directory, so any static
+ * HTTP server (or the device itself) can serve it to standard players without a media server.
+ * Segments start at an IDR, each is written as a run of moof+mdat parts of about HLSWRITER_PART_MSEC.
+ * Parts are listed as byte ranges of their segment file, so nothing is written twice.
+ * Playlist is rewritten to a temp file and renamed over the old one after every part.
+ * Only HLSWRITER_PLAYLIST_SEGMENTS + HLSWRITER_DELETE_DELAY_SEGMENTS segments stay on disk.
+ * Like MP4Writer, frames come in through single-producer rings and all file work is on writer's own
+ * thread. No lock is shared with publishers.
+ */
+class HLSWriter : public QObject, public MediaSink
+{
+    Q_OBJECT
+public:
+    //Existing playlist and segments in directory are removed on start
+    HLSWriter(QString directory = QString(),
+            QObject* parent = 0);
+    ~HLSWriter();
+    void setAudioHeader(QByteArray header, int nchan, int srate, int ssize);
+    void postFrame(MediaFrame frame);
+    QString playlistFileName() { return mDirectory + "/" + HLSWRITER_PLAYLIST; }
+    int droppedFramesCount() { return mDroppedFramesCount.fetchAndAddRelaxed(0); }
+
+signals:
+    void writeLocationError();
+    void finished();
+
+public slots:
+    void start();
+    void safeStop();
+
+private slots:
+    void pumpFrames();
+    void stop();
+
+private:
+    struct Part {
+        int offset;
+        int size;
+        int duration;       //msec
+        bool isIndependent;
+    };
+
+    struct Segment {
+        int sequence;
+        int duration;
+        QList<Part> parts;
+    };
+
+    void schedulePump();
+    void removeOldFiles();
+    bool writeInitSegment();
+    void writeFrame(const MediaFrame& frame);
+    void writePart(bool isFinal);
+    void closeSegment();
+    void writePlaylist(bool isEnd);
+    QString segmentFileName(int sequence);
+    bool writeFile(const QString& fileName, const QByteArray& data);
+    void failWrite(const QString& fileName, const QString& error);
+
+    QString mDirectory;
+    FrameRing<MediaFrame> mAudioQueue;
+    FrameRing<MediaFrame> mVideoQueue;
+    QAtomicInt mIsPumpScheduled;
+    QAtomicInt mDroppedFramesCount;
+    volatile bool mIsStopped;
+    QMutex mConfigLock;
+    QByteArray mAACHeader;          //Set by camera audio thread, under mConfigLock
+
+    //Writer thread only
+    MP4Muxer mMuxer;
+    QByteArray mSPS;
+    QByteArray mPPS;
+    QByteArray mFragment;           //Reused for every part
+    QByteArray mPlaylist;
+    bool mIsInitWritten;
+    bool mHasWriteFailed;
+    Interleaver mInterleaver;
+    QElapsedTimer mInterleaveClock;
+    QTimer* mInterleaveTimer;       //Gives up on a late track
+    bool mIsPartIndependent;        //Part being muxed starts with an IDR
+    bool mIsNextPartIndependent;    //Sample held back by muxer, which starts next part, is an IDR
+    long mStartTS;
+    QFile mSegmentFile;
+    Segment mSegment;               //Being written, its parts are listed already
+    QList<Segment> mSegments;       //Closed, oldest first, includes unlisted ones not deleted yet
+    int mMaxSegmentDuration;
+};
+
+#endif /* HLSWRITER_H_ */
@@ -0,0 +1,75 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "interleaver.h"
+
+Interleaver::Interleaver(int trackCount, int maxSkewMsec, int waitTimeoutMsec)
+    :mTrackCount(qBound(1, trackCount, INTERLEAVER_MAX_TRACKS)),
+     mMaxSkewMsec(maxSkewMsec),
+     mWaitTimeoutMsec(waitTimeoutMsec) {
+    reset();
+}
+
+void Interleaver::reset() {
+    for (int i = 0; i < INTERLEAVER_MAX_TRACKS; i++) {
+        mTracks[i].isStarted = false;
+        mTracks[i].isStalled = false;
+        mTracks[i].lastDts = 0;
+        mTracks[i].lastSeenMsec = 0;
+    }
+    mWaitUntilMsec = -1;
+    mStallCount = 0;
+}
+
+int Interleaver::next(const long* heads, qint64 nowMsec) {
+    int earliest = -1;
+    for (int i = 0; i < mTrackCount; i++) {
+        if (heads[i] == INTERLEAVER_EMPTY)
+            continue;
+        mTracks[i].isStalled = false;
+        mTracks[i].lastSeenMsec = nowMsec;
+        if (earliest < 0 || heads[i] < heads[earliest])
+            earliest = i;
+    }
+    mWaitUntilMsec = -1;
+    if (earliest < 0)
+        return -1;
+    for (int i = 0; i < mTrackCount; i++) {
+        Track& track = mTracks[i];
+        //Next frame of an empty track can't be earlier than its last one
+        if (heads[i] != INTERLEAVER_EMPTY || !track.isStarted || track.isStalled || track.lastDts >= heads[earliest])
+            continue;
+        qint64 deadline = track.lastSeenMsec + mWaitTimeoutMsec;
+        if (nowMsec >= deadline || heads[earliest] - track.lastDts > mMaxSkewMsec) {
+            track.isStalled = true;
+            mStallCount++;
+        } else if (mWaitUntilMsec < 0 || deadline < mWaitUntilMsec) {
+            mWaitUntilMsec = deadline;
+        }
+    }
+    return mWaitUntilMsec >= 0 ? -1 : earliest;
+}
+
+void Interleaver::taken(int track, long dts) {
+    mTracks[track].isStarted = true;
+    mTracks[track].lastDts = dts;
+}
+
+int Interleaver::waitMsec(qint64 nowMsec) const {
+    if (mWaitUntilMsec < 0)
+        return -1;
+    return (int) qMax((qint64) 0, mWaitUntilMsec - nowMsec);
+}
@@ -0,0 +1,77 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef INTERLEAVER_H_
+#define INTERLEAVER_H_
+
+#include <QtGlobal>
+
+#define INTERLEAVER_MAX_TRACKS 4
+#define INTERLEAVER_EMPTY (-1L)         //Head dts of a track with nothing queued
+#define INTERLEAVER_MAX_SKEW_MSEC 500   //Of dts, a started track further behind than this isn't waited for
+#define INTERLEAVER_WAIT_MSEC 250       //Of wall time, a started track without frames this long isn't waited for
+#define INTERLEAVER_TRACK_VIDEO 0       //Tracks of audio/video sinks, lower number goes first on equal dts
+#define INTERLEAVER_TRACK_AUDIO 1
+
+/*
+ * Picks which of a sink's track queues goes next so frames leave in dts order across tracks.
+ * A track that has started is waited for while its queue is empty, it could still come up with an
+ * earlier frame, unless its last dts is maxSkew behind the frame that would go instead or it hasn't had
+ * a frame queued for waitTimeout. Then it's stalled and the other tracks flow on their own till it has
+ * frames again, which then go in dts order with the rest. A track that is steadily late but still delivering
+ * is waited for, as dts order needs. Tracks that never had a frame are not waited for.
+ * Order within a track is the sink's queue order, the interleaver only picks between heads.
+ * Caller provides a monotonic msec clock, single threaded like the sink loop it's in.
+ */
+class Interleaver
+{
+public:
+    explicit Interleaver(int trackCount, int maxSkewMsec = INTERLEAVER_MAX_SKEW_MSEC,
+            int waitTimeoutMsec = INTERLEAVER_WAIT_MSEC);
+
+    void reset();
+    void setMaxSkew(int msec) { mMaxSkewMsec = msec; }
+    void setWaitTimeout(int msec) { mWaitTimeoutMsec = msec; }
+
+    //heads[track] is dts of the track's first queued frame or INTERLEAVER_EMPTY. Returns the track to
+    //take a frame from and call taken() for, or -1 to wait for frames, see waitMsec().
+    int next(const long* heads, qint64 nowMsec);
+    void taken(int track, long dts);
+    //After next() returned -1: msec till waiting gives up on a late track, -1 if only a new frame helps
+    int waitMsec(qint64 nowMsec) const;
+
+    bool isStarted(int track) const { return mTracks[track].isStarted; }
+    bool isStalled(int track) const { return mTracks[track].isStalled; }
+    //Times a late track was given up on
+    int stallCount() const { return mStallCount; }
+
+private:
+    struct Track {
+        bool isStarted;
+        bool isStalled;
+        long lastDts;
+        qint64 lastSeenMsec;    //Last time it had a frame queued
+    };
+
+    int mTrackCount;
+    int mMaxSkewMsec;
+    int mWaitTimeoutMsec;
+    Track mTracks[INTERLEAVER_MAX_TRACKS];
+    qint64 mWaitUntilMsec;      //-1 while not waiting
+    int mStallCount;
+};
+
+#endif /* INTERLEAVER_H_ */
@@ -0,0 +1,200 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "latencytracer.h"
+#include <QFile>
+#include <QDateTime>
+#include <QDebug>
+#include <QtAlgorithms>
+#if defined(Q_OS_UNIX)
+#include <time.h>
+#endif
+
+LatencyTracer::LatencyTracer()
+    :mIsExportEnabled(false),
+     mExportNext(0),
+     mExportCount(0)
+{
+    clear();
+}
+
+qint64 LatencyTracer::nowUsec()
+{
+#if defined(Q_OS_UNIX)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (qint64) now.tv_sec*1000000 + now.tv_nsec/1000;
+#else
+    return QDateTime::currentMSecsSinceEpoch()*1000;
+#endif
+}
+
+const char* LatencyTracer::stageName(Stage stage)
+{
+    static const char* NAMES[StageCount] = {"handoff", "queue", "socketWait", "send", "total"};
+    return NAMES[stage];
+}
+
+void LatencyTracer::record(Track track, const FrameTimes& times, long dts)
+{
+    qint64 points[StageCount][2] = {
+        {times.capture, times.enqueue},
+        {times.enqueue, times.dequeue},
+        {times.dequeue, times.firstByte},
+        {times.firstByte, times.lastByte},
+        {times.capture, times.lastByte}
+    };
+    mLock.lock();
+    mFramesCount[track]++;
+    for (int stage = 0; stage < StageCount; stage++) {
+        if (points[stage][0] == 0 || points[stage][1] == 0)
+            continue;
+        int& next = mWindowNext[track][stage];
+        mWindow[track][stage][next] = points[stage][1] - points[stage][0];
+        next = (next + 1) % LATENCY_WINDOW_FRAMES;
+        if (mWindowCount[track][stage] < LATENCY_WINDOW_FRAMES)
+            mWindowCount[track][stage]++;
+    }
+    if (mIsExportEnabled) {
+        TracedFrame& frame = mExported[mExportNext];
+        frame.times = times;
+        frame.dts = dts;
+        frame.track = track;
+        mExportNext = (mExportNext + 1) % mExported.size();
+        if (mExportCount < mExported.size())
+            mExportCount++;
+    }
+    mLock.unlock();
+}
+
+void LatencyTracer::clear()
+{
+    mLock.lock();
+    for (int track = 0; track < TrackCount; track++) {
+        mFramesCount[track] = 0;
+        for (int stage = 0; stage < StageCount; stage++) {
+            mWindowCount[track][stage] = 0;
+            mWindowNext[track][stage] = 0;
+        }
+    }
+    mExportNext = 0;
+    mExportCount = 0;
+    mLock.unlock();
+}
+
+void LatencyTracer::setExportEnabled(bool isEnabled)
+{
+    mLock.lock();
+    mIsExportEnabled = isEnabled;
+    if (isEnabled && mExported.isEmpty())
+        mExported.resize(LATENCY_EXPORT_MAX_FRAMES);
+    mLock.unlock();
+}
+
+qint64 LatencyTracer::percentile(Track track, Stage stage, int percent)
+{
+    mLock.lock();
+    int count = mWindowCount[track][stage];
+    QVector<qint64> sorted(count);
+    for (int i = 0; i < count; i++)
+        sorted[i] = mWindow[track][stage][i];
+    mLock.unlock();
+    if (count == 0)
+        return -1;
+    qSort(sorted.begin(), sorted.end());
+    return sorted.at(qMin(count - 1, count*percent/100));
+}
+
+QVariantList LatencyTracer::stats()
+{
+    static const char* TRACKS[TrackCount] = {"audio", "video"};
+    static const int PERCENTS[] = {50, 95, 99};
+    QVariantList stats;
+    for (int track = 0; track < TrackCount; track++) {
+        QVariantMap map;
+        map["track"] = TRACKS[track];
+        mLock.lock();
+        map["frames"] = mFramesCount[track];
+        mLock.unlock();
+        for (int stage = 0; stage < StageCount; stage++) {
+            for (unsigned int p = 0; p < sizeof(PERCENTS)/sizeof(PERCENTS[0]); p++)
+                map[QString("%1P%2").arg(stageName((Stage) stage)).arg(PERCENTS[p])] =
+                        percentile((Track) track, (Stage) stage, PERCENTS[p]);
+        }
+        stats.append(map);
+    }
+    return stats;
+}
+
+bool LatencyTracer::exportChromeTrace(const QString& fileName)
+{
+    /*
+     * Trace event format: async begin/end pairs ("b"/"e") sharing the frame's id, so overlapping frames
+     * of a track don't have to nest like "X" events on one thread would. Whole frame is the outer span,
+     * stages are inner ones. Times are usec already, made relative to first frame.
+     */
+    static const char* TRACKS[TrackCount] = {"audio", "video"};
+    mLock.lock();
+    QVector<TracedFrame> frames;
+    frames.reserve(mExportCount);
+    int first = (mExportNext - mExportCount + mExported.size()) % qMax(1, mExported.size());
+    for (int i = 0; i < mExportCount; i++)
+        frames.append(mExported.at((first + i) % mExported.size()));
+    mLock.unlock();
+    if (frames.isEmpty()) {
+        qWarning()<<"No latency trace to export";
+        return false;
+    }
+    qint64 origin = frames.first().times.capture;
+    for (int i = 1; i < frames.size(); i++) {
+        if (frames.at(i).times.capture != 0 && (origin == 0 || frames.at(i).times.capture < origin))
+            origin = frames.at(i).times.capture;
+    }
+    QByteArray json("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool isFirst = true;
+    for (int i = 0; i < frames.size(); i++) {
+        const TracedFrame& frame = frames.at(i);
+        qint64 points[StageCount][2] = {
+            {frame.times.capture, frame.times.lastByte},
+            {frame.times.capture, frame.times.enqueue},
+            {frame.times.enqueue, frame.times.dequeue},
+            {frame.times.dequeue, frame.times.firstByte},
+            {frame.times.firstByte, frame.times.lastByte}
+        };
+        for (int stage = 0; stage < StageCount; stage++) {
+            if (points[stage][0] == 0 || points[stage][1] == 0)
+                continue;
+            //Outer span first, then stages in order
+            QByteArray name = stage == 0 ? QByteArray("frame ") + QByteArray::number((qint64) frame.dts)
+                    : QByteArray(stageName((Stage) (stage - 1)));
+            QByteArray common = "\"cat\":\"" + QByteArray(TRACKS[frame.track]) + "\",\"name\":\"" + name
+                    + "\",\"id\":" + QByteArray::number(i) + ",\"pid\":1,\"tid\":" + QByteArray::number(frame.track + 1);
+            if (!isFirst)
+                json.append(",\n");
+            isFirst = false;
+            json.append("{\"ph\":\"b\"," + common + ",\"ts\":" + QByteArray::number(points[stage][0] - origin) + "},\n");
+            json.append("{\"ph\":\"e\"," + common + ",\"ts\":" + QByteArray::number(points[stage][1] - origin) + "}");
+        }
+    }
+    json.append("\n]}\n");
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+        qWarning()<<"Can't write latency trace"<<fileName<<file.errorString();
+        return false;
+    }
+    file.close();
+    return true;
+}
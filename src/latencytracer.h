@@ -0,0 +1,93 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef LATENCYTRACER_H_
+#define LATENCYTRACER_H_
+
+#include <QMutex>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+#include "mediaframe.h"
+
+#define LATENCY_WINDOW_FRAMES 1024         //Percentiles are over latest this many frames per track
+#define LATENCY_EXPORT_MAX_FRAMES 16384    //Kept for trace export, oldest overwritten
+
+/*
+ * Where a frame's time goes between encoder callback and kernel, per track:
+ * handoff (callback to publisher queue), queue (waiting in publisher ring), socketWait (in socket buffer
+ * behind earlier bytes), send (first to last byte taken by kernel) and total.
+ * Each stage keeps a window of its latest durations, percentiles are worked out when asked for, so
+ * record() only stores a few numbers and never allocates.
+ * With export enabled the full FrameTimes of recent frames are kept as well and can be written out
+ * in Chrome trace event format, one async span per frame with its stages nested, for chrome://tracing.
+ */
+class LatencyTracer
+{
+public:
+    enum Track {
+        TrackAudio = 0,
+        TrackVideo,
+        TrackCount
+    };
+    enum Stage {
+        StageHandoff = 0,
+        StageQueue,
+        StageSocketWait,
+        StageSend,
+        StageTotal,
+        StageCount
+    };
+
+    LatencyTracer();
+
+    //Monotonic, comparable across threads
+    static qint64 nowUsec();
+    static const char* stageName(Stage stage);
+
+    //Publisher thread, stages with a missing end are left out
+    void record(Track track, const FrameTimes& times, long dts);
+    void clear();
+    //Export storage is allocated here, not while recording
+    void setExportEnabled(bool isEnabled);
+
+    //Any thread. Usec, -1 without samples.
+    qint64 percentile(Track track, Stage stage, int percent);
+    //One map per track: track, frames, then <stage>P50/P95/P99 in usec
+    QVariantList stats();
+    bool exportChromeTrace(const QString& fileName);
+
+private:
+    Q_DISABLE_COPY(LatencyTracer)
+
+    struct TracedFrame {
+        FrameTimes times;
+        long dts;
+        int track;
+    };
+
+    QMutex mLock;
+    qint64 mWindow[TrackCount][StageCount][LATENCY_WINDOW_FRAMES];
+    int mWindowCount[TrackCount][StageCount];
+    int mWindowNext[TrackCount][StageCount];
+    int mFramesCount[TrackCount];
+    bool mIsExportEnabled;
+    QVector<TracedFrame> mExported;
+    int mExportNext;
+    int mExportCount;
+};
+
+#endif /* LATENCYTRACER_H_ */
@@ -0,0 +1,171 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mediabuffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+//Payload starts 16 byte aligned right after the block header
+#define MEDIABLOCK_HEADER_SIZE ((int)((sizeof(MediaBlock)+15) & ~15))
+
+MediaBufferPool::MediaBufferPool() {
+    for (int i = 0; i <= MEDIABUFFER_MAX_CLASS_SHIFT; i++) {
+        mFreeBlocks[i] = NULL;
+        mFreeCount[i] = 0;
+    }
+}
+
+MediaBufferPool::~MediaBufferPool() {
+    for (int i = 0; i <= MEDIABUFFER_MAX_CLASS_SHIFT; i++) {
+        while (mFreeBlocks[i] != NULL) {
+            MediaBlock* block = mFreeBlocks[i];
+            mFreeBlocks[i] = block->next;
+            free(block);
+        }
+    }
+}
+
+MediaBufferPool* MediaBufferPool::instance() {
+    static MediaBufferPool pool;
+    return &pool;
+}
+
+int MediaBufferPool::sizeClassFor(int size) {
+    int sizeClass = MEDIABUFFER_MIN_CLASS_SHIFT;
+    while (sizeClass <= MEDIABUFFER_MAX_CLASS_SHIFT && (1 << sizeClass) < size)
+        sizeClass++;
+    if (sizeClass > MEDIABUFFER_MAX_CLASS_SHIFT)
+        return -1;
+    return sizeClass;
+}
+
+MediaBlock* MediaBufferPool::allocate(int size) {
+    int sizeClass = sizeClassFor(size);
+    MediaBlock* block = NULL;
+    if (sizeClass >= 0) {
+        mLock.lock();
+        block = mFreeBlocks[sizeClass];
+        if (block != NULL) {
+            mFreeBlocks[sizeClass] = block->next;
+            mFreeCount[sizeClass]--;
+        }
+        mLock.unlock();
+    }
+    if (block == NULL) {
+        int capacity = sizeClass >= 0 ? (1 << sizeClass) : size;
+        void* memory = malloc(MEDIABLOCK_HEADER_SIZE + capacity);
+        if (memory == NULL)
+            return NULL;
+        block = new (memory) MediaBlock;
+        block->capacity = capacity;
+        block->sizeClass = sizeClass;
+        block->pool = this;
+        block->data = reinterpret_cast<char*>(memory) + MEDIABLOCK_HEADER_SIZE;
+    }
+    block->next = NULL;
+    block->ref.fetchAndStoreOrdered(1);
+    return block;
+}
+
+void MediaBufferPool::recycle(MediaBlock* block) {
+    int sizeClass = block->sizeClass;
+    if (sizeClass >= 0) {
+        mLock.lock();
+        if (mFreeCount[sizeClass] < MEDIABUFFER_MAX_FREE_PER_CLASS) {
+            block->next = mFreeBlocks[sizeClass];
+            mFreeBlocks[sizeClass] = block;
+            mFreeCount[sizeClass]++;
+            block = NULL;
+        }
+        mLock.unlock();
+    }
+    if (block != NULL)
+        free(block);
+}
+
+MediaBuffer::MediaBuffer()
+    :mBlock(NULL), mOffset(0), mLength(0) {}
+
+MediaBuffer::MediaBuffer(const MediaBuffer& other)
+    :mBlock(other.mBlock), mOffset(other.mOffset), mLength(other.mLength) {
+    if (mBlock)
+        mBlock->ref.ref();
+}
+
+MediaBuffer::~MediaBuffer() {
+    release();
+}
+
+MediaBuffer& MediaBuffer::operator=(const MediaBuffer& other) {
+    if (other.mBlock)
+        other.mBlock->ref.ref();
+    release();
+    mBlock = other.mBlock;
+    mOffset = other.mOffset;
+    mLength = other.mLength;
+    return *this;
+}
+
+void MediaBuffer::release() {
+    if (mBlock && !mBlock->ref.deref())
+        mBlock->pool->recycle(mBlock);
+    mBlock = NULL;
+}
+
+MediaBuffer MediaBuffer::fromData(const char* data, int size, MediaBufferPool* pool) {
+    MediaBuffer buffer;
+    if (size <= 0)
+        return buffer;
+    buffer.mBlock = pool->allocate(size);
+    if (buffer.mBlock == NULL)
+        return buffer;
+    memcpy(buffer.mBlock->data, data, size);
+    buffer.mLength = size;
+    return buffer;
+}
+
+MediaBuffer MediaBuffer::fromData(const uchar* data, int size, MediaBufferPool* pool) {
+    return fromData(reinterpret_cast<const char*>(data), size, pool);
+}
+
+MediaBuffer MediaBuffer::allocate(int size, MediaBufferPool* pool) {
+    MediaBuffer buffer;
+    if (size <= 0)
+        return buffer;
+    buffer.mBlock = pool->allocate(size);
+    if (buffer.mBlock == NULL)
+        return buffer;
+    buffer.mLength = size;
+    return buffer;
+}
+
+MediaBuffer MediaBuffer::mid(int pos, int len) const {
+    MediaBuffer buffer;
+    if (mBlock == NULL || pos >= mLength)
+        return buffer;
+    if (pos < 0)
+        pos = 0;
+    if (len < 0 || pos + len > mLength)
+        len = mLength - pos;
+    buffer = *this;
+    buffer.mOffset += pos;
+    buffer.mLength = len;
+    return buffer;
+}
+
+QByteArray MediaBuffer::toByteArray() const {
+    return QByteArray(constData(), mLength);
+}
@@ -0,0 +1,104 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MEDIABUFFER_H_
+#define MEDIABUFFER_H_
+
+#include <QByteArray>
+#include <QAtomicInt>
+#include <QMutex>
+
+#define MEDIABUFFER_MIN_CLASS_SHIFT 9      //512 bytes
+#define MEDIABUFFER_MAX_CLASS_SHIFT 22     //4 MB, larger blocks are not pooled
+#define MEDIABUFFER_MAX_FREE_PER_CLASS 32
+
+class MediaBufferPool;
+
+struct MediaBlock {
+    QAtomicInt ref;
+    int capacity;
+    int sizeClass;
+    MediaBufferPool* pool;
+    MediaBlock* next;
+    char* data;
+};
+
+/*
+ * Pool of reusable memory blocks in power of two size classes.
+ * Blocks are handed out by the camera callback threads and returned from
+ * whichever thread drops the last MediaBuffer referencing them.
+ */
+class MediaBufferPool
+{
+public:
+    MediaBufferPool();
+    ~MediaBufferPool();
+
+    static MediaBufferPool* instance();
+
+    MediaBlock* allocate(int size);
+    void recycle(MediaBlock* block);
+
+private:
+    Q_DISABLE_COPY(MediaBufferPool)
+
+    static int sizeClassFor(int size);
+
+    QMutex mLock;
+    MediaBlock* mFreeBlocks[MEDIABUFFER_MAX_CLASS_SHIFT+1];
+    int mFreeCount[MEDIABUFFER_MAX_CLASS_SHIFT+1];
+};
+
+/*
+ * Refcounted, read-only slice (block, offset, length) of a pooled block.
+ * Copying a MediaBuffer or taking mid()/left() never copies the payload.
+ */
+class MediaBuffer
+{
+public:
+    MediaBuffer();
+    MediaBuffer(const MediaBuffer& other);
+    ~MediaBuffer();
+    MediaBuffer& operator=(const MediaBuffer& other);
+
+    //The one and only payload copy, out of a buffer we don't own.
+    static MediaBuffer fromData(const char* data, int size, MediaBufferPool* pool = MediaBufferPool::instance());
+    static MediaBuffer fromData(const uchar* data, int size, MediaBufferPool* pool = MediaBufferPool::instance());
+    //Uninitialized payload to be filled through data() before the buffer is shared
+    static MediaBuffer allocate(int size, MediaBufferPool* pool = MediaBufferPool::instance());
+
+    const char* constData() const { return mBlock ? mBlock->data+mOffset : 0; }
+    char* data() { return mBlock ? mBlock->data+mOffset : 0; }
+    int size() const { return mLength; }
+    int length() const { return mLength; }
+    bool isEmpty() const { return mLength == 0; }
+    bool isNull() const { return mBlock == NULL; }
+    char at(int i) const { return mBlock->data[mOffset+i]; }
+
+    MediaBuffer mid(int pos, int len = -1) const;
+    MediaBuffer left(int len) const { return mid(0, len); }
+
+    //Deep copy, meant for small and rare data like SPS/PPS
+    QByteArray toByteArray() const;
+
+private:
+    void release();
+
+    MediaBlock* mBlock;
+    int mOffset;
+    int mLength;
+};
+
+#endif /* MEDIABUFFER_H_ */
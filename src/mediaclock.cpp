@@ -0,0 +1,124 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mediaclock.h"
+
+MediaClock::MediaClock() {
+    mVideoPeriodUsec = 0;
+    reset();
+}
+
+void MediaClock::reset() {
+    mStart.fetchAndStoreOrdered(NULL);
+    for (int i = 0; i < TrackCount; i++) {
+        mStartCandidates[i] = 0;
+        mTrackStartUsec[i] = 0;
+        mHasTrackStart[i] = false;
+    }
+    mHasAudio = false;
+    mAudioSampleRate = 0;
+    mAudioBaseUsec = 0;
+    mAudioSamples = 0;
+    mAudioCorrectionUsec = 0;
+    mLastAudioUsec = -1;
+    mHasVideo = false;
+    mLastVideoCameraUsec = 0;
+    mLastVideoUsec = -1;
+}
+
+void MediaClock::setVideoFrameRate(double fps) {
+    mVideoPeriodUsec = fps > 0 ? 1000000/fps : 0;
+}
+
+qint64 MediaClock::elapsedUsec(Track track, quint64 cameraUsec) {
+    /*
+     * First frame of a track offers its own timestamp as the start. The candidate is written before it is
+     * published, so whichever track loses the compare-and-swap finds a complete value behind the pointer.
+     * Either way the start is copied per track, later frames don't touch anything shared.
+     */
+    if (!mHasTrackStart[track]) {
+        mStartCandidates[track] = cameraUsec;
+        quint64* start = &mStartCandidates[track];
+        //Ordered either way, a failed swap still orders the read of the winner's pointer after it
+        if (!mStart.testAndSetOrdered(NULL, start))
+            start = mStart;
+        mTrackStartUsec[track] = *start;
+        mHasTrackStart[track] = true;
+    }
+    quint64 startUsec = mTrackStartUsec[track];
+    return cameraUsec > startUsec ? (qint64) (cameraUsec - startUsec) : 0;
+}
+
+qint64 MediaClock::audioTimestamp(quint64 cameraUsec, int sampleCount, int sampleRate) {
+    /*
+     * Sample clock is exact between frames but runs at the microphone's rate, not the camera's. The difference
+     * is taken out a fraction at a time, capped per frame, so spacing stays even while drift can't build up.
+     * A new rate restarts counting where the old one left off.
+     */
+    qint64 camera = elapsedUsec(TrackAudio, cameraUsec);
+    if (!mHasAudio || sampleRate != mAudioSampleRate) {
+        mAudioBaseUsec = mHasAudio ? mLastAudioUsec : camera;
+        mAudioSamples = 0;
+        mAudioCorrectionUsec = 0;
+        mAudioSampleRate = sampleRate;
+        mHasAudio = true;
+    }
+    qint64 sampleUsec = mAudioBaseUsec + mAudioSamples*1000000/mAudioSampleRate;
+    double error = camera - (sampleUsec + mAudioCorrectionUsec);
+    if (qAbs(error) > MEDIACLOCK_RESYNC_USEC) {
+        mAudioBaseUsec = camera;
+        mAudioSamples = 0;
+        mAudioCorrectionUsec = 0;
+        sampleUsec = camera;
+    } else {
+        mAudioCorrectionUsec += qBound((double) -MEDIACLOCK_AUDIO_MAX_STEP_USEC, error/MEDIACLOCK_AUDIO_DRIFT_FRAMES,
+                (double) MEDIACLOCK_AUDIO_MAX_STEP_USEC);
+    }
+    qint64 timestamp = qMax(sampleUsec + qRound64(mAudioCorrectionUsec), mLastAudioUsec + 1);
+    mAudioSamples += sampleCount;
+    mLastAudioUsec = timestamp;
+    return timestamp;
+}
+
+qint64 MediaClock::videoTimestamp(quint64 cameraUsec) {
+    /*
+     * Next timestamp is the last one plus as many frame periods as the camera says went by, a skipped
+     * frame is two, then moved 1/MEDIACLOCK_VIDEO_SMOOTHING of the way to the camera's own timestamp.
+     * Period follows camera intervals that look like one frame, so a frame rate the encoder doesn't
+     * quite hit isn't fought.
+     */
+    qint64 camera = elapsedUsec(TrackVideo, cameraUsec);
+    qint64 timestamp = camera;
+    if (mHasVideo) {
+        qint64 interval = camera - mLastVideoCameraUsec;
+        if (mVideoPeriodUsec <= 0)
+            mVideoPeriodUsec = interval;
+        else if (interval > mVideoPeriodUsec/2 && interval < mVideoPeriodUsec*3/2)
+            mVideoPeriodUsec += (interval - mVideoPeriodUsec)/MEDIACLOCK_VIDEO_PERIOD_FRAMES;
+        if (mVideoPeriodUsec > 0) {
+            qint64 periods = qMax((qint64) 1, qRound64((camera - mLastVideoUsec)/mVideoPeriodUsec));
+            double predicted = mLastVideoUsec + periods*mVideoPeriodUsec;
+            double error = camera - predicted;
+            if (qAbs(error) <= MEDIACLOCK_RESYNC_USEC)
+                timestamp = qRound64(predicted + error/MEDIACLOCK_VIDEO_SMOOTHING);
+        }
+    }
+    timestamp = qMax(timestamp, mLastVideoUsec + 1);
+    mHasVideo = true;
+    mLastVideoCameraUsec = camera;
+    mLastVideoUsec = timestamp;
+    return timestamp;
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MEDIACLOCK_H_
+#define MEDIACLOCK_H_
+
+#include <QtGlobal>
+#include <QAtomicPointer>
+
+#define MEDIACLOCK_AUDIO_DRIFT_FRAMES 64        //Audio correction closes 1/this of its error per frame
+#define MEDIACLOCK_AUDIO_MAX_STEP_USEC 500      //Per frame, 2.5% of an AAC frame at 48 kHz
+#define MEDIACLOCK_VIDEO_SMOOTHING 8            //Video closes 1/this of its error per frame
+#define MEDIACLOCK_VIDEO_PERIOD_FRAMES 64       //Frame period averages camera intervals over about this many
+#define MEDIACLOCK_RESYNC_USEC 500000           //Beyond this it's a gap or clock jump, not drift
+
+/*
+ * Stream timestamps, usec from start of stream, out of camera timestamps.
+ * Camera timestamps are taken when buffers reach the callback and jitter by milliseconds. Audio time is
+ * instead counted in samples sent, video time is stepped by the frame period, and both are pulled slowly
+ * towards the camera clock so neither track drifts off it, or off the other. Both tracks share one start,
+ * whichever frame comes first. Timestamps of a track never go backwards.
+ * Audio and video may be called from different threads, each track from only one. The shared start is
+ * set by whichever gets there first, the other one takes it over without waiting.
+ */
+class MediaClock
+{
+public:
+    MediaClock();
+
+    //Only while neither track is being timestamped, ie, once camera callbacks have stopped
+    void reset();
+    //Initial guess of video frame period, it follows camera timestamps from there. 0 for none.
+    void setVideoFrameRate(double fps);
+
+    //Start of a frame of sampleCount samples that camera stamped cameraUsec
+    qint64 audioTimestamp(quint64 cameraUsec, int sampleCount, int sampleRate);
+    qint64 videoTimestamp(quint64 cameraUsec);
+
+    //Camera clock minus sample clock, usec
+    qint64 audioDriftUsec() const { return (qint64) mAudioCorrectionUsec; }
+    qint64 videoPeriodUsec() const { return (qint64) mVideoPeriodUsec; }
+
+private:
+    enum Track { TrackAudio, TrackVideo, TrackCount };
+    qint64 elapsedUsec(Track track, quint64 cameraUsec);
+
+    //Points to the candidate of the track that got there first, NULL till then
+    QAtomicPointer<quint64> mStart;
+    //Each written by its own track only
+    quint64 mStartCandidates[TrackCount];
+    quint64 mTrackStartUsec[TrackCount];
+    bool mHasTrackStart[TrackCount];
+
+    bool mHasAudio;
+    int mAudioSampleRate;
+    qint64 mAudioBaseUsec;      //Where mAudioSamples started counting
+    qint64 mAudioSamples;
+    double mAudioCorrectionUsec;
+    qint64 mLastAudioUsec;
+
+    bool mHasVideo;
+    double mVideoPeriodUsec;
+    qint64 mLastVideoCameraUsec;
+    qint64 mLastVideoUsec;
+};
+
+#endif /* MEDIACLOCK_H_ */
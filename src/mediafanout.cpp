@@ -0,0 +1,95 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mediafanout.h"
+#include <QThread>
+
+MediaFanOut::MediaFanOut()
+    :mSinks(new SinkList()) {}
+
+MediaFanOut::~MediaFanOut() {
+    delete mSinks.fetchAndStoreOrdered(NULL);
+}
+
+MediaFanOut::SinkList* MediaFanOut::acquire(Reader reader) {
+    /*
+     * Hazard pointer: the list is announced in this reader's slot, then checked to still be current.
+     * If it was swapped meanwhile the writer may not have seen the announcement, so go again with the
+     * new one. Slot store is a full barrier, the recheck can't be done before it.
+     */
+    SinkList* sinks;
+    do {
+        sinks = mSinks;
+        mReading[reader].fetchAndStoreOrdered(sinks);
+    } while (sinks != (SinkList*) mSinks);
+    return sinks;
+}
+
+void MediaFanOut::release(Reader reader) {
+    mReading[reader].fetchAndStoreRelease(NULL);
+}
+
+void MediaFanOut::publish(SinkList* sinks) {
+    //Under mWriteLock. Sinks of a camera callback never block, so the wait is one postFrame() at most
+    SinkList* old = mSinks.fetchAndStoreOrdered(sinks);
+    for (int i = 0; i < ReaderCount; i++) {
+        //Ordered compare so the reader's release of the slot is seen along with everything before it
+        while (mReading[i].testAndSetOrdered(old, old))
+            QThread::yieldCurrentThread();
+    }
+    delete old;
+}
+
+void MediaFanOut::addSink(MediaSink* sink) {
+    if (sink == NULL)
+        return;
+    QMutexLocker locker(&mWriteLock);
+    if (mSinks->contains(sink))
+        return;
+    SinkList* sinks = new SinkList(*mSinks);
+    sinks->append(sink);
+    publish(sinks);
+}
+
+void MediaFanOut::removeSink(MediaSink* sink) {
+    QMutexLocker locker(&mWriteLock);
+    if (!mSinks->contains(sink))
+        return;
+    SinkList* sinks = new SinkList(*mSinks);
+    sinks->removeAll(sink);
+    publish(sinks);
+}
+
+int MediaFanOut::sinkCount() {
+    QMutexLocker locker(&mWriteLock);
+    return mSinks->size();
+}
+
+void MediaFanOut::setAudioHeader(QByteArray header, int nchan, int srate, int ssize) {
+    SinkList* sinks = acquire(ReaderAudio);
+    for (int i = 0; i < sinks->size(); i++)
+        sinks->at(i)->setAudioHeader(header, nchan, srate, ssize);
+    release(ReaderAudio);
+}
+
+void MediaFanOut::postFrame(MediaFrame frame) {
+    //Sinks only push to their own rings here, a slow one can't hold up the others
+    Reader reader = (frame.type == MediaFrame::VIDEO) ? ReaderVideo : ReaderAudio;
+    SinkList* sinks = acquire(reader);
+    for (int i = 0; i < sinks->size(); i++)
+        sinks->at(i)->postFrame(frame);
+    release(reader);
+}
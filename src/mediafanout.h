@@ -0,0 +1,67 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MEDIAFANOUT_H_
+#define MEDIAFANOUT_H_
+
+#include <QAtomicPointer>
+#include <QList>
+#include <QMutex>
+#include "mediasink.h"
+
+/*
+ * Hands every frame of one encode to a number of sinks.
+ * Frames are passed by value, MediaFrame only references its payload so nothing is copied per sink.
+ * Camera threads never lock: the sinks are an immutable list behind an atomic pointer, add and remove
+ * build a new list and swap it in. Each camera thread publishes the list it's walking in its own slot
+ * (one for video, one for audio and its header) and the old list is only freed once neither slot holds
+ * it, so once removeSink() returns no camera thread is inside that sink anymore, it may be deleted.
+ * Add and remove wait for that from whatever thread calls them, never the camera ones.
+ * Sinks should be added before first frame of a session, late ones miss SPS/PPS and audio header.
+ */
+class MediaFanOut : public MediaSink
+{
+public:
+    MediaFanOut();
+    ~MediaFanOut();
+
+    void addSink(MediaSink* sink);
+    void removeSink(MediaSink* sink);
+    int sinkCount();
+
+    void setAudioHeader(QByteArray header, int nchan, int srate, int ssize);
+    void postFrame(MediaFrame frame);
+
+private:
+    Q_DISABLE_COPY(MediaFanOut)
+
+    typedef QList<MediaSink*> SinkList;
+    enum Reader {
+        ReaderAudio = 0,
+        ReaderVideo,
+        ReaderCount
+    };
+
+    SinkList* acquire(Reader reader);
+    void release(Reader reader);
+    void publish(SinkList* sinks);
+
+    QMutex mWriteLock;                          //Serializes add/remove, never taken by camera threads
+    QAtomicPointer<SinkList> mSinks;
+    QAtomicPointer<SinkList> mReading[ReaderCount];
+};
+
+#endif /* MEDIAFANOUT_H_ */
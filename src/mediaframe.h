@@ -16,21 +16,71 @@
 #ifndef MEDIAFRAME_H_
 #define MEDIAFRAME_H_
 
+#include <QtCore/qnamespace.h>
+#include "mediabuffer.h"
+#include "h264.h"
+
+//Trace points in LatencyTracer::nowUsec() time, 0 where not taken
+struct FrameTimes {
+    qint64 capture;     //Encoder callback
+    qint64 enqueue;     //Publisher's postFrame()
+    qint64 dequeue;     //Popped by publisher thread
+    qint64 firstByte;   //First byte taken by kernel
+    qint64 lastByte;    //Last byte taken by kernel
+
+    FrameTimes()
+        :capture(0), enqueue(0), dequeue(0), firstByte(0), lastByte(0) {}
+};
+
+/*
+ * One audio frame or one video access unit. Video buffer is an AVCC sample, ie, NAL units each behind
+ * a 4 byte length, written out by sinks as is. SPS and PPS come as samples of their own.
+ */
 struct MediaFrame {
     enum MediaFrameType {
         AUDIO = Qt::UserRole+1,
         VIDEO,
-        EOS
+        EOS,
+        AUDIO_CONFIG        //AudioSpecificConfig for audio after it, only ever inside a sink's audio ring
     };
 
-    QByteArray buffer;
+    MediaBuffer buffer;
     long dts;
     long pts;
     MediaFrameType type;
+    FrameTimes times;
 
     bool isEmpty() {
         return buffer.isEmpty();
     }
+
+    //Type of first NAL, all slices of a picture share it
+    int nalType() const {
+        if (type != VIDEO || buffer.size() <= H264_AVCC_LENGTH_SIZE)
+            return 0;
+        return buffer.at(H264_AVCC_LENGTH_SIZE) & 31;
+    }
+
+    //First NAL without its length, for SPS/PPS
+    MediaBuffer firstNAL() const {
+        if (buffer.size() <= H264_AVCC_LENGTH_SIZE)
+            return MediaBuffer();
+        int length = 0;
+        for (int i = 0; i < H264_AVCC_LENGTH_SIZE; i++)
+            length = (length << 8) | (uchar) buffer.at(i);
+        return buffer.mid(H264_AVCC_LENGTH_SIZE, length);
+    }
+
+    //IDR picture, decoding can restart here
+    bool isKeyFrame() const {
+        return nalType() == 5;
+    }
+
+    //SPS or PPS
+    bool isSequenceHeader() const {
+        int nal = nalType();
+        return nal == 7 || nal == 8;
+    }
 };
 
 #endif /* MEDIAFRAME_H_ */
@@ -0,0 +1,38 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MEDIASINK_H_
+#define MEDIASINK_H_
+
+#include <QByteArray>
+#include "mediaframe.h"
+
+/*
+ * Anything encoded frames can be handed to, an RTMP destination, a recorder or a fan-out of those.
+ * Both calls come from camera callback threads, audio and video each from its own thread, and must
+ * never block. A sink that can't keep up queues or drops on its own.
+ */
+class MediaSink
+{
+public:
+    virtual ~MediaSink() {}
+
+    //AudioSpecificConfig of the AAC stream, on audio thread before first audio frame and again on a change
+    virtual void setAudioHeader(QByteArray header, int nchan, int srate, int ssize) = 0;
+    virtual void postFrame(MediaFrame frame) = 0;
+};
+
+#endif /* MEDIASINK_H_ */
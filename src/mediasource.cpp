@@ -0,0 +1,73 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mediasource.h"
+#include "controller.h"
+#include <QElapsedTimer>
+#include <QDebug>
+
+MediaSource::MediaSource(QObject* parent)
+    :QObject(parent),
+     mController(NULL),
+     mIsRealtime(true),
+     mIsStopped(false),
+     mFramesCount(0),
+     mBytesCount(0) {}
+
+void MediaSource::start()
+{
+    //Both tracks are merged in timestamp order, one thread stands in for both camera callback threads
+    Frame video;
+    Frame audio;
+    bool hasVideo = nextVideoFrame(video);
+    bool hasAudio = nextAudioFrame(audio);
+    QElapsedTimer clock;
+    clock.start();
+    while ((hasVideo || hasAudio) && !mIsStopped && mController != NULL) {
+        bool isVideo = hasVideo && (!hasAudio || video.timestamp <= audio.timestamp);
+        Frame& frame = isVideo ? video : audio;
+        if (mIsRealtime) {
+            qint64 wait = (qint64) (frame.timestamp/1000) - clock.elapsed();
+            if (wait > 0) {
+                mLock.lock();
+                if (!mIsStopped)
+                    mCondition.wait(&mLock, wait);
+                mLock.unlock();
+                continue;
+            }
+        }
+        if (isVideo)
+            mController->handleVideoFrame(frame.data, frame.size, MEDIASOURCE_START_TS + frame.timestamp, frame.isKeyFrame);
+        else
+            mController->handleAudioFrame(frame.data, frame.size, MEDIASOURCE_START_TS + frame.timestamp, frame.isKeyFrame);
+        mFramesCount++;
+        mBytesCount += frame.size;
+        if (isVideo)
+            hasVideo = nextVideoFrame(video);
+        else
+            hasAudio = nextAudioFrame(audio);
+    }
+    qDebug()<<"MediaSource"<<mFramesCount<<"frames"<<mBytesCount/1024<<"kb in"<<clock.elapsed()<<"msec";
+    emit finished();
+}
+
+void MediaSource::safeStop()
+{
+    mLock.lock();
+    mIsStopped = true;
+    mCondition.wakeAll();
+    mLock.unlock();
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MEDIASOURCE_H_
+#define MEDIASOURCE_H_
+
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <stdint.h>
+
+#define MEDIASOURCE_START_TS 1000000    //usec, Controller takes a 0 timestamp for not started
+
+class Controller;
+
+/*
+ * Something other than the camera that feeds encoded frames to Controller, eg, files or a generator,
+ * so the pipeline can run and be measured off-device.
+ * Frames are handed over exactly like camera encoder buffers: video is one Annex-B access unit with
+ * 4 byte start codes, SPS+PPS+IDR on key frames and one slice otherwise, audio is one ADTS frame,
+ * timestamps are usec. start() runs on source's own thread (moveToThread, like FramesWriter) till
+ * both tracks run out or safeStop() is called, frames are spaced out in real time unless told not to.
+ */
+class MediaSource : public QObject
+{
+    Q_OBJECT
+public:
+    MediaSource(QObject* parent = 0);
+    virtual ~MediaSource() {}
+
+    void setController(Controller* controller) { mController = controller; }
+    void setRealtime(bool isRealtime) { mIsRealtime = isRealtime; }
+    qint64 framesCount() { return mFramesCount; }
+    qint64 bytesCount() { return mBytesCount; }
+
+signals:
+    void finished();
+
+public slots:
+    void start();
+    void safeStop();
+
+protected:
+    struct Frame {
+        const uint8_t* data;    //Valid till next call for the same track
+        int size;
+        uint64_t timestamp;     //usec from start of source
+        bool isKeyFrame;
+    };
+
+    //Both return false once track has no more frames
+    virtual bool nextVideoFrame(Frame& frame) = 0;
+    virtual bool nextAudioFrame(Frame& frame) = 0;
+
+private:
+    Controller* mController;
+    bool mIsRealtime;
+    QMutex mLock;
+    QWaitCondition mCondition;
+    volatile bool mIsStopped;
+    qint64 mFramesCount;
+    qint64 mBytesCount;
+};
+
+#endif /* MEDIASOURCE_H_ */
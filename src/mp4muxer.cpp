@@ -0,0 +1,470 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mp4muxer.h"
+#include "flv.h"
+#include "h264.h"
+#include <QDebug>
+
+#define MP4_SAMPLE_FLAGS_SYNC 0x02000000        //sample_depends_on 2, ie, depends on nothing
+#define MP4_SAMPLE_FLAGS_NON_SYNC 0x01010000    //sample_depends_on 1 and sample_is_non_sync_sample
+
+namespace {
+
+const int kAACSampleRates[13] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+const quint32 kUnityMatrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+
+void putUInt8(QByteArray& out, quint32 value) {
+    out.append((char) (value & 255));
+}
+
+void putUInt16(QByteArray& out, quint32 value) {
+    out.append((char) ((value >> 8) & 255));
+    out.append((char) (value & 255));
+}
+
+void putUInt24(QByteArray& out, quint32 value) {
+    out.append((char) ((value >> 16) & 255));
+    putUInt16(out, value);
+}
+
+void putUInt32(QByteArray& out, quint32 value) {
+    out.append((char) ((value >> 24) & 255));
+    out.append((char) ((value >> 16) & 255));
+    out.append((char) ((value >> 8) & 255));
+    out.append((char) (value & 255));
+}
+
+void putUInt64(QByteArray& out, quint64 value) {
+    putUInt32(out, (quint32) (value >> 32));
+    putUInt32(out, (quint32) value);
+}
+
+void putZeros(QByteArray& out, int count) {
+    out.append(QByteArray(count, 0));
+}
+
+void setUInt32(QByteArray& out, int position, quint32 value) {
+    out[position] = (char) ((value >> 24) & 255);
+    out[position+1] = (char) ((value >> 16) & 255);
+    out[position+2] = (char) ((value >> 8) & 255);
+    out[position+3] = (char) (value & 255);
+}
+
+//Box size is patched by endBox() once contents are known
+int beginBox(QByteArray& out, const char* type) {
+    int start = out.size();
+    putUInt32(out, 0);
+    out.append(type, 4);
+    return start;
+}
+
+int beginFullBox(QByteArray& out, const char* type, int version, quint32 flags) {
+    int start = beginBox(out, type);
+    putUInt8(out, version);
+    putUInt24(out, flags);
+    return start;
+}
+
+void endBox(QByteArray& out, int start) {
+    setUInt32(out, start, out.size() - start);
+}
+
+//Descriptor of ISO 14496-1 with a one byte size, everything in esds is small enough
+void putDescriptor(QByteArray& out, int tag, const QByteArray& body) {
+    putUInt8(out, tag);
+    putUInt8(out, body.size());
+    out.append(body);
+}
+
+}
+
+MP4Muxer::MP4Muxer() {
+    reset();
+}
+
+void MP4Muxer::reset() {
+    mHasVideo = false;
+    mHasAudio = false;
+    mSPS.clear();
+    mPPS.clear();
+    mWidth = 0;
+    mHeight = 0;
+    mAudioConfig.clear();
+    mSampleRate = 0;
+    mChannels = 0;
+    mBaseTS = -1;
+    mSequenceNumber = 0;
+    initTrack(mVideo, MP4_VIDEO_TRACK_ID, MP4_VIDEO_TIMESCALE, 0);
+    initTrack(mAudio, MP4_AUDIO_TRACK_ID, 0, MP4_AAC_FRAME_SAMPLES);
+}
+
+void MP4Muxer::initTrack(Track& track, int id, quint32 timescale, quint32 nominalDuration) {
+    track.id = id;
+    track.timescale = timescale;
+    track.nominalDuration = nominalDuration;
+    track.samples.clear();
+    track.pending = Sample();
+    track.hasPending = false;
+    track.pendingTime = 0;
+    track.fragmentTime = 0;
+    track.lastDuration = 0;
+    track.bytes = 0;
+}
+
+bool MP4Muxer::setVideoConfig(const QByteArray& sps, const QByteArray& pps) {
+    mHasVideo = true;
+    mSPS = sps;
+    mPPS = pps;
+    H264SPSInfo info;
+    if (!H264::parseSPS(sps, info)) {
+        qDebug()<<"MP4Muxer can't parse SPS";
+        return false;
+    }
+    mWidth = info.width;
+    mHeight = info.height;
+    return true;
+}
+
+bool MP4Muxer::setAudioConfig(const QByteArray& audioSpecificConfig) {
+    //5 bit object type, 4 bit sampling frequency index, 4 bit channel configuration
+    if (audioSpecificConfig.size() < 2)
+        return false;
+    uchar first = (uchar) audioSpecificConfig.at(0);
+    uchar second = (uchar) audioSpecificConfig.at(1);
+    int rateIndex = ((first & 7) << 1) | (second >> 7);
+    if (rateIndex >= 13)
+        return false;
+    mHasAudio = true;
+    mAudioConfig = audioSpecificConfig;
+    mSampleRate = kAACSampleRates[rateIndex];
+    mChannels = (second >> 3) & 15;
+    mAudio.timescale = mSampleRate;
+    return true;
+}
+
+QByteArray MP4Muxer::initSegment() {
+    QByteArray out;
+    int ftyp = beginBox(out, "ftyp");
+    out.append("iso6", 4);
+    putUInt32(out, 0);
+    out.append("iso6", 4);
+    out.append("cmfc", 4);
+    out.append("mp41", 4);
+    endBox(out, ftyp);
+
+    int moov = beginBox(out, "moov");
+    int mvhd = beginFullBox(out, "mvhd", 0, 0);
+    putUInt32(out, 0);      //creation_time
+    putUInt32(out, 0);      //modification_time
+    putUInt32(out, MP4_MOVIE_TIMESCALE);
+    putUInt32(out, 0);      //duration, unknown, fragments carry it
+    putUInt32(out, 0x00010000);     //rate 1.0
+    putUInt16(out, 0x0100);         //volume 1.0
+    putZeros(out, 10);
+    for (int i = 0; i < 9; i++)
+        putUInt32(out, kUnityMatrix[i]);
+    putZeros(out, 24);
+    putUInt32(out, MP4_AUDIO_TRACK_ID + 1);     //next_track_ID
+    endBox(out, mvhd);
+
+    for (int t = 0; t < 2; t++) {
+        bool isVideo = (t == 0);
+        if ((isVideo && !mHasVideo) || (!isVideo && !mHasAudio))
+            continue;
+        Track& track = isVideo ? mVideo : mAudio;
+        int trak = beginBox(out, "trak");
+        int tkhd = beginFullBox(out, "tkhd", 0, 3);     //Enabled and in movie
+        putUInt32(out, 0);
+        putUInt32(out, 0);
+        putUInt32(out, track.id);
+        putUInt32(out, 0);
+        putUInt32(out, 0);      //duration
+        putZeros(out, 8);
+        putUInt16(out, 0);      //layer
+        putUInt16(out, 0);      //alternate_group
+        putUInt16(out, isVideo ? 0 : 0x0100);
+        putUInt16(out, 0);
+        for (int i = 0; i < 9; i++)
+            putUInt32(out, kUnityMatrix[i]);
+        putUInt32(out, isVideo ? (quint32) mWidth << 16 : 0);
+        putUInt32(out, isVideo ? (quint32) mHeight << 16 : 0);
+        endBox(out, tkhd);
+
+        int mdia = beginBox(out, "mdia");
+        int mdhd = beginFullBox(out, "mdhd", 0, 0);
+        putUInt32(out, 0);
+        putUInt32(out, 0);
+        putUInt32(out, track.timescale);
+        putUInt32(out, 0);
+        putUInt16(out, 0x55C4);     //"und" packed in 5 bit letters
+        putUInt16(out, 0);
+        endBox(out, mdhd);
+        int hdlr = beginFullBox(out, "hdlr", 0, 0);
+        putUInt32(out, 0);
+        out.append(isVideo ? "vide" : "soun", 4);
+        putZeros(out, 12);
+        const char* name = isVideo ? "VideoHandler" : "SoundHandler";
+        out.append(name, qstrlen(name) + 1);
+        endBox(out, hdlr);
+
+        int minf = beginBox(out, "minf");
+        if (isVideo) {
+            int vmhd = beginFullBox(out, "vmhd", 0, 1);
+            putZeros(out, 8);       //graphicsmode and opcolor
+            endBox(out, vmhd);
+        } else {
+            int smhd = beginFullBox(out, "smhd", 0, 0);
+            putZeros(out, 4);       //balance and reserved
+            endBox(out, smhd);
+        }
+        int dinf = beginBox(out, "dinf");
+        int dref = beginFullBox(out, "dref", 0, 0);
+        putUInt32(out, 1);
+        int url = beginFullBox(out, "url ", 0, 1);     //Media is in this file
+        endBox(out, url);
+        endBox(out, dref);
+        endBox(out, dinf);
+
+        int stbl = beginBox(out, "stbl");
+        int stsd = beginFullBox(out, "stsd", 0, 0);
+        putUInt32(out, 1);
+        if (isVideo) {
+            int avc1 = beginBox(out, "avc1");
+            putZeros(out, 6);
+            putUInt16(out, 1);      //data_reference_index
+            putZeros(out, 16);
+            putUInt16(out, mWidth);
+            putUInt16(out, mHeight);
+            putUInt32(out, 0x00480000);     //72 dpi
+            putUInt32(out, 0x00480000);
+            putUInt32(out, 0);
+            putUInt16(out, 1);      //frame_count
+            putZeros(out, 32);      //compressorname
+            putUInt16(out, 0x0018);
+            putUInt16(out, 0xFFFF);
+            //avcC is the same AVCDecoderConfigurationRecord FLV carries in its sequence header
+            int avcC = beginBox(out, "avcC");
+            out.append(FLV::avcDecoderConfigurationRecord(mSPS, mPPS));
+            endBox(out, avcC);
+            endBox(out, avc1);
+        } else {
+            int mp4a = beginBox(out, "mp4a");
+            putZeros(out, 6);
+            putUInt16(out, 1);
+            putZeros(out, 8);
+            putUInt16(out, mChannels);
+            putUInt16(out, 16);
+            putZeros(out, 4);
+            putUInt32(out, (quint32) mSampleRate << 16);
+            int esds = beginFullBox(out, "esds", 0, 0);
+            QByteArray decoderConfig;
+            putUInt8(decoderConfig, 0x40);      //MPEG-4 audio
+            putUInt8(decoderConfig, 0x15);      //Audio stream
+            putUInt24(decoderConfig, 0);        //bufferSizeDB
+            putUInt32(decoderConfig, 0);        //maxBitrate
+            putUInt32(decoderConfig, 0);        //avgBitrate
+            putDescriptor(decoderConfig, 5, mAudioConfig);
+            QByteArray slConfig;
+            putUInt8(slConfig, 2);
+            QByteArray esDescriptor;
+            putUInt16(esDescriptor, track.id);
+            putUInt8(esDescriptor, 0);
+            putDescriptor(esDescriptor, 4, decoderConfig);
+            putDescriptor(esDescriptor, 6, slConfig);
+            putDescriptor(out, 3, esDescriptor);
+            endBox(out, esds);
+            endBox(out, mp4a);
+        }
+        endBox(out, stsd);
+        //Empty sample tables, every sample lives in fragments
+        int stts = beginFullBox(out, "stts", 0, 0);
+        putUInt32(out, 0);
+        endBox(out, stts);
+        int stsc = beginFullBox(out, "stsc", 0, 0);
+        putUInt32(out, 0);
+        endBox(out, stsc);
+        int stsz = beginFullBox(out, "stsz", 0, 0);
+        putUInt32(out, 0);
+        putUInt32(out, 0);
+        endBox(out, stsz);
+        int stco = beginFullBox(out, "stco", 0, 0);
+        putUInt32(out, 0);
+        endBox(out, stco);
+        endBox(out, stbl);
+        endBox(out, minf);
+        endBox(out, mdia);
+        endBox(out, trak);
+    }
+
+    int mvex = beginBox(out, "mvex");
+    for (int t = 0; t < 2; t++) {
+        if ((t == 0 && !mHasVideo) || (t == 1 && !mHasAudio))
+            continue;
+        int trex = beginFullBox(out, "trex", 0, 0);
+        putUInt32(out, t == 0 ? MP4_VIDEO_TRACK_ID : MP4_AUDIO_TRACK_ID);
+        putUInt32(out, 1);      //default_sample_description_index
+        putUInt32(out, 0);
+        putUInt32(out, 0);
+        putUInt32(out, 0);
+        endBox(out, trex);
+    }
+    endBox(out, mvex);
+    endBox(out, moov);
+    return out;
+}
+
+void MP4Muxer::addVideoSample(const MediaBuffer& sample, long pts, long dts, bool isKeyFrame) {
+    long offset = pts - dts;
+    addSample(mVideo, sample, dts, offset > 0 ? (quint32) offset : 0, isKeyFrame);
+}
+
+void MP4Muxer::addAudioSample(const MediaBuffer& frame, long dts) {
+    addSample(mAudio, frame, dts, 0, true);
+}
+
+void MP4Muxer::addSample(Track& track, const MediaBuffer& data, long dts, quint32 compositionOffset, bool isSync) {
+    if (mBaseTS < 0)
+        mBaseTS = dts;
+    qint64 time = (qint64) (dts - mBaseTS) * track.timescale / 1000;
+    if (track.hasPending) {
+        qint64 duration = time - track.pendingTime;
+        //Whole frames unless timestamps say a frame or more went missing
+        if (track.nominalDuration > 0 && qAbs(duration - (qint64) track.nominalDuration) < track.nominalDuration)
+            duration = track.nominalDuration;
+        if (duration <= 0)
+            duration = 1;
+        closePending(track, (quint32) duration);
+    } else {
+        track.pendingTime = time;
+    }
+    track.pending.data = data;
+    track.pending.compositionOffset = compositionOffset * track.timescale / 1000;
+    track.pending.isSync = isSync;
+    track.pending.duration = 0;
+    track.hasPending = true;
+    track.bytes += data.size();
+}
+
+void MP4Muxer::closePending(Track& track, quint32 duration) {
+    if (track.samples.isEmpty())
+        track.fragmentTime = track.pendingTime;
+    track.pending.duration = duration;
+    track.samples.append(track.pending);
+    track.pendingTime += duration;
+    track.lastDuration = duration;
+    track.pending = Sample();
+    track.hasPending = false;
+}
+
+int MP4Muxer::fragmentDuration() {
+    int duration = 0;
+    Track* tracks[2] = {&mVideo, &mAudio};
+    for (int t = 0; t < 2; t++) {
+        Track& track = *tracks[t];
+        if (track.samples.isEmpty() || track.timescale == 0)
+            continue;
+        qint64 trackDuration = (track.pendingTime - track.fragmentTime) * 1000 / track.timescale;
+        if (trackDuration > duration)
+            duration = (int) trackDuration;
+    }
+    return duration;
+}
+
+int MP4Muxer::fragmentBytes() {
+    return mVideo.bytes + mAudio.bytes;
+}
+
+bool MP4Muxer::writeFragment(QByteArray& out, bool isFinal) {
+    /*
+     * moof with mfhd and one traf per track (tfhd, tfdt, trun), then one mdat with video samples followed
+     * by audio samples. trun data offsets are relative to moof start (default-base-is-moof) and patched
+     * once moof size is known.
+     */
+    Track* tracks[2] = {&mVideo, &mAudio};
+    if (isFinal) {
+        for (int t = 0; t < 2; t++) {
+            Track& track = *tracks[t];
+            if (track.hasPending) {
+                quint32 duration = track.lastDuration;
+                if (duration == 0)
+                    duration = track.nominalDuration > 0 ? track.nominalDuration : track.timescale/30;
+                closePending(track, duration);
+            }
+        }
+    }
+    if (mVideo.samples.isEmpty() && mAudio.samples.isEmpty())
+        return false;
+    int moofStart = out.size();
+    int moof = beginBox(out, "moof");
+    int mfhd = beginFullBox(out, "mfhd", 0, 0);
+    putUInt32(out, ++mSequenceNumber);
+    endBox(out, mfhd);
+    int dataOffsetPositions[2] = {-1, -1};
+    for (int t = 0; t < 2; t++) {
+        if (!tracks[t]->samples.isEmpty())
+            writeTraf(out, *tracks[t], t == 0, dataOffsetPositions[t]);
+    }
+    endBox(out, moof);
+    int moofSize = out.size() - moofStart;
+
+    int mdatStart = out.size();
+    beginBox(out, "mdat");
+    for (int t = 0; t < 2; t++) {
+        Track& track = *tracks[t];
+        if (track.samples.isEmpty())
+            continue;
+        setUInt32(out, dataOffsetPositions[t], moofSize + (out.size() - mdatStart));
+        for (int i = 0; i < track.samples.size(); i++) {
+            //Video samples come length prefixed already, ie, AVCC
+            const MediaBuffer& data = track.samples.at(i).data;
+            out.append(data.constData(), data.size());
+        }
+        track.samples.clear();
+        track.bytes = track.hasPending ? track.pending.data.size() : 0;
+    }
+    endBox(out, mdatStart);
+    return true;
+}
+
+void MP4Muxer::writeTraf(QByteArray& out, Track& track, bool isVideo, int& dataOffsetPosition) {
+    int traf = beginBox(out, "traf");
+    int tfhd = beginFullBox(out, "tfhd", 0, 0x020000);     //default-base-is-moof
+    putUInt32(out, track.id);
+    endBox(out, tfhd);
+    int tfdt = beginFullBox(out, "tfdt", 1, 0);
+    putUInt64(out, (quint64) track.fragmentTime);
+    endBox(out, tfdt);
+    //data-offset, sample duration and size, video adds sample flags and composition time offset
+    quint32 flags = 0x000001 | 0x000100 | 0x000200;
+    if (isVideo)
+        flags |= 0x000400 | 0x000800;
+    int trun = beginFullBox(out, "trun", 0, flags);
+    putUInt32(out, track.samples.size());
+    dataOffsetPosition = out.size();
+    putUInt32(out, 0);
+    for (int i = 0; i < track.samples.size(); i++) {
+        const Sample& sample = track.samples.at(i);
+        putUInt32(out, sample.duration);
+        putUInt32(out, sample.data.size());
+        if (isVideo) {
+            putUInt32(out, sample.isSync ? MP4_SAMPLE_FLAGS_SYNC : MP4_SAMPLE_FLAGS_NON_SYNC);
+            putUInt32(out, sample.compositionOffset);
+        }
+    }
+    endBox(out, trun);
+    endBox(out, traf);
+}
@@ -0,0 +1,100 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MP4MUXER_H_
+#define MP4MUXER_H_
+
+#include <QByteArray>
+#include <QList>
+#include "mediabuffer.h"
+
+#define MP4_VIDEO_TRACK_ID 1
+#define MP4_AUDIO_TRACK_ID 2
+#define MP4_MOVIE_TIMESCALE 1000
+#define MP4_VIDEO_TIMESCALE 1000    //Frame timestamps are msec already
+#define MP4_AAC_FRAME_SAMPLES 1024
+
+/*
+ * Fragmented MP4 (CMAF style) boxes for one H.264 and one AAC track.
+ * initSegment() is ftyp+moov with avcC and esds and no samples, each writeFragment() is one moof+mdat.
+ * Samples are added in decode order with msec timestamps relative to start of recording. The latest
+ * sample of each track is held back till the next one gives its duration, so a fragment closed right after
+ * an IDR is added ends just before that IDR.
+ * Audio durations are whole AAC frames in sample rate units, timestamps only correct them after a gap.
+ */
+class MP4Muxer
+{
+public:
+    MP4Muxer();
+
+    void reset();
+    //Both return false if config can't be parsed, track is still set up then but may lack frame size
+    bool setVideoConfig(const QByteArray& sps, const QByteArray& pps);
+    bool setAudioConfig(const QByteArray& audioSpecificConfig);
+    bool hasVideo() { return mHasVideo; }
+    bool hasAudio() { return mHasAudio; }
+    QByteArray initSegment();
+
+    void addVideoSample(const MediaBuffer& sample, long pts, long dts, bool isKeyFrame);
+    void addAudioSample(const MediaBuffer& frame, long dts);
+    //Of samples ready for next fragment
+    int fragmentDuration();
+    int fragmentBytes();
+    //Appends moof+mdat of ready samples to out, isFinal also takes held back ones. False if there was nothing.
+    bool writeFragment(QByteArray& out, bool isFinal);
+
+private:
+    struct Sample {
+        MediaBuffer data;
+        quint32 duration;
+        quint32 compositionOffset;
+        bool isSync;
+    };
+
+    struct Track {
+        int id;
+        quint32 timescale;
+        quint32 nominalDuration;    //0 if durations come from timestamps only
+        QList<Sample> samples;      //Ready for next fragment
+        Sample pending;
+        bool hasPending;
+        qint64 pendingTime;         //Decode time of pending sample, in timescale units
+        qint64 fragmentTime;        //Decode time of samples.first()
+        quint32 lastDuration;
+        int bytes;
+    };
+
+    void initTrack(Track& track, int id, quint32 timescale, quint32 nominalDuration);
+    void addSample(Track& track, const MediaBuffer& data, long dts, quint32 compositionOffset, bool isSync);
+    void closePending(Track& track, quint32 duration);
+    void writeTraf(QByteArray& out, Track& track, bool isVideo, int& dataOffsetPosition);
+
+    bool mHasVideo;
+    bool mHasAudio;
+    QByteArray mSPS;
+    QByteArray mPPS;
+    int mWidth;
+    int mHeight;
+    QByteArray mAudioConfig;
+    int mSampleRate;
+    int mChannels;
+    long mBaseTS;           //dts of first sample of any track, -1 till then
+    quint32 mSequenceNumber;
+    Track mVideo;
+    Track mAudio;
+};
+
+#endif /* MP4MUXER_H_ */
@@ -0,0 +1,266 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mp4writer.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+
+MP4Writer::MP4Writer(QString path, QObject* parent)
+    :QObject(parent),
+     mAudioQueue(MP4WRITER_MAX_QUEUE_SIZE),
+     mVideoQueue(MP4WRITER_MAX_QUEUE_SIZE),
+     mIsPumpScheduled(0),
+     mDroppedFramesCount(0),
+     mIsStopped(false),
+     mIsInitWritten(false),
+     mHasWriteFailed(false),
+     mInterleaver(2),
+     mStartTS(0),
+     mBytesWritten(0),
+     mFragmentCount(0)
+{
+    mInterleaveTimer = new QTimer(this);
+    mInterleaveTimer->setSingleShot(true);
+    QObject::connect(mInterleaveTimer,SIGNAL(timeout()),this,SLOT(pumpFrames()));
+    mInterleaveClock.start();
+    if(path.isEmpty())
+        path = "shared/documents/"+QDateTime::currentDateTime().toString("dd-MMM-yy hh:mm:ssAP");
+    mWriteLocation = path+MP4WRITER_EXTENSION;
+    QDir dir;
+    dir.mkpath(QFileInfo(mWriteLocation).absolutePath());
+}
+
+MP4Writer::~MP4Writer() {}
+
+void MP4Writer::start()
+{
+    mFile.setFileName(mWriteLocation);
+    if (!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        qDebug()<<"Can't open"<<mWriteLocation<<mFile.errorString();
+        mIsStopped = true;
+        emit writeLocationError();
+        emit finished();
+        return;
+    }
+    mFragment.reserve(MP4WRITER_MAX_FRAGMENT_BYTES + 64*1024);
+    schedulePump();
+}
+
+void MP4Writer::setAudioHeader(QByteArray header, int nchan, int srate, int ssize)
+{
+    //esds takes rate and channels from the config itself
+    Q_UNUSED(nchan);
+    Q_UNUSED(srate);
+    Q_UNUSED(ssize);
+    mConfigLock.lock();
+    mAACHeader = header;
+    mConfigLock.unlock();
+}
+
+void MP4Writer::postFrame(MediaFrame frame)
+{
+    //Camera threads, one producer per ring, never blocks
+    if (mIsStopped)
+        return;
+    if (frame.type == MediaFrame::EOS) {
+        safeStop();
+        return;
+    }
+    FrameRing<MediaFrame>& queue = (frame.type == MediaFrame::AUDIO) ? mAudioQueue : mVideoQueue;
+    if (!queue.push(frame)) {
+        mDroppedFramesCount.fetchAndAddRelaxed(1);
+        return;
+    }
+    schedulePump();
+}
+
+void MP4Writer::schedulePump()
+{
+    if (mIsPumpScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "pumpFrames", Qt::QueuedConnection);
+}
+
+void MP4Writer::pumpFrames()
+{
+    /*
+     * Writes frames of both rings in dts order. Once a track has started its next frame is waited for,
+     * so samples of a fragment cover the same stretch of time in both tracks, but only as long as
+     * mInterleaver allows, a stalled microphone doesn't stall the recording.
+     */
+    mIsPumpScheduled.fetchAndStoreOrdered(0);
+    while (!mIsStopped && !mHasWriteFailed) {
+        if (!mIsInitWritten && !writeInitSegment())
+            return;
+        if (!mMuxer.hasAudio()) {
+            MediaFrame dropped;
+            while (mAudioQueue.pop(dropped)) {}
+        }
+        MediaFrame* audioFrame = mAudioQueue.peek();
+        MediaFrame* videoFrame = mVideoQueue.peek();
+        long heads[2];
+        heads[INTERLEAVER_TRACK_VIDEO] = videoFrame != NULL ? videoFrame->dts : INTERLEAVER_EMPTY;
+        heads[INTERLEAVER_TRACK_AUDIO] = audioFrame != NULL ? audioFrame->dts : INTERLEAVER_EMPTY;
+        int track = mInterleaver.next(heads, mInterleaveClock.elapsed());
+        if (track < 0) {
+            int wait = mInterleaver.waitMsec(mInterleaveClock.elapsed());
+            if (wait >= 0 && !mInterleaveTimer->isActive())
+                mInterleaveTimer->start(wait);
+            return;
+        }
+        MediaFrame frame;
+        if (track == INTERLEAVER_TRACK_AUDIO)
+            mAudioQueue.pop(frame);
+        else
+            mVideoQueue.pop(frame);
+        mInterleaver.taken(track, frame.dts);
+        writeFrame(frame);
+    }
+}
+
+bool MP4Writer::writeInitSegment()
+{
+    /*
+     * File starts at first IDR. SPS/PPS in front of it are taken for avcC, video before it can't be decoded
+     * and audio before it would start ahead of picture, both are dropped.
+     * AAC config is set on first audio frame, usually right away, video waits a bit for it.
+     */
+    MediaFrame frame;
+    MediaFrame* head;
+    while ((head = mVideoQueue.peek()) != NULL && !head->isKeyFrame()) {
+        mVideoQueue.pop(frame);
+        if (frame.isSequenceHeader()) {
+            if (frame.nalType() == 7)
+                mSPS = frame.firstNAL().toByteArray();
+            else
+                mPPS = frame.firstNAL().toByteArray();
+        }
+    }
+    if (head == NULL || mSPS.isEmpty() || mPPS.isEmpty())
+        return false;
+    mConfigLock.lock();
+    QByteArray audioConfig = mAACHeader;
+    mConfigLock.unlock();
+    if (audioConfig.isEmpty()) {
+        MediaFrame* last = mVideoQueue.peekAt(mVideoQueue.size() - 1);
+        if (last == NULL || last->dts - head->dts < MP4WRITER_AUDIO_WAIT_MSEC)
+            return false;
+        qDebug()<<"MP4Writer no audio config, recording video only";
+    }
+    mStartTS = head->dts;
+    mMuxer.reset();
+    mMuxer.setVideoConfig(mSPS, mPPS);
+    if (!audioConfig.isEmpty())
+        mMuxer.setAudioConfig(audioConfig);
+    while ((head = mAudioQueue.peek()) != NULL && head->dts < mStartTS)
+        mAudioQueue.pop(frame);
+    mIsInitWritten = true;
+    return writeData(mMuxer.initSegment());
+}
+
+void MP4Writer::writeFrame(const MediaFrame& frame)
+{
+    if (frame.buffer.isEmpty())
+        return;
+    if (frame.type == MediaFrame::AUDIO) {
+        mMuxer.addAudioSample(frame.buffer, frame.dts - mStartTS);
+    } else {
+        //Parameter sets are in avcC already, camera repeats the same ones
+        if (frame.isSequenceHeader())
+            return;
+        bool isKeyFrame = frame.isKeyFrame();
+        mMuxer.addVideoSample(frame.buffer, frame.pts - mStartTS, frame.dts - mStartTS, isKeyFrame);
+        //Muxer holds the IDR back, so fragment closed here ends right before it
+        if (isKeyFrame && mMuxer.fragmentDuration() >= MP4WRITER_MIN_FRAGMENT_MSEC) {
+            writeFragment(false);
+            return;
+        }
+    }
+    if (mMuxer.fragmentBytes() >= MP4WRITER_MAX_FRAGMENT_BYTES)
+        writeFragment(false);
+}
+
+void MP4Writer::writeFragment(bool isFinal)
+{
+    mFragment.clear();
+    if (!mMuxer.writeFragment(mFragment, isFinal))
+        return;
+    if (writeData(mFragment))
+        mFragmentCount++;
+}
+
+bool MP4Writer::writeData(const QByteArray& data)
+{
+    if (mHasWriteFailed)
+        return false;
+    //Whole box sequence in one write, a crash can't leave half a moof behind a complete one
+    if (mFile.write(data.constData(), data.size()) != data.size()) {
+        qDebug()<<"MP4Writer write failed"<<mFile.errorString();
+        mHasWriteFailed = true;
+        emit writeLocationError();
+        return false;
+    }
+    mBytesWritten += data.size();
+    return true;
+}
+
+void MP4Writer::safeStop()
+{
+    if (mIsStopped)
+        return;
+    mIsStopped = true;
+    //May be called from any thread, last fragment is written on writer's own thread
+    QMetaObject::invokeMethod(this, "stop", Qt::QueuedConnection);
+}
+
+void MP4Writer::stop()
+{
+    /*
+     * safeStop() has already cut pumpFrames() short, and camera threads are detached from the fan-out by now,
+     * so what the rings hold is the end of the recording. It goes through writeFrame() in dts order without
+     * waiting on either track, then the last fragment closes the file.
+     */
+    mInterleaveTimer->stop();
+    if (mFile.isOpen()) {
+        if (!mIsInitWritten && !mHasWriteFailed)
+            writeInitSegment();
+        if (mIsInitWritten && !mMuxer.hasAudio()) {
+            MediaFrame dropped;
+            while (mAudioQueue.pop(dropped)) {}
+        }
+        while (mIsInitWritten && !mHasWriteFailed) {
+            MediaFrame* audioFrame = mAudioQueue.peek();
+            MediaFrame* videoFrame = mVideoQueue.peek();
+            if (audioFrame == NULL && videoFrame == NULL)
+                break;
+            MediaFrame frame;
+            if (videoFrame == NULL || (audioFrame != NULL && audioFrame->dts < videoFrame->dts))
+                mAudioQueue.pop(frame);
+            else
+                mVideoQueue.pop(frame);
+            writeFrame(frame);
+        }
+        if (mIsInitWritten)
+            writeFragment(true);
+        mFile.close();
+        if (!mIsInitWritten)
+            QFile::remove(mWriteLocation);
+    }
+    qDebug()<<"MP4Writer"<<mWriteLocation<<mBytesWritten/1024<<"kb in"<<mFragmentCount<<"fragments,"
+            <<droppedFramesCount()<<"frames dropped";
+    emit finished();
+}
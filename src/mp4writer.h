@@ -0,0 +1,104 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MP4WRITER_H_
+#define MP4WRITER_H_
+
+#include <QObject>
+#include <QThread>
+#include <QFile>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "mediaframe.h"
+#include "mediasink.h"
+#include "framering.h"
+#include "interleaver.h"
+#include "mp4muxer.h"
+
+#define MP4WRITER_MAX_QUEUE_SIZE 256                //Per track, a slow card drops frames instead of growing memory
+#define MP4WRITER_MIN_FRAGMENT_MSEC 1000            //Shorter GOPs share a fragment
+#define MP4WRITER_MAX_FRAGMENT_BYTES (4*1024*1024)  //Fragment is cut even without an IDR past this
+#define MP4WRITER_AUDIO_WAIT_MSEC 2000              //Video waits this long for AAC config, then file is video only
+#define MP4WRITER_EXTENSION ".mp4"
+
+/*
+ * Records the stream locally as fragmented MP4.
+ * Init segment goes out once SPS/PPS (and AAC config, if it comes in time) are known, then one moof+mdat
+ * per GOP starting at an IDR. Each fragment is written as soon as it is closed, so the file plays while
+ * recording and a crash loses at most the open fragment. Nothing has to be patched on stop.
+ * Frames arrive on camera threads into two single-producer rings like RTMPPublisher's, muxing and file
+ * writes happen on writer's own thread. Memory is bounded by the rings and MP4WRITER_MAX_FRAGMENT_BYTES.
+ */
+class MP4Writer : public QObject, public MediaSink
+{
+    Q_OBJECT
+public:
+    //Path without extension, MP4WRITER_EXTENSION is appended
+    MP4Writer(QString path = QString(),
+            QObject* parent = 0);
+    ~MP4Writer();
+    void setAudioHeader(QByteArray header, int nchan, int srate, int ssize);
+    void postFrame(MediaFrame frame);
+    QString fileName() { return mWriteLocation; }
+    int droppedFramesCount() { return mDroppedFramesCount.fetchAndAddRelaxed(0); }
+
+signals:
+    void writeLocationError();
+    void finished();
+
+public slots:
+    void start();
+    void safeStop();
+
+private slots:
+    void pumpFrames();
+    void stop();
+
+private:
+    void schedulePump();
+    bool writeInitSegment();
+    void writeFrame(const MediaFrame& frame);
+    void writeFragment(bool isFinal);
+    bool writeData(const QByteArray& data);
+
+    QString mWriteLocation;
+    QFile mFile;
+    FrameRing<MediaFrame> mAudioQueue;
+    FrameRing<MediaFrame> mVideoQueue;
+    QAtomicInt mIsPumpScheduled;
+    QAtomicInt mDroppedFramesCount;
+    volatile bool mIsStopped;
+    QMutex mConfigLock;
+    QByteArray mAACHeader;          //Set by camera audio thread, under mConfigLock
+
+    //Writer thread only
+    MP4Muxer mMuxer;
+    QByteArray mSPS;
+    QByteArray mPPS;
+    QByteArray mFragment;           //Reused for every moof+mdat
+    bool mIsInitWritten;
+    bool mHasWriteFailed;
+    Interleaver mInterleaver;
+    QElapsedTimer mInterleaveClock;
+    QTimer* mInterleaveTimer;       //Gives up on a late track
+    long mStartTS;                  //dts of first IDR, file timeline starts here
+    qint64 mBytesWritten;
+    int mFragmentCount;
+};
+
+#endif /* MP4WRITER_H_ */
@@ -0,0 +1,337 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "prerollbuffer.h"
+#include <QThread>
+#include <string.h>
+
+PrerollBuffer::PrerollBuffer(int durationMsec, int maxBytes, int maxFrames)
+    :mDurationMsec(durationMsec),
+     mOldestVideoDts(0),
+     mNewestVideoDts(0),
+     mHasVideo(0),
+     mVideoConfigSequence(0),
+     mAudioConfigSequence(0),
+     mNumChannels(0),
+     mSampleSize(0) {
+    int audioBytes = qMin(PREROLL_AUDIO_BYTES, maxBytes/4);
+    initTrack(mVideo, maxBytes - audioBytes, maxFrames);
+    initTrack(mAudio, audioBytes, maxFrames);
+    mSPS.size = 0;
+    mPPS.size = 0;
+    mAACHeader.size = 0;
+}
+
+PrerollBuffer::~PrerollBuffer() {
+    delete[] mVideo.arena;
+    delete[] mVideo.entries;
+    delete[] mAudio.arena;
+    delete[] mAudio.entries;
+}
+
+void PrerollBuffer::initTrack(Track& track, int arenaSize, int maxFrames) {
+    int size = 1;
+    while (size < maxFrames)
+        size <<= 1;
+    track.arena = new char[arenaSize];
+    track.arenaSize = arenaSize;
+    track.entries = new Entry[size];
+    track.mask = size - 1;
+    track.head = 0;
+    track.tail = 0;
+    track.usedBytes = 0;
+    track.isClearPending = 0;
+    track.writePos = 0;
+}
+
+void PrerollBuffer::keepParameterSet(ParameterSet& stored, QAtomicInt& sequence, const char* data, int size) {
+    if (size > PREROLL_MAX_PARAMETER_SET)
+        return;
+    if (stored.size == size && memcmp(stored.data, data, size) == 0)
+        return;
+    sequence.fetchAndAddOrdered(1);
+    memcpy(stored.data, data, size);
+    stored.size = size;
+    sequence.fetchAndAddOrdered(1);
+}
+
+QByteArray PrerollBuffer::parameterSet(const ParameterSet& stored) {
+    //Size may be torn while a camera thread rewrites it, caller retries then but mustn't read past data
+    return QByteArray(stored.data, qBound(0, stored.size, PREROLL_MAX_PARAMETER_SET));
+}
+
+void PrerollBuffer::setAudioHeader(QByteArray header, int nchan, int srate, int ssize) {
+    Q_UNUSED(srate);
+    if (header.size() > PREROLL_MAX_PARAMETER_SET)
+        return;
+    mAudioConfigSequence.fetchAndAddOrdered(1);
+    memcpy(mAACHeader.data, header.constData(), header.size());
+    mAACHeader.size = header.size();
+    mNumChannels = nchan;
+    mSampleSize = ssize;
+    mAudioConfigSequence.fetchAndAddOrdered(1);
+}
+
+void PrerollBuffer::postFrame(MediaFrame frame) {
+    //Camera threads, each only ever writes its own track
+    if (frame.type == MediaFrame::EOS || frame.buffer.isEmpty())
+        return;
+    bool isVideo = frame.type == MediaFrame::VIDEO;
+    Track& track = isVideo ? mVideo : mAudio;
+    if (track.isClearPending.testAndSetOrdered(1, 0))
+        applyClear(track);
+    if (isVideo && frame.isSequenceHeader()) {
+        MediaBuffer nal = frame.firstNAL();
+        keepParameterSet(frame.nalType() == 7 ? mSPS : mPPS, mVideoConfigSequence, nal.constData(), nal.size());
+        return;
+    }
+    //Video starts at an IDR, a picture that can't be kept breaks the rest of its GOP
+    if (isVideo && track.count() == 0 && !frame.isKeyFrame())
+        return;
+    int offset;
+    if (!findSpace(track, frame.buffer.size(), offset, isVideo)) {
+        if (isVideo)
+            applyClear(track);
+        return;
+    }
+    memcpy(track.arena + offset, frame.buffer.constData(), frame.buffer.size());
+    int tail = track.tail.fetchAndAddRelaxed(0);
+    Entry& entry = track.at(tail);
+    entry.offset = offset;
+    entry.size = frame.buffer.size();
+    entry.dts = frame.dts;
+    entry.pts = frame.pts;
+    entry.isKeyFrame = frame.isKeyFrame();
+    track.writePos = offset + entry.size;
+    track.usedBytes.fetchAndAddRelaxed(entry.size);
+    track.tail.fetchAndStoreRelease(tail + 1);
+    if (isVideo)
+        dropVideoForDuration();
+    else
+        dropAudioForDuration();
+}
+
+bool PrerollBuffer::findSpace(Track& track, int size, int& offset, bool isVideo) {
+    /*
+     * Frames are laid out back to back from writePos. One that doesn't fit before end of arena starts
+     * over at 0, the tail is left unused. Free space ends at oldest frame, which is dropped (a GOP at a
+     * time for video) till there is room. A frame larger than whole arena is not buffered.
+     */
+    if (size > track.arenaSize)
+        return false;
+    while (true) {
+        int count = track.count();
+        if (count == 0) {
+            offset = 0;
+            return true;
+        }
+        if (count <= track.mask) {
+            int head = track.at(track.head.fetchAndAddRelaxed(0)).offset;
+            if (track.writePos > head) {
+                if (track.writePos + size <= track.arenaSize) {
+                    offset = track.writePos;
+                    return true;
+                }
+                if (size < head) {
+                    offset = 0;
+                    return true;
+                }
+            } else if (track.writePos + size < head) {
+                offset = track.writePos;
+                return true;
+            }
+        }
+        dropOldest(track, isVideo);
+    }
+}
+
+void PrerollBuffer::dropOldest(Track& track, bool isVideo) {
+    //Oldest frame, for video everything up to next IDR too so buffer keeps starting at one
+    int head = track.head.fetchAndAddRelaxed(0);
+    int count = track.count();
+    int dropped = 0;
+    int bytes = 0;
+    do {
+        bytes += track.at(head + dropped).size;
+        dropped++;
+    } while (isVideo && dropped < count && !track.at(head + dropped).isKeyFrame);
+    track.usedBytes.fetchAndAddRelaxed(-bytes);
+    //Ordered, a snapshot must be able to see these are gone before any of their bytes are overwritten
+    track.head.fetchAndStoreOrdered(head + dropped);
+}
+
+void PrerollBuffer::applyClear(Track& track) {
+    track.head.fetchAndStoreOrdered(track.tail.fetchAndAddRelaxed(0));
+    track.usedBytes.fetchAndStoreRelaxed(0);
+    track.writePos = 0;
+    if (&track == &mVideo)
+        mHasVideo.fetchAndStoreRelease(0);
+}
+
+void PrerollBuffer::dropVideoForDuration() {
+    //Drop a GOP only if next IDR onwards still covers the duration
+    int count;
+    while ((count = mVideo.count()) > 1) {
+        int head = mVideo.head.fetchAndAddRelaxed(0);
+        long newest = mVideo.at(head + count - 1).dts;
+        int next = 1;
+        while (next < count && !mVideo.at(head + next).isKeyFrame)
+            next++;
+        if (next >= count || newest - mVideo.at(head + next).dts < mDurationMsec)
+            break;
+        dropOldest(mVideo, true);
+    }
+    int head = mVideo.head.fetchAndAddRelaxed(0);
+    mOldestVideoDts.fetchAndStoreRelaxed((int) mVideo.at(head).dts);
+    mNewestVideoDts.fetchAndStoreRelaxed((int) mVideo.at(head + mVideo.count() - 1).dts);
+    mHasVideo.fetchAndStoreRelease(1);
+}
+
+void PrerollBuffer::dropAudioForDuration() {
+    //Audio from before the oldest IDR can't go in a clip, without video the duration decides
+    int head = mAudio.head.fetchAndAddRelaxed(0);
+    int count = mAudio.count();
+    long newest = mAudio.at(head + count - 1).dts;
+    long oldest = mHasVideo.fetchAndAddAcquire(0) ? (long) mOldestVideoDts.fetchAndAddRelaxed(0)
+            : newest - mDurationMsec;
+    while (count > 1 && mAudio.at(head).dts < oldest) {
+        dropOldest(mAudio, false);
+        head++;
+        count--;
+    }
+}
+
+void PrerollBuffer::clear() {
+    //Camera threads own their tracks, they empty them on their next frame
+    mVideo.isClearPending.fetchAndStoreOrdered(1);
+    mAudio.isClearPending.fetchAndStoreOrdered(1);
+}
+
+bool PrerollBuffer::readConfig(PrerollClip& clip) {
+    //Read again while a camera thread is halfway through rewriting, that's a few hundred bytes at most
+    int sequence;
+    do {
+        while ((sequence = mVideoConfigSequence.fetchAndAddOrdered(0)) & 1)
+            QThread::yieldCurrentThread();
+        clip.sps = parameterSet(mSPS);
+        clip.pps = parameterSet(mPPS);
+    } while (mVideoConfigSequence.fetchAndAddOrdered(0) != sequence);
+    do {
+        while ((sequence = mAudioConfigSequence.fetchAndAddOrdered(0)) & 1)
+            QThread::yieldCurrentThread();
+        clip.aacHeader = parameterSet(mAACHeader);
+        clip.numChannels = mNumChannels;
+        clip.sampleSize = mSampleSize;
+    } while (mAudioConfigSequence.fetchAndAddOrdered(0) != sequence);
+    return !clip.sps.isEmpty() && !clip.pps.isEmpty();
+}
+
+bool PrerollBuffer::copyTrack(Track& track, QList<Entry>& entries, MediaBuffer& first, MediaBuffer& second,
+        int& start) {
+    /*
+     * Entries from head to tail are copied, then the bytes they cover in one or two copies. The camera
+     * thread may drop the oldest ones meanwhile and write over them, but it moves head past them first,
+     * so whatever is still past head after a copy was copied intact. Ordered reads of head keep the copies
+     * ahead of the checks. Nothing is locked, a camera thread never waits on a snapshot.
+     */
+    int tail = track.tail.fetchAndAddAcquire(0);
+    int head = track.head.fetchAndAddOrdered(0);
+    for (int i = head; i < tail; i++)
+        entries.append(track.at(i));
+    int valid = track.head.fetchAndAddOrdered(0);
+    while (head < valid && !entries.isEmpty()) {
+        entries.removeFirst();
+        head++;
+    }
+    if (entries.isEmpty())
+        return false;
+    start = entries.first().offset;
+    int end = entries.last().offset + entries.last().size;
+    if (end > start) {
+        first = MediaBuffer::fromData(track.arena + start, end - start);
+    } else {
+        first = MediaBuffer::fromData(track.arena + start, track.arenaSize - start);
+        second = MediaBuffer::fromData(track.arena, end);
+    }
+    valid = track.head.fetchAndAddOrdered(0);
+    while (head < valid && !entries.isEmpty()) {
+        entries.removeFirst();
+        head++;
+    }
+    return !entries.isEmpty();
+}
+
+void PrerollBuffer::appendFrames(QList<MediaFrame>& frames, const QList<Entry>& entries, int from, long fromDts,
+        MediaFrame::MediaFrameType type, const MediaBuffer& first, const MediaBuffer& second, int start) {
+    for (int i = from; i < entries.size(); i++) {
+        const Entry& entry = entries.at(i);
+        if (entry.dts < fromDts)
+            continue;
+        MediaFrame frame;
+        if (entry.offset >= start)
+            frame.buffer = first.mid(entry.offset - start, entry.size);
+        else
+            frame.buffer = second.mid(entry.offset, entry.size);
+        frame.dts = entry.dts;
+        frame.pts = entry.pts;
+        frame.type = type;
+        frames.append(frame);
+    }
+}
+
+bool PrerollBuffer::snapshot(PrerollClip& clip) {
+    /*
+     * Each track is copied on its own while its camera thread keeps going, see copyTrack(). What it
+     * dropped meanwhile is left out, video is then cut to start at its first IDR and audio at that IDR.
+     */
+    if (mVideo.isClearPending.fetchAndAddAcquire(0) || mAudio.isClearPending.fetchAndAddAcquire(0))
+        return false;
+    if (!readConfig(clip))
+        return false;
+    QList<Entry> video;
+    MediaBuffer videoFirst;
+    MediaBuffer videoSecond;
+    int videoStart;
+    if (!copyTrack(mVideo, video, videoFirst, videoSecond, videoStart))
+        return false;
+    int from = 0;
+    while (from < video.size() && !video.at(from).isKeyFrame)
+        from++;
+    if (from >= video.size())
+        return false;
+    QList<Entry> audio;
+    MediaBuffer audioFirst;
+    MediaBuffer audioSecond;
+    int audioStart = 0;
+    bool hasAudio = copyTrack(mAudio, audio, audioFirst, audioSecond, audioStart);
+    clip.frames.clear();
+    appendFrames(clip.frames, video, from, video.at(from).dts, MediaFrame::VIDEO, videoFirst, videoSecond,
+            videoStart);
+    if (hasAudio)
+        appendFrames(clip.frames, audio, 0, video.at(from).dts, MediaFrame::AUDIO, audioFirst, audioSecond,
+                audioStart);
+    return true;
+}
+
+int PrerollBuffer::bufferedDuration() {
+    if (!mHasVideo.fetchAndAddAcquire(0))
+        return 0;
+    return mNewestVideoDts.fetchAndAddRelaxed(0) - mOldestVideoDts.fetchAndAddRelaxed(0);
+}
+
+int PrerollBuffer::bufferedBytes() {
+    return mVideo.usedBytes.fetchAndAddRelaxed(0) + mAudio.usedBytes.fetchAndAddRelaxed(0);
+}
@@ -0,0 +1,138 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef PREROLLBUFFER_H_
+#define PREROLLBUFFER_H_
+
+#include <QByteArray>
+#include <QList>
+#include <QAtomicInt>
+#include "mediaframe.h"
+#include "mediasink.h"
+
+#define PREROLL_DURATION_MSEC 10000
+#define PREROLL_MAX_BYTES (12*1024*1024)
+#define PREROLL_AUDIO_BYTES (1024*1024)     //Of PREROLL_MAX_BYTES, AAC at 320 kbps needs 400 kB for 10 secs
+#define PREROLL_MAX_FRAMES 1024             //Per track, 10 secs of 30 fps video or 48 kHz AAC is under 500
+#define PREROLL_MAX_PARAMETER_SET 256       //SPS/PPS/AudioSpecificConfig larger than this are not kept
+
+//Copy of buffered frames, video starting with an IDR, for writing a clip off the live path
+struct PrerollClip {
+    QList<MediaFrame> frames;   //Video then audio, each track in its own order, no SPS/PPS
+    QByteArray sps;
+    QByteArray pps;
+    QByteArray aacHeader;
+    int numChannels;
+    int sampleSize;
+};
+
+/*
+ * Last PREROLL_DURATION_MSEC of encoded frames, for instant replay clips.
+ * Payloads are copied into arenas allocated once up front and indexed by fixed arrays of entries,
+ * so steady state adds no allocations and memory stays flat. Keeping MediaBuffer references instead
+ * would hold pool blocks for seconds and make the pool fall back to malloc for live frames.
+ * Each track has its own arena and entries with its camera thread as the only writer, so postFrame()
+ * never locks. Oldest video goes a GOP at a time, buffer always starts at an IDR. A GOP is only dropped
+ * for time if the rest still covers the duration, it is dropped for space whenever needed. Audio goes
+ * a frame at a time once it is older than the oldest video, or than the duration without video.
+ * snapshot() copies without locking and keeps what a camera thread didn't drop meanwhile, see there.
+ */
+class PrerollBuffer : public MediaSink
+{
+public:
+    PrerollBuffer(int durationMsec = PREROLL_DURATION_MSEC,
+            int maxBytes = PREROLL_MAX_BYTES,
+            int maxFrames = PREROLL_MAX_FRAMES);
+    ~PrerollBuffer();
+
+    void setAudioHeader(QByteArray header, int nchan, int srate, int ssize);
+    void postFrame(MediaFrame frame);
+    //Forget everything, eg, timestamps start over with next stream. Done by each camera thread on its
+    //next frame, snapshot() has nothing to give till then.
+    void clear();
+    //Returns false if no IDR is buffered yet. Any thread but the camera ones.
+    bool snapshot(PrerollClip& clip);
+    //Approximate from any thread
+    int bufferedDuration();
+    int bufferedBytes();
+
+private:
+    Q_DISABLE_COPY(PrerollBuffer)
+
+    struct Entry {
+        int offset;
+        int size;
+        long dts;
+        long pts;
+        bool isKeyFrame;
+    };
+
+    /*
+     * head and tail are running entry indexes, only the track's camera thread moves them. An entry and its
+     * bytes are written before tail is released past it, and head is moved past an entry (with a full
+     * barrier) before anything of it is overwritten.
+     */
+    struct Track {
+        char* arena;
+        int arenaSize;
+        Entry* entries;
+        int mask;                   //Entries are a power of two
+        QAtomicInt head;
+        QAtomicInt tail;
+        QAtomicInt usedBytes;
+        QAtomicInt isClearPending;
+        int writePos;               //Next free byte, wraps to 0 when a frame doesn't fit before end
+
+        Entry& at(int index) { return entries[index & mask]; }
+        int count() { return tail.fetchAndAddRelaxed(0) - head.fetchAndAddRelaxed(0); }
+    };
+
+    //Small config copied in and out under a sequence count, writer is one camera thread
+    struct ParameterSet {
+        char data[PREROLL_MAX_PARAMETER_SET];
+        int size;
+    };
+
+    static void initTrack(Track& track, int arenaSize, int maxFrames);
+    static bool findSpace(Track& track, int size, int& offset, bool isVideo);
+    static void dropOldest(Track& track, bool isVideo);
+    void applyClear(Track& track);
+    void dropVideoForDuration();
+    void dropAudioForDuration();
+    static void keepParameterSet(ParameterSet& stored, QAtomicInt& sequence, const char* data, int size);
+    static QByteArray parameterSet(const ParameterSet& stored);
+    bool readConfig(PrerollClip& clip);
+    static bool copyTrack(Track& track, QList<Entry>& entries, MediaBuffer& first, MediaBuffer& second, int& start);
+    static void appendFrames(QList<MediaFrame>& frames, const QList<Entry>& entries, int from, long fromDts,
+            MediaFrame::MediaFrameType type, const MediaBuffer& first, const MediaBuffer& second, int start);
+
+    Track mVideo;
+    Track mAudio;
+    int mDurationMsec;
+    QAtomicInt mOldestVideoDts;     //Of first buffered IDR, audio before it is of no use
+    QAtomicInt mNewestVideoDts;
+    QAtomicInt mHasVideo;
+
+    QAtomicInt mVideoConfigSequence;    //Odd while camera video thread rewrites SPS/PPS
+    QAtomicInt mAudioConfigSequence;    //Odd while camera audio thread rewrites the rest
+    ParameterSet mSPS;
+    ParameterSet mPPS;
+    ParameterSet mAACHeader;
+    int mNumChannels;
+    int mSampleSize;
+};
+
+#endif /* PREROLLBUFFER_H_ */
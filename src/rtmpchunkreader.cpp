@@ -0,0 +1,205 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rtmpchunkreader.h"
+#include <QDebug>
+#include <string.h>
+
+static inline quint32 readUInt24(const uchar* data) {
+    return (data[0] << 16) | (data[1] << 8) | data[2];
+}
+
+static inline quint32 readUInt32(const uchar* data) {
+    return ((quint32) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+RTMPChunkReader::RTMPChunkReader()
+    :mReadOffset(0),
+     mChunkSize(RTMP_DEFAULT_CHUNK_SIZE),
+     mHasError(false) {}
+
+void RTMPChunkReader::reset()
+{
+    mBuffer.clear();
+    mReadOffset = 0;
+    mChunkSize = RTMP_DEFAULT_CHUNK_SIZE;
+    mHasError = false;
+    mStreams.clear();
+}
+
+void RTMPChunkReader::append(const char* data, int length)
+{
+    if (length <= 0)
+        return;
+    compact();
+    mBuffer.append(data, length);
+}
+
+void RTMPChunkReader::compact()
+{
+    if (mReadOffset == 0)
+        return;
+    if (mReadOffset >= mBuffer.size())
+        mBuffer.clear();
+    else
+        mBuffer.remove(0, mReadOffset);
+    mReadOffset = 0;
+}
+
+void RTMPChunkReader::setChunkSize(int chunkSize)
+{
+    if (chunkSize < 1) {
+        qDebug()<<"RTMPChunkReader-bad chunk size"<<chunkSize;
+        mHasError = true;
+        return;
+    }
+    mChunkSize = chunkSize;
+}
+
+void RTMPChunkReader::abort(int csid)
+{
+    if (!mStreams.contains(csid))
+        return;
+    ChunkStream& stream = mStreams[csid];
+    stream.payload.clear();
+    stream.received = 0;
+}
+
+bool RTMPChunkReader::readMessage(RTMPMessage& message)
+{
+    while (!mHasError) {
+        bool isComplete = false;
+        if (!readChunk(message, isComplete))
+            return false;
+        if (isComplete)
+            return true;
+    }
+    return false;
+}
+
+bool RTMPChunkReader::readChunk(RTMPMessage& message, bool& isComplete)
+{
+    /*
+     * Chunk basic header is 1 to 3 bytes, fmt in top two bits and csid in remaining six.
+     * csid 0 means one more byte follows (csid 64-319), csid 1 means two more follow (csid 64-65599).
+     * Message header is 11, 7, 3 or 0 bytes for fmt 0 to 3:
+     * - fmt 0, absolute timestamp, length, type and little endian message stream id.
+     * - fmt 1, timestamp delta, length and type, stream id of previous message.
+     * - fmt 2, timestamp delta only.
+     * - fmt 3, nothing, either continuation of current message or a new one same as previous.
+     * Timestamp field of 0xFFFFFF means a 4 byte extended timestamp follows the message header,
+     * and then it also follows every fmt 3 chunk of that message.
+     */
+    const uchar* data = reinterpret_cast<const uchar*>(mBuffer.constData()) + mReadOffset;
+    int available = mBuffer.size() - mReadOffset;
+    if (available < 1)
+        return false;
+    int fmt = data[0] >> 6;
+    int csid = data[0] & 0x3F;
+    int offset = 1;
+    if (csid == 0) {
+        if (available < 2)
+            return false;
+        csid = 64 + data[1];
+        offset = 2;
+    } else if (csid == 1) {
+        if (available < 3)
+            return false;
+        csid = 64 + data[1] + (data[2] << 8);
+        offset = 3;
+    }
+    static const int messageHeaderSizes[4] = {11, 7, 3, 0};
+    int headerSize = offset + messageHeaderSizes[fmt];
+    if (available < headerSize)
+        return false;
+    QHash<int, ChunkStream>::const_iterator known = mStreams.constFind(csid);
+    if (fmt != 0 && known == mStreams.constEnd()) {
+        //Nothing to inherit header fields from
+        qDebug()<<"RTMPChunkReader-fmt"<<fmt<<"chunk on new csid"<<csid;
+        mHasError = true;
+        return false;
+    }
+    //Header is decoded into locals, stream state is only updated once whole chunk is buffered
+    const ChunkStream* current = (known == mStreams.constEnd()) ? NULL : &known.value();
+    const ChunkStream* previous = (fmt == 0) ? NULL : current;
+    //Whatever the fmt, a csid still in the middle of a message only takes fmt 3 continuations
+    bool isNewMessage = (current == NULL || current->received == 0);
+    int length = previous ? previous->length : 0;
+    int type = previous ? previous->type : 0;
+    quint32 streamId = previous ? previous->streamId : 0;
+    bool hasExtendedTimestamp = previous ? previous->hasExtendedTimestamp : false;
+    quint32 timestampField = 0;
+    if (fmt <= 2) {
+        timestampField = readUInt24(data + offset);
+        hasExtendedTimestamp = (timestampField == 0xFFFFFF);
+    }
+    if (fmt <= 1) {
+        length = (int) readUInt24(data + offset + 3);
+        type = data[offset + 6];
+    }
+    if (fmt == 0)
+        streamId = data[offset + 7] | (data[offset + 8] << 8) | (data[offset + 9] << 16) | ((quint32) data[offset + 10] << 24);
+    if (hasExtendedTimestamp) {
+        if (available < headerSize + 4)
+            return false;
+        timestampField = readUInt32(data + headerSize);
+        headerSize += 4;
+    }
+    if (fmt != 3 && !isNewMessage) {
+        qDebug()<<"RTMPChunkReader-new header on csid"<<csid<<"before message ended";
+        mHasError = true;
+        return false;
+    }
+    int received = isNewMessage ? 0 : current->received;
+    int chunkLength = length - received;
+    if (chunkLength > mChunkSize)
+        chunkLength = mChunkSize;
+    if (available < headerSize + chunkLength)
+        return false;
+
+    ChunkStream& stream = mStreams[csid];
+    if (isNewMessage) {
+        if (fmt == 0) {
+            stream.timestamp = timestampField;
+            stream.timestampDelta = 0;
+        } else if (fmt == 3) {
+            //Same header as previous message, its delta applies again
+            stream.timestamp += stream.timestampDelta;
+        } else {
+            stream.timestampDelta = timestampField;
+            stream.timestamp += timestampField;
+        }
+        stream.length = length;
+        stream.type = type;
+        stream.streamId = streamId;
+        stream.payload.resize(length);
+        stream.received = 0;
+    }
+    stream.hasExtendedTimestamp = hasExtendedTimestamp;
+    memcpy(stream.payload.data() + stream.received, data + headerSize, chunkLength);
+    stream.received += chunkLength;
+    mReadOffset += headerSize + chunkLength;
+    isComplete = (stream.received >= stream.length);
+    if (isComplete) {
+        message.csid = csid;
+        message.timestamp = stream.timestamp;
+        message.type = stream.type;
+        message.streamId = stream.streamId;
+        message.payload = stream.payload;
+        stream.payload = QByteArray();
+        stream.received = 0;
+    }
+    return true;
+}
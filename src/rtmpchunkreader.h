@@ -0,0 +1,79 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RTMPCHUNKREADER_H_
+#define RTMPCHUNKREADER_H_
+
+#include <QByteArray>
+#include <QHash>
+#include "rtmpprotocol.h"
+
+struct RTMPMessage {
+    int csid;
+    quint32 timestamp;
+    int type;
+    quint32 streamId;
+    QByteArray payload;
+};
+
+/*
+ * Incremental chunk stream demuxer for what server sends us.
+ * Bytes are appended as they arrive, readMessage() hands out complete messages and leaves partial
+ * chunks in the buffer until rest of them arrives. Chunk headers are decoded against per chunk stream
+ * state (fmt 1-3 reuse fields of the previous message on the same csid), extended timestamps included.
+ * Inbound traffic is a handful of small control and command messages, so nothing fancy is done about memory.
+ */
+class RTMPChunkReader
+{
+public:
+    RTMPChunkReader();
+
+    void reset();
+    void append(const char* data, int length);
+    void append(const QByteArray& data) { append(data.constData(), data.size()); }
+    //Returns false when no complete message is buffered yet or stream is broken, see hasError()
+    bool readMessage(RTMPMessage& message);
+    //Set Chunk Size from server applies to all chunks after it
+    void setChunkSize(int chunkSize);
+    int chunkSize() const { return mChunkSize; }
+    //Abort message from server, partial message on csid is discarded
+    void abort(int csid);
+    bool hasError() const { return mHasError; }
+
+private:
+    struct ChunkStream {
+        ChunkStream() : timestamp(0), timestampDelta(0), length(0), type(0), streamId(0),
+                hasExtendedTimestamp(false), received(0) {}
+        quint32 timestamp;
+        quint32 timestampDelta;
+        int length;
+        int type;
+        quint32 streamId;
+        bool hasExtendedTimestamp;
+        QByteArray payload;
+        int received;
+    };
+    //Consumes one chunk if all of it is buffered, sets isComplete once it ends a message
+    bool readChunk(RTMPMessage& message, bool& isComplete);
+    void compact();
+
+    QByteArray mBuffer;
+    int mReadOffset;
+    int mChunkSize;
+    bool mHasError;
+    QHash<int, ChunkStream> mStreams;
+};
+
+#endif /* RTMPCHUNKREADER_H_ */
@@ -0,0 +1,172 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rtmpchunkwriter.h"
+
+RTMPChunkWriter::RTMPChunkWriter()
+    :mChunkSize(RTMP_DEFAULT_CHUNK_SIZE) {
+    mStreams.resize(16);
+    for (int i = 0; i < 4; i++)
+        mHeaderCounts[i] = 0;
+}
+
+void RTMPChunkWriter::reset()
+{
+    mChunkSize = RTMP_DEFAULT_CHUNK_SIZE;
+    for (int i = 0; i < mStreams.size(); i++)
+        mStreams[i] = ChunkStream();
+    for (int i = 0; i < 4; i++)
+        mHeaderCounts[i] = 0;
+}
+
+void RTMPChunkWriter::setChunkSize(int chunkSize)
+{
+    if (chunkSize < 1)
+        chunkSize = 1;
+    if (chunkSize > RTMP_MAX_CHUNK_SIZE)
+        chunkSize = RTMP_MAX_CHUNK_SIZE;
+    mChunkSize = chunkSize;
+}
+
+int RTMPChunkWriter::writeBasicHeader(unsigned char* buffer, int fmt, int csid)
+{
+    //csid 2-63 fit in the first byte, 64-319 take one more byte and up to 65599 two more
+    if (csid < 64) {
+        buffer[0] = (unsigned char) ((fmt << 6) | csid);
+        return 1;
+    } else if (csid < 320) {
+        buffer[0] = (unsigned char) (fmt << 6);
+        buffer[1] = (unsigned char) (csid - 64);
+        return 2;
+    }
+    buffer[0] = (unsigned char) ((fmt << 6) | 1);
+    buffer[1] = (unsigned char) ((csid - 64) & 255);
+    buffer[2] = (unsigned char) (((csid - 64) >> 8) & 255);
+    return 3;
+}
+
+void RTMPChunkWriter::appendBody(SocketWriter& writer, int offset, int length,
+        const unsigned char* bodyHeader, int bodyHeaderLength, const char* payload)
+{
+    //Body header is a few bytes of tag data, a chunk boundary may still fall inside it when chunks are tiny
+    if (offset < bodyHeaderLength) {
+        int headerPart = bodyHeaderLength - offset;
+        if (headerPart > length)
+            headerPart = length;
+        writer.appendCopy(bodyHeader + offset, headerPart);
+        offset += headerPart;
+        length -= headerPart;
+    }
+    if (length > 0)
+        writer.append(payload + (offset - bodyHeaderLength), length);
+}
+
+void RTMPChunkWriter::writeMessage(SocketWriter& writer,
+        int csid,
+        int type,
+        quint32 streamId,
+        quint32 timestamp,
+        const unsigned char* bodyHeader,
+        int bodyHeaderLength,
+        const char* payload,
+        int payloadLength)
+{
+    if (csid >= mStreams.size())
+        mStreams.resize(csid + 1);
+    ChunkStream& stream = mStreams[csid];
+    int length = bodyHeaderLength + payloadLength;
+    int fmt;
+    quint32 timestampField;
+    if (!stream.isValid ||
+            stream.streamId != streamId ||
+            timestamp < stream.timestamp) {
+        //Deltas can't go backwards, restart with an absolute timestamp
+        fmt = 0;
+        timestampField = timestamp;
+    } else {
+        timestampField = timestamp - stream.timestamp;
+        if (length != stream.length || type != stream.type)
+            fmt = 1;
+        else if (stream.hasDelta && timestampField == stream.timestampDelta)
+            fmt = 3;
+        else
+            fmt = 2;
+    }
+    bool hasExtendedTimestamp = (timestampField >= RTMP_MAX_TIMESTAMP_FIELD);
+    quint32 shortTimestamp = hasExtendedTimestamp ? RTMP_MAX_TIMESTAMP_FIELD : timestampField;
+
+    /*
+     * Message header, 11, 7, 3 or 0 bytes for fmt 0 to 3, then 4 byte extended timestamp if needed.
+     * Message stream id is the only little endian field in the protocol.
+     */
+    unsigned char header[3 + 11 + 4];
+    int headerLength = writeBasicHeader(header, fmt, csid);
+    if (fmt <= 2) {
+        header[headerLength++] = (unsigned char) ((shortTimestamp >> 16) & 255);
+        header[headerLength++] = (unsigned char) ((shortTimestamp >> 8) & 255);
+        header[headerLength++] = (unsigned char) (shortTimestamp & 255);
+    }
+    if (fmt <= 1) {
+        header[headerLength++] = (unsigned char) ((length >> 16) & 255);
+        header[headerLength++] = (unsigned char) ((length >> 8) & 255);
+        header[headerLength++] = (unsigned char) (length & 255);
+        header[headerLength++] = (unsigned char) type;
+    }
+    if (fmt == 0) {
+        header[headerLength++] = (unsigned char) (streamId & 255);
+        header[headerLength++] = (unsigned char) ((streamId >> 8) & 255);
+        header[headerLength++] = (unsigned char) ((streamId >> 16) & 255);
+        header[headerLength++] = (unsigned char) ((streamId >> 24) & 255);
+    }
+    unsigned char extendedTimestamp[4] = {(unsigned char) ((timestampField >> 24) & 255),
+            (unsigned char) ((timestampField >> 16) & 255),
+            (unsigned char) ((timestampField >> 8) & 255),
+            (unsigned char) (timestampField & 255)};
+    if (hasExtendedTimestamp) {
+        for (int i = 0; i < 4; i++)
+            header[headerLength++] = extendedTimestamp[i];
+    }
+    writer.appendCopy(header, headerLength);
+    mHeaderCounts[fmt]++;
+
+    int chunkLength = length < mChunkSize ? length : mChunkSize;
+    appendBody(writer, 0, chunkLength, bodyHeader, bodyHeaderLength, payload);
+    int offset = chunkLength;
+    if (offset < length) {
+        //Continuation chunks are fmt 3, repeating extended timestamp of the message if it had one
+        unsigned char separator[3 + 4];
+        int separatorLength = writeBasicHeader(separator, 3, csid);
+        if (hasExtendedTimestamp) {
+            for (int i = 0; i < 4; i++)
+                separator[separatorLength++] = extendedTimestamp[i];
+        }
+        while (offset < length) {
+            chunkLength = length - offset;
+            if (chunkLength > mChunkSize)
+                chunkLength = mChunkSize;
+            writer.appendCopy(separator, separatorLength);
+            appendBody(writer, offset, chunkLength, bodyHeader, bodyHeaderLength, payload);
+            offset += chunkLength;
+        }
+    }
+
+    stream.isValid = true;
+    stream.streamId = streamId;
+    stream.length = length;
+    stream.type = type;
+    stream.timestamp = timestamp;
+    stream.timestampDelta = (fmt == 0) ? 0 : timestampField;
+    stream.hasDelta = (fmt != 0);
+}
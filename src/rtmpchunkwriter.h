@@ -0,0 +1,74 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RTMPCHUNKWRITER_H_
+#define RTMPCHUNKWRITER_H_
+
+#include <QVector>
+#include "rtmpprotocol.h"
+#include "socketwriter.h"
+
+/*
+ * Outgoing chunk stream muxer.
+ * Remembers last message header sent on every chunk stream and picks the smallest header that describes
+ * the next one: fmt 3 when length, type and timestamp delta all repeat (every steady rate audio frame),
+ * fmt 2 when only length and type repeat, fmt 1 when just stream id does, fmt 0 otherwise.
+ * Messages are laid out into a SocketWriter, headers copied and payload referenced.
+ * State belongs to one connection, reset() it on every new one.
+ */
+class RTMPChunkWriter
+{
+public:
+    RTMPChunkWriter();
+
+    void reset();
+    //Takes effect for messages after the Set Chunk Size message announcing it
+    void setChunkSize(int chunkSize);
+    int chunkSize() const { return mChunkSize; }
+    //Body is bodyHeader (copied) followed by payload (referenced, must outlive writer.submit())
+    void writeMessage(SocketWriter& writer,
+            int csid,
+            int type,
+            quint32 streamId,
+            quint32 timestamp,
+            const unsigned char* bodyHeader,
+            int bodyHeaderLength,
+            const char* payload,
+            int payloadLength);
+    //Headers written so far by fmt, for the stats
+    qint64 headerCount(int fmt) const { return mHeaderCounts[fmt & 3]; }
+
+private:
+    struct ChunkStream {
+        ChunkStream() : isValid(false), streamId(0), length(0), type(0), timestamp(0),
+                timestampDelta(0), hasDelta(false) {}
+        bool isValid;
+        quint32 streamId;
+        int length;
+        int type;
+        quint32 timestamp;
+        quint32 timestampDelta;
+        bool hasDelta;      //Previous header carried a delta, so a fmt 3 header can repeat it
+    };
+    static int writeBasicHeader(unsigned char* buffer, int fmt, int csid);
+    void appendBody(SocketWriter& writer, int offset, int length,
+            const unsigned char* bodyHeader, int bodyHeaderLength, const char* payload);
+
+    int mChunkSize;
+    QVector<ChunkStream> mStreams;
+    qint64 mHeaderCounts[4];
+};
+
+#endif /* RTMPCHUNKWRITER_H_ */
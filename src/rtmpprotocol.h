@@ -0,0 +1,47 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RTMPPROTOCOL_H_
+#define RTMPPROTOCOL_H_
+
+#define RTMP_DEFAULT_CHUNK_SIZE 128
+#define RTMP_MAX_CHUNK_SIZE 0xFFFFFF        //No message is longer, larger chunks gain nothing
+#define RTMP_MAX_TIMESTAMP_FIELD 0xFFFFFF   //Anything from here on goes in an extended timestamp
+
+//Chunk stream ids we send on, 2 is reserved for protocol control
+#define RTMP_CSID_CONTROL 2
+#define RTMP_CSID_COMMAND 4
+#define RTMP_CSID_AUDIO 8
+#define RTMP_CSID_VIDEO 9
+
+//Message type ids, section 5.4 and 7.1 of RTMP spec
+#define RTMP_MSG_SET_CHUNK_SIZE 1
+#define RTMP_MSG_ABORT 2
+#define RTMP_MSG_ACK 3
+#define RTMP_MSG_USER_CONTROL 4
+#define RTMP_MSG_WINDOW_ACK_SIZE 5
+#define RTMP_MSG_SET_PEER_BANDWIDTH 6
+#define RTMP_MSG_AUDIO 8
+#define RTMP_MSG_VIDEO 9
+#define RTMP_MSG_DATA_AMF0 18
+#define RTMP_MSG_COMMAND_AMF0 20
+
+//User control event types
+#define RTMP_UC_STREAM_BEGIN 0
+#define RTMP_UC_STREAM_EOF 1
+#define RTMP_UC_PING_REQUEST 6
+#define RTMP_UC_PING_RESPONSE 7
+
+#endif /* RTMPPROTOCOL_H_ */
@@ -14,7 +14,7 @@
  */
 
 #include "rtmppublisher.h"
-#include <QDateTime>
+#include "adts.h"
 
 RTMPPublisher::RTMPPublisher(QString host,
             int port,
@@ -22,13 +22,37 @@ RTMPPublisher::RTMPPublisher(QString host,
             QString playPath,
             QObject* parent)
     :QObject(parent),
-     mHost(host), mPort(port), mApp(app), mPlayPath(playPath) {
-    mLock = new QMutex();
+     mSocket(NULL),
+     mState(StateIdle),
+     mIsPumpScheduled(0),
+     mHost(host), mPort(port), mApp(app), mPlayPath(playPath),
+     mAudioQueue(2*MAX_QUEUE_SIZE),
+     mVideoQueue(2*MAX_QUEUE_SIZE),
+     mGopCache(GOP_CACHE_MAX_FRAMES),
+     mInterleaver(2),
+     mIsStopped(false),
+     mIsDroppingToKeyFrame(false),
+     mLatencyTracer(NULL),
+     mPendingWrites(PENDING_WRITES_SIZE) {
     mAACHeader.clear();
     mHasAudio = false;
+    mLastQueuedAudioTS = 0;
     mHasVideo = false;
-    mAudioQueue.clear();
-    mVideoQueue.clear();
+    mIsWarm = false;
+    mLastSocketError = -1;
+    mTimeoutTimer = new QTimer(this);
+    mTimeoutTimer->setSingleShot(true);
+    QObject::connect(mTimeoutTimer,SIGNAL(timeout()),this,SLOT(on_mTimeoutTimer_timeout()));
+    mKeepAliveTimer = new QTimer(this);
+    mKeepAliveTimer->setInterval(WARM_KEEPALIVE_MSEC);
+    QObject::connect(mKeepAliveTimer,SIGNAL(timeout()),this,SLOT(on_mKeepAliveTimer_timeout()));
+    mReconnectTimer = new QTimer(this);
+    mReconnectTimer->setSingleShot(true);
+    QObject::connect(mReconnectTimer,SIGNAL(timeout()),this,SLOT(reconnect()));
+    mInterleaveTimer = new QTimer(this);
+    mInterleaveTimer->setSingleShot(true);
+    QObject::connect(mInterleaveTimer,SIGNAL(timeout()),this,SLOT(pumpFrames()));
+    mInterleaveClock.start();
 }
 
 RTMPPublisher::~RTMPPublisher() {
@@ -39,132 +63,680 @@ RTMPPublisher::~RTMPPublisher() {
     }
 }
 
-void RTMPPublisher::run() {
-    qDebug()<<"Thread";
-    QTime iTime;
-    mIsStopped = false;
-    bool video = false;
-    bool audio = false;
-    iTime.start();
+void RTMPPublisher::start() {
+    /*
+     * Runs on publisher's own thread once it starts. From here on everything is driven by that thread's
+     * event loop, ie, socket signals, timers and pumpFrames() calls posted by postFrame().
+     * Nothing here blocks, so a stalled socket only stops this connection, frames keep being queued
+     * (or dropped) by the producers meanwhile.
+     */
+    mAACFormat = 0;
+    mHasAudio = false;
+    mAudioTimestamp = 0;
+    mHasVideo = false;
+    mVideoTimestamp = 0;
+    mNumChannels = 0;
+    mSampleSize = 0;
+    mTotalBytesWritten = 0;
+    mBytesPending.fetchAndStoreRelaxed(0);
+    mLastQueuedVideoTS.fetchAndStoreRelaxed(0);
+    mLastSentVideoTS.fetchAndStoreRelaxed(0);
+    mFramesSentCount = 0;
+    mPendingWrites.clear();
+    mAudioFramesReceivedCount.fetchAndStoreRelaxed(0);
+    mVideoFramesReceivedCount.fetchAndStoreRelaxed(0);
+    for (int i = 0; i < DropReasonCount; i++)
+        mDroppedFramesCounts[i].fetchAndStoreRelaxed(0);
+    mLastReceivedFrameTS = 0;
+    mInterleaver.reset();
+    mGopCacheBytes = 0;
+    mIsGopCacheValid = false;
+    mIsGopCacheKeyFrameRequested = false;
+    mLostReplaysCount.fetchAndStoreRelaxed(0);
+    mReplayIndex = -1;
+    mIsWaitingForKeyFrame = false;
+    mIsResuming = false;
+    mTimestampOffset = 0;
+    mLastSentTS = 0;
+    mHasPublished = false;
+    mReconnectAttempts = 0;
+    mReconnectCount = 0;
+    openConnection();
+}
+
+void RTMPPublisher::openConnection() {
+    //Everything that belongs to one TCP connection, start() and every reconnect come through here
+    mChunkReader.reset();
+    mChunkWriter.reset();
+    mStreamId = PIPELINE_PUBLISH ? RTMP_FIRST_STREAM_ID : 0;
+    mBytesReceived = 0;
+    mLastAckedBytes = 0;
+    mAckWindow = 0;
+    mServerAckedBytes = 0;
+    //Sequence headers go out again on every connection
+    mHasAudio = false;
+    mHasVideo = false;
+    mSocket = new QTcpSocket(this);
+    mSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    mWriter.setSocket(mSocket);
+    QObject::connect(mSocket,SIGNAL(connected()),
+            this,SLOT(on_mSocket_connected()));
+    QObject::connect(mSocket,SIGNAL(readyRead()),
+            this,SLOT(on_mSocket_readyRead()));
+    QObject::connect(mSocket,SIGNAL(error(QAbstractSocket::SocketError)),
+            this,SLOT(on_mSocket_error(QAbstractSocket::SocketError)));
+    QObject::connect(mSocket,SIGNAL(bytesWritten(qint64)),
+                this,SLOT(on_mSocket_bytesWritten(qint64)));
+    mHandshakeBytesLeft = 0;
+    mIsBatching = false;
+    mIsPublishSent = false;
+    for (int i = 0; i < PhaseCount; i++)
+        mPhaseTimes[i] = -1;
+    mStartTime.start();
+    mState = StateConnecting;
+    //One deadline for whole startup, from connectToHost() to NetStream.Publish.Start
+    mTimeoutTimer->start(STARTUP_TIMEOUT_MSEC);
+    mSocket->connectToHost(this->mHost, this->mPort);
+}
+
+void RTMPPublisher::reconnect() {
+    if(mIsStopped || mState != StateReconnecting)
+        return;
+    qDebug()<<"Reconnecting, attempt"<<mReconnectAttempts;
+    openConnection();
+}
+
+void RTMPPublisher::resumeStream() {
+    /*
+     * New connection after a failure, viewers' decoders need an IDR before anything else.
+     * - If an IDR is still queued, video before it is dropped and stream resumes there.
+     * - Otherwise frames since last sent IDR are replayed from mGopCache before queued ones.
+     * - If cache overflowed there is nothing to resume from, video is dropped till next IDR.
+     *   cacheFrame() asks for an IDR well before that, so this only happens when encoder can't force one.
+     * Either way first frame sent fixes mTimestampOffset so timestamps don't go back.
+     */
+    mIsResuming = true;
+    mReplayIndex = -1;
+    mIsWaitingForKeyFrame = false;
+    bool hasQueuedKeyFrame = false;
+    for (int i = 0; i < mVideoQueue.size(); i++) {
+        MediaFrame* frame = mVideoQueue.peekAt(i);
+        if (frame != NULL && frame->isKeyFrame()) {
+            hasQueuedKeyFrame = true;
+            break;
+        }
+    }
+    if (hasQueuedKeyFrame) {
+        skipToLatestKeyFrame(0);
+        clearGopCache();
+        qDebug()<<"Resuming from queued IDR";
+    } else if (mIsGopCacheValid && !mGopCache.isEmpty()) {
+        mReplayIndex = 0;
+        qDebug()<<"Resuming with"<<mGopCache.size()<<"cached frames";
+    } else {
+        mIsWaitingForKeyFrame = true;
+        if (mLastSentTS > 0)
+            mLostReplaysCount.fetchAndAddRelaxed(1);
+        qDebug()<<"Resuming at next IDR";
+    }
+}
+
+void RTMPPublisher::on_mSocket_connected() {
+    markPhase(PhaseConnected);
     handshake();
-    qDebug()<<"handshake done!";
+}
+
+void RTMPPublisher::on_mSocket_readyRead() {
+    /*
+     * Startup as seen from here,
+     * - StateHandshaking, C0+C1 are out, waiting for S0+S1. Once they are in, C2 and every message up to publish
+     *   goes out in one write, see startSession().
+     * - StateStarting, S2 is skipped (mHandshakeBytesLeft), then server messages are parsed. Frames already flow.
+     * - StatePublishing, NetStream.Publish.Start has arrived.
+     */
+    if(mSocket == NULL)
+        return;
+    if(mState == StateHandshaking) {
+        if(mSocket->bytesAvailable()<1537)
+            return;
+        QByteArray buf = mSocket->read(1537);
+        mBytesReceived += buf.size();
+        if((uchar)buf.at(0) != 3)
+            qDebug()<<"Server RTMP version"<<(int)(uchar)buf.at(0);
+        markPhase(PhaseHandshake);
+        startSession(buf.mid(1));
+        if(mSocket == NULL)
+            return;
+    }
+    if(mState != StateStarting && mState != StatePublishing)
+        return;
+    if(mHandshakeBytesLeft > 0) {
+        //S2 is our C1 echoed back, nothing to check in it as C1 is all zeros
+        QByteArray buf = mSocket->read(qMin((qint64) mHandshakeBytesLeft, mSocket->bytesAvailable()));
+        mBytesReceived += buf.size();
+        mHandshakeBytesLeft -= buf.size();
+        if(mHandshakeBytesLeft > 0)
+            return;
+    }
+    readMessages();
+}
+
+void RTMPPublisher::startSession(const QByteArray& s1) {
+    /*
+     * Everything the client may send without waiting for a reply goes out in one gathered write right after S1,
+     * C2, Set Chunk Size, connect, createStream and publish. That's one round trip for TCP, one for C0+C1
+     * and one for the commands, instead of one per step.
+     * publish needs message stream id that createStream returns. Servers hand out 1 for first stream
+     * of a connection, so with PIPELINE_PUBLISH publish goes on stream 1 right away and is repeated if
+     * createStream result says otherwise.
+     * Frames start flowing right after publish, server handles messages of a connection in order.
+     */
+    mHandshakeBytesLeft = 1536;
+    mState = StateStarting;
+    beginBatch();
+    //Echo S1 back as C2
+    mWriter.appendCopy(s1.constData(), s1.size());
     setChunkSize();
-    qDebug()<<"chunk size set!";
     connect();
-    qDebug()<<"connect done!";
+    createStream();
+    if (PIPELINE_PUBLISH && !mIsWarm)
+        publish();
+    endBatch();
+    qDebug()<<"Startup messages sent"<<mStartTime.elapsed();
+    pumpFrames();
+}
+
+void RTMPPublisher::enterWarm() {
+    /*
+     * Session is authenticated and has a stream, only publish is left. Pings keep NAT mappings and
+     * server idle timers from dropping it, and make a dead link show up as a socket error early.
+     */
+    qDebug()<<"Warm session ready at"<<mStartTime.elapsed()<<"msec, stream"<<mStreamId;
+    mState = StateWarm;
+    mTimeoutTimer->stop();
+    mKeepAliveTimer->start();
+}
+
+void RTMPPublisher::on_mKeepAliveTimer_timeout() {
+    if(mState != StateWarm || !isSocketConnected()) {
+        mKeepAliveTimer->stop();
+        return;
+    }
+    sendPingRequest();
+}
+
+void RTMPPublisher::goLive() {
+    //Flag is read on publisher's thread, state change happens there as well
+    mIsWarm = false;
+    QMetaObject::invokeMethod(this, "publishWarmSession", Qt::QueuedConnection);
+}
+
+void RTMPPublisher::publishWarmSession() {
+    /*
+     * Critical path after user taps start is just publish and first frames, startup phases are timed
+     * from here on. A session still starting up sees mIsWarm cleared and publishes on its own.
+     */
+    if(mState == StateFailed) {
+        //Warm session died before it was needed, let controller report it now
+        emit socketError(mLastSocketError);
+        return;
+    }
+    if(mState != StateWarm)
+        return;
+    mKeepAliveTimer->stop();
+    mStartTime.restart();
+    mPhaseTimes[PhasePublishStart] = -1;
+    mPhaseTimes[PhaseFirstFrame] = -1;
+    mState = StateStarting;
+    mTimeoutTimer->start(STARTUP_TIMEOUT_MSEC);
     publish();
-    qDebug()<<"publish done!";
-    readAll();
-    qDebug()<<"Success!"<<iTime.elapsed();
-    while (!mIsStopped && isSocketConnected()) {
-        //qDebug()<<"I'm running!0";
-        mLock->lock();
-        MediaFrame audioFrame;
-        MediaFrame videoFrame;
+    pumpFrames();
+}
+
+void RTMPPublisher::markPhase(Phase phase) {
+    if (mPhaseTimes[phase] >= 0)
+        return;
+    mPhaseTimes[phase] = mStartTime.elapsed();
+    static const char* names[PhaseCount] = {"connected", "handshake", "connect result", "createStream result", "publish start", "first frame"};
+    qDebug()<<"RTMPPublisher"<<names[phase]<<"at"<<mPhaseTimes[phase]<<"msec";
+    if (phase == PhasePublishStart) {
+        qDebug()<<"RTMPPublisher startup"
+                <<"tcp"<<mPhaseTimes[PhaseConnected]
+                <<"handshake"<<mPhaseTimes[PhaseHandshake]
+                <<"connect"<<mPhaseTimes[PhaseConnectResult]
+                <<"createStream"<<mPhaseTimes[PhaseCreateStreamResult]
+                <<"publish"<<mPhaseTimes[PhasePublishStart]
+                <<"first frame"<<mPhaseTimes[PhaseFirstFrame];
+    }
+}
+
+void RTMPPublisher::readMessages() {
+    /*
+     * Everything server sends after handshake goes through the chunk reader, whatever is complete is dispatched.
+     * Partial chunks stay buffered in the reader till next readyRead().
+     */
+    if(!isSocketConnected())
+        return;
+    QByteArray data = mSocket->readAll();
+    mBytesReceived += data.size();
+    mChunkReader.append(data);
+    RTMPMessage message;
+    while (mSocket != NULL && mChunkReader.readMessage(message))
+        handleMessage(message);
+    if (mChunkReader.hasError()) {
+        qDebug()<<"RTMPPublisher-malformed chunk stream from server";
+        on_mSocket_error(QAbstractSocket::UnknownSocketError);
+        return;
+    }
+    if (mAckWindow > 0 && mBytesReceived - mLastAckedBytes >= mAckWindow)
+        sendAcknowledgement();
+}
+
+void RTMPPublisher::handleMessage(const RTMPMessage& message) {
+    const uchar* body = reinterpret_cast<const uchar*>(message.payload.constData());
+    int length = message.payload.size();
+    switch (message.type) {
+        case RTMP_MSG_SET_CHUNK_SIZE:
+            if (length >= 4) {
+                int chunkSize = (int) (((body[0] & 0x7F) << 24) | (body[1] << 16) | (body[2] << 8) | body[3]);
+                qDebug()<<"Server chunk size"<<chunkSize;
+                mChunkReader.setChunkSize(chunkSize);
+            }
+            break;
+        case RTMP_MSG_ABORT:
+            if (length >= 4)
+                mChunkReader.abort((body[0] << 24) | (body[1] << 16) | (body[2] << 8) | body[3]);
+            break;
+        case RTMP_MSG_ACK:
+            //Server's count of what it has received from us, only useful for debugging
+            if (length >= 4)
+                mServerAckedBytes = ((quint32) body[0] << 24) | (body[1] << 16) | (body[2] << 8) | body[3];
+            if(VERBOSE)
+                qDebug()<<"Server acked"<<mServerAckedBytes<<"bytes";
+            break;
+        case RTMP_MSG_USER_CONTROL:
+            handleUserControl(message);
+            break;
+        case RTMP_MSG_WINDOW_ACK_SIZE:
+            if (length >= 4) {
+                mAckWindow = ((quint32) body[0] << 24) | (body[1] << 16) | (body[2] << 8) | body[3];
+                qDebug()<<"Server ack window"<<mAckWindow;
+            }
+            break;
+        case RTMP_MSG_SET_PEER_BANDWIDTH:
+            //Server limits what we may send unacked, answer with our own window like other clients do
+            if (length >= 4) {
+                quint32 window = ((quint32) body[0] << 24) | (body[1] << 16) | (body[2] << 8) | body[3];
+                qDebug()<<"Server peer bandwidth"<<window<<"limit type"<<(length >= 5 ? body[4] : -1);
+                sendWindowAckSize(window);
+            }
+            break;
+        case RTMP_MSG_COMMAND_AMF0:
+            handleCommand(message);
+            break;
+        default:
+            if(VERBOSE)
+                qDebug()<<"Ignoring server message type"<<message.type<<"size"<<length;
+            break;
+    }
+}
+
+void RTMPPublisher::handleUserControl(const RTMPMessage& message) {
+    /*
+     * User Control message body is 2 byte event type followed by event data.
+     * Ping Request carries a 4 byte server timestamp which has to be echoed back in a Ping Response,
+     * servers drop clients that don't.
+     */
+    const uchar* body = reinterpret_cast<const uchar*>(message.payload.constData());
+    if (message.payload.size() < 2)
+        return;
+    int event = (body[0] << 8) | body[1];
+    quint32 value = 0;
+    if (message.payload.size() >= 6)
+        value = ((quint32) body[2] << 24) | (body[3] << 16) | (body[4] << 8) | body[5];
+    switch (event) {
+        case RTMP_UC_STREAM_BEGIN:
+            qDebug()<<"Stream begin"<<value;
+            break;
+        case RTMP_UC_STREAM_EOF:
+            qDebug()<<"Stream EOF"<<value;
+            break;
+        case RTMP_UC_PING_REQUEST:
+            sendPingResponse(value);
+            break;
+        case RTMP_UC_PING_RESPONSE:
+            //Echo of our keepalive ping, value is mStartTime.elapsed() when it was sent
+            if(VERBOSE)
+                qDebug()<<"Ping round trip"<<((quint32) mStartTime.elapsed() - value)<<"msec";
+            break;
+        default:
+            if(VERBOSE)
+                qDebug()<<"Ignoring user control event"<<event;
+            break;
+    }
+}
+
+void RTMPPublisher::handleCommand(const RTMPMessage& message) {
+    /*
+     * AMF0 command is command name, transaction id, command object and then optional arguments.
+     * For onStatus and _error the info object, with level, code and description, is the fourth value.
+     * _result of createStream has new message stream id as the fourth value.
+     */
+    QVariantList values;
+    if (!AMF0::decode(message.payload, values) || values.isEmpty()) {
+        qDebug()<<"RTMPPublisher-undecodable command"<<message.payload.size();
+        return;
+    }
+    QString name = values.at(0).toString();
+    int transactionId = (int) values.value(1).toDouble();
+    if (name == "_result") {
+        if (transactionId == TRANSACTION_CONNECT) {
+            markPhase(PhaseConnectResult);
+        } else if (transactionId == TRANSACTION_CREATE_STREAM) {
+            markPhase(PhaseCreateStreamResult);
+            quint32 streamId = (quint32) values.value(3).toDouble();
+            if (!mIsPublishSent) {
+                mStreamId = streamId;
+                if (mIsWarm)
+                    enterWarm();
+                else
+                    publish();
+            } else if (streamId != mStreamId) {
+                //Pipelined publish went on a stream server never created, its errors are ignored below
+                qDebug()<<"Server created stream"<<streamId<<"instead of"<<mStreamId<<", publishing again";
+                mStreamId = streamId;
+                publish();
+                //Sequence headers went to the wrong stream too, send them again before next frames
+                mHasAudio = false;
+                mHasVideo = false;
+            }
+        }
+    } else if (name == "onStatus" || name == "_error") {
+        if (name == "onStatus" && message.streamId != mStreamId) {
+            qDebug()<<"Ignoring status for stream"<<message.streamId;
+            return;
+        }
+        QVariantMap info = values.value(3).toMap();
+        QString level = info.value("level").toString();
+        QString code = info.value("code").toString();
+        QString description = info.value("description").toString();
+        if (name == "_error" && level.isEmpty())
+            level = "error";
+        qDebug()<<name<<level<<code<<description;
+        if (level == "error" && mHasPublished && mState == StateStarting) {
+            //Server may still hold the stream key of the lost connection for a while, retry like a transport failure
+            qDebug()<<"Resume rejected"<<code;
+            on_mSocket_error(QAbstractSocket::RemoteHostClosedError);
+            return;
+        }
+        if (code == "NetStream.Publish.Start" && mState == StateStarting) {
+            markPhase(PhasePublishStart);
+            mState = StatePublishing;
+            mHasPublished = true;
+            mReconnectAttempts = 0;
+            mTimeoutTimer->stop();
+            pumpFrames();
+        }
+        emit publishStatus(level, code, description);
+    } else if(VERBOSE) {
+        qDebug()<<"Server command"<<name;
+    }
+}
+
+void RTMPPublisher::writeControlMessage(int type, const unsigned char* body, int length) {
+    //Protocol control and user control messages go on chunk stream 2 with message stream id 0
+    writeMessage(RTMP_CSID_CONTROL, type, 0, 0, NULL, 0, reinterpret_cast<const char*>(body), length);
+}
+
+void RTMPPublisher::sendAcknowledgement() {
+    unsigned char body[4] = {(unsigned char) (mBytesReceived >> 24), (unsigned char) (mBytesReceived >> 16), (unsigned char) (mBytesReceived >> 8), (unsigned char) mBytesReceived};
+    if(VERBOSE)
+        qDebug()<<"Acknowledging"<<mBytesReceived<<"bytes";
+    writeControlMessage(RTMP_MSG_ACK, body, 4);
+    mLastAckedBytes = mBytesReceived;
+}
+
+void RTMPPublisher::sendPingResponse(quint32 timestamp) {
+    unsigned char body[6] = {(unsigned char) 0, (unsigned char) RTMP_UC_PING_RESPONSE, (unsigned char) (timestamp >> 24), (unsigned char) (timestamp >> 16), (unsigned char) (timestamp >> 8), (unsigned char) timestamp};
+    writeControlMessage(RTMP_MSG_USER_CONTROL, body, 6);
+}
+
+void RTMPPublisher::sendPingRequest() {
+    quint32 timestamp = (quint32) mStartTime.elapsed();
+    unsigned char body[6] = {(unsigned char) 0, (unsigned char) RTMP_UC_PING_REQUEST, (unsigned char) (timestamp >> 24), (unsigned char) (timestamp >> 16), (unsigned char) (timestamp >> 8), (unsigned char) timestamp};
+    writeControlMessage(RTMP_MSG_USER_CONTROL, body, 6);
+}
+
+void RTMPPublisher::sendWindowAckSize(quint32 size) {
+    unsigned char body[4] = {(unsigned char) (size >> 24), (unsigned char) (size >> 16), (unsigned char) (size >> 8), (unsigned char) size};
+    writeControlMessage(RTMP_MSG_WINDOW_ACK_SIZE, body, 4);
+}
+
+void RTMPPublisher::on_mTimeoutTimer_timeout() {
+    /*
+     * Same timer guards whole startup and stalled writes while publishing.
+     * A write is stalled when socket buffer still has data and nothing reached the kernel for WRITE_STALL_TIMEOUT_MSEC.
+     */
+    if(mState == StatePublishing &&
+            (mSocket == NULL || mSocket->bytesToWrite() == 0))
+        return;
+    qDebug()<<"RTMPPublisher-timeout in state"<<mState;
+    on_mSocket_error(QAbstractSocket::SocketTimeoutError);
+}
+
+void RTMPPublisher::skipToLatestKeyFrame(int fromIndex) {
+    /*
+     * Video backlog is over budget. If a newer IDR is already queued, everything before it is stale,
+     * frames up to it are dropped as a whole run so decoder restarts cleanly at the IDR.
+     * SPS/PPS found on the way are still consumed, those are never dropped.
+     */
+    int keyFrameIndex = -1;
+    for (int i = mVideoQueue.size() - 1; i >= fromIndex; i--) {
+        MediaFrame* frame = mVideoQueue.peekAt(i);
+        if (frame != NULL && frame->isKeyFrame()) {
+            keyFrameIndex = i;
+            break;
+        }
+    }
+    if (keyFrameIndex <= 0)
+        return;
+    for (int i = 0; i < keyFrameIndex; i++) {
         MediaFrame frame;
-        while (!mIsStopped && isSocketConnected()) {
-            //qDebug()<<"I'm running!";
-            if (!mIsStopped && this->mAudioQueue.isEmpty() && audio) {
-                mCondition.wait(mLock);// this->condition.await();
-            } else {
-                if (!this->mAudioQueue.isEmpty()) {
-                    audioFrame = this->mAudioQueue.first();
-                    audio = true;
-                    if (audioFrame.type == MediaFrame::EOS) {
-                        return;
-                    }
-                }
-                while (!mIsStopped && this->mVideoQueue.isEmpty() && video) {
-                    mCondition.wait(mLock);// this->condition.await();
-                }
-                if (!this->mVideoQueue.isEmpty()) {
-                    videoFrame = this->mVideoQueue.first();
-                    video = true;
-                    if (videoFrame.type == MediaFrame::EOS) {
-                        return;
-                    }
-                }
-//                iTime.restart();
-                if (!audioFrame.isEmpty() && (videoFrame.isEmpty() || audioFrame.dts < videoFrame.dts)) {
-                    if(VERBOSE)
-                        qDebug()<<"--Sending AUDIO DTS"<<audioFrame.dts<<"size"<<audioFrame.buffer.size()<<"Video Queue Size"<<mVideoQueue.size();
-                    frame = audioFrame;
-                    mAudioQueue.removeFirst();
-                } else if (!videoFrame.isEmpty()) {
-                    if(VERBOSE)
-                        qDebug()<<"----Sending VIDEO DTS"<<videoFrame.dts<<"size"<<videoFrame.buffer.size()<<"Audio Queue Size"<<mAudioQueue.size();
-                    frame = videoFrame;
-                    mVideoQueue.removeFirst();
-                } else {
-                    if(!mIsStopped)
-                        mCondition.wait(mLock);// this->condition.await();
-                }
-                if (!frame.isEmpty()) {
-                    mLock->unlock();    //this.lock.unlock();
-                    readAll();
-//                    qDebug()<<frame.type<<"Time taken"<<iTime.elapsed();
-                    switch (frame.type) {
-                        case MediaFrame::AUDIO:
-                            sendAudioFrame(frame.buffer, frame.pts);
-                            break;
-                        case MediaFrame::VIDEO:
-                            sendVideoNal(frame.buffer, frame.pts, frame.dts);
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
+        mVideoQueue.pop(frame);
+        if (frame.isSequenceHeader())
+            sendVideoFrame(frame, frame.pts, frame.dts);
+        else
+            dropFrame(DropVideoCongestion);
+    }
+    qDebug()<<"Skipped"<<keyFrameIndex<<"video frames to latest keyframe";
+}
+
+void RTMPPublisher::schedulePump() {
+    //Called by producers, at most one pumpFrames() call is pending in event queue at any time
+    if(mIsPumpScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "pumpFrames", Qt::QueuedConnection);
+}
+
+void RTMPPublisher::pumpFrames() {
+    /*
+     * Moves frames from the rings to the socket as long as socket buffer is below SEND_BUFFER_HIGH_WATER.
+     * Called when frames are posted and when socket reports written bytes, ie, when there is room again.
+     */
+    mIsPumpScheduled.fetchAndStoreOrdered(0);
+    while (!mIsStopped &&
+            (mState == StatePublishing || (mState == StateStarting && mIsPublishSent)) &&
+            isSocketConnected() &&
+            mSocket->bytesToWrite() < SEND_BUFFER_HIGH_WATER) {
+        if (mVideoQueue.size() > MAX_QUEUE_SIZE)
+            skipToLatestKeyFrame();
+        if (mReplayIndex >= 0) {
+            //Cache doesn't grow while replaying, nothing is popped till replay is done
+            MediaFrame* cached = mGopCache.peekAt(mReplayIndex);
+            if (cached == NULL) {
+                mReplayIndex = -1;
+                continue;
+            }
+            mReplayIndex++;
+            sendFrame(*cached);
+            continue;
+        }
+        MediaFrame* audioFrame = mAudioQueue.peek();
+        MediaFrame* videoFrame = mVideoQueue.peek();
+        long heads[2];
+        heads[INTERLEAVER_TRACK_VIDEO] = videoFrame != NULL ? videoFrame->dts : INTERLEAVER_EMPTY;
+        heads[INTERLEAVER_TRACK_AUDIO] = audioFrame != NULL ? audioFrame->dts : INTERLEAVER_EMPTY;
+        int track = mInterleaver.next(heads, mInterleaveClock.elapsed());
+        if (track < 0) {
+            //Waiting for a started track, pumped again when it posts or when waiting for it times out
+            int wait = mInterleaver.waitMsec(mInterleaveClock.elapsed());
+            if (wait >= 0 && !mInterleaveTimer->isActive())
+                mInterleaveTimer->start(wait);
+            return;
+        }
+        MediaFrame frame;
+        if (track == INTERLEAVER_TRACK_AUDIO) {
+            if(VERBOSE)
+                qDebug()<<"--Sending AUDIO DTS"<<audioFrame->dts<<"size"<<audioFrame->buffer.size()<<"Video Queue Size"<<mVideoQueue.size();
+            mAudioQueue.pop(frame);
+            mInterleaver.taken(track, frame.dts);
+        } else {
+            if(VERBOSE)
+                qDebug()<<"----Sending VIDEO DTS"<<videoFrame->dts<<"size"<<videoFrame->buffer.size()<<"Audio Queue Size"<<mAudioQueue.size();
+            mVideoQueue.pop(frame);
+            mInterleaver.taken(track, frame.dts);
+            mLastSentVideoTS.fetchAndStoreRelaxed(frame.dts);
+            if (mIsWaitingForKeyFrame && !frame.isSequenceHeader()) {
+                if (!frame.isKeyFrame()) {
+                    dropFrame(DropVideoCongestion);
+                    continue;
                 }
+                mIsWaitingForKeyFrame = false;
             }
+        }
+        cacheFrame(frame);
+        if (mLatencyTracer != NULL)
+            sendTracedFrame(frame);
+        else
+            sendFrame(frame);
+    }
+    if (isSocketConnected())
+        mBytesPending.fetchAndStoreRelaxed((int) mSocket->bytesToWrite());
+    if (mState == StatePublishing &&
+            isSocketConnected() &&
+            mSocket->bytesToWrite() > 0 &&
+            !mTimeoutTimer->isActive())
+        mTimeoutTimer->start(WRITE_STALL_TIMEOUT_MSEC);
+}
 
-            //qDebug()<<"I'm running!10";
+void RTMPPublisher::sendFrame(const MediaFrame& frame) {
+    if (frame.type == MediaFrame::AUDIO_CONFIG) {
+        applyAudioConfig(frame.buffer);
+        return;
+    }
+    long dts = frame.dts + mTimestampOffset;
+    if (mIsResuming) {
+        //First frame on a new connection, move timeline so it continues right after last frame sent
+        if (mLastSentTS > 0 && dts <= mLastSentTS) {
+            mTimestampOffset += mLastSentTS + 1 - dts;
+            dts = frame.dts + mTimestampOffset;
+            qDebug()<<"Timestamp offset now"<<mTimestampOffset;
         }
+        mIsResuming = false;
     }
-    qDebug()<<"yellow"<<mIsStopped;
-    if(mIsStopped) {
-        qDebug()<<"Destroying socket!";
-        destroySocket();
-        emit finished();
+    long pts = frame.pts + mTimestampOffset;
+    switch (frame.type) {
+        case MediaFrame::AUDIO:
+            sendAudioFrame(frame.buffer, pts);
+            break;
+        case MediaFrame::VIDEO:
+            sendVideoFrame(frame, pts, dts);
+            break;
+        default:
+            return;
     }
+    if (dts > mLastSentTS)
+        mLastSentTS = dts;
+    markPhase(PhaseFirstFrame);
 }
 
-bool RTMPPublisher::initiate() {
-    mSocket = new QTcpSocket(this);
-    mSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
-    QObject::connect(mSocket,SIGNAL(error(QAbstractSocket::SocketError)),
-            this,SLOT(on_mSocket_error(QAbstractSocket::SocketError)));
-    QObject::connect(mSocket,SIGNAL(bytesWritten(qint64)),
-                this,SLOT(on_mSocket_bytesWritten(qint64)));
-    mSocket->connectToHost(this->mHost, this->mPort);
-    if(mSocket->waitForConnected(15*1000)) {
-        qDebug()<<"Connection established!";
-        return true;
-    } else {
-        qDebug()<<"Couldn't connect!"<<mSocket->error();
-        //Error signal here?
-        return false;
+void RTMPPublisher::sendTracedFrame(MediaFrame& frame) {
+    /*
+     * Kernel has taken the first mTotalBytesWritten bytes of the session, the rest of what was written is
+     * in socket buffer. Frame goes between socket's end of stream before and after sending it, its first
+     * and last byte times are when mTotalBytesWritten passes those, right away or in on_mSocket_bytesWritten().
+     */
+    frame.times.dequeue = LatencyTracer::nowUsec();
+    qint64 startOffset = mTotalBytesWritten + mSocket->bytesToWrite();
+    sendFrame(frame);
+    if (!isSocketConnected())
+        return;
+    PendingWrite pending;
+    pending.startOffset = startOffset;
+    pending.endOffset = mTotalBytesWritten + mSocket->bytesToWrite();
+    //SPS and PPS don't go out as they come
+    if (pending.endOffset == pending.startOffset)
+        return;
+    pending.dts = frame.dts;
+    pending.track = frame.type == MediaFrame::AUDIO ? LatencyTracer::TrackAudio : LatencyTracer::TrackVideo;
+    pending.times = frame.times;
+    if (mPendingWrites.push(pending))
+        completeWrites();
+}
+
+void RTMPPublisher::completeWrites() {
+    qint64 now = LatencyTracer::nowUsec();
+    PendingWrite* pending;
+    while ((pending = mPendingWrites.peek()) != NULL) {
+        if (pending->times.firstByte == 0 && mTotalBytesWritten > pending->startOffset)
+            pending->times.firstByte = now;
+        //Later frames can't have started before this one is done
+        if (mTotalBytesWritten < pending->endOffset)
+            return;
+        pending->times.lastByte = now;
+        mLatencyTracer->record(pending->track, pending->times, pending->dts);
+        PendingWrite done;
+        mPendingWrites.pop(done);
     }
 }
 
-void RTMPPublisher::start() {
-    mAACFormat = 0;
-    mHasAudio = false;
-    mAudioTimestamp = 0;
-    mHasVideo = false;
-    mVideoTimestamp = 0;
-    mNumChannels = 0;
-    mSampleRate = 0;
-    mSampleSize = 0;
-    mIsWaitingForHandshakeReadyRead = false;
-    mTotalBytesWritten = 0;
-    mAudioFramesReceivedCount = 0;
-    mVideoFramesReceivedCount = 0;
-    mDroppedFramesCount = 0;
-    mLastReceivedFrameTS = 0;
-    if(initiate()) {
-        run();
-    } else
-        emit socketError(mSocket->error());
+void RTMPPublisher::cacheFrame(const MediaFrame& frame) {
+    /*
+     * Keeps what was sent since latest IDR, so a new connection can start with a decodable GOP.
+     * SPS/PPS are kept by sendVideoFrame() anyway.
+     * Cache only ever drops from the front at an IDR, anything less would leave frames without their
+     * reference. To stay bounded with long GOPs, and after a replay has resent the whole GOP, an IDR is
+     * asked for once cache passes GOP_CACHE_HIGH_WATER_PERCENT, so the next IDR boundary comes before
+     * the bound does. If it doesn't (encoder can't force one), the GOP is given up till next IDR.
+     */
+    if (!RECONNECT_ENABLED || frame.isSequenceHeader())
+        return;
+    if (frame.isKeyFrame()) {
+        clearGopCache();
+        mIsGopCacheValid = true;
+        mIsGopCacheKeyFrameRequested = false;
+    }
+    if (!mIsGopCacheValid)
+        return;
+    if (mGopCacheBytes + frame.buffer.size() > GOP_CACHE_MAX_BYTES ||
+            !mGopCache.push(frame)) {
+        qDebug()<<"GOP cache full, given up till next IDR";
+        clearGopCache();
+        return;
+    }
+    mGopCacheBytes += frame.buffer.size();
+    if (!mIsGopCacheKeyFrameRequested &&
+            (mGopCacheBytes >= GOP_CACHE_MAX_BYTES/100*GOP_CACHE_HIGH_WATER_PERCENT ||
+             mGopCache.size() >= mGopCache.capacity()/100*GOP_CACHE_HIGH_WATER_PERCENT)) {
+        mIsGopCacheKeyFrameRequested = true;
+        emit keyFrameRequested();
+    }
+}
+
+void RTMPPublisher::clearGopCache() {
+    mGopCache.clear();
+    mGopCacheBytes = 0;
+    mIsGopCacheValid = false;
+    mReplayIndex = -1;
 }
 
 void RTMPPublisher::handshake() {
@@ -179,174 +751,125 @@ void RTMPPublisher::handshake() {
      * - protocol version
      * - own digest
      * - received digest
+     * Client doesn't have to wait for S2 before sending C2 and its first messages, see on_mSocket_readyRead().
      */
-    unsigned char buffer[3073];
+    unsigned char buffer[1537];
     buffer[0] = (unsigned char) 3;
-    for (int i = 1; i < 3073; i++) {
+    for (int i = 1; i < 1537; i++) {
         buffer[i] = (unsigned char) 0;
     }
-    if(isSocketConnected() &&
-            mSocket->bytesAvailable()<0)
-        mSocket->readAll(); //Clearing?
+    mState = StateHandshaking;
     write(buffer, 1537);
-    int startTime = QDateTime::currentDateTime().toTime_t();
-    mIsWaitingForHandshakeReadyRead = true;
-    while(isSocketConnected() &&
-            mSocket->bytesAvailable()<3073 &&
-            QDateTime::currentDateTime().toTime_t()-startTime<2*60*1000) {
-        qDebug()<<"Waiting for handshake read!";
-        waitForReadyRead();
-    }
-    mIsWaitingForHandshakeReadyRead = false;
-    if(isSocketConnected() &&
-            mSocket->bytesAvailable()>=3073) {
-        QByteArray buf = mSocket->read(3073);
-        buf = buf.left(1536);
-        write(buf);
-    } else {
-        qDebug()<<"Handshake error!"<<mSocket->bytesAvailable();
-    }
 }
 
 void RTMPPublisher::setChunkSize() {
     /*
-	 * First byte, Chunk Basic Header, here is 4. First two bits represent fmt, ie, Type 0 chunk header type (header will be 11 bytes).
-	 * - Next six bits represent chunk stream id, ie, 4 for a User control message.?
-     * For 11 byte header,
-	 * - First 3 are for timestamp, ignored here.
-	 * - Next 3 are payload length which is 4 for this.
-     * - Next 1 byte is for protocol message type which is 1 here.
-     * - Next 4 bytes are for message stream id which will be 0 in this case.
-     * Remaining 4 for are payload which is chunk size here with first bit as 0.
+     * Set Chunk Size, protocol control message type 1 with a 4 byte body, first bit 0.
+     * Each side announces the chunk size it sends with, there is no reply. We ask for as large a size
+     * as CHUNK_SIZE allows on every connection, so most frames go out as a single chunk with one header.
+     * The message itself still goes with the default 128 byte chunks, new size applies after it.
      */
-    int bufferLength = 16;
-    unsigned char buffer[16] = {(unsigned char) 4, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 4, (unsigned char) 1, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0};
-    buffer[bufferLength - 4] = (unsigned char) (CHUNK_SIZE >> 24);
-    buffer[bufferLength - 3] = (unsigned char) (CHUNK_SIZE >> 16);
-    buffer[bufferLength - 2] = (unsigned char) (CHUNK_SIZE >> 8);
-    buffer[bufferLength - 1] = (unsigned char) CHUNK_SIZE;
-    write(buffer, bufferLength);
+    int chunkSize = CHUNK_SIZE;
+    if (chunkSize > RTMP_MAX_CHUNK_SIZE)
+        chunkSize = RTMP_MAX_CHUNK_SIZE;
+    unsigned char body[4] = {(unsigned char) ((chunkSize >> 24) & 0x7F), (unsigned char) (chunkSize >> 16), (unsigned char) (chunkSize >> 8), (unsigned char) chunkSize};
+    writeMessage(RTMP_CSID_CONTROL, RTMP_MSG_SET_CHUNK_SIZE, 0, 0, body, 4, NULL, 0);
+    mChunkWriter.setChunkSize(chunkSize);
+    qDebug()<<"Chunk size"<<chunkSize;
 }
 
 void RTMPPublisher::connect() {
     /*
-	 * First byte, Chunk Basic Header, here is 4. First two bits represent fmt, ie, Type 0 chunk header type (header will be 11 bytes).
-	 * - Next six bits represent chunk stream id, ie, 4 for a User control message.?
-     * For 11 byte header,
-	 * - First 3 are for timestamp, ignored here.
-	 * - Next 3 are payload length which will be mApp.length()+31 here.
-     * - Next 1 byte is for protocol message type which is 20 here as it is a Command Message.
-     * - Next 4 bytes are for message stream id which will be 0 in this case.
-     * Remaining bytes 28(in buffer)+3(in bufferEnd)+mApp.length() are for payload which is AMF encoded connect message.
+     * Command message, type 20, on command chunk stream and message stream 0.
+     * Body is AMF encoded connect command, ie, string "connect", transaction id 1 and command object
+     * with app name, tcUrl and client type.
      */
-    int bufferLength = 40;
-    unsigned char buffer[40] = {(unsigned char) 4, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 20, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 2, (unsigned char) 0, (unsigned char) 7, (unsigned char) 99, (unsigned char) 111, (unsigned char) 110, (unsigned char) 110, (unsigned char) 101, (unsigned char) 99, (unsigned char) 116, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 3, (unsigned char) 0, (unsigned char) 3, (unsigned char) 97, (unsigned char) 112, (unsigned char) 112, (unsigned char) 2, (unsigned char) 0, (unsigned char) 0};
-    unsigned char bufferEnd[3] = {(unsigned char) 0, (unsigned char) 0, (unsigned char) 9};
-    int length = mApp.length() + 31;
-    buffer[4] = (unsigned char) (length >> 16);
-    buffer[5] = (unsigned char) (length >> 8);
-    buffer[6] = (unsigned char) length;
-    buffer[bufferLength - 2] = (unsigned char) (mApp.length() >> 8);
-    buffer[bufferLength - 1] = (unsigned char) mApp.length();
-    write(buffer, bufferLength);//    this.out.write(buffer);
-    write(this->mApp.toUtf8());//    this.out.write(this.app.getBytes());
-    write(bufferEnd, 3);//    this.out.write(bufferEnd);
+    QByteArray body;
+    AMF0::encodeString(body, "connect");
+    AMF0::encodeNumber(body, TRANSACTION_CONNECT);
+    AMF0::encodeObjectStart(body);
+    AMF0::encodePropertyName(body, "app");
+    AMF0::encodeString(body, this->mApp);
+    AMF0::encodePropertyName(body, "type");
+    AMF0::encodeString(body, "nonprivate");
+    AMF0::encodePropertyName(body, "tcUrl");
+    AMF0::encodeString(body, QString("rtmp://%1:%2/%3").arg(this->mHost).arg(this->mPort).arg(this->mApp));
+    AMF0::encodeObjectEnd(body);
+    sendCommand(0, body);
+}
+
+void RTMPPublisher::createStream() {
+    //String "createStream", transaction id 2 and null command object, server replies with new stream id
+    QByteArray body;
+    AMF0::encodeString(body, "createStream");
+    AMF0::encodeNumber(body, TRANSACTION_CREATE_STREAM);
+    AMF0::encodeNull(body);
+    sendCommand(0, body);
 }
 
 void RTMPPublisher::publish() {
     /*
-	 * First byte, Chunk Basic Header, here is 4. First two bits represent fmt, ie, Type 0 chunk header type (header will be 11 bytes).
-	 * - Next six bits of first byte represent chunk stream id, ie, 4 for a User control message.?
-     * For 11 byte header,
-	 * - First 3 are for timestamp, ignored here.
-	 * - Next 3 are payload length which will be mPlayPath.length()+23 here.
-     * - Next 1 byte is for protocol message type which is 20 here as it is a Command Message.
-     * - Next 4 bytes are for message stream id which will be 0 in this case.
-     * Remaining bytes 23(in buffer)+mPlayPath.length() are for payload which is AMF encoded connect message.
+     * Command message, type 20, on command chunk stream and message stream mStreamId.
+     * Body is AMF encoded publish command, ie, string "publish", transaction id 0, null command object,
+     * publishing name and publishing type "live".
      */
-    int bufferLength = 35;
-    unsigned char buffer[35] = {(unsigned char) 4, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 20, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 2, (unsigned char) 0, (unsigned char) 7, (unsigned char) 112, (unsigned char) 117, (unsigned char) 98, (unsigned char) 108, (unsigned char) 105, (unsigned char) 115, (unsigned char) 104, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 5, (unsigned char) 2, (unsigned char) 0, (unsigned char) 0};
-    int length = mPlayPath.length() + 23;
-    buffer[4] = (unsigned char) (length >> 16);
-    buffer[5] = (unsigned char) (length >> 8);
-    buffer[6] = (unsigned char) length;
-    buffer[bufferLength - 2] = (unsigned char) (mPlayPath.length() >> 8);
-    buffer[bufferLength - 1] = (unsigned char) mPlayPath.length();
-    write(buffer, bufferLength);
-    write(this->mPlayPath.toUtf8());
+    QByteArray body;
+    AMF0::encodeString(body, "publish");
+    AMF0::encodeNumber(body, 0);
+    AMF0::encodeNull(body);
+    AMF0::encodeString(body, this->mPlayPath);
+    AMF0::encodeString(body, "live");
+    sendCommand(mStreamId, body);
+    mIsPublishSent = true;
+    if (mHasPublished)
+        resumeStream();
+}
+
+void RTMPPublisher::sendCommand(quint32 streamId, const QByteArray& body) {
+    //Passed as body header so it is copied, commands may be batched past lifetime of body
+    writeMessage(RTMP_CSID_COMMAND, RTMP_MSG_COMMAND_AMF0, streamId, 0,
+            reinterpret_cast<const unsigned char*>(body.constData()), body.size(), NULL, 0);
+}
+
+void RTMPPublisher::beginBatch() {
+    //Messages written till endBatch() go out in one submit
+    mWriter.clear();
+    mIsBatching = true;
+}
+
+void RTMPPublisher::endBatch() {
+    mIsBatching = false;
+    submitMessages();
 }
 
 void RTMPPublisher::startAudio(long ts) {
     /*
-	 * First byte, Chunk Basic Header, here is 8. First two bits represent fmt, ie, Type 0 chunk header type (header will be 11 bytes).
-	 * - Next six bits of first byte represent chunk stream id, ie, 8 for a Audio.?
-     * For 11 byte header,
-	 * - First 3 are for timestamp, setting audio start timestamp here. Start timestamp will be 0 mostly.
-	 * - Next 3 are payload length which will be mAACHeader.length()+2 here.
-     * - Next 1 byte is for protocol message type which is 8 here as it is a Audio Message.
-     * - Next 4 bytes are for message stream id which will be 0 in this case.
-     * Remaining bytes 2(in buffer)+mAACHeader.length() are for payload, sending audio header.
+     * Audio message, type 8, carrying AAC sequence header, ie, AudioSpecificConfig in mAACHeader.
+     * Body is 2 bytes of FLV audio tag header, sound format byte and AACPacketType 0, then the config.
      */
-    unsigned char buffer[14] = {(unsigned char) 8, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 8, (unsigned char) 1, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0};
     qDebug()<<"Starting audio";
     this->mAudioTimestamp = ts;
-    buffer[1] = (unsigned char) ((int) ((ts >> 16) & 255));
-    buffer[2] = (unsigned char) ((int) ((ts >> 8) & 255));
-    buffer[3] = (unsigned char) ((int) (255 & ts));
-    int length = this->mAACHeader.length() + 2;
-    buffer[4] = (unsigned char) ((length >> 16) & 255);
-    buffer[5] = (unsigned char) ((length >> 8) & 255);
-    buffer[6] = (unsigned char) (length & 255);
-    this->mAACFormat = (((this->mNumChannels - 1) & 1) | 172) | (((this->mSampleSize - 1) & 1) << 1);
-    buffer[12] = (unsigned char) this->mAACFormat;
-    write(buffer, 14);
-    write(this->mAACHeader);
+    this->mAACFormat = FLV::aacSoundFormat(this->mNumChannels, this->mSampleSize);
+    unsigned char buffer[FLV_AUDIO_HEADER_SIZE];
+    FLV::audioTagHeader(buffer, this->mAACFormat, FLV_AAC_SEQUENCE_HEADER);
+    writeMessage(RTMP_CSID_AUDIO, RTMP_MSG_AUDIO, mStreamId, ts, buffer, FLV_AUDIO_HEADER_SIZE, this->mAACHeader.constData(), this->mAACHeader.size());
     this->mHasAudio = true;
 }
 
-void RTMPPublisher::sendAudioFrame(QByteArray frame, long ts) {
+void RTMPPublisher::sendAudioFrame(const MediaBuffer& frame, long ts) {
     /*
-	 * First byte, Chunk Basic Header, here is 72. First two bits represent fmt, ie, Type 1 chunk header type (header will be 7 bytes with no message stream id field).
-	 * - Next six bits of first byte represent chunk stream id, ie, 8 for a Audio.?
-     * For 7 byte header,
-	 * - First 3 are for timestamp delta relative to timestamp sent in previous chunk.
-	 * - Next 3 are payload length which will be frame.length()+2 here.
-     * - Next 1 byte is for protocol message type which is 8 here as it is a Audio Message.
-     * Remaining bytes 2(in buffer)+frame.length() are for payload, sending audio.
-	 * If payload size is greater than CHUNK_SIZE then it is split. Byte value 200 is used for splitting.
+     * Audio message, type 8. Body is 2 bytes of FLV audio tag header, sound format byte and AACPacketType 1,
+     * then raw AAC frame. Chunk header is picked by mChunkWriter, mostly a 1 byte fmt 3 as frames repeat
+     * in size and duration.
      */
     if (!((this->mAACHeader.isNull() || this->mAACHeader.isEmpty()) || this->mHasAudio)) {
         startAudio(ts);
     }
     if (this->mHasAudio) {
-        unsigned char buffer[10] = {(unsigned char) 72, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 8, (unsigned char) 0, (unsigned char) 1};
-        long delta = ts - this->mAudioTimestamp;
+        unsigned char buffer[FLV_AUDIO_HEADER_SIZE];
+        FLV::audioTagHeader(buffer, this->mAACFormat, FLV_AAC_RAW);
         this->mAudioTimestamp = ts;
-        buffer[1] = (unsigned char) ((int) ((delta >> 16) & 255));
-        buffer[2] = (unsigned char) ((int) ((delta >> 8) & 255));
-        buffer[3] = (unsigned char) ((int) (255 & delta));
-        int totalLength = frame.length() + 2;
-        buffer[4] = (unsigned char) ((totalLength >> 16) & 255);
-        buffer[5] = (unsigned char) ((totalLength >> 8) & 255);
-        buffer[6] = (unsigned char) (totalLength & 255);
-        buffer[8] = (unsigned char) this->mAACFormat;
-        QByteArray buf(reinterpret_cast<char*>(buffer), 10);
-        int length = CHUNK_SIZE - 2;
-        if (length > frame.length()) {
-            length = frame.length();
-        }
-        buf.append(frame.left(length));
-        write(buf, false);
-        int offset = length;
-        while (offset < frame.length()) {
-            length = CHUNK_SIZE;
-            if (offset + length > frame.length()) {
-                length = frame.length() - offset;
-            }
-            write(IntToArray(200));
-            write(frame.mid(offset, length), false);
-            offset += length;
-        }
+        writeMessage(RTMP_CSID_AUDIO, RTMP_MSG_AUDIO, mStreamId, ts, buffer, FLV_AUDIO_HEADER_SIZE, frame);
     } else {
         qDebug()<<"Skip audio frame";
     }
@@ -354,56 +877,32 @@ void RTMPPublisher::sendAudioFrame(QByteArray frame, long ts) {
 
 void RTMPPublisher::startVideo(long ts) {
     /*
-	 * First byte, Chunk Basic Header, here is 9. First two bits represent fmt, ie, Type 0 chunk header type (header will be 11 bytes).
-	 * - Next six bits of first byte represent chunk stream id, ie, 9 for a Video.?
-     * For 11 byte header,
-	 * - First 3 are for timestamp, setting video start timestamp here. Start timestamp will be 0 mostly.
-	 * - Next 3 are payload length which will be mSPS.length() + 16) + mPPS.length() here.
-     * - Next 1 byte is for protocol message type which is 9 here as it is a Video Message.
-     * - Next 4 bytes are for message stream id which will be 0 in this case.
-     * Remaining bytes 13(in buffer)+3(in bufferEnd)+mSPS.length() + mPPS.length() are for payload, sending video sps, pps.
+     * Video message, type 9, carrying AVC sequence header.
+     * Body is 5 bytes of FLV video tag header, ie, key frame/AVC byte 23, AVCPacketType 0 and composition time 0,
+     * then AVCDecoderConfigurationRecord built from mSPS and mPPS.
      */
-    int bufferLength = 25;
-    unsigned char buffer[25] = {(unsigned char) 9, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 9, (unsigned char) 1, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 23, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 1, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) -1, (unsigned char) -31, (unsigned char) 0, (unsigned char) 0};
-    unsigned char bufferEnd[3] = {(unsigned char) 1, (unsigned char) 0, (unsigned char) 0};
+    unsigned char buffer[FLV_VIDEO_HEADER_SIZE];
     qDebug()<<"Starting video";
     this->mVideoTimestamp = ts;
-    buffer[1] = (unsigned char) ((int) ((ts >> 16) & 255));
-    buffer[2] = (unsigned char) ((int) ((ts >> 8) & 255));
-    buffer[3] = (unsigned char) ((int) (255 & ts));
-    int length = (this->mSPS.length() + 16) + this->mPPS.length();
-    buffer[4] = (unsigned char) ((length >> 16) & 255);
-    buffer[5] = (unsigned char) ((length >> 8) & 255);
-    buffer[6] = (unsigned char) (length & 255);
-    buffer[bufferLength - 2] = (unsigned char) ((this->mSPS.length()>> 8) & 255);
-    buffer[bufferLength - 1] = (unsigned char) (this->mSPS.length() & 255);
-    bufferEnd[1] = (unsigned char) ((this->mPPS.length() >> 8) & 255);
-    bufferEnd[2] = (unsigned char) (this->mPPS.length() & 255);
-    write(buffer, bufferLength);
-    write(this->mSPS);
-    write(bufferEnd, 3);
-    write(this->mPPS);
+    FLV::videoTagHeader(buffer, true, FLV_AVC_SEQUENCE_HEADER, 0);
+    QByteArray record = FLV::avcDecoderConfigurationRecord(this->mSPS, this->mPPS);
+    writeMessage(RTMP_CSID_VIDEO, RTMP_MSG_VIDEO, mStreamId, ts, buffer, FLV_VIDEO_HEADER_SIZE, record.constData(), record.size());
     this->mHasVideo = true;
 }
 
-void RTMPPublisher::sendVideoNal(QByteArray nal, long pts, long dts) {
+void RTMPPublisher::sendVideoFrame(const MediaFrame& frame, long pts, long dts) {
     /*
-	 * First byte, Chunk Basic Header, here is 73. First two bits represent fmt, ie, Type 1 chunk header type (header will be 7 bytes with no message stream id field).
-	 * - Next six bits of first byte represent chunk stream id, ie, 9 for a Video.?
-     * For 7 byte header,
-	 * - First 3 are for timestamp delta relative to timestamp sent in previous chunk.
-	 * - Next 3 are payload length which will be frame.length()+2 here.
-     * - Next 1 byte is for protocol message type which is 9 here as it is a Video Message.
-     * Remaining bytes 9(in buffer)+nal.length() are for payload, sending video. DTS, PTS delay has also been taken care of.
-	 * If payload size is greater than CHUNK_SIZE then it is split. Byte value 201 is used for splitting.
+     * Video message, type 9. Body is 5 bytes of FLV video tag header, ie, frame type/AVC byte (23 for IDR, 39 otherwise),
+     * AVCPacketType 1 and 3 byte composition time (pts-dts), then the AVCC sample, every NAL behind its 4 byte length.
+     * SPS and PPS are not sent as they come, they are kept for the sequence header sent before first frame.
      */
-    int nalType = nal[0] & 31;
+    int nalType = frame.nalType();
     if (nalType == 7) {
         qDebug()<<"SPS arrived";
-        this->mSPS = nal;
+        this->mSPS = frame.firstNAL().toByteArray();
     } else if (nalType == 8) {
         qDebug()<<"PPS arrived";
-        this->mPPS = nal;
+        this->mPPS = frame.firstNAL().toByteArray();
     } else {
         if (!(this->mSPS.isNull() || this->mSPS.isEmpty() ||
                 this->mPPS.isNull() || this->mPPS.isEmpty() ||
@@ -411,45 +910,10 @@ void RTMPPublisher::sendVideoNal(QByteArray nal, long pts, long dts) {
             startVideo(dts);
         }
         if (this->mHasVideo) {
-            int bufferLength = 17;
-            unsigned char buffer[17] = {(unsigned char) 73, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 9, (unsigned char) 39, (unsigned char) 1, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0, (unsigned char) 0};
-            long delta = dts - this->mVideoTimestamp;
+            unsigned char buffer[FLV_VIDEO_HEADER_SIZE];
             this->mVideoTimestamp = dts;
-            buffer[1] = (unsigned char) ((int) (255 & (delta >> 16)));
-            buffer[2] = (unsigned char) ((int) (255 & (delta >> 8)));
-            buffer[3] = (unsigned char) ((int) (255 & delta));
-            int totalLength = nal.length() + 9;
-            buffer[4] = (unsigned char) ((totalLength >> 16) & 255);
-            buffer[5] = (unsigned char) ((totalLength >> 8) & 255);
-            buffer[6] = (unsigned char) (totalLength & 255);
-            if (nalType == 5) {
-                buffer[8] = (unsigned char) 23;
-            }
-            long delay = pts - dts;
-            buffer[bufferLength - 7] = (unsigned char) ((int) (255 & (delay >> 16)));
-            buffer[bufferLength - 6] = (unsigned char) ((int) (255 & (delay >> 8)));
-            buffer[bufferLength - 5] = (unsigned char) ((int) (255 & delay));
-            buffer[bufferLength - 4] = (unsigned char) ((nal.length() >> 24) & 255);
-            buffer[bufferLength - 3] = (unsigned char) ((nal.length() >> 16) & 255);
-            buffer[bufferLength - 2] = (unsigned char) ((nal.length() >> 8) & 255);
-            buffer[bufferLength - 1] = (unsigned char) (nal.length() & 255);
-            QByteArray buf(reinterpret_cast<char*>(buffer), bufferLength);
-            int length = CHUNK_SIZE - 9;
-            if (length > nal.length()) {
-                length = nal.length();
-            }
-            buf.append(nal.left(length));
-            write(buf, false);
-            int offset = length;
-            while (offset < nal.length()) {
-                length = CHUNK_SIZE;
-                if (offset + length > nal.length()) {
-                    length = nal.length() - offset;
-                }
-                write((uchar)201);
-                write(nal.mid(offset, length), false);
-                offset += length;
-            }
+            FLV::videoTagHeader(buffer, nalType == 5, FLV_AVC_NALU, pts - dts);
+            writeMessage(RTMP_CSID_VIDEO, RTMP_MSG_VIDEO, mStreamId, dts, buffer, FLV_VIDEO_HEADER_SIZE, frame.buffer);
         } else {
             qDebug()<<"Skip video frame";
         }
@@ -457,10 +921,37 @@ void RTMPPublisher::sendVideoNal(QByteArray nal, long pts, long dts) {
 }
 
 void RTMPPublisher::setAudioHeader(QByteArray header, int nchan, int srate, int ssize) {
+    /*
+     * Camera audio thread, ie, audio ring's producer. Config goes into the ring as a frame of its own, so
+     * publisher thread applies it between the frames it came between and nothing here is shared.
+     * Channels are read back from the config itself, AAC always decodes to 16 bit.
+     */
+    Q_UNUSED(nchan);
+    Q_UNUSED(srate);
+    Q_UNUSED(ssize);
+    mPendingAudioConfig.type = MediaFrame::AUDIO_CONFIG;
+    mPendingAudioConfig.buffer = MediaBuffer::fromData(header.constData(), header.size());
+    mPendingAudioConfig.dts = mLastQueuedAudioTS;
+    mPendingAudioConfig.pts = mLastQueuedAudioTS;
+    queueAudioConfig();
+}
+
+bool RTMPPublisher::queueAudioConfig() {
+    //Producer side, retried before next audio frame if ring is full
+    if (!mAudioQueue.push(mPendingAudioConfig))
+        return false;
+    mPendingAudioConfig.buffer = MediaBuffer();
+    return true;
+}
+
+void RTMPPublisher::applyAudioConfig(const MediaBuffer& config) {
+    //A new config mid-stream goes out as another sequence header before the next frame
+    QByteArray header = config.toByteArray();
+    if (this->mHasAudio && header != this->mAACHeader)
+        this->mHasAudio = false;
     this->mAACHeader = header;
-    this->mNumChannels = nchan;
-    this->mSampleRate = srate;
-    this->mSampleSize = ssize;
+    this->mNumChannels = ADTS::channelConfig(header);
+    this->mSampleSize = 2;
 }
 
 bool RTMPPublisher::isSocketConnected() {
@@ -470,129 +961,215 @@ bool RTMPPublisher::isSocketConnected() {
     return false;
 }
 
-bool RTMPPublisher::waitForReadyRead(int msec) {
-    if(isSocketConnected())
-        return mSocket->waitForReadyRead(msec);
-    return false;
-}
-
-QByteArray RTMPPublisher::readAll() {
-    if(isSocketConnected())
-        return mSocket->readAll();
-    return QByteArray();
-}
-
-qint64 RTMPPublisher::write(const QByteArray data, const bool doWait)
+void RTMPPublisher::writeMessage(int csid,
+        int type,
+        quint32 streamId,
+        long timestamp,
+        const unsigned char* bodyHeader,
+        int bodyHeaderLength,
+        const char* payload,
+        int payloadLength)
 {
-    if(isSocketConnected()) {
+    /*
+     * Whole message goes out as one gather list, chunk headers picked by mChunkWriter,
+     * body header (tag bytes) copied and payload slices referenced between them.
+     */
+    if(!isSocketConnected())
+        return;
 #if(LOG_HIGH_WRITE_TIMES)
-        logTimer.restart();
+    logTimer.restart();
 #endif
-        qint64 written = mSocket->write(data); //write the data itself
-        if(doWait)
-            mSocket->waitForBytesWritten();
-        else
-            mSocket->flush();
+    if(!mIsBatching)
+        mWriter.clear();
+    mChunkWriter.writeMessage(mWriter, csid, type, streamId, (quint32) timestamp,
+            bodyHeader, bodyHeaderLength, payload, payloadLength);
+    if(type == RTMP_MSG_AUDIO || type == RTMP_MSG_VIDEO)
+        mFramesSentCount++;
+    if(mIsBatching)
+        return;
+    qint64 written = submitMessages();
 #if(LOG_HIGH_WRITE_TIMES)
-        if(logTimer.elapsed()>HIGH_WRITE_LIMIT_MSEC)
-            qDebug()<<data.size()<<"QByteArray"<<logTimer.elapsed()<<written;
+    if(logTimer.elapsed()>HIGH_WRITE_LIMIT_MSEC)
+        qDebug()<<payloadLength<<"message"<<logTimer.elapsed()<<written<<mWriter.sliceCount();
+#else
+    Q_UNUSED(written);
 #endif
-        return written;
-    }
-    return 0;
 }
 
-qint64 RTMPPublisher::write(const char* data, qint64 length, const bool doWait)
+qint64 RTMPPublisher::submitMessages()
 {
-    if(isSocketConnected()) {
-#if(LOG_HIGH_WRITE_TIMES)
-        logTimer.restart();
-#endif
-        qint64 written = mSocket->write(data, length); //write the data itself
-        if(doWait)
-            mSocket->waitForBytesWritten();
-        else
-            mSocket->flush();
-#if(LOG_HIGH_WRITE_TIMES)
-        if(logTimer.elapsed()>HIGH_WRITE_LIMIT_MSEC)
-            qDebug()<<length<<"char"<<logTimer.elapsed()<<written;
-#endif
-        return written;
-    }
-    return 0;
+    qint64 directBefore = mWriter.directBytesWritten();
+    qint64 written = mWriter.submit();
+    mTotalBytesWritten += mWriter.directBytesWritten() - directBefore;
+    mBytesWrittenCounter.fetchAndAddRelaxed((int) (mWriter.directBytesWritten() - directBefore));
+    return written;
 }
 
-qint64 RTMPPublisher::write(const unsigned char* data, qint64 length, const bool doWait)
+void RTMPPublisher::writeMessage(int csid,
+        int type,
+        quint32 streamId,
+        long timestamp,
+        const unsigned char* bodyHeader,
+        int bodyHeaderLength,
+        const MediaBuffer& payload)
 {
-    return write(reinterpret_cast<const char*>(data), length, doWait);
+    writeMessage(csid, type, streamId, timestamp, bodyHeader, bodyHeaderLength, payload.constData(), payload.size());
 }
 
-qint64 RTMPPublisher::write(const unsigned char data, const bool doWait)
+qint64 RTMPPublisher::write(const QByteArray data)
 {
-    return write(reinterpret_cast<const char*>(&data), 1, doWait);
+    return write(data.constData(), data.size());
 }
 
-qint64 RTMPPublisher::write(qint32 data, const bool doWait)
+qint64 RTMPPublisher::write(const char* data, qint64 length)
 {
-    return write(IntToArray(data), doWait);
+    //Never waits, socket buffer is drained by the event loop
+    if(isSocketConnected())
+        return mSocket->write(data, length);
+    return 0;
 }
 
-void RTMPPublisher::on_mSocket_readyRead() {
-
+qint64 RTMPPublisher::write(const unsigned char* data, qint64 length)
+{
+    return write(reinterpret_cast<const char*>(data), length);
 }
 
 void RTMPPublisher::postFrame(MediaFrame frame)
 {
+    //Called from camera encoder callbacks, audio and video each from its own thread.
+    //Each ring has a single producer so no locking is needed here.
     if(this->mIsStopped) return;
-    mLock->lock();
     if (frame.type == MediaFrame::EOS) {
-        this->mVideoQueue.append(frame);
-        this->mAudioQueue.append(frame);
-        mCondition.wakeAll();
-    } else {
-        mLastReceivedFrameTS = frame.dts;
-        QLinkedList<MediaFrame> *queue;
-        if(frame.type == MediaFrame::AUDIO) {
-            queue = &mAudioQueue;
-            mAudioFramesReceivedCount++;
-            emit audioFramesCountChanged();
+        safeStop();
+        return;
+    }
+    mLastReceivedFrameTS = frame.dts;
+    if(mLatencyTracer != NULL)
+        frame.times.enqueue = LatencyTracer::nowUsec();
+    if(frame.type == MediaFrame::AUDIO) {
+        mAudioFramesReceivedCount.ref();
+        //Frames mustn't get ahead of a config still waiting for room
+        if ((!mPendingAudioConfig.buffer.isNull() && !queueAudioConfig()) || !mAudioQueue.push(frame)) {
+            dropFrame(DropAudioQueueFull);
         } else {
-            queue = &mVideoQueue;
-            mVideoFramesReceivedCount++;
-            emit videoFramesCountChanged();
+            mLastQueuedAudioTS = frame.dts;
+            schedulePump();
         }
-        if ((frame.type == MediaFrame::AUDIO && queue->size() >= 2*MAX_QUEUE_SIZE) ||
-                (frame.type == MediaFrame::VIDEO && queue->size() >= MAX_QUEUE_SIZE)) {
-//            qDebug()<<"Drop frame";
-            mDroppedFramesCount++;
-            emit droppedFramesCountChanged();
+    } else {
+        mVideoFramesReceivedCount.ref();
+        postVideoFrame(frame);
+    }
+}
+
+void RTMPPublisher::postVideoFrame(const MediaFrame& frame)
+{
+    /*
+     * GOP aware dropping, video ring is twice MAX_QUEUE_SIZE but only MAX_QUEUE_SIZE is budget for regular frames.
+     * - SPS/PPS may use the whole ring, they are never dropped by policy.
+     * - IDR may use all but the last VIDEO_QUEUE_KEYFRAME_RESERVE slots and ends a dropping run.
+     * - Any other frame starts a dropping run once budget is used up, and is dropped while a run lasts,
+     *   because it depends on what was dropped before it.
+     */
+    int queued = mVideoQueue.size();
+    bool isQueued = false;
+    if (frame.isSequenceHeader()) {
+        isQueued = mVideoQueue.push(frame);
+    } else if (frame.isKeyFrame()) {
+        if (queued < mVideoQueue.capacity() - VIDEO_QUEUE_KEYFRAME_RESERVE)
+            isQueued = mVideoQueue.push(frame);
+        if (isQueued) {
+            mIsDroppingToKeyFrame = false;
         } else {
-            queue->append(frame);
-            mCondition.wakeAll();
+            mIsDroppingToKeyFrame = true;
+            dropFrame(DropVideoQueueFull);
+            return;
         }
+    } else {
+        if (!mIsDroppingToKeyFrame && queued >= MAX_QUEUE_SIZE) {
+            mIsDroppingToKeyFrame = true;
+            if (REQUEST_KEYFRAME_ON_DROP)
+                emit keyFrameRequested();
+        }
+        if (mIsDroppingToKeyFrame) {
+            dropFrame(DropVideoCongestion);
+            return;
+        }
+        isQueued = mVideoQueue.push(frame);
     }
-    mLock->unlock();
+    if (isQueued) {
+        mLastQueuedVideoTS.fetchAndStoreRelaxed(frame.dts);
+        schedulePump();
+    } else
+        dropFrame(DropVideoQueueFull);
+}
+
+void RTMPPublisher::dropFrame(DropReason reason)
+{
+    //Counters are only read, Controller polls them into its stats snapshot
+    mDroppedFramesCounts[reason].ref();
+}
+
+int RTMPPublisher::queuedVideoDuration()
+{
+    if (mVideoQueue.isEmpty())
+        return 0;
+    int queued = mLastQueuedVideoTS.fetchAndAddRelaxed(0) - mLastSentVideoTS.fetchAndAddRelaxed(0);
+    return queued > 0 ? queued : 0;
+}
+
+int RTMPPublisher::droppedFramesCount()
+{
+    int count = 0;
+    for (int i = 0; i < DropReasonCount; i++)
+        count += droppedFramesCount((DropReason)i);
+    return count;
 }
 
 void RTMPPublisher::safeStop() {
     qDebug()<<"RTMPPublisher"
-            <<(mAudioFramesReceivedCount+mVideoFramesReceivedCount)
+            <<totalFramesCount()
             <<"frames received in"
             <<mLastReceivedFrameTS/1000<<"secs";
     qDebug()<<"RTMPPublisher"
-            <<mDroppedFramesCount
+            <<droppedFramesCount()
             <<"frames dropped out of"
-            <<(mAudioFramesReceivedCount+mVideoFramesReceivedCount);
+            <<totalFramesCount()
+            <<"congestion"<<droppedFramesCount(DropVideoCongestion)
+            <<"video full"<<droppedFramesCount(DropVideoQueueFull)
+            <<"audio full"<<droppedFramesCount(DropAudioQueueFull);
     qDebug()<<"RTMPPublisher"
             <<mTotalBytesWritten/1024
             <<"kb data written";
+    if(mFramesSentCount>0)
+        qDebug()<<"RTMPPublisher"
+                <<mWriter.syscallCount()
+                <<"write syscalls for"
+                <<mFramesSentCount
+                <<"frames,"
+                <<(double)mWriter.syscallCount()/mFramesSentCount
+                <<"per frame";
+    qDebug()<<"RTMPPublisher"
+            <<mReconnectCount
+            <<"reconnects";
+    qDebug()<<"RTMPPublisher chunk headers by fmt"
+            <<mChunkWriter.headerCount(0)
+            <<mChunkWriter.headerCount(1)
+            <<mChunkWriter.headerCount(2)
+            <<mChunkWriter.headerCount(3);
     mIsStopped = true;
-    mCondition.wakeAll();
-    qDebug()<<"Condition awaked!";
-    //Not closing/destroying socket here. It will be closed by class itself
-//    destroySocket();
-//    qDebug()<<"Socket destroyed!";
-//    emit finished();
+    //May be called from any thread, socket is closed on publisher's own thread
+    QMetaObject::invokeMethod(this, "stop", Qt::QueuedConnection);
+}
+
+void RTMPPublisher::stop() {
+    qDebug()<<"Destroying socket!";
+    mTimeoutTimer->stop();
+    mKeepAliveTimer->stop();
+    mReconnectTimer->stop();
+    mInterleaveTimer->stop();
+    mState = StateStopped;
+    destroySocket();
+    emit finished();
 }
 
 void RTMPPublisher::destroySocket() {
@@ -608,28 +1185,49 @@ void RTMPPublisher::destroySocket() {
         mSocket->deleteLater();
         mSocket = NULL;
     }
+    //Whatever is left never reaches kernel through this socket
+    mPendingWrites.clear();
 }
 
 void RTMPPublisher::on_mSocket_error(QAbstractSocket::SocketError error)
 {
-    if(error==QAbstractSocket::SocketTimeoutError && mIsWaitingForHandshakeReadyRead)
+    /*
+     * Before stream ever went live an error ends the session, controller reports it.
+     * After that, connection is reopened with exponential backoff while producers keep queuing frames,
+     * socketError() is emitted only once RECONNECT_MAX_ATTEMPTS are used up.
+     */
+    if(mState == StateStopped || mState == StateFailed || mState == StateReconnecting)
         return;
     qDebug()<<"RTMPPublisher-socketError"<<error;
+    mTimeoutTimer->stop();
+    mKeepAliveTimer->stop();
     destroySocket();
+    if(RECONNECT_ENABLED && mHasPublished && !mIsStopped &&
+            mReconnectAttempts < RECONNECT_MAX_ATTEMPTS) {
+        int delay = RECONNECT_INITIAL_MSEC << qMin(mReconnectAttempts, 8);
+        if(delay > RECONNECT_MAX_MSEC)
+            delay = RECONNECT_MAX_MSEC;
+        mReconnectAttempts++;
+        mReconnectCount++;
+        mState = StateReconnecting;
+        qDebug()<<"Connection lost, reconnecting in"<<delay<<"msec";
+        mReconnectTimer->start(delay);
+        return;
+    }
+    mState = StateFailed;
+    mLastSocketError = error;
     emit socketError(error);
 }
 
 void RTMPPublisher::on_mSocket_bytesWritten(qint64 bytes)
 {
     mTotalBytesWritten += bytes;
+    mBytesWrittenCounter.fetchAndAddRelaxed((int) bytes);
 //    qDebug()<<"Total"<<mTotalBytesWritten/1024;
-}
-
-QByteArray RTMPPublisher::IntToArray(qint32 source) //Use qint32 to ensure that the number have 4 bytes
-{
-    //Avoid use of cast, this is the Qt way to serialize objects
-    QByteArray temp;
-    QDataStream data(&temp, QIODevice::ReadWrite);
-    data << source;
-    return temp;
+    if(mLatencyTracer != NULL)
+        completeWrites();
+    //Data is moving, restart stall detection and refill socket buffer
+    if(mState == StatePublishing)
+        mTimeoutTimer->stop();
+    pumpFrames();
 }
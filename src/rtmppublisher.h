@@ -19,22 +19,54 @@
 #include <QObject>
 #include <QThread>
 #include <QtNetwork/QTcpSocket>
-#include <QLinkedList>
-#include <QMutex>
-#include <QWaitCondition>
+#include <QTimer>
 #include <QTime>
+#include <QElapsedTimer>
 #include "mediaframe.h"
+#include "mediasink.h"
+#include "framering.h"
+#include "socketwriter.h"
+#include "rtmpchunkreader.h"
+#include "rtmpchunkwriter.h"
+#include "amf0.h"
+#include "flv.h"
+#include "latencytracer.h"
+#include "interleaver.h"
 
-#define CHUNK_SIZE 4096
+#define CHUNK_SIZE 65536    //Announced on every connection, some ingest servers refuse much larger ones
 #define VERBOSE false
 #define MAX_QUEUE_SIZE 128
+#define VIDEO_QUEUE_KEYFRAME_RESERVE 16
+#define REQUEST_KEYFRAME_ON_DROP true
 #define LOG_HIGH_WRITE_TIMES false
 #define HIGH_WRITE_LIMIT_MSEC 10
+#define STARTUP_TIMEOUT_MSEC 15000     //Connect to NetStream.Publish.Start
+#define PIPELINE_PUBLISH true           //Send publish without waiting for createStream result
+#define RTMP_FIRST_STREAM_ID 1          //What servers return for first createStream of a connection
+#define WARM_KEEPALIVE_MSEC 10000      //Ping interval while a warm session waits for goLive()
+#define RECONNECT_ENABLED true
+#define RECONNECT_INITIAL_MSEC 500
+#define RECONNECT_MAX_MSEC 8000
+#define RECONNECT_MAX_ATTEMPTS 10       //About a minute of trying with above backoff
+#define GOP_CACHE_MAX_FRAMES 4096       //Audio and video frames since last IDR, replayed after a reconnect
+#define GOP_CACHE_MAX_BYTES (8*1024*1024)
+#define GOP_CACHE_HIGH_WATER_PERCENT 75 //Past this share of either bound an IDR is asked for, cache restarts there
+#define TRANSACTION_CONNECT 1
+#define TRANSACTION_CREATE_STREAM 2
+#define WRITE_STALL_TIMEOUT_MSEC 10000
+#define SEND_BUFFER_HIGH_WATER (256*1024)
+#define PENDING_WRITES_SIZE 1024        //Traced frames not fully taken by kernel yet
 
-class RTMPPublisher : public QObject
+class RTMPPublisher : public QObject, public MediaSink
 {
     Q_OBJECT
 public:
+    enum DropReason {
+        DropVideoCongestion = 0,    //Dependent frames dropped up to next IDR
+        DropVideoQueueFull,         //Video queue couldn't even take an IDR
+        DropAudioQueueFull,
+        DropReasonCount
+    };
 
     RTMPPublisher(QString host,
             int port,
@@ -42,54 +74,171 @@ public:
             QString path,
             QObject* parent = 0);
     ~RTMPPublisher();
-    void run();
-    bool initiate();
+    //Audio producer's thread, config is queued in order with audio frames and applied by publisher thread
     void setAudioHeader(QByteArray header, int nchan, int srate, int ssize);
+    //Warm session stops short of publish and idles with pings till goLive(), set before start()
+    void setWarm(const bool isWarm) { mIsWarm = isWarm; }
+    //Frames sent are timed into tracer, NULL for none, set before start()
+    void setLatencyTracer(LatencyTracer* tracer) { mLatencyTracer = tracer; }
     void postFrame(MediaFrame frame);
-    static inline QByteArray IntToArray(qint32 source);
 
-    int droppedFramesCount() { return mDroppedFramesCount; }
-    int totalFramesCount() { return mAudioFramesReceivedCount+mVideoFramesReceivedCount; }
-    int audioFramesCount() { return mAudioFramesReceivedCount; }
-    int videoFramesCount() { return mVideoFramesReceivedCount; }
+    int droppedFramesCount();
+    int droppedFramesCount(DropReason reason) { return mDroppedFramesCounts[reason].fetchAndAddRelaxed(0); }
+    //Counters are atomic and safe to poll from any thread, no signal is emitted per frame
+    int totalFramesCount() { return audioFramesCount()+videoFramesCount(); }
+    int audioFramesCount() { return mAudioFramesReceivedCount.fetchAndAddRelaxed(0); }
+    int videoFramesCount() { return mVideoFramesReceivedCount.fetchAndAddRelaxed(0); }
+    //Reconnects that had no decodable GOP to replay and waited for the next IDR
+    int lostReplaysCount() { return mLostReplaysCount.fetchAndAddRelaxed(0); }
     qint64 totalBytesWritten() { return mTotalBytesWritten; }
+    //Exact once finished() is emitted
+    qint64 framesSentCount() { return mFramesSentCount; }
+    qint64 writeSyscallCount() { return mWriter.syscallCount(); }
+    //Following are safe to call from any thread
+    //Wraps around, callers use unsigned difference of two readings
+    quint32 bytesWrittenCounter() { return (quint32) mBytesWrittenCounter.fetchAndAddRelaxed(0); }
+    //Video received but not sent yet, in msec of media time
+    int queuedVideoDuration();
+    //Bytes in socket buffer not handed to kernel yet
+    int bytesPending() { return mBytesPending.fetchAndAddRelaxed(0); }
 
 signals:
     void socketError(int error);
     void finished();
-    void audioFramesCountChanged();
-    void videoFramesCountChanged();
-    void droppedFramesCountChanged();
+    void keyFrameRequested();
+    //onStatus and _error replies, level is "status", "warning" or "error"
+    void publishStatus(QString level, QString code, QString description);
 
 public slots:
     void start();
     void safeStop();
+    //Thread safe, publishes a warm session or lets one still starting up go on to publish
+    void goLive();
 
 private slots:
+    void stop();
+    void pumpFrames();
+    void on_mTimeoutTimer_timeout();
+    void on_mKeepAliveTimer_timeout();
+    void publishWarmSession();
+    void reconnect();
+    void on_mSocket_connected();
     void on_mSocket_readyRead();
     void on_mSocket_error(QAbstractSocket::SocketError socketError);
     void on_mSocket_bytesWritten(qint64 bytes);
 private:
+    //Byte range a traced frame takes in the outgoing stream, offsets count from start of session
+    struct PendingWrite {
+        qint64 startOffset;
+        qint64 endOffset;
+        long dts;
+        LatencyTracer::Track track;
+        FrameTimes times;
+    };
+
+    enum State {
+        StateIdle = 0,
+        StateConnecting,
+        StateHandshaking,   //C0+C1 sent, waiting for S0+S1
+        StateStarting,      //C2 and commands up to publish sent, waiting for NetStream.Publish.Start
+        StateWarm,          //Connected and stream created, publish deferred till goLive()
+        StateReconnecting,  //Connection lost after publishing, waiting for backoff to run out
+        StatePublishing,
+        StateStopped,
+        StateFailed
+    };
+
+    //Startup milestones, msec since start() is logged for each
+    enum Phase {
+        PhaseConnected = 0,
+        PhaseHandshake,
+        PhaseConnectResult,
+        PhaseCreateStreamResult,
+        PhasePublishStart,
+        PhaseFirstFrame,
+        PhaseCount
+    };
+
+    void openConnection();
     void connect();
+    void createStream();
     void handshake();
     void publish();
-    void sendAudioFrame(QByteArray frame, long ts);
-    void sendVideoNal(QByteArray nal, long pts, long dts);
+    void startSession(const QByteArray& s1);
+    void markPhase(Phase phase);
+    void sendCommand(quint32 streamId, const QByteArray& body);
+    void beginBatch();
+    void endBatch();
+    qint64 submitMessages();
+    void sendAudioFrame(const MediaBuffer& frame, long ts);
+    void applyAudioConfig(const MediaBuffer& config);
+    bool queueAudioConfig();
+    void sendVideoFrame(const MediaFrame& frame, long pts, long dts);
     void setChunkSize();
     void startAudio(long ts);
     void startVideo(long ts);
     void destroySocket();
     bool isSocketConnected();
-    bool waitForReadyRead(int msecs = 30000);
-    QByteArray readAll();
-    qint64 write(const QByteArray data, const bool doWait = true);
-    qint64 write(const char* data, qint64 length, const bool doWait = true);
-    qint64 write(const unsigned char* data, qint64 length, const bool doWait = true);
-    qint64 write(const unsigned char data, const bool doWait = true);
-    qint64 write(const qint32 data, const bool doWait = true);
+    void postVideoFrame(const MediaFrame& frame);
+    void dropFrame(DropReason reason);
+    void skipToLatestKeyFrame(int fromIndex = 1);
+    void sendFrame(const MediaFrame& frame);
+    void sendTracedFrame(MediaFrame& frame);
+    void completeWrites();
+    void cacheFrame(const MediaFrame& frame);
+    void clearGopCache();
+    void resumeStream();
+    void schedulePump();
+    void readMessages();
+    void handleMessage(const RTMPMessage& message);
+    void handleUserControl(const RTMPMessage& message);
+    void handleCommand(const RTMPMessage& message);
+    void writeControlMessage(int type, const unsigned char* body, int length);
+    void sendAcknowledgement();
+    void sendPingResponse(quint32 timestamp);
+    void sendWindowAckSize(quint32 size);
+    void sendPingRequest();
+    void enterWarm();
+    void writeMessage(int csid,
+            int type,
+            quint32 streamId,
+            long timestamp,
+            const unsigned char* bodyHeader,
+            int bodyHeaderLength,
+            const char* payload,
+            int payloadLength);
+    void writeMessage(int csid,
+            int type,
+            quint32 streamId,
+            long timestamp,
+            const unsigned char* bodyHeader,
+            int bodyHeaderLength,
+            const MediaBuffer& payload);
+    qint64 write(const QByteArray data);
+    qint64 write(const char* data, qint64 length);
+    qint64 write(const unsigned char* data, qint64 length);
     QTcpSocket *mSocket;
-    QMutex* mLock;
-    QWaitCondition mCondition;
+    SocketWriter mWriter;
+    RTMPChunkReader mChunkReader;
+    RTMPChunkWriter mChunkWriter;
+    quint32 mStreamId;              //Message stream id publish and media go on
+    quint32 mBytesReceived;         //Sequence number of acks, wraps around like the protocol expects
+    quint32 mLastAckedBytes;
+    quint32 mAckWindow;             //Server wants an ack after this many bytes, 0 till it says so
+    quint32 mServerAckedBytes;
+    State mState;
+    QTimer* mTimeoutTimer;
+    QTimer* mKeepAliveTimer;
+    QTimer* mReconnectTimer;
+    QTimer* mInterleaveTimer;       //Gives up on a late track, see Interleaver
+    QElapsedTimer mStartTime;
+    qint64 mPhaseTimes[PhaseCount];
+    int mHandshakeBytesLeft;        //S2 bytes still to skip
+    bool mIsBatching;
+    bool mIsPublishSent;
+    volatile bool mIsWarm;
+    int mLastSocketError;
+    QAtomicInt mIsPumpScheduled;
     QString mHost;
     int mPort;
     QString mApp;
@@ -103,17 +252,42 @@ private:
     QByteArray mPPS;
     long mVideoTimestamp;
     int mNumChannels;
-    int mSampleRate;
     int mSampleSize;
-    QLinkedList<MediaFrame> mAudioQueue;
-    QLinkedList<MediaFrame> mVideoQueue;
-    bool mIsWaitingForHandshakeReadyRead;
-    bool mIsStopped;
-    int mAudioFramesReceivedCount;
-    int mVideoFramesReceivedCount;
-    int mDroppedFramesCount;
+    FrameRing<MediaFrame> mAudioQueue;
+    FrameRing<MediaFrame> mVideoQueue;
+    //Consumer side only, frames popped since last IDR
+    FrameRing<MediaFrame> mGopCache;
+    int mGopCacheBytes;
+    bool mIsGopCacheValid;          //False once cache overflowed, till next IDR
+    bool mIsGopCacheKeyFrameRequested;  //Cache passed high water, IDR asked for once per GOP
+    int mReplayIndex;               //Next cached frame to replay after a reconnect, -1 when not replaying
+    bool mIsWaitingForKeyFrame;     //Resumed without anything to replay, video waits for next IDR
+    bool mIsResuming;               //Next frame sent fixes mTimestampOffset
+    long mTimestampOffset;          //Added to frame timestamps so they keep growing across reconnects
+    long mLastSentTS;
+    bool mHasPublished;             //Reached NetStream.Publish.Start once, losing connection now means reconnect
+    int mReconnectAttempts;
+    int mReconnectCount;
+    Interleaver mInterleaver;
+    QElapsedTimer mInterleaveClock;
+    volatile bool mIsStopped;
+    QAtomicInt mAudioFramesReceivedCount;
+    QAtomicInt mVideoFramesReceivedCount;
+    QAtomicInt mDroppedFramesCounts[DropReasonCount];
+    QAtomicInt mLostReplaysCount;
+    bool mIsDroppingToKeyFrame;
     long mLastReceivedFrameTS;
+    //Audio producer side only
+    long mLastQueuedAudioTS;
+    MediaFrame mPendingAudioConfig;     //Config the audio ring had no room for, null buffer if none
     qint64 mTotalBytesWritten;
+    QAtomicInt mBytesWrittenCounter;
+    QAtomicInt mBytesPending;
+    QAtomicInt mLastQueuedVideoTS;
+    QAtomicInt mLastSentVideoTS;
+    qint64 mFramesSentCount;
+    LatencyTracer* mLatencyTracer;
+    FrameRing<PendingWrite> mPendingWrites;
 
 #if (LOG_HIGH_WRITE_TIMES)
     QTime logTimer;
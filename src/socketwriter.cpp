@@ -0,0 +1,178 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "socketwriter.h"
+#include <string.h>
+#if defined(Q_OS_UNIX)
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+/*
+ * A peer reset turns the next write into SIGPIPE, which would kill the process before the publisher ever
+ * sees the error and reconnects. Linux takes MSG_NOSIGNAL per call, BSD and OS X a socket option instead.
+ */
+#if defined(MSG_NOSIGNAL)
+#define SOCKETWRITER_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SOCKETWRITER_SEND_FLAGS 0
+#endif
+
+SocketWriter::SocketWriter()
+    :mSocket(NULL),
+     mSliceCount(0),
+     mScratchUsed(0),
+     mSyscallCount(0),
+     mMessageCount(0),
+     mDirectBytesWritten(0),
+     mNoSigPipeFd(-1) {
+    mSlices.resize(64);
+    mScratch.resize(1024);
+}
+
+void SocketWriter::clear() {
+    mSliceCount = 0;
+    mScratchUsed = 0;
+}
+
+void SocketWriter::appendCopy(const char* data, int length) {
+    if (length <= 0)
+        return;
+    if (mScratchUsed + length > mScratch.size())
+        mScratch.resize(2*(mScratchUsed + length));
+    memcpy(mScratch.data() + mScratchUsed, data, length);
+    if (mSliceCount == mSlices.size())
+        mSlices.resize(2*mSliceCount);
+    Slice& slice = mSlices[mSliceCount++];
+    slice.data = NULL;
+    slice.scratchOffset = mScratchUsed;
+    slice.length = length;
+    mScratchUsed += length;
+}
+
+void SocketWriter::appendCopy(const unsigned char* data, int length) {
+    appendCopy(reinterpret_cast<const char*>(data), length);
+}
+
+void SocketWriter::append(const char* data, int length) {
+    if (length <= 0)
+        return;
+    if (mSliceCount == mSlices.size())
+        mSlices.resize(2*mSliceCount);
+    Slice& slice = mSlices[mSliceCount++];
+    slice.data = data;
+    slice.scratchOffset = -1;
+    slice.length = length;
+}
+
+const char* SocketWriter::sliceData(const Slice& slice) const {
+    //Scratch pointers are resolved late since the scratch buffer may move while appending
+    if (slice.data == NULL)
+        return mScratch.constData() + slice.scratchOffset;
+    return slice.data;
+}
+
+qint64 SocketWriter::submitBuffered(int fromSlice, int fromOffset) {
+    qint64 written = 0;
+    for (int i = fromSlice; i < mSliceCount; i++) {
+        const Slice& slice = mSlices.at(i);
+        int offset = (i == fromSlice) ? fromOffset : 0;
+        written += mSocket->write(sliceData(slice) + offset, slice.length - offset);
+    }
+    mSocket->flush();
+    mSyscallCount++;
+    return written;
+}
+
+qint64 SocketWriter::submitPerSlice() {
+    qint64 written = 0;
+    for (int i = 0; i < mSliceCount; i++) {
+        const Slice& slice = mSlices.at(i);
+        written += mSocket->write(sliceData(slice), slice.length);
+        mSocket->flush();
+        mSyscallCount++;
+    }
+    return written;
+}
+
+qint64 SocketWriter::submit() {
+    if (mSocket == NULL)
+        return -1;
+    mMessageCount++;
+    if (mSliceCount == 0)
+        return 0;
+    if (!SOCKETWRITER_GATHER_ENABLED)
+        return submitPerSlice();
+#if defined(Q_OS_UNIX)
+    int fd = mSocket->socketDescriptor();
+    if (fd < 0 || mSocket->bytesToWrite() > 0)
+        return submitBuffered(0, 0);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    if (fd != mNoSigPipeFd) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+        mNoSigPipeFd = fd;
+    }
+#endif
+    struct iovec iov[SOCKETWRITER_MAX_IOV];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    qint64 written = 0;
+    int slice = 0;
+    int sliceOffset = 0;
+    while (slice < mSliceCount) {
+        int count = 0;
+        qint64 batchLength = 0;
+        for (int i = slice; i < mSliceCount && count < SOCKETWRITER_MAX_IOV; i++, count++) {
+            int offset = (i == slice) ? sliceOffset : 0;
+            iov[count].iov_base = const_cast<char*>(sliceData(mSlices.at(i)) + offset);
+            iov[count].iov_len = mSlices.at(i).length - offset;
+            batchLength += iov[count].iov_len;
+        }
+        message.msg_iovlen = count;
+        ssize_t result = ::sendmsg(fd, &message, SOCKETWRITER_SEND_FLAGS);
+        mSyscallCount++;
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            //EAGAIN or a real error (EPIPE, ECONNRESET), QTcpSocket will report the latter on its own
+            break;
+        }
+        written += result;
+        mDirectBytesWritten += result;
+        qint64 remaining = result;
+        while (slice < mSliceCount && remaining > 0) {
+            int left = mSlices.at(slice).length - sliceOffset;
+            if (remaining >= left) {
+                remaining -= left;
+                slice++;
+                sliceOffset = 0;
+            } else {
+                sliceOffset += remaining;
+                remaining = 0;
+            }
+        }
+        if (result < batchLength)
+            break;  //Kernel buffer is full
+    }
+    if (slice < mSliceCount)
+        written += submitBuffered(slice, sliceOffset);
+    return written;
+#else
+    return submitBuffered(0, 0);
+#endif
+}
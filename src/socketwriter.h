@@ -0,0 +1,74 @@
+/* Copyright (c) 2015 Abhishek Kumar
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SOCKETWRITER_H_
+#define SOCKETWRITER_H_
+
+#include <QByteArray>
+#include <QVector>
+#include <QtNetwork/QTcpSocket>
+
+#define SOCKETWRITER_MAX_IOV 512
+#define SOCKETWRITER_GATHER_ENABLED true    //False writes and flushes slice by slice like before, for bench comparisons
+
+/*
+ * Gathers one outgoing message as a list of slices and hands it to the kernel with sendmsg(), never raising SIGPIPE.
+ * Small pieces (chunk headers, separators) are copied into a scratch buffer, payload is only referenced
+ * and must stay valid until submit() returns.
+ * Whatever the kernel doesn't take right away is appended to the QTcpSocket write buffer, and while that
+ * buffer is non-empty every message goes through it as well so byte order on the wire is kept.
+ */
+class SocketWriter
+{
+public:
+    SocketWriter();
+
+    void setSocket(QTcpSocket* socket) { mSocket = socket; }
+    void clear();
+    void appendCopy(const char* data, int length);
+    void appendCopy(const unsigned char* data, int length);
+    void append(const char* data, int length);
+    int sliceCount() const { return mSliceCount; }
+    //Returns bytes handed to the kernel or socket buffer, -1 if there is no socket
+    qint64 submit();
+
+    qint64 syscallCount() const { return mSyscallCount; }
+    qint64 messageCount() const { return mMessageCount; }
+    //Bytes written with sendmsg() directly, these never show up in QTcpSocket::bytesWritten()
+    qint64 directBytesWritten() const { return mDirectBytesWritten; }
+
+private:
+    struct Slice {
+        const char* data;
+        int scratchOffset;
+        int length;
+    };
+    const char* sliceData(const Slice& slice) const;
+    qint64 submitBuffered(int fromSlice, int fromOffset);
+    qint64 submitPerSlice();
+
+    QTcpSocket* mSocket;
+    //Both only ever grow, so a steady stream of messages doesn't allocate
+    QVector<Slice> mSlices;
+    int mSliceCount;
+    QByteArray mScratch;
+    int mScratchUsed;
+    qint64 mSyscallCount;
+    qint64 mMessageCount;
+    qint64 mDirectBytesWritten;
+    int mNoSigPipeFd;       //Socket SO_NOSIGPIPE was set on, where MSG_NOSIGNAL is missing
+};
+
+#endif /* SOCKETWRITER_H_ */